@@ -32,7 +32,6 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
-#include <dirent.h>
 #include <errno.h>
 
 
@@ -43,6 +42,7 @@
 #include "cfgs_client_api.h"
 #include "cfgs_str.h"
 #include "fs.h"
+#include "wal.h"
 
 
 #define CFGS_BACKEND_NAME  "cfgs_fs_bk"
@@ -56,7 +56,7 @@ const char g_progname[] = CFGS_BACKEND_NAME;
 #define on_unload                 cfgs_fs_bk ## _LTX_on_unload
 #define on_load                   cfgs_fs_bk ## _LTX_on_load
 
-#if CFGS_CRT_REV != 4
+#if CFGS_CRT_REV != 6
 #  error please update defines to CFGS_CRT_REV if needed
 #endif
 #define cfgs_getval                 cfgs_fs_bk ## _LTX_cfgs_getval
@@ -65,6 +65,7 @@ const char g_progname[] = CFGS_BACKEND_NAME;
 #define cfgs_getsubvals             cfgs_fs_bk ## _LTX_cfgs_getsubvals
 #define cfgs_getsublayers           cfgs_fs_bk ## _LTX_cfgs_getsublayers
 #define cfgs_getinfos               cfgs_fs_bk ## _LTX_cfgs_getinfos
+#define cfgs_getvals                cfgs_fs_bk ## _LTX_cfgs_getvals
 
 
 
@@ -84,7 +85,8 @@ on_match_get( match_data *data )
     LOG( cfgs_log(CFGST_LL_INFO, "OnMatchGet '%s' -> '%s'!\n", data->valname, data->filename); );
 
     /*FIXME: replace open with restartable func*/
-    f = open( data->filename, O_RDONLY );
+    f = data->dirfd >= 0 ? openat( data->dirfd, VALS_FILE, O_RDONLY )
+                         : open( data->filename, O_RDONLY );
     lassert( f >= 0 );
     if ( f == -1 )
         return -1;
@@ -125,14 +127,17 @@ on_match_set( match_data *data )
         return -1;
     LOG( cfgs_log(CFGST_LL_INFO, "OnMatchSet '%s' -> '%s'!\n", name, data->filename); );
 
-    f = open( data->filename, O_TRUNC|O_WRONLY|O_SYNC/*|O_NOFOLLOW*/ );
+    /* durable through the log; the tree is synced once folded, see wal.c */
+    f = data->dirfd >= 0 
+        ? openat( data->dirfd, VALS_FILE, O_TRUNC|O_WRONLY|O_CREAT/*|O_NOFOLLOW*/, 0666 )
+        : open( data->filename, O_TRUNC|O_WRONLY/*|O_NOFOLLOW*/ );
     lassert( f >= 0 );
     if ( f == -1 )
         return -1;
 
     lassert( data->value != NULL && data->value->value_type == CFGS_VT_UCPTR );
     if ( data && data->value ) {
-        cfgs_tag  *tag = cs_tags_from_entries( data->value );
+        cfgs_tag  *tag = cs_tags_from_entries( NULL, data->value );
         if ( tag ) {
             ret = cfgs_dlist_length( (cfgs_dlist*)tag );
             lassert( ret > 0 );
@@ -148,6 +153,14 @@ on_match_set( match_data *data )
 }
 
 
+/* the value is on disk */
+static int 
+on_match_exists( match_data *data )
+{
+    return 1;
+}
+
+
 int 
 on_match_rm( match_data *data )
 {
@@ -157,7 +170,8 @@ on_match_rm( match_data *data )
     
     LOG( cfgs_log(CFGST_LL_INFO, "OnMatchSet '%s' -> '%s'!\n", data->valname, data->filename); );
 
-    if ( 0 == unlink(data->filename) )
+    if ( 0 == (data->dirfd >= 0 ? unlinkat(data->dirfd, VALS_FILE, 0) 
+                                : unlink(data->filename)) )
         return 1;
 
     return 0;
@@ -223,17 +237,58 @@ make_root_dir( char *root_dir, const char *layer, const char *entry_type )
 }
 
 
+/* 
+ * The values of the exact name valname: logged, cached or in the tree. 
+ * @return -1 on error.  
+ */
+static int
+getentry_exact( const char *root_dir, const char *name, cfgs_entry **pval )
+{
+    int        nvals;
+    match_data data  = {0};
+    
+    data.dirfd = -1;
+    *pval = NULL;
+    nvals = wal_pending( root_dir, name, pval );
+    if ( nvals != 0 )
+        return nvals;
+    if ( does_not_exists(root_dir, name) ) 
+        return 0;
+    if ( (*pval=is_cached(root_dir, name)) != NULL )
+        return 1;
+
+    data.valname = (char*)name;  
+    data.vlist   = pval; 
+TEST_ERROR         
+    nvals = fs_search( root_dir, name, false, on_match_get, &data );
+    if ( nvals < 0 ) { 
+        if ( *pval ) {
+            CFGST_DLIST_FREE( *pval, cfgs_entry_free );
+            *pval = NULL;
+        }
+        /*FIXME: store error*/
+        return -1;
+    }
+TEST_ERROR        
+    if ( *pval ) 
+        add_to_positive_hit( root_dir, name, *pval );
+    else
+        add_to_negative_hit( root_dir, name );
+
+    return *pval != NULL;
+}
+
+
 cfgs_entry*
 cs_getentry( cfgs_session *sess, 
              const char   *name, CFGS_ET entry_type,
              const char   *layer )
 {
-    int        nvals = 0;
     cfgs_entry *pval = NULL;
-    match_data data  = {0};
     char       root_dir[ FILENAME_MAX ];
     const char *l = layer != NULL ? layer : CFGS_DEFAULT_LAYER;
     const char *entry_dir = get_entry_dir( entry_type );
+    cfgs_str   *names, *n;
     
     if ( !entry_dir || !name || !sess ) 
         return NULL;
@@ -245,26 +300,32 @@ cs_getentry( cfgs_session *sess,
     }
     
     lassert( name != NULL );
-    if ( !name || does_not_exists(name) ) 
+    if ( !name ) 
         return NULL;
+    
+    /* FIXME: if layer == NULL, for every layer under CFGS_VALUES_ROOT_DIR? */
+    make_root_dir( root_dir, l, entry_dir );
+    
+    if ( !is_regexp(name) ) {
+        (void)getentry_exact( root_dir, name, &pval );
+        return pval;
+    }
 
-    if ( !((pval=is_cached(name)) != NULL) ) {
-        /* FIXME: if layer == NULL, for every layer under CFGS_VALUES_ROOT_DIR? */
-        make_root_dir( root_dir, l, entry_dir );
-        data.valname = (char*)name;  
-        data.vlist   = &pval; 
-TEST_ERROR         
-        nvals = fs_search( root_dir, name, false, on_match_get, &data );
-        if ( nvals < 0 ) { 
-            if ( pval ) {
-                cfgs_entry_free( pval );
-                pval = NULL;
-            }
-            /*FIXME: store error*/
-            return NULL;
+    /* patterns: the index has the names logged too, then each is read */
+    if ( !wal_index(root_dir) )
+        return NULL;
+    names = fs_index_match( root_dir, name );
+    for ( n=names; n; n=n->next ) {
+        cfgs_entry *v;
+
+        if ( getentry_exact(root_dir, n->name, &v) < 0 ) {
+            CFGST_DLIST_FREE( pval, cfgs_entry_free );
+            pval = NULL;
+            break;
         }
-TEST_ERROR        
+        pval = (cfgs_entry*)cfgs_dlist_cat( (cfgs_dlist*)pval, (cfgs_dlist*)v );
     }
+    CFGST_DLIST_FREE( names, cfgs_str_free );
 
     return pval; 
 }
@@ -279,6 +340,24 @@ cfgs_getval( cfgs_session *sess, const char *name, const char *layer )
     return cs_getentry( sess, name, CFGS_ET_VALUE, layer );
 }
 
+
+cfgs_entry*
+cfgs_getvals( cfgs_session *sess, const char **names, int n, const char *layer )
+{
+    cfgs_entry *pv = NULL;
+    int        i;
+    
+    if ( !sess || !names )
+        return NULL;
+    
+    for ( i=0; i<n; i++ ) {
+        cfgs_entry *v = cs_getentry( sess, names[i], CFGS_ET_VALUE, layer );
+        pv = (cfgs_entry*)cfgs_dlist_cat( (cfgs_dlist*)pv, (cfgs_dlist*)v );
+    }
+        
+    return pv;
+}
+
 #if 0
 //FIXME
 cfgs_entry *
@@ -305,21 +384,38 @@ cfgs_getscheme( cfgs_session *ss, const char *valname, const char *scheme )
 #endif
 
 
+/* Is e one of the values of name in layer? */
+static bool
+same_value( cfgs_entry *e, const char *name, const char *layer )
+{
+    const char *n = cfgs_entry_attr( e, CFGS_EA_NAME );
+    const char *l = cfgs_entry_attr( e, CFGS_EA_LAYER );
+
+    return n && 0 == strcmp( n, name ) 
+        && 0 == strcmp( l ? l : CFGS_DEFAULT_LAYER, layer );
+}
+
+
 int 
 cs_setentry( cfgs_session *sess, cfgs_entry *vl, CFGS_ET entry_type )
 {
     int        nvals = 0;
-    cfgs_entry *crt  = vl;
+    cfgs_entry *crt  = vl, *next;
     const char *entry_dir = get_entry_dir( entry_type );
+    long       lsn = 0, ret;
+    bool       failed = false;
     
     if ( !entry_dir || !sess || !vl ) {
         return -1;
     }
 
-    for ( ; crt; crt=crt->next ) {
+    for ( ; crt; crt=next ) {
         const char *name, *layer; 
         char       root_dir[ FILENAME_MAX ];
-        match_data data = {0};
+        cfgs_entry *vals = NULL;
+        int        n = 0;
+
+        next = crt->next;
         name = cfgs_entry_attr( crt, CFGS_EA_NAME );
         if ( !name || !*name )
             continue; 
@@ -342,15 +438,42 @@ cs_setentry( cfgs_session *sess, cfgs_entry *vl, CFGS_ET entry_type )
            /* FIXME: report error */                                      
             continue;
         }
+        
+        /* its values: the entries in a row with its name */
+        for ( next=crt; next && same_value(next, name, layer); next=next->next ) {
+            cfgs_entry *dup = cfgs_entry_dup( next );
+
+            if ( !dup ) {
+                n = -1;
+                break;
+            }
+            vals = (cfgs_entry*)cfgs_dlist_add_tail( (cfgs_dlist*)vals, (cfgs_dlist*)dup );
+            n++;
+        }
 TEST_ERROR    
         make_root_dir( root_dir, layer, entry_dir );
 TEST_ERROR        
-        data.value = vl;
-        nvals += fs_search( root_dir, name, true, on_match_set, &data );
+        /* the tree gets it from the log */
+        ret = n < 0 ? -1 : wal_log( root_dir, name, vals );
+        CFGST_DLIST_FREE( vals, cfgs_entry_free );
+        if ( ret < 0 ) {
+            /* the ones logged before stay, see cfgs_setval */
+            cfgs_session_store_error( sess, CFGS_ERRT_INTERNAL, CFGSP_ERR_SERVER, 
+                    "'%s' not logged, %d values before it were", name, nvals );
+            failed = true;
+            break;
+        }
+        lsn = ret;
+        nvals += n;
+        rm_from_cache( root_dir, name );
 TEST_ERROR        
     }
+    
+    /* one sync for all entries, for all writers if the caller defers it */
+    if ( lsn > 0 && !cfgs_session_commit_or_defer(sess, wal_commit, lsn) ) 
+        return -1;
    
-    return nvals; 
+    return failed && !nvals ? -1 : nvals; 
 }
 
 
@@ -394,7 +517,10 @@ cs_rmentry( cfgs_session *sess, const char *name,
     char       root_dir[ FILENAME_MAX ];
     const char *l = layer != NULL ? layer : CFGS_DEFAULT_LAYER;
     const char *entry_dir = get_entry_dir( entry_type );
+    cfgs_entry *pval = NULL;
+    long       lsn;
     
+    data.dirfd = -1;
     if ( !entry_dir || !name || !sess ) {
         return -1;
     }
@@ -412,13 +538,28 @@ cs_rmentry( cfgs_session *sess, const char *name,
 
     /* FIXME: for every layer under CFGS_VALUES_ROOT_DIR */
     make_root_dir( root_dir, l, entry_dir );
-    data.valname = (char*)name;
-    nvals += fs_search( root_dir, name, false, on_match_rm, &data );
-    if ( nvals < 0 ) {
+    
+    /* anything to remove, logged or on disk? */
+    nvals = wal_pending( root_dir, name, &pval );
+    if ( nvals > 0 ) {
+        nvals = pval != NULL;
+        CFGST_DLIST_FREE( pval, cfgs_entry_free );
+    } else if ( nvals == 0 ) {
+        data.valname = (char*)name;
+        nvals = fs_search( root_dir, name, false, on_match_exists, &data );
+    }
+    if ( nvals <= 0 ) {
         /*FIXME: report error */
+        return nvals;
     }
+    
+    lsn = wal_log( root_dir, name, NULL );
+    rm_from_cache( root_dir, name );
+    fs_dirs_forget( root_dir, name );
+    if ( lsn < 0 || !cfgs_session_commit_or_defer(sess, wal_commit, lsn) ) 
+        return -1;
    
-    return nvals; 
+    return 1; 
 }
 
 
@@ -462,9 +603,27 @@ cfgs_register_notif( cfgs_session *s, cfgs_notif *notif )
 }
 
 
+int 
+cfgs_unregister_notif( cfgs_session *s, cfgs_notif *notif )
+{
+    /* Not used.  Notifications are the responsability of the server.  */
+    lassert( false );
+    return 0; 
+}
+
+
 bool
 on_load( void )
 {
+    char root_dir[ FILENAME_MAX ];
+
+    if ( !fs_cache_init() || !fs_dirs_init() || !wal_init() ) 
+        return false;
+    /* the other layers' on first use */
+    make_root_dir( root_dir, CFGS_DEFAULT_LAYER, get_entry_dir(CFGS_ET_VALUE) );
+    if ( !wal_index(root_dir) ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "on_load: cannot index '%s'\n", root_dir); );
+    }
     LOG( cfgs_log(CFGST_LL_INFO, "backend '%s' successfully loaded\n", g_progname); );
     return true;
 }
@@ -473,6 +632,10 @@ on_load( void )
 bool
 on_unload( void )
 {
+    wal_shutdown();
+    fs_index_shutdown();
+    fs_dirs_shutdown();
+    fs_cache_shutdown();
     LOG( cfgs_log(CFGST_LL_INFO, "backend '%s' successfully unloaded \n", g_progname); );
     return true;
 }
@@ -481,13 +644,9 @@ on_unload( void )
 cfgs_str *
 cfgs_getsubvals( cfgs_session *sess, const char *valname, const char *layer )
 {
-    cfgs_str   *pval = NULL;
     char       root_dir[ FILENAME_MAX ];
     const char *l = layer != NULL ? layer : CFGS_DEFAULT_LAYER;
     const char *entry_dir = get_entry_dir( CFGS_ET_VALUE );
-    DIR        *dirp = NULL;
-    struct dirent *dire = NULL;
-    int        old_errno;
     
     lassert( valname != NULL );
     if ( !entry_dir || !valname || !sess ) 
@@ -499,35 +658,13 @@ cfgs_getsubvals( cfgs_session *sess, const char *valname, const char *layer )
         return NULL;
     }
     
+    /* new names get their directories once in the tree */
+    /* the index has the names logged too */
     make_root_dir( root_dir, l, entry_dir );
-    strcat( root_dir, valname ); /*lenght has been verified*/
-    if ( !dir_on_disk(root_dir) )
+    if ( !wal_index(root_dir) ) 
         return NULL;
-	
-    dirp = opendir( root_dir );
-    if ( !dirp ) {
-        LOG( cfgs_log(CFGST_LL_CRITIC, "cfgs_getsubvals::opendir \n"); );
-	    return NULL;
-    }
-    
-TEST_ERROR;
-    old_errno = errno;
-    /*FIXME: overwritten by next call.  Thr. safe: readdir_r*/
-    for ( dire = readdir(dirp); dire; dire = readdir(dirp) ) {
-        cfgs_str *s;
-        if ( 0 == strcmp(".", dire->d_name) || 0 == strcmp("..", dire->d_name) )
-	        continue;
-		/*FIXME: filter out files*/
-	    s = cfgs_str_new( dire->d_name );
-	    if ( !s )
-	        break;
-		pval = (cfgs_str*)cfgs_dlist_add_tail( (cfgs_dlist*)pval, (cfgs_dlist*)s );
-    }
-    if ( errno == 0 ) 
-        errno = old_errno; 
-    closedir( dirp );
 
-    return pval; 
+    return fs_index_subnames( root_dir, valname ); 
 }
 
 
@@ -32,47 +32,137 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
-#include <glob.h>
+#include <ftw.h>
 #include <fnmatch.h>
+#include <pthread.h>
 
 #include "fs.h"
 #include "cfgs_log.h"
 #include "cfgs_hash.h"
 #include "cfgs_mem.h"
+#include "cfgs_dlist.h"
+#include "cfgs_cache.h"
 
 
 
 /* FIXME: mem free ? */
-/* FIXME: use cfgs_cache.h */
 
+/* 
+ * Values found (or not) by fs_search_exact.  Keyed by the value file's 
+ * directory, as fs_search_exact computes it: rootdir holds the layer and 
+ * '.' and '/' separators end up in the same file.  
+ */
+static cfgs_cache *m_cache = NULL;
+
+
+static void *
+dup_entries( void *vals )
+{
+    return cfgs_entries_dup( (cfgs_entry*)vals );
+}
+
+
+static void
+free_entries( void *vals )
+{
+    CFGST_DLIST_FREE( (cfgs_entry*)vals, cfgs_entry_free );
+}
+
+
+bool
+fs_cache_init( void )
+{
+    const char *env = getenv( CFGS_ENV_CACHE_SIZE );
+    int        size = env ? atoi( env ) : CGFS_CACHE_SIZE;
+    
+    if ( size <= 0 ) 
+        return true;
+    
+    m_cache = cfgs_cache_new( size, dup_entries, free_entries );
+    return m_cache != NULL;
+}
+
+
+void
+fs_cache_shutdown( void )
+{
+    cfgs_cache_free( m_cache );
+    m_cache = NULL;
+}
+
+
+char *
+cache_key( char *key, const char *rootdir, const char *valname )
+{
+    char *p;
+    
+    snprintf( key, FILENAME_MAX-1, "%s%s", rootdir, valname );
+    for ( p=key; *p; p++ ) {
+        if ( *p == '.' )
+            *p = FS_PATH_SEP_C;
+    }
+    
+    return key;
+}
 
 
 cfgs_entry *
-is_cached( const char *name )
+is_cached( const char *rootdir, const char *valname )
 {
-    return NULL;
+    char key[ FILENAME_MAX ];
+    
+    if ( !m_cache )
+        return NULL;
+    return (cfgs_entry*)cfgs_pos_hit( m_cache, cache_key(key, rootdir, valname) );
 }
 
 
 /* check negative hits cache */
 bool
-does_not_exists( const char *name )
+does_not_exists( const char *rootdir, const char *valname )
 {
-    return false;
+    char key[ FILENAME_MAX ];
+    
+    if ( !m_cache )
+        return false;
+    return cfgs_neg_hit( m_cache, cache_key(key, rootdir, valname) );
+}
+
+
+void
+add_to_positive_hit( const char *rootdir, const char *valname, cfgs_entry *vals )
+{
+    char       key[ FILENAME_MAX ];
+    cfgs_entry *copy;
+    
+    if ( !m_cache )
+        return;
+    
+    copy = cfgs_entries_dup( vals );
+    if ( copy && !cfgs_cache_add(m_cache, cache_key(key, rootdir, valname), copy) ) 
+        free_entries( copy );
 }
 
 
 void
-add_to_positive_hit( const char * name )
+add_to_negative_hit( const char *rootdir, const char *valname )
 {
-    /*FIXME cfgs_cache.h*/
+    char key[ FILENAME_MAX ];
+    
+    if ( !m_cache )
+        return;
+    (void)cfgs_cache_add_neg( m_cache, cache_key(key, rootdir, valname) );
 }
 
 
 void
-add_to_negative_hit( const char * name )
+rm_from_cache( const char *rootdir, const char *valname )
 {
-    /*FIXME cfgs_cache.h*/
+    char key[ FILENAME_MAX ];
+    
+    if ( !m_cache )
+        return;
+    cfgs_cache_rm( m_cache, cache_key(key, rootdir, valname) );
 }
 
 
@@ -105,24 +195,6 @@ nsegs( const char *name )
 }
 
 
-static int
-makedir( const char *dir )
-{
-    int ret;
-   
-    lassert( dir != NULL );
-    ret = mkdir( dir, FS_DIR_PERM );
-    LOG( cfgs_log(CFGST_LL_INFO, "mkdir %s returns %d\n", dir, ret); );
-    
-    if ( ret == -1 && errno == EEXIST ) {
-        errno = 0;
-        ret = 0;
-    }
-TEST_ERROR    
-    return ret;
-}
-
-
 static bool
 file_on_disk( const char *file )
 {
@@ -146,125 +218,334 @@ TEST_ERROR
 }
 
 
-/* FIXME: use creat*/
-/* ret 0 on success */
-static int
-makefile( const char *fname )
+/*
+ * Directories opened by fs_search_exact, keyed by path.  A search starts
+ * from the deepest one cached and opens the rest one segment at a time,
+ * relative to its parent, instead of resolving the whole path at every
+ * level.  Users hold a reference: evicting a directory closes it once
+ * they are done with it.  A directory found in the cache and removed 
+ * behind our back is forgotten, its path walked again.  Our own removals 
+ * forget theirs, see fs_dirs_forget; the changes of other processes drop 
+ * them all, see fs_dirs_drop.  
+ * FIXME: a directory renamed by hand is found at its old path until then.
+ */
+typedef struct _dir_fd dir_fd;
+struct _dir_fd {
+    dir_fd *next;
+    dir_fd *prev;
+    char   *path;
+    int    fd;
+    int    refs;     /* users, and the cache's */
+};
+
+static pthread_mutex_t m_dirs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cfgs_hash       *m_dirs      = NULL;   /* path -> dir_fd */
+static dir_fd          *m_dirs_lru  = NULL;   /* least recently used first */
+static int             m_nb_dirs    = 0;
+
+
+static void
+dir_free( dir_fd *d )
 {
-    struct stat s;
-    int         ret;
-   
-    lassert( fname != NULL );
-        
-    ret = stat( fname, &s );
-    if ( ret==0 && !(S_ISREG(s.st_mode)) ) {
-TEST_ERROR    
-        LOG( cfgs_log(CFGST_LL_CRITIC, "%s is not a regular file!\n", fname); );
-        return -1;
+    close( d->fd );
+    xfree( d->path );
+    xfree( d );
+}
+
+
+/* With m_dirs_mutex */
+static void
+dir_unref( dir_fd *d )
+{
+    if ( --d->refs == 0 )
+        dir_free( d );
+}
+
+
+/* With m_dirs_mutex */
+static void
+dir_evict( dir_fd *d )
+{
+    m_dirs_lru = (dir_fd*)cfgs_dlist_rem( (cfgs_dlist*)m_dirs_lru, (cfgs_dlist*)d );
+    cfgs_hash_delete( m_dirs, d->path, d, NULL );
+    m_nb_dirs--;
+    dir_unref( d );
+}
+
+
+static dir_fd *
+dir_get( const char *path )
+{
+    dir_fd *d = NULL;
+
+    pthread_mutex_lock( &m_dirs_mutex );
+    if ( m_dirs )
+        d = (dir_fd*)cfgs_hash_find( m_dirs, path );
+    if ( d ) {
+        d->refs++;
+        m_dirs_lru = (dir_fd*)cfgs_dlist_rem( (cfgs_dlist*)m_dirs_lru, (cfgs_dlist*)d );
+        m_dirs_lru = (dir_fd*)cfgs_dlist_add_tail( (cfgs_dlist*)m_dirs_lru, (cfgs_dlist*)d );
     }
-    
-    if ( ret != 0 && errno == ENOENT ) {
-        FILE *f;
-        
-        errno = 0; 
-        f  = fopen( fname, "w" );
-        if ( !f ) {
-            LOG( cfgs_log(CFGST_LL_CRITIC, "fopen(w) '%s'\n", fname); );
-            return -1;
-        }
-        fclose( f );
-TEST_ERROR        
-        return 0;
+    pthread_mutex_unlock( &m_dirs_mutex );
+
+    return d;
+}
+
+
+static void
+dir_put( dir_fd *d )
+{
+    pthread_mutex_lock( &m_dirs_mutex );
+    dir_unref( d );
+    pthread_mutex_unlock( &m_dirs_mutex );
+}
+
+
+/* @return fd, cached if possible, or NULL: then close fd */
+static dir_fd *
+dir_add( const char *path, int fd )
+{
+    dir_fd *d = XCALLOC( dir_fd, 1 );
+
+    if ( !d )
+        return NULL;
+    d->path = xstrdup( path );
+    if ( !d->path ) {
+        xfree( d );
+        return NULL;
     }
-TEST_ERROR    
-    return ret;
+    d->fd   = fd;
+    d->refs = 1;
+
+    pthread_mutex_lock( &m_dirs_mutex );
+    if (  m_dirs && !cfgs_hash_find(m_dirs, path)
+       && cfgs_hash_insert(m_dirs, d->path, d, 0) != CFGST_HASH_INVALID_IDX ) {
+        d->refs++;
+        m_dirs_lru = (dir_fd*)cfgs_dlist_add_tail( (cfgs_dlist*)m_dirs_lru, (cfgs_dlist*)d );
+        m_nb_dirs++;
+        while ( m_nb_dirs > CGFS_DIR_CACHE_SIZE )
+            dir_evict( m_dirs_lru );
+    }
+    pthread_mutex_unlock( &m_dirs_mutex );
+
+    return d;
 }
 
 
-static bool
-dir_exists( const char *dir, const char *seg, bool forcecreate )
+/* Forget @param path and the directories under it */
+static void
+dir_forget( const char *path )
 {
-    static bool dir_on_disk( const char *dir );
+    size_t len = strlen( path );
+    dir_fd *d, *next;
 
-    char crt[ FILENAME_MAX ] = {0};
-    
-    //printf( "** %s  =>  %s \n", dir, seg );
-    snprintf( crt, FILENAME_MAX-1, "%s%s", dir, seg );
-    
-    //if ( cache && in_cache(cache, crt) != -1 ) {
-    //    return true;
-    //}
-TEST_ERROR
-    if ( dir_on_disk(crt) )
-        return true;
-    else {
-        if ( forcecreate ) {
-            if ( makedir(crt) != 0 )
-                return false;
-        
-            //if ( cache )
-            //    add_to_cache( cache, crt );
-            
-            return true;
-        } else
-            return false;
+    pthread_mutex_lock( &m_dirs_mutex );
+    for ( d=m_dirs_lru; d; d=next ) {
+        next = d->next;
+        if (  0 == strncmp(d->path, path, len)
+           && (d->path[len] == '\0' || d->path[len] == FS_PATH_SEP_C) )
+            dir_evict( d );
     }
-    
-    return false;
+    pthread_mutex_unlock( &m_dirs_mutex );
 }
 
 
 static bool
-file_exists( const char *file, bool forcecreate )
+dir_gone( const dir_fd *d )
 {
-    int  ret;
+    struct stat st;
 
-    if ( forcecreate ) {
-        ret = makefile( file );
-        return ret == 0;
-    } else
-        return file_on_disk( file );
+    return 0 == fstat( d->fd, &st ) && st.st_nlink == 0;
+}
 
-    return false;
+
+/* dir_get, if not removed.  Else it and the ones under it are forgotten */
+static dir_fd *
+dir_get_valid( const char *path )
+{
+    dir_fd *d = dir_get( path );
+
+    if ( !d || !dir_gone(d) )
+        return d;
+
+    LOG( cfgs_log(CFGST_LL_INFO, "dir_get_valid: %s gone\n", path); );
+    dir_forget( d->path );
+    dir_put( d );
+    return NULL;
+}
+
+
+/* One walk of dir_open.  Sets stale if a cached directory is gone */
+static dir_fd *
+dir_walk( char *path, bool create, bool *stale )
+{
+    dir_fd *d, *n;
+    char   *p, *seg, c;
+    int    fd;
+
+    d = dir_get_valid( path );
+    if ( d )
+        return d;
+
+    /* deepest cached ancestor, the root at worst */
+    for ( p=path+strlen(path); !d; ) {
+        while ( --p > path && *p != FS_PATH_SEP_C )
+            ;
+        if ( p <= path ) {
+            p = path;
+            d = dir_get_valid( FS_ROOT_DIR );
+            if ( d )
+                break;
+            fd = open( FS_ROOT_DIR, O_RDONLY|O_DIRECTORY );
+            if ( fd < 0 )
+                return NULL;
+            d = dir_add( FS_ROOT_DIR, fd );
+            if ( !d ) {
+                close( fd );
+                return NULL;
+            }
+            break;
+        }
+        *p = '\0';
+        d  = dir_get_valid( path );
+        *p = FS_PATH_SEP_C;
+    }
+
+    /* p is the separator before the first segment to open */
+    while ( *p ) {
+        seg = p + 1;
+        p   = strchr( seg, FS_PATH_SEP_C );
+        if ( !p )
+            p = seg + strlen( seg );
+        if ( p == seg )
+            continue;
+
+        c  = *p;
+        *p = '\0';
+        n  = NULL;
+        fd = openat( d->fd, seg, O_RDONLY|O_DIRECTORY );
+        if ( fd < 0 && errno == ENOENT && create ) {
+            LOG( cfgs_log(CFGST_LL_INFO, "mkdir %s\n", path); );
+            if ( 0 == mkdirat(d->fd, seg, FS_DIR_PERM) || errno == EEXIST )
+                fd = openat( d->fd, seg, O_RDONLY|O_DIRECTORY );
+        }
+        if ( fd >= 0 && !(n = dir_add(path, fd)) )
+            close( fd );
+        *p = c;
+
+        if ( !n ) {
+            /* removed behind our back? */
+            if ( dir_gone(d) ) {
+                dir_forget( d->path );
+                *stale = true;
+            }
+            if ( errno == ENOENT || errno == ENOTDIR )
+                errno = 0;
+            dir_put( d );
+            return NULL;
+        }
+        dir_put( d );
+        d = n;
+    }
+
+    return d;
+}
+
+
+/*
+ * The directory @param path, absolute and '/' separated, made if
+ * @param create.  @return NULL if it does not exist; dir_put it.
+ */
+static dir_fd *
+dir_open( char *path, bool create )
+{
+    bool   stale = false;
+    dir_fd *d    = dir_walk( path, create, &stale );
+
+    /* each walk forgets at least one of the directories removed */
+    while ( !d && stale ) {
+        stale = false;
+        d = dir_walk( path, create, &stale );
+    }
+    return d;
+}
+
+
+bool
+fs_dirs_init( void )
+{
+    m_dirs = cfgs_hash_new( 0 );
+    return m_dirs != NULL;
+}
+
+
+void
+fs_dirs_forget( const char *rootdir, const char *valname )
+{
+    char path[ FILENAME_MAX ];
+
+    dir_forget( cache_key(path, rootdir, valname) );
+}
+
+
+void
+fs_dirs_drop( void )
+{
+    pthread_mutex_lock( &m_dirs_mutex );
+    while ( m_dirs_lru )
+        dir_evict( m_dirs_lru );
+    pthread_mutex_unlock( &m_dirs_mutex );
+}
+
+
+void
+fs_dirs_shutdown( void )
+{
+    pthread_mutex_lock( &m_dirs_mutex );
+    while ( m_dirs_lru )
+        dir_evict( m_dirs_lru );
+    cfgs_hash_free( m_dirs, NULL );
+    m_dirs = NULL;
+    pthread_mutex_unlock( &m_dirs_mutex );
 }
 
 
+/* Sets gone if d was removed: known for sure on a set or a miss only */
 static int 
-check_vals( const char *dir, 
+check_vals( const dir_fd *d, 
         bool forcecreate, 
-        callonmatch *mf, match_data *data )
+        callonmatch *mf, match_data *data, bool *gone )
 {
-    char crt[ FILENAME_MAX ] ={0};
-    int  num = 0;
+    char        crt[ FILENAME_MAX ] ={0};
+    struct stat st;
+    int         num = 0;
     
-    snprintf( crt, FILENAME_MAX-1, "%s/%s", dir, VALS_FILE );
-    //printf( "**** %s \n", crt );
-    
-    if ( !file_exists(crt, forcecreate) ) {
-        /*add_to_negative_hit( stack_to_path(valstack, STK_TOP) );*/
+    /* a set makes the file */
+    if ( forcecreate )
+        *gone = dir_gone( d );
+    else if ( 0 != fstatat(d->fd, VALS_FILE, &st, 0) || !S_ISREG(st.st_mode) ) {
+        if ( errno == ENOENT || errno == ENOTDIR )
+            errno = 0;
+        *gone = dir_gone( d );
         return 0;
     }
-
+    if ( *gone )
+        return 0;
+    
     /*
      *  work
      */
+    snprintf( crt, FILENAME_MAX-1, "%s/%s", d->path, VALS_FILE );
     data->filename = crt;
+    data->dirfd    = d->fd;
     num += (*mf)( data );
-    if ( num > 0 ) {
-        add_to_positive_hit( dir );
-    }
+    /* closed once d is put */
+    data->dirfd    = -1;
     
     return num;
 }
 
 
-typedef struct _srch_dirs {
-    char path[ FILENAME_MAX ];
-    char crtd[ FILENAME_MAX ]; /* current dir   */
-    char seg[ FILENAME_MAX ];  /* child of crtd */
-} srch_dirs;
-
-
 /* returns -1 on error.  */
 static int 
 fs_search_exact( const char *rootdir, const char *valname, 
@@ -272,137 +553,430 @@ fs_search_exact( const char *rootdir, const char *valname,
         callonmatch *mf, match_data *data 
         )
 {
-    int        num = 0;
-    srch_dirs  *srch;
-    const char *bs, *es, *end;
-    char       *p;
-
-    LOG( cfgs_log(CFGST_LL_CRITIC, "fs_search_exact\n"); );
+    char   path[ FILENAME_MAX ];
+    dir_fd *d;
+    int    num = 0;
+    bool   gone = false;
 
-    srch = XCALLOC( srch_dirs, 1 );
-    if ( !srch )
-        return -1;
-    
-    /* lassert( sizeof(srch->path) >= FILENAME_MAX ); */
-    snprintf( srch->path, FILENAME_MAX-1, "%s%s", rootdir, valname );
-#if 1
     /* FIXME: if path separator is not the same as CFGS_SEG_SEP. Check tests. */
-    for ( p=srch->path; *p; p++ ) {
-        if ( *p == '.' )
-            *p = FS_PATH_SEP_C;
-    }
-#endif
-    snprintf( srch->crtd, FILENAME_MAX-1, FS_ROOT_DIR );
+    cache_key( path, rootdir, valname );
     
-    es  = srch->path; 
-    end = srch->path + strlen( srch->path );
-    lassert( *end == 0 );
-    bs  = es;
-    while ( bs < end ) {
-        /* find limits of a path segment */
-        bs = es;
-        es = strchr( es+1, FS_PATH_SEP_C );
-        if ( !es )
-            es = end;
-        //printf( "\n%s\n%s\n", bs, es );
-        
-        strcat( srch->crtd, srch->seg );
-        strncpy( srch->seg, bs+1, es-bs );
-        srch->seg[ es-bs ] = '\0';
-        
-        if ( !dir_exists( srch->crtd, srch->seg, forcecreate ) ) {
-            xfree( srch );
+    d = dir_open( path, forcecreate );
+    if ( !d )
+        return num;
+    
+    num += check_vals( d, forcecreate, mf, data, &gone );
+    if ( gone ) {
+        /* once more from what is on disk */
+        dir_forget( d->path );
+        dir_put( d );
+        gone = false;
+        d = dir_open( path, forcecreate );
+        if ( !d )
             return num;
-        } else {
-            ;
-            /*num += check_vals( srch->crtd, forcecreate, mf, data );*/
-        }
+        num += check_vals( d, forcecreate, mf, data, &gone );
     }
-    
-    num += check_vals( srch->crtd, forcecreate, mf, data );
-    xfree( srch );
+    dir_put( d );
     return num;
 }
 
 
+/*
+ * Index of the names having values, sorted, one per rootdir (layer and
+ * entry type).  Built by scanning the tree at load for the default layer,
+ * the first time a search by pattern or a listing needs it for the others,
+ * kept up to date by wal.c as it logs the changes.  Rebuilt when the tree 
+ * changed behind it, see wal_index.  A scan fills an index of its own, put
+ * in use once the changes logged meanwhile are in.  A pattern is matched 
+ * against the range of names starting with its literal part.
+ */
+struct _fs_index {
+    fs_index  *next;
+    fs_index  *prev;
+    char      *rootdir;
+    cfgs_hash *set;       /* name -> cfgs_str in names */
+    cfgs_str  *names;
+    int       nb_names;
+    char      **sorted;   /* of names, rebuilt when dirty */
+    bool      dirty;
+    long      gen;        /* of the tree scanned */
+};
+
+static pthread_mutex_t m_index_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fs_index        *m_indexes    = NULL;
+
+/* nftw has no user data: scans are done under m_scan_mutex */
+static pthread_mutex_t m_scan_mutex = PTHREAD_MUTEX_INITIALIZER;
+static fs_index        *m_scanning  = NULL;
+
+
+/* The name of valname's directory under rootdir: "/a/b", "" for rootdir */
+static char *
+index_name( char *name, const char *rootdir, const char *valname )
+{
+    char path[ FILENAME_MAX ];
+    char *p, *q;
+
+    cache_key( path, rootdir, valname );
+    for ( p=path+strlen(rootdir), q=name; *p; p++ ) {
+        if ( *p == FS_PATH_SEP_C && (p[1] == FS_PATH_SEP_C || p[1] == '\0') )
+            continue;
+        *q++ = *p;
+    }
+    *q = '\0';
+
+    return name;
+}
+
+
+static void
+index_free( fs_index *ix )
+{
+    if ( ix->set )
+        cfgs_hash_free( ix->set, NULL );
+    CFGST_DLIST_FREE( ix->names, cfgs_str_free );
+    if ( ix->sorted )
+        xfree( ix->sorted );
+    if ( ix->rootdir )
+        xfree( ix->rootdir );
+    xfree( ix );
+}
+
+
+/* With m_index_mutex, or ix not in use yet */
+static void
+index_add( fs_index *ix, const char *name )
+{
+    cfgs_str *s;
+
+    if ( cfgs_hash_find(ix->set, name) )
+        return;
+    s = cfgs_str_new( name );
+    if ( !s )
+        return;
+    if ( cfgs_hash_insert(ix->set, s->name, s, 0) == CFGST_HASH_INVALID_IDX ) {
+        cfgs_str_free( s );
+        return;
+    }
+    ix->names = (cfgs_str*)cfgs_dlist_add_tail( (cfgs_dlist*)ix->names, (cfgs_dlist*)s );
+    ix->nb_names++;
+    ix->dirty = true;
+}
+
+
+/* With m_index_mutex, or ix not in use yet */
+static void
+index_rm( fs_index *ix, const char *name )
+{
+    cfgs_str *s = (cfgs_str*)cfgs_hash_find( ix->set, name );
+
+    if ( !s )
+        return;
+    cfgs_hash_delete( ix->set, s->name, s, NULL );
+    ix->names = (cfgs_str*)cfgs_dlist_rem( (cfgs_dlist*)ix->names, (cfgs_dlist*)s );
+    cfgs_str_free( s );
+    ix->nb_names--;
+    ix->dirty = true;
+}
+
+
 static int
-globerr( const char *epath, int eerrno )
+index_scan( const char *file, const struct stat *st, int flag, struct FTW *ftw )
 {
-    LOG( cfgs_log(CFGST_LL_CRITIC, 
-            "globerr: glob failed '%s' ('%d')\n", epath?epath:"", eerrno); );
-    errno = 0;
+    char   name[ FILENAME_MAX ];
+    size_t root = strlen( m_scanning->rootdir );
+    size_t len  = strlen( file );
+
+    if (  flag != FTW_F || !S_ISREG(st->st_mode) 
+       || 0 != strcmp(file + ftw->base, VALS_FILE) 
+       || len < root + sizeof(VALS_FILE) )
+        return 0;
+
+    /* rootdir/a/b/VALUES -> /a/b */
+    len -= root + sizeof(VALS_FILE);
+    if ( len >= sizeof(name) )
+        return 0;
+    memcpy( name, file + root, len );
+    name[ len ] = '\0';
+    index_add( m_scanning, name );
+
     return 0;
 }
 
 
-//FIXME: prints only first value.  Problem might be elsewhere
+/* With m_index_mutex */
+static fs_index *
+index_get( const char *rootdir )
+{
+    fs_index *ix;
+
+    for ( ix=m_indexes; ix; ix=ix->next ) {
+        if ( 0 == strcmp(ix->rootdir, rootdir) )
+            return ix;
+    }
+
+    return NULL;
+}
+
+
+int
+fs_index_scan( const char *rootdir, long gen, fs_index **scan )
+{
+    fs_index *ix;
+    bool     current;
+
+    *scan = NULL;
+    pthread_mutex_lock( &m_index_mutex );
+    ix      = index_get( rootdir );
+    current = ix && ix->gen == gen;
+    pthread_mutex_unlock( &m_index_mutex );
+    if ( current )
+        return 0;
+
+    ix = XCALLOC( fs_index, 1 );
+    if ( ix ) {
+        ix->rootdir = xstrdup( rootdir );
+        ix->set     = cfgs_hash_new( 0 );
+        ix->gen     = gen;
+    }
+    if ( !ix || !ix->rootdir || !ix->set ) {
+        if ( ix )
+            index_free( ix );
+        return -1;
+    }
+
+    pthread_mutex_lock( &m_scan_mutex );
+    m_scanning = ix;
+    if ( 0 != nftw(rootdir, index_scan, 16, FTW_PHYS) && errno != ENOENT ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "fs_index_scan: cannot scan '%s'\n", rootdir); );
+        m_scanning = NULL;
+        pthread_mutex_unlock( &m_scan_mutex );
+        index_free( ix );
+        return -1;
+    }
+    m_scanning = NULL;
+    pthread_mutex_unlock( &m_scan_mutex );
+    errno = 0;
+
+    LOG( cfgs_log(CFGST_LL_INFO, "fs_index_scan: '%s', %d names\n", rootdir, ix->nb_names); );
+    *scan = ix;
+    return 1;
+}
+
+
+void
+fs_index_replay( fs_index *scan, const char *valname, bool set )
+{
+    char name[ FILENAME_MAX ];
+
+    index_name( name, scan->rootdir, valname );
+    if ( set )
+        index_add( scan, name );
+    else
+        index_rm( scan, name );
+}
+
+
+void
+fs_index_publish( fs_index *scan )
+{
+    fs_index *ix;
+
+    pthread_mutex_lock( &m_index_mutex );
+    ix = index_get( scan->rootdir );
+    if ( ix ) {
+        LOG( cfgs_log(CFGST_LL_INFO, "fs_index_publish: '%s' changed\n", ix->rootdir); );
+        m_indexes = (fs_index*)cfgs_dlist_rem( (cfgs_dlist*)m_indexes, (cfgs_dlist*)ix );
+        index_free( ix );
+    }
+    m_indexes = (fs_index*)cfgs_dlist_add_tail( (cfgs_dlist*)m_indexes, (cfgs_dlist*)scan );
+    pthread_mutex_unlock( &m_index_mutex );
+}
+
+
+void
+fs_index_discard( fs_index *scan )
+{
+    index_free( scan );
+}
+
+
 static int
-glob_recursive( char *crtdir, const char *pattern, callonmatch *mf, match_data *data )
+cmp_names( const void *a, const void *b )
 {
-    int    ret;
-    int    i;
-    int    num = 0;
-    glob_t matches;
-    
-    lassert( crtdir && pattern && mf && data );
-
-/* FIXME: configure.in check? */
-#if defined __CYGWIN32__ || defined __CYGWIN__ 
-#  define GLOB_ONLYDIR (0)   
-#endif
-TEST_ERROR
-    ret = glob( crtdir, GLOB_NOSORT|GLOB_ONLYDIR, globerr, &matches );
-    if ( ret != 0 ) {
-        LOG( cfgs_log(CFGST_LL_CRITIC, 
-            "glob failed for '%s'(ret='%d')\n", crtdir, ret); );
-        if ( errno == ENOTDIR )  errno = 0;
-        return 0; /*FIME: -1? will cause name='*' to fail if no vals*/
+    return strcmp( *(char* const*)a, *(char* const*)b );
+}
+
+
+/* With m_index_mutex.  @return the first name not before key */
+static int
+index_lower_bound( fs_index *ix, const char *key )
+{
+    int lo = 0, hi = ix->nb_names;
+
+    if ( ix->dirty ) {
+        cfgs_str *s;
+        int      i;
+
+        if ( ix->sorted )
+            xfree( ix->sorted );
+        ix->sorted = XCALLOC( char*, ix->nb_names + 1 );
+        if ( !ix->sorted )
+            return ix->nb_names;
+        for ( s=ix->names, i=0; s; s=s->next )
+            ix->sorted[ i++ ] = s->name;
+        qsort( ix->sorted, ix->nb_names, sizeof(char*), cmp_names );
+        ix->dirty = false;
     }
-    
-    for ( i=0; i<matches.gl_pathc; i++ ) {
-        int    n = 0;
-    
-        /* FIXME: use crtdir as a file name */
-        snprintf( crtdir, FILENAME_MAX-1, "%s%s%s", 
-                matches.gl_pathv[i], FS_PATH_SEP_S, VALS_FILE );
-TEST_ERROR        
-        if (  file_exists(crtdir, false) 
-           &&  0 == fnmatch(pattern, matches.gl_pathv[i], 0) 
-           ) {
-            LOG( cfgs_log(CFGST_LL_INFO, "glob & fnmatch: '%s' \n", matches.gl_pathv[i]); );
-            //printf( "**** match: %s \n", matches.gl_pathv[i] );
-            
-            data->filename = crtdir;
-            n = (*mf)( data );
-            if ( n > 0 ) {
-                num += n;
-                //FIXME: matches.gl_pathv[i] will be freed. xstrdup?
-                add_to_positive_hit( matches.gl_pathv[i] ); 
+
+    while ( lo < hi ) {
+        int mid = (lo + hi) / 2;
+
+        if ( strcmp(ix->sorted[mid], key) < 0 )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+
+void
+fs_index_add( const char *rootdir, const char *valname )
+{
+    char     name[ FILENAME_MAX ];
+    fs_index *ix;
+
+    pthread_mutex_lock( &m_index_mutex );
+    /* not built yet: wal_index adds it */
+    ix = index_get( rootdir );
+    if ( ix )
+        index_add( ix, index_name(name, rootdir, valname) );
+    pthread_mutex_unlock( &m_index_mutex );
+}
+
+
+void
+fs_index_rm( const char *rootdir, const char *valname )
+{
+    char     name[ FILENAME_MAX ];
+    fs_index *ix;
+
+    pthread_mutex_lock( &m_index_mutex );
+    ix = index_get( rootdir );
+    if ( ix )
+        index_rm( ix, index_name(name, rootdir, valname) );
+    pthread_mutex_unlock( &m_index_mutex );
+}
+
+
+cfgs_str *
+fs_index_match( const char *rootdir, const char *valname )
+{
+    char     pattern[ FILENAME_MAX ];
+    char     prefix[ FILENAME_MAX ];
+    size_t   plen;
+    fs_index *ix;
+    cfgs_str *names = NULL;
+    int      i;
+
+    index_name( pattern, rootdir, valname );
+    plen = strcspn( pattern, "*?[\\" );
+    memcpy( prefix, pattern, plen );
+    prefix[ plen ] = '\0';
+
+    pthread_mutex_lock( &m_index_mutex );
+    ix = index_get( rootdir );
+    for ( i=ix ? index_lower_bound(ix, prefix) : 0; ix && i<ix->nb_names; i++ ) {
+        const char *name = ix->sorted[ i ];
+        cfgs_str   *s;
+
+        if ( 0 != strncmp(name, prefix, plen) )
+            break;
+        if ( 0 != fnmatch(pattern, name, 0) )
+            continue;
+        s = cfgs_str_new( name );
+        if ( !s )
+            break;
+        names = (cfgs_str*)cfgs_dlist_add_tail( (cfgs_dlist*)names, (cfgs_dlist*)s );
+    }
+    pthread_mutex_unlock( &m_index_mutex );
+
+    return names;
+}
+
+
+cfgs_str *
+fs_index_subnames( const char *rootdir, const char *valname )
+{
+    char      prefix[ FILENAME_MAX ];
+    size_t    plen;
+    fs_index  *ix;
+    cfgs_hash *seen;
+    cfgs_str  *subs = NULL;
+    int       i;
+
+    index_name( prefix, rootdir, valname );
+    plen = strlen( prefix );
+    if ( plen + 2 > sizeof(prefix) )
+        return NULL;
+    prefix[ plen++ ] = FS_PATH_SEP_C;
+    prefix[ plen ]   = '\0';
+
+    seen = cfgs_hash_new( 0 );
+    if ( !seen )
+        return NULL;
+
+    pthread_mutex_lock( &m_index_mutex );
+    ix = index_get( rootdir );
+    for ( i=ix ? index_lower_bound(ix, prefix) : 0; ix && i<ix->nb_names; i++ ) {
+        const char *rest = ix->sorted[ i ] + plen;
+        size_t     len   = strcspn( rest, FS_PATH_SEP_S );
+        cfgs_str   *s;
+
+        if ( 0 != strncmp(ix->sorted[i], prefix, plen) )
+            break;
+        if ( !len || len >= sizeof(prefix) - plen )
+            continue;
+        /* the next segment, once */
+        memcpy( prefix + plen, rest, len );
+        prefix[ plen + len ] = '\0';
+        if ( !cfgs_hash_find(seen, prefix + plen) ) {
+            s = cfgs_str_new( prefix + plen );
+            if ( !s || cfgs_hash_insert(seen, s->name, s, 0) == CFGST_HASH_INVALID_IDX ) {
+                if ( s )
+                    cfgs_str_free( s );
+                break;
             }
+            subs = (cfgs_str*)cfgs_dlist_add_tail( (cfgs_dlist*)subs, (cfgs_dlist*)s );
         }
-TEST_ERROR    
-        snprintf( crtdir, FILENAME_MAX-1, "%s%s%s", 
-                matches.gl_pathv[i], FS_PATH_SEP_S, "*" );
-        num += glob_recursive( crtdir, pattern, mf, data );
+        prefix[ plen ] = '\0';
     }
-    
-    globfree( &matches );
-    return num;
+    pthread_mutex_unlock( &m_index_mutex );
+
+    cfgs_hash_free( seen, NULL );
+    return subs;
 }
 
 
-typedef struct _srch_pat {
-    char pattern[ FILENAME_MAX ];
-    char crtdir[ FILENAME_MAX ]; 
-} srch_pat;
+void
+fs_index_shutdown( void )
+{
+    pthread_mutex_lock( &m_index_mutex );
+    while ( m_indexes ) {
+        fs_index *ix = m_indexes;
+
+        m_indexes = (fs_index*)cfgs_dlist_rem( (cfgs_dlist*)m_indexes, (cfgs_dlist*)ix );
+        index_free( ix );
+    }
+    pthread_mutex_unlock( &m_index_mutex );
+}
+
 
 /*
- *  Note: la facon la plus simple de tester la presence d'une valeur serait de 
- *  chdir dans le repertoire CFGS_VALUES_ROOT_DIR "/" MOD_NAME "/" valuename.  Mais ceci
- *  ne marcherait pas pour des recherches de type '.net.*' - on doit chercher
- *  niveau par niveau.  A discuter. 
- *  FIXME: fwt 
- *  Return -1 on error.  
+ *  Patterns are matched against the index, then each name found is read
+ *  as an exact one.  Return -1 on error.  
  */
 static int 
 fs_search_regexp( const char *rootdir, const char *valname, 
@@ -410,19 +984,18 @@ fs_search_regexp( const char *rootdir, const char *valname,
         callonmatch *mf, match_data *data 
         )
 {
-    srch_pat *pat = NULL;
+    cfgs_str *names, *n;
     int      num = 0;
     
-    pat = XCALLOC( srch_pat, 1 );
-    if ( !pat ) 
-        return -1;
-    
-    snprintf( pat->pattern, FILENAME_MAX-1, "%s%s%s", rootdir, FS_PATH_SEP_S, valname );
-    snprintf( pat->crtdir,  FILENAME_MAX-1, "%s%s%s", rootdir, FS_PATH_SEP_S, "*" );
+    names = fs_index_match( rootdir, valname );
 TEST_ERROR    
-    num = glob_recursive( pat->crtdir, pat->pattern, mf, data );
+    for ( n=names; n; n=n->next ) {
+        int ret = fs_search_exact( rootdir, n->name, false, mf, data );
+        if ( ret > 0 ) 
+            num += ret;
+    }
 TEST_ERROR    
-    xfree( pat );
+    CFGST_DLIST_FREE( names, cfgs_str_free );
     return num;
 }
 
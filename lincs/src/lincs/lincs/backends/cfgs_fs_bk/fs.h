@@ -35,6 +35,7 @@ extern "C" {
 #include "cfgs/cfgs_config.h"
 #include "cfgs_client_api.h"
 #include "cfgs_hash.h"
+#include "cfgs_str.h"
 
 #include <stdio.h>
 
@@ -60,12 +61,18 @@ typedef struct _match_data {
     char   *valname;
     cfgs_entry *value;    /*in*/
     char   *filename;
+    int    dirfd;         /* filename's directory, or -1: use filename; 
+                             not 0, set it to -1 when initializing */
     cfgs_entry **vlist;   /*out*/
 } match_data;
 
 /* function to call when we found the file corresponding to a value name */
 typedef int callonmatch( match_data* );
 
+/* cfgs_fs_bk.c: write data->value, remove the file.  Return -1 on error.  */
+int on_match_set( match_data *data );
+int on_match_rm( match_data *data );
+
 
 /*  Scans the filesytem for value files that are matching the valname criteria, 
  *  starting at rootdir.  Will create intermediate folders if forcecreate.  
@@ -76,10 +83,49 @@ int fs_search( const char *rootdir, const char *valname,
         callonmatch *mf, match_data *data 
         );
 
+/* 
+ *  Cache of the exact value names searched under rootdir, see cfgs_cache.h.  
+ *  Setting/removing a value must drop it with rm_from_cache.  
+ */
+bool       fs_cache_init( void );
+void       fs_cache_shutdown( void );
+/* Directories kept open by searches */
+bool       fs_dirs_init( void );
+void       fs_dirs_shutdown( void );
+/* a value removed: its directory and the ones under it are not kept */
+void       fs_dirs_forget( const char *rootdir, const char *valname );
+/* the tree changed behind our back: none is kept */
+void       fs_dirs_drop( void );
 /* negative hit */
-bool   does_not_exists( const char *name );
-/* positive hit */
-cfgs_entry *is_cached( const char *name );
+bool       does_not_exists( const char *rootdir, const char *valname );
+/* positive hit: a copy of the values, free it */
+cfgs_entry *is_cached( const char *rootdir, const char *valname );
+void       add_to_positive_hit( const char *rootdir, const char *valname, cfgs_entry *vals );
+void       add_to_negative_hit( const char *rootdir, const char *valname );
+void       rm_from_cache( const char *rootdir, const char *valname );
+/* the value's directory: key of the cache and of the changes logged */
+char       *cache_key( char *key, const char *rootdir, const char *valname );
+
+/*
+ *  Index of the names having values under rootdir, for searches by
+ *  pattern and listings.  Logging a change must keep it up to date.  
+ *  fs_index_scan scans the tree unless the index has @param gen already:
+ *  returns 1 if scanned, into @param scan, 0 if not, -1 on error.  The 
+ *  scan is not in use until published: the changes logged meanwhile are 
+ *  replayed on it first.  Or it is discarded.  See wal_index.  
+ */
+typedef struct _fs_index fs_index;
+int        fs_index_scan( const char *rootdir, long gen, fs_index **scan );
+void       fs_index_replay( fs_index *scan, const char *valname, bool set );
+void       fs_index_publish( fs_index *scan );
+void       fs_index_discard( fs_index *scan );
+void       fs_index_add( const char *rootdir, const char *valname );
+void       fs_index_rm( const char *rootdir, const char *valname );
+/* the names matching the pattern valname, '/' separated */
+cfgs_str   *fs_index_match( const char *rootdir, const char *valname );
+/* the next segment of the names under valname */
+cfgs_str   *fs_index_subnames( const char *rootdir, const char *valname );
+void       fs_index_shutdown( void );
 
 bool is_regexp( const char *name );
 
@@ -0,0 +1,831 @@
+/*
+ *  $Revision: 1.1 $
+ *  $Date: 2004/04/16 21:02:37 $
+ *
+ *  Write-ahead log of the changes to the values tree.
+ */
+/*
+#
+# Copyright (c) 2003 Aurelian Melinte.
+# This file is part of LinCS/tiger.
+#
+# LinCS/tiger is distributed under the terms of the GNU Lesser General Public
+# License version 2 or any later version.  See the file COPYING.LIB for copying
+# permission or http://www.gnu.org.
+#
+# THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED OR
+# IMPLIED, without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  ANY USE IS AT YOUR OWN RISK.
+#
+# Permission to modify the code and to distribute modified code is granted,
+# provided the above notices are retained, and a notice that the code was
+# modified is included with the above copyright notice.
+#
+ */
+
+#include "cfgs/cfgs_config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "wal.h"
+#include "fs.h"
+#include "cfgs_log.h"
+#include "cfgs_hash.h"
+#include "cfgs_mem.h"
+#include "cfgs_dlist.h"
+#include "cfgs_str.h"
+#include "cfgs_sock.h"
+
+
+/*
+ * A set or remove is appended to WAL_FILE and kept in memory until the tree
+ * has it; gets look there first, searches by pattern and listings find its
+ * name in the index.  Only the compactor folds the log into the tree, 
+ * every CGFS_WAL_COMPACT_SECS, sooner past CGFS_WAL_MAX changes: WAL_FILE
+ * is renamed WAL_OLD_FILE, applied in order, the tree synced and
+ * WAL_OLD_FILE removed.  A crash in between applies it again.  The
+ * directories of new names are made then too, out of the requests' way.
+ *
+ * Durability, CFGS_ENV_FS_DURABILITY:
+ *   sync   a change is acknowledged once on disk.  The threads of a 
+ *          process logging meanwhile wait for the same fdatasync; the 
+ *          daemon writes one request at a time, each waits for its own
+ *   async  the compactor syncs the log every CGFS_WAL_SYNC_MS
+ *   none   the system writes the log when it sees fit
+ *
+ * Other processes (clients falling back on the backends) append to the
+ * same file under a flock and may fold it too.  Whoever folds bumps the
+ * store's generation in WAL_GEN_FILE: the name index is rebuilt when the
+ * tree changed other than by our own changes, see wal_index.
+ * FIXME: their changes are seen here once folded.
+ */
+
+/* Records: uint32_t length of the rest, op, rootdir and valname NUL
+   terminated, the values as xml for a set */
+#define WAL_OP_SET  'S'
+#define WAL_OP_RM   'R'
+
+typedef struct _wal_rec wal_rec;
+struct _wal_rec {
+    wal_rec    *next;
+    wal_rec    *prev;
+    char       *key;       /* see cache_key() */
+    char       *rootdir;
+    char       *valname;
+    cfgs_entry *vals;      /* NULL if removed */
+    long       lsn;
+};
+
+static WAL_DUR   m_dur     = WAL_DUR_SYNC;
+static char      m_wal[ FILENAME_MAX ];
+static char      m_old[ FILENAME_MAX ];
+static char      m_gen_file[ FILENAME_MAX ];
+
+/* All below, with m_mutex */
+static pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int       m_fd      = -1;     /* WAL_FILE, appended to */
+static long      m_lsn     = 0;      /* changes logged */
+static long      m_synced  = 0;      /* of which on disk */
+static long      m_lost    = 0;      /* of which a sync failed for */
+static bool      m_syncing = false;  /* a thread is in fdatasync for others */
+static pthread_cond_t m_synced_cond = PTHREAD_COND_INITIALIZER;
+static cfgs_hash *m_recs   = NULL;   /* key -> wal_rec */
+static wal_rec   *m_list   = NULL;   /* by lsn */
+static int       m_nb_recs = 0;
+static bool      m_running = false;
+static pthread_cond_t m_wake = PTHREAD_COND_INITIALIZER;
+static long      m_gen     = 0;      /* the store's, as last seen */
+static long      m_view    = 0;      /* of the index: bumped by others' folds */
+static long      m_folded  = 0;      /* changes logged up to the last fold */
+
+/* one index scan at a time, see wal_index */
+static pthread_mutex_t m_index_build_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t       m_compactor;
+/* one compaction at a time */
+static pthread_mutex_t m_compact_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+static void
+rec_free( wal_rec *r )
+{
+    if ( r->key )
+        xfree( r->key );
+    if ( r->rootdir )
+        xfree( r->rootdir );
+    if ( r->valname )
+        xfree( r->valname );
+    CFGST_DLIST_FREE( r->vals, cfgs_entry_free );
+    xfree( r );
+}
+
+
+/* With m_mutex.  Takes r, or frees it if key was logged already */
+static void
+rec_put( wal_rec *r )
+{
+    wal_rec *old = (wal_rec*)cfgs_hash_find( m_recs, r->key );
+
+    if ( old ) {
+        cfgs_entry *vals = old->vals;
+
+        old->vals = r->vals;
+        r->vals   = vals;
+        rec_free( r );
+        m_list = (wal_rec*)cfgs_dlist_rem( (cfgs_dlist*)m_list, (cfgs_dlist*)old );
+        r = old;
+    } else if ( cfgs_hash_insert(m_recs, r->key, r, 0) == CFGST_HASH_INVALID_IDX ) {
+        /* in the log anyway: gets see the tree until folded */
+        LOG( cfgs_log(CFGST_LL_CRITIC, "rec_put: '%s'\n", r->key); );
+        rec_free( r );
+        return;
+    } else
+        m_nb_recs++;
+
+    r->lsn = m_lsn;
+    m_list = (wal_rec*)cfgs_dlist_add_tail( (cfgs_dlist*)m_list, (cfgs_dlist*)r );
+}
+
+
+/* With m_mutex.  Drop the changes the tree has */
+static void
+recs_drop( long upto )
+{
+    while ( m_list && m_list->lsn <= upto ) {
+        wal_rec *r = m_list;
+
+        m_list = (wal_rec*)cfgs_dlist_rem( (cfgs_dlist*)m_list, (cfgs_dlist*)r );
+        cfgs_hash_delete( m_recs, r->key, r, NULL );
+        rec_free( r );
+        m_nb_recs--;
+    }
+}
+
+
+static cfgs_buf *
+rec_encode( const char *rootdir, const char *valname, cfgs_entry *vals )
+{
+    cfgs_buf *b, *xml = NULL;
+    uint32_t len = 0;
+    bool     ok;
+
+    if ( vals ) {
+        cfgs_tag *tag = cs_tags_from_entries( NULL, vals );
+
+        if ( !tag )
+            return NULL;
+        xml = cfgs_tags_to_cfgs_buf( tag );
+        CFGST_DLIST_FREE( tag, cfgs_tag_free );
+        if ( !xml )
+            return NULL;
+    }
+
+    b = cfgs_buf_new( NULL, 256 );
+    ok = b
+      && cfgs_buf_cat( b, (const char*)&len, sizeof(len) )
+      && cfgs_buf_cat_ch( b, vals ? WAL_OP_SET : WAL_OP_RM )
+      && cfgs_buf_cat( b, rootdir, strlen(rootdir)+1 )
+      && cfgs_buf_cat( b, valname, strlen(valname)+1 )
+      /* without the NUL */
+      && ( !xml || cfgs_buf_cat(b, xml->buf, xml->used-1) );
+    if ( xml )
+        cfgs_buf_free( xml );
+    if ( !ok ) {
+        if ( b )
+            cfgs_buf_free( b );
+        return NULL;
+    }
+
+    len = b->used - sizeof(len);
+    memcpy( b->buf, &len, sizeof(len) );
+    return b;
+}
+
+
+static void
+rec_apply( char op, const char *rootdir, const char *valname,
+           const char *xml, int len )
+{
+    match_data data = {0};
+
+    data.dirfd = -1;
+    if ( op == WAL_OP_SET ) {
+        cfgs_tag *tag = cfgs_tags_from_str( xml, len );
+
+        data.value = tag ? cfgs_entries_from_tags( tag ) : NULL;
+        if ( tag )
+            CFGST_DLIST_FREE( tag, cfgs_tag_free );
+        if ( data.value ) {
+            (void)fs_search( rootdir, valname, true, on_match_set, &data );
+            CFGST_DLIST_FREE( data.value, cfgs_entry_free );
+        } else
+            LOG( cfgs_log(CFGST_LL_CRITIC, "rec_apply: bad values for '%s'\n", valname); );
+    } else {
+        data.valname = (char*)valname;
+        (void)fs_search( rootdir, valname, false, on_match_rm, &data );
+        fs_dirs_forget( rootdir, valname );
+    }
+    errno = 0;
+
+    rm_from_cache( rootdir, valname );
+}
+
+
+/* 
+ * With m_mutex.  Sync m_fd, holding all logged so far: their waiters are 
+ * told whether it is on disk.  
+ */
+static bool
+wal_sync_all( void )
+{
+    bool ok = 0 == fdatasync( m_fd );
+
+    if ( ok ) {
+        m_synced = m_lsn;
+    } else {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "wal_sync_all: '%s'\n", m_wal); );
+        m_lost = m_lsn;
+    }
+    pthread_cond_broadcast( &m_synced_cond );
+    return ok;
+}
+
+
+/* With m_mutex.  Open and lock WAL_FILE against other processes */
+static bool
+wal_lock( void )
+{
+    struct stat fst, st;
+
+    for ( ;; ) {
+        if ( m_fd < 0 ) {
+            m_fd = open( m_wal, O_WRONLY|O_APPEND|O_CREAT, WAL_FILE_PERM );
+            if ( m_fd < 0 && errno == ENOENT
+               && 0 == mkdir(CFGS_VALUES_ROOT_DIR, FS_DIR_PERM) )
+                continue;
+            if ( m_fd < 0 ) {
+                LOG( cfgs_log(CFGST_LL_CRITIC, "wal_lock: open '%s'\n", m_wal); );
+                return false;
+            }
+        }
+        while ( flock(m_fd, LOCK_EX) != 0 ) {
+            if ( errno != EINTR ) {
+                LOG( cfgs_log(CFGST_LL_CRITIC, "wal_lock: flock '%s'\n", m_wal); );
+                return false;
+            }
+        }
+
+        /* still the log, not renamed by a compaction? */
+        if (  0 == fstat(m_fd, &fst) && 0 == stat(m_wal, &st)
+           && fst.st_ino == st.st_ino ) {
+            errno = 0;
+            return true;
+        }
+        /* what we appended there is acknowledged, or failed */
+        (void)wal_sync_all();
+        close( m_fd );
+        m_fd = -1;
+    }
+
+    return false;
+}
+
+
+static void
+wal_unlock( void )
+{
+    (void)flock( m_fd, LOCK_UN );
+}
+
+
+long
+wal_log( const char *rootdir, const char *valname, cfgs_entry *vals )
+{
+    char     key[ FILENAME_MAX ];
+    cfgs_buf *b;
+    wal_rec  *r;
+    long     lsn = -1;
+
+    lassert( rootdir && valname );
+    b = rec_encode( rootdir, valname, vals );
+    r = XCALLOC( wal_rec, 1 );
+    if ( !b || !r )
+        goto out;
+    r->key     = xstrdup( cache_key(key, rootdir, valname) );
+    r->rootdir = xstrdup( rootdir );
+    r->valname = xstrdup( valname );
+    if (  !r->key || !r->rootdir || !r->valname 
+       || (vals && !(r->vals = cfgs_entries_dup(vals))) )
+        goto out;
+
+    pthread_mutex_lock( &m_mutex );
+    if ( wal_lock() ) {
+        struct stat st;
+
+        if ( 0 != fstat(m_fd, &st) ) {
+            LOG( cfgs_log(CFGST_LL_CRITIC, "wal_log: fstat '%s'\n", m_wal); );
+        } else if ( cfgst_rwrite(m_fd, b->buf, b->used) == b->used ) {
+            lsn = ++m_lsn;
+            rec_put( r );
+            r = NULL;
+            /* searches by pattern see it from now on */
+            if ( vals )
+                fs_index_add( rootdir, valname );
+            else
+                fs_index_rm( rootdir, valname );
+        } else {
+            LOG( cfgs_log(CFGST_LL_CRITIC, "wal_log: write '%s'\n", m_wal); );
+            /* no torn record before the next ones */
+            (void)ftruncate( m_fd, st.st_size );
+        }
+        wal_unlock();
+    }
+    if ( m_nb_recs >= CGFS_WAL_MAX )
+        pthread_cond_signal( &m_wake );
+    pthread_mutex_unlock( &m_mutex );
+
+out:
+    if ( b )
+        cfgs_buf_free( b );
+    if ( r )
+        rec_free( r );
+    return lsn;
+}
+
+
+/* One thread syncs for all those waiting */
+static bool
+wal_sync( long lsn )
+{
+    bool ok = true;
+
+    pthread_mutex_lock( &m_mutex );
+    while ( ok && m_synced < lsn ) {
+        long upto;
+        int  fd;
+
+        if ( lsn <= m_lost ) {
+            ok = false;
+            break;
+        }
+        if ( m_syncing ) {
+            pthread_cond_wait( &m_synced_cond, &m_mutex );
+            continue;
+        }
+
+        upto      = m_lsn;
+        fd        = m_fd >= 0 ? dup( m_fd ) : -1;
+        m_syncing = true;
+        pthread_mutex_unlock( &m_mutex );
+
+        ok = fd >= 0 && 0 == fdatasync( fd );
+        if ( fd >= 0 )
+            close( fd );
+
+        pthread_mutex_lock( &m_mutex );
+        m_syncing = false;
+        if ( ok && upto > m_synced )
+            m_synced = upto;
+        /* the others waiting for it fail too */
+        if ( !ok && upto > m_lost )
+            m_lost = upto;
+        pthread_cond_broadcast( &m_synced_cond );
+    }
+    pthread_mutex_unlock( &m_mutex );
+
+    if ( !ok )
+        LOG( cfgs_log(CFGST_LL_CRITIC, "wal_sync: '%s'\n", m_wal); );
+    return ok;
+}
+
+
+bool
+wal_commit( long lsn )
+{
+    if ( m_dur != WAL_DUR_SYNC )
+        return true;
+    return wal_sync( lsn );
+}
+
+
+int
+wal_pending( const char *rootdir, const char *valname, cfgs_entry **vals )
+{
+    char    key[ FILENAME_MAX ];
+    wal_rec *r;
+    int     ret = 0;
+
+    *vals = NULL;
+    cache_key( key, rootdir, valname );
+
+    pthread_mutex_lock( &m_mutex );
+    r = (wal_rec*)cfgs_hash_find( m_recs, key );
+    if ( r ) {
+        ret = 1;
+        if ( r->vals && !(*vals = cfgs_entries_dup(r->vals)) )
+            ret = -1;
+    }
+    pthread_mutex_unlock( &m_mutex );
+
+    return ret;
+}
+
+
+/* 
+ * The store's generation, bumped first if @param bump.  
+ * @return 0 if none yet, -1 on error.  
+ */
+static long
+gen_get( bool bump )
+{
+    long g = 0;
+    int  f = open( m_gen_file, bump ? O_RDWR|O_CREAT : O_RDONLY, WAL_FILE_PERM );
+
+    if ( f < 0 ) {
+        if ( errno != ENOENT ) 
+            return -1;
+        errno = 0;
+        return 0;
+    }
+    while ( flock(f, bump ? LOCK_EX : LOCK_SH) != 0 ) {
+        if ( errno != EINTR ) {
+            close( f );
+            return -1;
+        }
+    }
+
+    if ( pread(f, &g, sizeof(g), 0) != sizeof(g) )
+        g = 0;
+    if ( bump ) {
+        g++;
+        if ( pwrite(f, &g, sizeof(g), 0) != sizeof(g) ) {
+            LOG( cfgs_log(CFGST_LL_CRITIC, "gen_get: write '%s'\n", m_gen_file); );
+            g = -1;
+        }
+    }
+    close( f );
+
+    return g;
+}
+
+
+static bool
+store_sync( void )
+{
+    int  f  = open( CFGS_VALUES_ROOT_DIR, O_RDONLY|O_DIRECTORY );
+    bool ok = f >= 0 && 0 == syncfs( f );
+
+    if ( !ok )
+        LOG( cfgs_log(CFGST_LL_CRITIC, "store_sync: '%s'\n", CFGS_VALUES_ROOT_DIR); );
+    if ( f >= 0 )
+        close( f );
+    return ok;
+}
+
+
+/* 
+ * Apply WAL_OLD_FILE, if any, and remove it.  @param napplied gets the 
+ * number of records applied, @param gen the store's generation then.  
+ */
+static bool
+wal_apply_old( int *napplied, long *gen )
+{
+    struct stat st;
+    char        *buf;
+    const char  *p, *end;
+    int         f;
+    bool        ok;
+
+    *napplied = 0;
+    f = open( m_old, O_RDONLY );
+    if ( f < 0 ) {
+        if ( errno == ENOENT ) {
+            errno = 0;
+            return true;
+        }
+        LOG( cfgs_log(CFGST_LL_CRITIC, "wal_apply_old: open '%s'\n", m_old); );
+        return false;
+    }
+    while ( flock(f, LOCK_EX) != 0 ) {
+        if ( errno != EINTR ) {
+            close( f );
+            return false;
+        }
+    }
+    /* applied meanwhile by another process? */
+    if ( fstat(f, &st) != 0 || st.st_nlink == 0 ) {
+        close( f );
+        errno = 0;
+        return true;
+    }
+
+    buf = (char*)xmalloc( st.st_size + 1 );
+    if ( !buf || cfgst_rread(f, buf, st.st_size) != st.st_size ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "wal_apply_old: read '%s'\n", m_old); );
+        if ( buf )
+            xfree( buf );
+        close( f );
+        return false;
+    }
+
+    /* a record cut short by a crash ends the log */
+    p   = buf;
+    end = buf + st.st_size;
+    while ( (size_t)(end - p) >= sizeof(uint32_t) ) {
+        const char *rend, *rootdir, *valname;
+        uint32_t   len;
+        char       op;
+
+        memcpy( &len, p, sizeof(len) );
+        p += sizeof(len);
+        if ( len > end - p )
+            break;
+        rend    = p + len;
+        op      = *p++;
+        if ( op != WAL_OP_SET && op != WAL_OP_RM )
+            break;
+        rootdir = p;
+        p       = memchr( p, '\0', rend - p );
+        if ( !p++ )
+            break;
+        valname = p;
+        p       = memchr( p, '\0', rend - p );
+        if ( !p++ )
+            break;
+
+        rec_apply( op, rootdir, valname, p, rend - p );
+        (*napplied)++;
+        p = rend;
+    }
+    xfree( buf );
+
+    /* the store's file system only, before the log goes */
+    ok = store_sync();
+    *gen = gen_get( true );
+    if ( ok && 0 != unlink(m_old) ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "wal_apply_old: unlink '%s'\n", m_old); );
+        ok = false;
+    }
+    close( f );
+
+    return ok;
+}
+
+
+/*
+ * With m_mutex.  WAL_FILE becomes WAL_OLD_FILE.
+ * @return 1 if everything logged is in WAL_OLD_FILE or already applied,
+ * 0 if another process has yet to apply WAL_OLD_FILE, -1 on error.
+ */
+static int
+wal_rotate( void )
+{
+    struct stat st;
+    int         ret = 1;
+
+    if ( !wal_lock() )
+        return -1;
+
+    if ( 0 == stat(m_old, &st) )
+        ret = 0;
+    else if ( 0 == fstat(m_fd, &st) && st.st_size > 0 ) {
+        /* acknowledged as synced, whatever the durability; or kept */
+        if ( !wal_sync_all() ) {
+            ret = -1;
+        } else if ( 0 == rename(m_wal, m_old) ) {
+            /* unlocks it */
+            close( m_fd );
+            m_fd = -1;
+        } else {
+            LOG( cfgs_log(CFGST_LL_CRITIC, "wal_rotate: rename '%s'\n", m_wal); );
+            ret = -1;
+        }
+    }
+    errno = 0;
+
+    if ( m_fd >= 0 )
+        wal_unlock();
+
+    return ret;
+}
+
+
+/* Fold the log into the tree */
+static bool
+wal_compact( void )
+{
+    long upto, gen = -1;
+    int  rot, n;
+    bool ok;
+
+    pthread_mutex_lock( &m_compact_mutex );
+
+    /* left by a crash, or by another process */
+    ok = wal_apply_old( &n, &gen );
+
+    pthread_mutex_lock( &m_mutex );
+    upto = m_lsn;
+    rot  = ok ? wal_rotate() : -1;
+    pthread_mutex_unlock( &m_mutex );
+
+    ok = rot >= 0 && wal_apply_old( &n, &gen );
+    if ( ok && rot > 0 ) {
+        pthread_mutex_lock( &m_mutex );
+        recs_drop( upto );
+        /* only our changes, the index has them: no other since seen */
+        if ( n > 0 && n == upto - m_folded && gen == m_gen + 1 )
+            m_gen = gen;
+        m_folded = upto;
+        pthread_mutex_unlock( &m_mutex );
+    }
+
+    pthread_mutex_unlock( &m_compact_mutex );
+    return ok;
+}
+
+
+/* 
+ * With m_mutex.  Folded by another process, or with its changes: the index 
+ * and the directories kept open are stale.  
+ */
+static void
+gen_check( void )
+{
+    long gen = gen_get( false );
+
+    if ( gen >= 0 && gen != m_gen ) {
+        m_gen = gen;
+        m_view++;
+        fs_dirs_drop();
+    }
+}
+
+
+bool
+wal_index( const char *rootdir )
+{
+    fs_index *scan;
+    wal_rec  *r;
+    long     view, folded;
+    int      built;
+
+    /* one at a time: the next finds the index current */
+    pthread_mutex_lock( &m_index_build_mutex );
+    for ( ;; ) {
+        pthread_mutex_lock( &m_mutex );
+        gen_check();
+        view   = m_view;
+        folded = m_folded;
+        pthread_mutex_unlock( &m_mutex );
+
+        /* the whole tree: without m_mutex, changes are logged meanwhile */
+        built = fs_index_scan( rootdir, view, &scan );
+        if ( built <= 0 )
+            break;
+
+        pthread_mutex_lock( &m_mutex );
+        gen_check();
+        if ( view == m_view && folded == m_folded ) {
+            /* add what the tree does not have yet, in use from now on */
+            for ( r=m_list; r; r=r->next ) {
+                if ( 0 == strcmp(r->rootdir, rootdir) )
+                    fs_index_replay( scan, r->valname, r->vals != NULL );
+            }
+            fs_index_publish( scan );
+            pthread_mutex_unlock( &m_mutex );
+            break;
+        }
+        pthread_mutex_unlock( &m_mutex );
+        /* folded meanwhile: changes dropped from the log might be missed */
+        fs_index_discard( scan );
+    }
+    pthread_mutex_unlock( &m_index_build_mutex );
+
+    return built >= 0;
+}
+
+
+static void *
+compactor( void *arg )
+{
+    time_t last   = time( NULL );
+    bool   failed = false;
+    int    ms     = m_dur == WAL_DUR_ASYNC ? CGFS_WAL_SYNC_MS
+                                           : CGFS_WAL_COMPACT_SECS*1000;
+
+    pthread_mutex_lock( &m_mutex );
+    while ( m_running ) {
+        struct timespec ts;
+        bool            compact;
+        long            lsn;
+
+        if ( failed || m_nb_recs < CGFS_WAL_MAX ) {
+            clock_gettime( CLOCK_REALTIME, &ts );
+            ts.tv_sec  += ms / 1000;
+            ts.tv_nsec += (ms % 1000) * 1000000L;
+            if ( ts.tv_nsec >= 1000000000L ) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            (void)pthread_cond_timedwait( &m_wake, &m_mutex, &ts );
+            if ( !m_running )
+                break;
+        }
+        gen_check();
+
+        lsn     = m_lsn;
+        compact = m_nb_recs >= CGFS_WAL_MAX
+               || ( m_nb_recs && time(NULL) - last >= CGFS_WAL_COMPACT_SECS );
+        pthread_mutex_unlock( &m_mutex );
+
+        if ( m_dur == WAL_DUR_ASYNC )
+            (void)wal_sync( lsn );
+        if ( compact ) {
+            failed = !wal_compact();
+            last   = time( NULL );
+        }
+
+        pthread_mutex_lock( &m_mutex );
+    }
+    pthread_mutex_unlock( &m_mutex );
+
+    return NULL;
+}
+
+
+bool
+wal_init( void )
+{
+    const char *env = getenv( CFGS_ENV_FS_DURABILITY );
+    const char *dur = env ? env : CGFS_FS_DURABILITY;
+
+    if ( 0 == strcmp(dur, "async") )
+        m_dur = WAL_DUR_ASYNC;
+    else if ( 0 == strcmp(dur, "none") )
+        m_dur = WAL_DUR_NONE;
+    else {
+        lassert( 0 == strcmp(dur, "sync") );
+        m_dur = WAL_DUR_SYNC;
+    }
+
+    snprintf( m_wal, FILENAME_MAX-1, "%s%s%s",
+              CFGS_VALUES_ROOT_DIR, FS_PATH_SEP_S, WAL_FILE );
+    snprintf( m_old, FILENAME_MAX-1, "%s%s%s",
+              CFGS_VALUES_ROOT_DIR, FS_PATH_SEP_S, WAL_OLD_FILE );
+    snprintf( m_gen_file, FILENAME_MAX-1, "%s%s%s",
+              CFGS_VALUES_ROOT_DIR, FS_PATH_SEP_S, WAL_GEN_FILE );
+
+    m_recs = cfgs_hash_new( 0 );
+    if ( !m_recs )
+        return false;
+    if ( !wal_compact() )
+        return false;
+
+    m_running = true;
+    if ( 0 != pthread_create(&m_compactor, NULL, compactor, NULL) ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "wal_init: cannot start the compactor\n"); );
+        m_running = false;
+        return false;
+    }
+
+    LOG( cfgs_log(CFGST_LL_INFO, "wal_init: durability '%s'\n", dur); );
+    return true;
+}
+
+
+void
+wal_shutdown( void )
+{
+    pthread_mutex_lock( &m_mutex );
+    if ( m_running ) {
+        m_running = false;
+        pthread_cond_signal( &m_wake );
+        pthread_mutex_unlock( &m_mutex );
+        pthread_join( m_compactor, NULL );
+    } else
+        pthread_mutex_unlock( &m_mutex );
+
+    (void)wal_compact();
+
+    pthread_mutex_lock( &m_mutex );
+    recs_drop( m_lsn );
+    if ( m_recs )
+        cfgs_hash_free( m_recs, NULL );
+    m_recs = NULL;
+    if ( m_fd >= 0 )
+        close( m_fd );
+    m_fd = -1;
+    pthread_mutex_unlock( &m_mutex );
+}
+
@@ -0,0 +1,87 @@
+/*
+ *  $Revision: 1.1 $
+ *  $Date: 2004/04/16 21:02:37 $
+ *
+ *  Write-ahead log of the changes to the values tree.
+ */
+/*
+#
+# Copyright (c) 2003 Aurelian Melinte.
+# This file is part of LinCS/tiger.
+#
+# LinCS/tiger is distributed under the terms of the GNU Lesser General Public
+# License version 2 or any later version.  See the file COPYING.LIB for copying
+# permission or http://www.gnu.org.
+#
+# THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED OR
+# IMPLIED, without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  ANY USE IS AT YOUR OWN RISK.
+#
+# Permission to modify the code and to distribute modified code is granted,
+# provided the above notices are retained, and a notice that the code was
+# modified is included with the above copyright notice.
+#
+ */
+
+#ifndef WAL_H
+#define WAL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "cfgs/cfgs_config.h"
+#include "cfgs_client_api.h"
+
+
+/* Under CFGS_VALUES_ROOT_DIR: the log, and the log being folded into the tree */
+#define WAL_FILE       "cfgs_fs_bk.wal"
+#define WAL_OLD_FILE   "cfgs_fs_bk.wal.old"
+/* ... and the store's generation, bumped by every fold */
+#define WAL_GEN_FILE   "cfgs_fs_bk.gen"
+
+#define WAL_FILE_PERM  (0640)
+
+/** When is a change on disk, see CGFS_FS_DURABILITY */
+typedef enum {
+    WAL_DUR_SYNC = 0,  /**< before it is acknowledged */
+    WAL_DUR_ASYNC,     /**< within CGFS_WAL_SYNC_MS */
+    WAL_DUR_NONE,      /**< when the system sees fit */
+} WAL_DUR;
+
+
+/** Replay what a previous run left in the log and start the compactor */
+bool wal_init( void );
+/** Stop the compactor and fold the log into the tree */
+void wal_shutdown( void );
+
+/**
+ *  Log a set of @param valname to @param vals under @param rootdir or, if
+ *  vals is NULL, its removal.
+ *  @return the change's sequence number, to commit, or -1 on error.
+ */
+long wal_log( const char *rootdir, const char *valname, cfgs_entry *vals );
+/** Wait, as the durability asks, for the changes up to @param lsn to be on disk */
+bool wal_commit( long lsn );
+
+/**
+ *  @return 1 if a change of @param valname is logged, its values copied
+ *  into @param vals (NULL if removed), 0 if not, -1 on error.
+ */
+int  wal_pending( const char *rootdir, const char *valname, cfgs_entry **vals );
+/** 
+ *  Make the name index of @param rootdir current: built with the changes
+ *  logged, rebuilt if another process changed the tree.  Searches by 
+ *  pattern and listings need it.  
+ */
+bool wal_index( const char *rootdir );
+
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*WAL_H*/
+
@@ -0,0 +1,260 @@
+/*
+ *  $Revision: 1.1 $
+ *  $Date: 2004/04/14 20:12:05 $
+ *
+ *  Client API
+ *
+ */
+/*
+# 
+# Copyright (c) 2003 Aurelian Melinte. 
+# This file is part of LinCS/tiger.  
+# 
+# LinCS/tiger is distributed under the terms of the GNU Lesser General Public
+# License version 2 or any later version.  See the file COPYING.LIB for copying 
+# permission or http://www.gnu.org. 
+#                                                                            
+# THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED OR  
+# IMPLIED, without even the implied warranty of MERCHANTABILITY or FITNESS 
+# FOR A PARTICULAR PURPOSE.  ANY USE IS AT YOUR OWN RISK. 
+#                                                                            
+# Permission to modify the code and to distribute modified code is granted, 
+# provided the above notices are retained, and a notice that the code was 
+# modified is included with the above copyright notice. 
+# 
+ */ 
+
+#include "cfgs/cfgs_config.h"
+
+#include <string.h>
+
+
+#include "cfgs_backend.h"
+#include "cfgs_log.h"
+#include "cfgs_mem.h"
+#include "cfgs_dlist.h"
+#include "cfgs_client_api.h"
+#include "cfgs_str.h"
+#include "snap.h"
+
+
+#define CFGS_BACKEND_NAME  "cfgs_snap_bk"
+
+const char g_progname[] = CFGS_BACKEND_NAME;
+
+
+/* 
+ * exported functions:
+ */
+#define on_unload                 cfgs_snap_bk ## _LTX_on_unload
+#define on_load                   cfgs_snap_bk ## _LTX_on_load
+
+#if CFGS_CRT_REV != 6
+#  error please update defines to CFGS_CRT_REV if needed
+#endif
+#define cfgs_getval                 cfgs_snap_bk ## _LTX_cfgs_getval
+#define cfgs_setval                 cfgs_snap_bk ## _LTX_cfgs_setval
+#define cfgs_rmval                  cfgs_snap_bk ## _LTX_cfgs_rmval
+#define cfgs_getsubvals             cfgs_snap_bk ## _LTX_cfgs_getsubvals
+#define cfgs_getsublayers           cfgs_snap_bk ## _LTX_cfgs_getsublayers
+#define cfgs_getinfos               cfgs_snap_bk ## _LTX_cfgs_getinfos
+#define cfgs_getvals                cfgs_snap_bk ## _LTX_cfgs_getvals
+
+
+
+static bool
+is_regexp( const char *name )
+{
+    return strchr( name, '*' ) || strchr( name, '?' );
+}
+
+
+static snap_layer *
+get_layer( const char *layer )
+{
+    const char *l = layer != NULL ? layer : CFGS_DEFAULT_LAYER;
+    
+    /* regexps allowed only for value names */
+    if ( is_regexp(l) )
+        return NULL;
+    
+    return snap_layer_get( l );
+}
+
+
+cfgs_entry*
+cfgs_getval( cfgs_session *sess, const char *name, const char *layer )
+{
+    cfgs_entry *pval = NULL;
+    snap_layer *sl;
+    
+    if ( !sess || !name )
+        return NULL;
+    
+    /* FIXME: if layer == NULL, for every layer under CFGS_VALUES_ROOT_DIR? */
+    sl = get_layer( layer );
+    if ( !sl ) 
+        return NULL;
+    
+    if ( is_regexp(name) ) 
+        (void)snap_glob( sl, name, &pval );
+    else
+        pval = snap_get( sl, name );
+    
+    return pval;
+}
+
+
+cfgs_entry*
+cfgs_getvals( cfgs_session *sess, const char **names, int n, const char *layer )
+{
+    cfgs_entry *pv = NULL;
+    int        i;
+    
+    if ( !sess || !names )
+        return NULL;
+    
+    for ( i=0; i<n; i++ ) {
+        cfgs_entry *v = cfgs_getval( sess, names[i], layer );
+        pv = (cfgs_entry*)cfgs_dlist_cat( (cfgs_dlist*)pv, (cfgs_dlist*)v );
+    }
+        
+    return pv;
+}
+
+
+int 
+cfgs_setval( cfgs_session *sess, cfgs_entry *vl )
+{
+    int        nvals = 0;
+    cfgs_entry *crt  = vl;
+    
+    if ( !sess || !vl )
+        return -1;
+
+    for ( ; crt; crt=crt->next ) {
+        const char *name, *layer; 
+        snap_layer *sl;
+        int        n;
+        
+        name = cfgs_entry_attr( crt, CFGS_EA_NAME );
+        if ( !name || !*name )
+            continue; 
+
+        layer = cfgs_entry_attr( crt, CFGS_EA_LAYER );
+        if ( !layer ) {
+            cfgs_entry_add_attr( crt, CFGS_EA_LAYER, CFGS_DEFAULT_LAYER );
+            layer = cfgs_entry_attr( crt, CFGS_EA_LAYER );
+            if ( !layer ) {
+                return -1; 
+            }
+        }
+        
+        /* regexps allowed only for get */
+        if ( is_regexp(name) || is_regexp(layer) )
+            continue;
+        
+        sl = snap_layer_get( layer );
+        n  = sl ? snap_log( sl, name, crt ) : -1;
+        /* the ones logged before stay, see cfgs_setval */
+        if ( n < 0 ) 
+            return nvals ? nvals : -1;
+        nvals += n;
+    }
+   
+    return nvals; 
+}
+
+
+int 
+cfgs_rmval( cfgs_session *sess, const char *name, const char *layer )
+{
+    snap_layer *sl;
+    
+    if ( !sess || !name )
+        return -1;
+    
+    /* regexps allowed only for get */
+    if ( is_regexp(name) || (layer && is_regexp(layer)) )
+        return 0; /*FIXME: -1 ?*/
+    
+    /* FIXME: for every layer under CFGS_VALUES_ROOT_DIR */
+    sl = get_layer( layer );
+    if ( !sl ) 
+        return -1;
+    
+    return snap_log( sl, name, NULL );
+}
+
+
+int 
+cfgs_register_notif( cfgs_session *s, cfgs_notif *notif )
+{
+    /* Not used.  Notifications are the responsability of the server.  */
+    lassert( false );
+    return 0; 
+}
+
+
+int 
+cfgs_unregister_notif( cfgs_session *s, cfgs_notif *notif )
+{
+    /* Not used.  Notifications are the responsability of the server.  */
+    lassert( false );
+    return 0; 
+}
+
+
+bool
+on_load( void )
+{
+    /* layers are mapped when first used */
+    if ( !snap_init() )
+        return false;
+    LOG( cfgs_log(CFGST_LL_INFO, "backend '%s' successfully loaded\n", g_progname); );
+    return true;
+}
+
+
+bool
+on_unload( void )
+{
+    snap_layers_free();
+    LOG( cfgs_log(CFGST_LL_INFO, "backend '%s' successfully unloaded \n", g_progname); );
+    return true;
+}
+
+
+cfgs_str *
+cfgs_getsubvals( cfgs_session *sess, const char *valname, const char *layer )
+{
+    snap_layer *sl;
+    
+    lassert( valname != NULL );
+    if ( !valname || !sess ) 
+        return NULL;
+    
+    sl = get_layer( layer );
+    if ( !sl ) 
+        return NULL;
+    
+    return snap_subnames( sl, valname );
+}
+
+
+cfgs_str *
+cfgs_getsublayers( cfgs_session *s, const char *layername )
+{
+    return NULL; //FIXME
+}
+
+
+cfgs_str *
+cfgs_getinfos( cfgs_session *s )
+{
+    cfgs_str *ret = cfgs_str_new( 
+            "; ;Backend " CFGS_BACKEND_NAME 
+            ";    CFGS_VALUES_ROOT_DIR: " CFGS_VALUES_ROOT_DIR 
+	    );
+    return ret; 
+}
@@ -0,0 +1,1342 @@
+/*
+ *  $Revision: 1.1 $
+ *  $Date: 2004/04/14 20:12:05 $
+ *
+ *  Layer snapshots: all the values of a layer in one mapped file.
+ */
+/*
+#
+# Copyright (c) 2003 Aurelian Melinte.
+# This file is part of LinCS/tiger.
+#
+# LinCS/tiger is distributed under the terms of the GNU Lesser General Public
+# License version 2 or any later version.  See the file COPYING.LIB for copying
+# permission or http://www.gnu.org.
+#
+# THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED OR
+# IMPLIED, without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  ANY USE IS AT YOUR OWN RISK.
+#
+# Permission to modify the code and to distribute modified code is granted,
+# provided the above notices are retained, and a notice that the code was
+# modified is included with the above copyright notice.
+#
+ */
+
+#include "cfgs/cfgs_config.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <ftw.h>
+#include <sys/file.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "snap.h"
+#include "cfgs_log.h"
+#include "cfgs_hash.h"
+#include "cfgs_mem.h"
+#include "cfgs_dlist.h"
+#include "cfgs_sock.h"
+
+
+#define SNAP_BK_NAME   "cfgs_snap_bk"
+
+/* cfgs_fs_bk's tree, imported into layers without a snapshot */
+#define FS_BK_NAME     "cfgs_fs_bk"
+#define FS_VALS_FILE   "VALUES"
+
+
+/*
+ * A layer is its snapshot, mapped read only, and the changes logged since,
+ * kept in memory too: a get is a hash lookup in either, no system call and
+ * no parsing.  A set or remove is one append to the delta file.
+ * Several processes may change a layer: the daemon and clients falling back
+ * on the backends.  Changes, and replays of the delta file, are made under
+ * a flock of LOCK_FILE, after reloading the layer if another process
+ * changed it.  Changing a layer bumps the generation mapped from LOCK_FILE:
+ * a read compares it with the one loaded, no system call.  Where LOCK_FILE
+ * cannot be made (read only store), the files are checked with two stat.
+ */
+typedef struct _snap_change snap_change;
+struct _snap_change {
+    snap_change *next;
+    snap_change *prev;
+    char        *name;
+    cfgs_entry  *vals;     /* NULL if removed */
+};
+
+struct _snap_layer {
+    snap_layer  *next;
+    snap_layer  *prev;
+    char        *name;
+    char        dir[ FILENAME_MAX ];
+    const char  *map;      /* NULL: no snapshot yet */
+    size_t      map_len;
+    ino_t       map_ino;
+    int         lock_fd;   /* LOCK_FILE, opened once loaded */
+    volatile uint32_t *gen; /* LOCK_FILE mapped, NULL if not opened */
+    uint32_t    gen_seen;  /* loaded */
+    pthread_rwlock_t rwlock; /* reads vs. changes and reloads */
+    cfgs_hash   *delta;    /* name -> snap_change */
+    snap_change *changes;
+    int         nb_changes;
+    int         nb_records; /* in the delta file */
+    int         delta_fd;   /* opened by the first change */
+    off_t       delta_len;
+};
+
+static snap_layer      *m_layers = NULL;
+static pthread_mutex_t m_layers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* merges run off the changes' path, see merger() */
+static pthread_mutex_t m_merge_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  m_merge_wake  = PTHREAD_COND_INITIALIZER;
+static bool            m_merging     = false;  /* the merger runs */
+static bool            m_merge_asked = false;
+static pthread_t       m_merger;
+
+
+
+/* FNV-1a.  Part of the file format */
+static uint32_t
+name_hash( const char *name )
+{
+    uint32_t h = 2166136261U;
+
+    for ( ; *name; name++ ) {
+        h ^= (unsigned char)*name;
+        h *= 16777619U;
+    }
+
+    return h;
+}
+
+
+static bool
+put_u32( cfgs_buf *b, uint32_t u )
+{
+    return cfgs_buf_cat( b, (const char*)&u, sizeof(u) );
+}
+
+
+static bool
+get_u32( const char **p, const char *end, uint32_t *u )
+{
+    if ( end - *p < (long)sizeof(*u) )
+        return false;
+    memcpy( u, *p, sizeof(*u) );
+    *p += sizeof(*u);
+    return true;
+}
+
+
+/* a NUL terminated string within [*p, end) */
+static const char *
+get_str( const char **p, const char *end )
+{
+    const char *s = *p;
+    const char *z = memchr( s, '\0', end - s );
+
+    if ( !z )
+        return NULL;
+    *p = z + 1;
+    return s;
+}
+
+
+/*
+ * Values: their number, then for each one its entry_type, value_type and
+ * number of attributes, as uint32_t, followed by its attributes as pairs
+ * of NUL terminated strings.  Decoding them only copies strings.
+ */
+static bool
+vals_encode( cfgs_buf *b, cfgs_entry *vals )
+{
+    cfgs_entry *v;
+    bool       ok;
+
+    ok = put_u32( b, cfgs_dlist_length((cfgs_dlist*)vals) );
+    for ( v=vals; ok && v; v=v->next ) {
+        cfgs_pair *p;
+
+        ok = put_u32( b, v->entry_type )
+          && put_u32( b, v->value_type )
+          && put_u32( b, cfgs_dlist_length((cfgs_dlist*)v->attr) );
+        for ( p=v->attr; ok && p; p=p->next ) {
+            const char *s = p->second ? p->second : "";
+            ok = cfgs_buf_cat( b, p->first, strlen(p->first)+1 )
+              && cfgs_buf_cat( b, s, strlen(s)+1 );
+        }
+    }
+
+    return ok;
+}
+
+
+static cfgs_entry *
+vals_decode( const char *p, const char *end )
+{
+    cfgs_entry *vals = NULL;
+    uint32_t   nb_vals, i;
+
+    if ( !get_u32(&p, end, &nb_vals) || !nb_vals )
+        return NULL;
+
+    for ( i=0; i<nb_vals; i++ ) {
+        uint32_t   et, vt, nb_attrs, j;
+        cfgs_entry *v;
+
+        if (  !get_u32(&p, end, &et) || !get_u32(&p, end, &vt)
+           || !get_u32(&p, end, &nb_attrs) )
+            break;
+        v = cfgs_entry_new();
+        if ( !v )
+            break;
+        v->entry_type = et;
+        v->value_type = vt;
+        vals = (cfgs_entry*)cfgs_dlist_add_tail( (cfgs_dlist*)vals, (cfgs_dlist*)v );
+
+        for ( j=0; j<nb_attrs; j++ ) {
+            const char *n = get_str( &p, end );
+            const char *s = n ? get_str( &p, end ) : NULL;
+            if ( !s || !cfgs_entry_add_attr(v, n, s) )
+                break;
+        }
+        if ( j < nb_attrs )
+            break;
+    }
+
+    if ( i < nb_vals ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "vals_decode: invalid values\n"); );
+        CFGST_DLIST_FREE( vals, cfgs_entry_free );
+        return NULL;
+    }
+    return vals;
+}
+
+
+/*
+ * The snapshot
+ */
+#define SNAP_HDR( sl )    ( (const snap_hdr*)(sl)->map )
+#define SNAP_NAMES( sl )  ( (const snap_name*)((sl)->map + SNAP_HDR(sl)->names_off) )
+#define SNAP_NB( sl )     ( (sl)->map ? SNAP_HDR(sl)->nb_names : 0 )
+
+static const char *
+snap_name_at( const snap_layer *sl, uint32_t i )
+{
+    uint32_t off = SNAP_NAMES(sl)[ i ].name_off;
+
+    return off < sl->map_len ? sl->map + off : "";
+}
+
+
+static cfgs_entry *
+snap_vals_at( const snap_layer *sl, uint32_t i )
+{
+    const snap_name *sn = SNAP_NAMES( sl ) + i;
+
+    if ( sn->vals_off > sl->map_len || sn->vals_len > sl->map_len - sn->vals_off )
+        return NULL;
+    return vals_decode( sl->map + sn->vals_off, sl->map + sn->vals_off + sn->vals_len );
+}
+
+
+/* @return the index of name or -1 */
+static int
+snap_find( const snap_layer *sl, const char *name )
+{
+    const snap_hdr  *hdr = SNAP_HDR( sl );
+    const uint32_t  *buckets;
+    uint32_t        h, i, n, mask;
+
+    if ( !hdr || !hdr->nb_names )
+        return -1;
+
+    buckets = (const uint32_t*)( sl->map + hdr->buckets_off );
+    mask    = hdr->nb_buckets - 1;
+    h       = name_hash( name );
+    /* a corrupt snapshot may have no free bucket: every one probed once */
+    for ( i=h & mask, n=0; n < hdr->nb_buckets && buckets[i] && buckets[i] <= hdr->nb_names;
+          i=(i+1) & mask, n++ ) {
+        const snap_name *sn = SNAP_NAMES( sl ) + buckets[i] - 1;
+        if ( sn->hash == h && 0 == strcmp(snap_name_at(sl, buckets[i]-1), name) )
+            return buckets[i] - 1;
+    }
+
+    return -1;
+}
+
+
+/* first name whose first len chars are not less than key's */
+static uint32_t
+snap_lower_bound( const snap_layer *sl, const char *key, size_t len )
+{
+    uint32_t lo = 0, hi = SNAP_NB( sl );
+
+    while ( lo < hi ) {
+        uint32_t mid = lo + (hi - lo)/2;
+        if ( strncmp(snap_name_at(sl, mid), key, len) < 0 )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+
+static bool
+snap_valid( const char *map, size_t len )
+{
+    const snap_hdr *hdr = (const snap_hdr*)map;
+
+    /* the file ends with a NUL: names cannot run past the map */
+    return len >= sizeof(snap_hdr)
+        && 0 == memcmp( hdr->magic, SNAP_MAGIC, sizeof(hdr->magic) )
+        && hdr->size == len
+        && map[ len-1 ] == '\0'
+        && hdr->nb_buckets > hdr->nb_names
+        && (hdr->nb_buckets & (hdr->nb_buckets-1)) == 0
+        && hdr->names_off == sizeof(snap_hdr)
+        && hdr->buckets_off == hdr->names_off + hdr->nb_names*sizeof(snap_name)
+        && hdr->buckets_off + (size_t)hdr->nb_buckets*sizeof(uint32_t) <= len;
+}
+
+
+/* Map the layer's snapshot.  No snapshot is not an error: *map is NULL */
+static bool
+snap_map( const snap_layer *sl, const char **map, size_t *len, ino_t *ino )
+{
+    char        file[ FILENAME_MAX ];
+    struct stat st;
+    void        *m;
+    int         f;
+
+    *map = NULL;
+    *len = 0;
+    *ino = 0;
+
+    snprintf( file, FILENAME_MAX-1, "%s/%s", sl->dir, SNAP_FILE );
+    f = open( file, O_RDONLY );
+    if ( f < 0 ) {
+        if ( errno == ENOENT || errno == ENOTDIR ) {
+            errno = 0;
+            return true;
+        }
+        LOG( cfgs_log(CFGST_LL_CRITIC, "snap_map: open '%s'\n", file); );
+        return false;
+    }
+
+    if ( fstat(f, &st) != 0 || st.st_size < sizeof(snap_hdr) ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "snap_map: '%s' too short\n", file); );
+        close( f );
+        return false;
+    }
+    m = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, f, 0 );
+    close( f );
+    if ( m == MAP_FAILED ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "snap_map: mmap '%s'\n", file); );
+        return false;
+    }
+    if ( !snap_valid((const char*)m, st.st_size) ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "snap_map: '%s' is not a snapshot\n", file); );
+        munmap( m, st.st_size );
+        return false;
+    }
+
+    *map = (const char*)m;
+    *len = st.st_size;
+    *ino = st.st_ino;
+    return true;
+}
+
+
+static bool
+make_dirs( const char *dir )
+{
+    char path[ FILENAME_MAX ];
+    char *p;
+
+    snprintf( path, FILENAME_MAX-1, "%s", dir );
+    for ( p=strchr(path+1, '/'); ; p=strchr(p+1, '/') ) {
+        if ( p )
+            *p = '\0';
+        if ( mkdir(path, SNAP_DIR_PERM) != 0 && errno != EEXIST ) {
+            LOG( cfgs_log(CFGST_LL_CRITIC, "make_dirs: mkdir '%s'\n", path); );
+            return false;
+        }
+        if ( !p )
+            break;
+        *p = '/';
+    }
+
+    errno = 0;
+    return true;
+}
+
+
+static bool
+write_all( int f, const void *buf, size_t len )
+{
+    return len == 0 || cfgst_rwrite( f, buf, len ) == (int)len;
+}
+
+
+/*
+ * Changes
+ */
+static void
+change_free( snap_change *c )
+{
+    CFGST_DLIST_FREE( c->vals, cfgs_entry_free );
+    xfree( c->name );
+    xfree( c );
+}
+
+
+/* Record name's values (NULL: removed).  They belong to the layer on success */
+static bool
+delta_put( snap_layer *sl, const char *name, cfgs_entry *vals )
+{
+    snap_change *c = (snap_change*)cfgs_hash_find( sl->delta, name );
+
+    if ( c ) {
+        CFGST_DLIST_FREE( c->vals, cfgs_entry_free );
+        c->vals = vals;
+        return true;
+    }
+
+    c = XCALLOC( snap_change, 1 );
+    if ( !c )
+        return false;
+    c->name = xstrdup( name );
+    if (  !c->name
+       || cfgs_hash_insert(sl->delta, c->name, c, 0) == CFGST_HASH_INVALID_IDX ) {
+        xfree( c->name );
+        xfree( c );
+        return false;
+    }
+    c->vals = vals;
+
+    sl->changes = (snap_change*)cfgs_dlist_add_tail( (cfgs_dlist*)sl->changes,
+                                                      (cfgs_dlist*)c );
+    sl->nb_changes++;
+    return true;
+}
+
+
+static void
+delta_clear( snap_layer *sl )
+{
+    CFGST_DLIST_FREE( sl->changes, change_free );
+    cfgs_hash_free( sl->delta, NULL );
+    sl->changes    = NULL;
+    sl->delta      = cfgs_hash_new( 0 );
+    sl->nb_changes = 0;
+    sl->nb_records = 0;
+}
+
+
+static void layer_changed( snap_layer *sl );
+
+/* 
+ * Load the changes logged.  A record cut short by a crash is dropped, and
+ * truncated if @param locked.  
+ */
+static bool
+delta_replay( snap_layer *sl, bool locked )
+{
+    char        file[ FILENAME_MAX ];
+    struct stat st;
+    char        *buf;
+    const char  *p, *end;
+    int         f;
+
+    snprintf( file, FILENAME_MAX-1, "%s/%s", sl->dir, DELTA_FILE );
+    f = open( file, O_RDWR );
+    if ( f < 0 ) {
+        if ( errno == ENOENT || errno == ENOTDIR ) {
+            errno = 0;
+            return true;
+        }
+        LOG( cfgs_log(CFGST_LL_CRITIC, "delta_replay: open '%s'\n", file); );
+        return false;
+    }
+    if ( fstat(f, &st) != 0 ) {
+        close( f );
+        return false;
+    }
+
+    buf = (char*)xmalloc( st.st_size + 1 );
+    if ( !buf || cfgst_rread(f, buf, st.st_size) != st.st_size ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "delta_replay: read '%s'\n", file); );
+        if ( buf )
+            xfree( buf );
+        close( f );
+        return false;
+    }
+
+    p   = buf;
+    end = buf + st.st_size;
+    while ( p < end ) {
+        const char *rend, *name;
+        cfgs_entry *vals = NULL;
+        uint32_t   len;
+
+        if ( !get_u32(&p, end, &len) || len > end - p )
+            break;
+        rend = p + len;
+        name = get_str( &p, rend );
+        if ( !name )
+            break;
+        if ( p < rend && !(vals = vals_decode(p, rend)) )
+            break;
+        if ( !delta_put(sl, name, vals) ) {
+            CFGST_DLIST_FREE( vals, cfgs_entry_free );
+            break;
+        }
+        sl->nb_records++;
+        p = rend;
+        sl->delta_len = p - buf;
+    }
+
+    if ( locked && sl->delta_len < st.st_size ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "delta_replay: '%s' truncated to %ld bytes\n",
+                file, (long)sl->delta_len); );
+        layer_changed( sl );
+        (void)ftruncate( f, sl->delta_len );
+    }
+    xfree( buf );
+    close( f );
+
+    return true;
+}
+
+
+/* Another process changed the layer since we loaded it */
+static bool
+layer_stale( const snap_layer *sl )
+{
+    char        file[ FILENAME_MAX ];
+    struct stat st;
+    bool        stale;
+
+    if ( sl->gen )
+        return *sl->gen != sl->gen_seen;
+
+    /* no generation: the files are no longer those loaded? */
+    snprintf( file, FILENAME_MAX-1, "%s/%s", sl->dir, SNAP_FILE );
+    stale = 0 == stat( file, &st ) ? st.st_ino != sl->map_ino : sl->map != NULL;
+    if ( !stale ) {
+        snprintf( file, FILENAME_MAX-1, "%s/%s", sl->dir, DELTA_FILE );
+        stale = 0 == stat( file, &st ) ? st.st_size != sl->delta_len
+                                       : sl->delta_len != 0;
+    }
+    errno = 0;
+
+    return stale;
+}
+
+
+/* Done locked, before changing the layer's files */
+static void
+layer_changed( snap_layer *sl )
+{
+    if ( sl->gen )
+        sl->gen_seen = __sync_add_and_fetch( sl->gen, 1 );
+}
+
+
+/* Open LOCK_FILE, made with the layer's directory, and map its generation */
+static bool
+layer_open( snap_layer *sl )
+{
+    char        file[ FILENAME_MAX ];
+    struct stat st;
+    void        *m;
+
+    if ( sl->lock_fd < 0 ) {
+        if ( !make_dirs(sl->dir) )
+            return false;
+        snprintf( file, FILENAME_MAX-1, "%s/%s", sl->dir, LOCK_FILE );
+        sl->lock_fd = open( file, O_RDWR|O_CREAT, SNAP_FILE_PERM );
+        if ( sl->lock_fd < 0 ) {
+            LOG( cfgs_log(CFGST_LL_CRITIC, "layer_open: open '%s'\n", file); );
+            return false;
+        }
+    }
+
+    /* reads check the generation, changes bump it */
+    if (  !sl->gen && 0 == fstat(sl->lock_fd, &st) 
+       && (st.st_size >= sizeof(uint32_t) 
+          || 0 == ftruncate(sl->lock_fd, sizeof(uint32_t))) ) {
+        m = mmap( NULL, sizeof(uint32_t), PROT_READ|PROT_WRITE, MAP_SHARED,
+                  sl->lock_fd, 0 );
+        if ( m != MAP_FAILED )
+            sl->gen = (volatile uint32_t*)m;
+    }
+    errno = 0;
+
+    return true;
+}
+
+
+static bool
+layer_reload( snap_layer *sl )
+{
+    const char *map;
+    size_t     len;
+    ino_t      ino;
+
+    LOG( cfgs_log(CFGST_LL_INFO, "layer_reload: layer '%s'\n", sl->name); );
+    if ( !snap_map(sl, &map, &len, &ino) )
+        return false;
+    if ( sl->map )
+        munmap( (void*)sl->map, sl->map_len );
+    sl->map     = map;
+    sl->map_len = len;
+    sl->map_ino = ino;
+
+    /* may be unlinked by a merge */
+    if ( sl->delta_fd >= 0 )
+        close( sl->delta_fd );
+    sl->delta_fd  = -1;
+    sl->delta_len = 0;
+    delta_clear( sl );
+    return sl->delta && delta_replay( sl, true );
+}
+
+
+/* Lock the layer against other processes.  Done with the rwlock written */
+static bool
+layer_lock( snap_layer *sl )
+{
+    if ( !layer_open(sl) )
+        return false;
+
+    while ( flock(sl->lock_fd, LOCK_EX) != 0 ) {
+        if ( errno != EINTR ) {
+            LOG( cfgs_log(CFGST_LL_CRITIC, "layer_lock: layer '%s'\n", sl->name); );
+            return false;
+        }
+    }
+    if ( layer_stale(sl) && !layer_reload(sl) ) {
+        (void)flock( sl->lock_fd, LOCK_UN );
+        return false;
+    }
+    if ( sl->gen )
+        sl->gen_seen = *sl->gen;
+
+    return true;
+}
+
+
+static void
+layer_unlock( snap_layer *sl )
+{
+    (void)flock( sl->lock_fd, LOCK_UN );
+}
+
+
+/* Read the layer: reload it first if stale */
+static void
+layer_rdlock( snap_layer *sl )
+{
+    pthread_rwlock_rdlock( &sl->rwlock );
+    if ( !layer_stale(sl) )
+        return;
+
+    pthread_rwlock_unlock( &sl->rwlock );
+    pthread_rwlock_wrlock( &sl->rwlock );
+    if ( layer_lock(sl) )
+        layer_unlock( sl );
+    pthread_rwlock_unlock( &sl->rwlock );
+    pthread_rwlock_rdlock( &sl->rwlock );
+}
+
+
+/*
+ * Delta file records: uint32_t length of the rest of the record, the name,
+ * NUL terminated, then the values for a set, nothing for a remove.
+ */
+static bool
+delta_append( snap_layer *sl, const char *name, cfgs_entry *vals )
+{
+    cfgs_buf *b;
+    uint32_t len;
+    bool     ok;
+
+    if ( sl->delta_fd < 0 ) {
+        char file[ FILENAME_MAX ];
+
+        snprintf( file, FILENAME_MAX-1, "%s/%s", sl->dir, DELTA_FILE );
+        sl->delta_fd = open( file, O_WRONLY|O_APPEND|O_CREAT|O_SYNC, SNAP_FILE_PERM );
+        if ( sl->delta_fd < 0 ) {
+            LOG( cfgs_log(CFGST_LL_CRITIC, "delta_append: open '%s'\n", file); );
+            return false;
+        }
+    }
+
+    b = cfgs_buf_new( NULL, 256 );
+    if ( !b )
+        return false;
+    ok = put_u32( b, 0 )
+      && cfgs_buf_cat( b, name, strlen(name)+1 )
+      && ( !vals || vals_encode(b, vals) );
+    if ( ok ) {
+        len = b->used - sizeof(len);
+        memcpy( b->buf, &len, sizeof(len) );
+        ok = write_all( sl->delta_fd, b->buf, b->used );
+        if ( ok )
+            sl->delta_len += b->used;
+        else
+            (void)ftruncate( sl->delta_fd, sl->delta_len );
+    }
+    cfgs_buf_free( b );
+
+    return ok;
+}
+
+
+/*
+ * Merging
+ */
+typedef struct _snap_item {
+    const char  *name;
+    cfgs_entry  *vals;      /* a change's values, or */
+    const char  *enc;       /* the encoded values of the old snapshot */
+    uint32_t    enc_len;
+} snap_item;
+
+
+static int
+cmp_changes( const void *a, const void *b )
+{
+    return strcmp( (*(snap_change**)a)->name, (*(snap_change**)b)->name );
+}
+
+
+static bool
+snap_write( const snap_layer *sl, const snap_item *items, uint32_t n )
+{
+    snap_hdr  hdr;
+    snap_name *names;
+    uint32_t  *buckets;
+    cfgs_buf  *heap;
+    size_t    heap_off;
+    uint32_t  i, mask;
+    char      file[ FILENAME_MAX ], tmp[ FILENAME_MAX ];
+    int       f;
+    bool      ok;
+
+    memset( &hdr, 0, sizeof(hdr) );
+    memcpy( hdr.magic, SNAP_MAGIC, sizeof(hdr.magic) );
+    hdr.nb_names = n;
+    for ( hdr.nb_buckets=8; hdr.nb_buckets < 2*n; hdr.nb_buckets*=2 )
+        ;
+    hdr.names_off   = sizeof( hdr );
+    hdr.buckets_off = hdr.names_off + n*sizeof(snap_name);
+    heap_off        = hdr.buckets_off + (size_t)hdr.nb_buckets*sizeof(uint32_t);
+    mask            = hdr.nb_buckets - 1;
+
+    names   = XCALLOC( snap_name, n ? n : 1 );
+    buckets = XCALLOC( uint32_t, hdr.nb_buckets );
+    heap    = cfgs_buf_new( NULL, 4096 );
+    ok      = names && buckets && heap;
+
+    for ( i=0; ok && i<n; i++ ) {
+        uint32_t b;
+
+        names[i].hash     = name_hash( items[i].name );
+        names[i].name_off = heap_off + heap->used;
+        ok = cfgs_buf_cat( heap, items[i].name, strlen(items[i].name)+1 );
+        names[i].vals_off = heap_off + heap->used;
+        if ( items[i].vals )
+            ok = ok && vals_encode( heap, items[i].vals );
+        else
+            ok = ok && cfgs_buf_cat( heap, items[i].enc, items[i].enc_len );
+        names[i].vals_len = heap_off + heap->used - names[i].vals_off;
+
+        for ( b=names[i].hash & mask; buckets[b]; b=(b+1) & mask )
+            ;
+        buckets[b] = i + 1;
+    }
+    ok = ok && cfgs_buf_cat_ch( heap, '\0' );
+    if ( ok && heap_off + heap->used > 0xffffffffUL ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "snap_write: layer '%s' too big\n", sl->name); );
+        ok = false;
+    }
+
+    if ( ok ) {
+        hdr.size = heap_off + heap->used;
+        snprintf( file, FILENAME_MAX-1, "%s/%s", sl->dir, SNAP_FILE );
+        snprintf( tmp,  FILENAME_MAX-1, "%s/%s.new", sl->dir, SNAP_FILE );
+
+        /* readers keep the old snapshot until it is replaced as a whole */
+        f  = make_dirs( sl->dir ) ? open( tmp, O_WRONLY|O_CREAT|O_TRUNC, SNAP_FILE_PERM ) : -1;
+        ok = f >= 0
+          && write_all( f, &hdr, sizeof(hdr) )
+          && write_all( f, names, n*sizeof(snap_name) )
+          && write_all( f, buckets, hdr.nb_buckets*sizeof(uint32_t) )
+          && write_all( f, heap->buf, heap->used )
+          && 0 == fsync( f );
+        if ( f >= 0 && 0 != close(f) )
+            ok = false;
+        if ( ok )
+            ok = 0 == rename( tmp, file );
+        if ( !ok ) {
+            LOG( cfgs_log(CFGST_LL_CRITIC, "snap_write: cannot write '%s'\n", tmp); );
+            (void)unlink( tmp );
+        }
+    }
+
+    if ( names )   xfree( names );
+    if ( buckets ) xfree( buckets );
+    if ( heap )    cfgs_buf_free( heap );
+    return ok;
+}
+
+
+/* Done locked */
+static bool
+layer_merge( snap_layer *sl )
+{
+    snap_change **chs;
+    snap_change *c;
+    snap_item   *items;
+    uint32_t    nb_old;
+    uint32_t    i, j, n;
+    const char  *map;
+    size_t      map_len;
+    ino_t       map_ino;
+    char        file[ FILENAME_MAX ];
+    bool        ok;
+
+    if ( !sl->nb_changes )
+        return true;
+    nb_old = SNAP_NB( sl );
+
+    chs   = XCALLOC( snap_change*, sl->nb_changes );
+    items = XCALLOC( snap_item, nb_old + sl->nb_changes );
+    if ( !chs || !items ) {
+        if ( chs )   xfree( chs );
+        if ( items ) xfree( items );
+        return false;
+    }
+    for ( c=sl->changes, i=0; c; c=c->next )
+        chs[ i++ ] = c;
+    qsort( chs, sl->nb_changes, sizeof(*chs), cmp_changes );
+
+    /* both sorted: the changes replace the old values */
+    for ( i=j=n=0; i<nb_old || j<sl->nb_changes; ) {
+        int cmp = i >= nb_old ? 1
+                : j >= sl->nb_changes ? -1
+                : strcmp( snap_name_at(sl, i), chs[j]->name );
+        if ( cmp < 0 ) {
+            const snap_name *sn = SNAP_NAMES( sl ) + i;
+            items[n].name    = snap_name_at( sl, i );
+            items[n].enc     = sl->map + sn->vals_off;
+            items[n].enc_len = sn->vals_len;
+            n++, i++;
+            continue;
+        }
+        if ( chs[j]->vals ) {
+            items[n].name = chs[j]->name;
+            items[n].vals = chs[j]->vals;
+            n++;
+        }
+        if ( cmp == 0 )
+            i++;
+        j++;
+    }
+
+    layer_changed( sl );
+    ok = snap_write( sl, items, n ) && snap_map( sl, &map, &map_len, &map_ino ) && map;
+    xfree( items );
+    xfree( chs );
+    if ( !ok )
+        return false;
+
+    /* the changes are in the new snapshot; replaying them is harmless */
+    if ( sl->map )
+        munmap( (void*)sl->map, sl->map_len );
+    sl->map     = map;
+    sl->map_len = map_len;
+    sl->map_ino = map_ino;
+
+    snprintf( file, FILENAME_MAX-1, "%s/%s", sl->dir, DELTA_FILE );
+    (void)unlink( file );
+    if ( sl->delta_fd >= 0 )
+        close( sl->delta_fd );
+    sl->delta_fd  = -1;
+    sl->delta_len = 0;
+
+    LOG( cfgs_log(CFGST_LL_INFO, "layer_merge: layer '%s', %d changes, %u values\n",
+            sl->name, sl->nb_changes, n); );
+    delta_clear( sl );
+    return sl->delta != NULL;
+}
+
+
+bool
+snap_merge( snap_layer *sl )
+{
+    bool ok = false;
+
+    pthread_rwlock_wrlock( &sl->rwlock );
+    if ( layer_lock(sl) ) {
+        ok = layer_merge( sl );
+        layer_unlock( sl );
+    }
+    pthread_rwlock_unlock( &sl->rwlock );
+
+    return ok;
+}
+
+
+/*
+ * Import of cfgs_fs_bk's tree.  nftw has no user data: done under
+ * m_layers_mutex.
+ */
+static snap_layer *m_importing   = NULL;
+static size_t     m_import_root = 0;
+
+static int
+import_value( const char *file, const struct stat *st, int flag, struct FTW *ftw )
+{
+    char       name[ FILENAME_MAX ];
+    size_t     len;
+    cfgs_tag   *tag;
+    cfgs_entry *vals;
+    int        f;
+
+    if ( flag != FTW_F || 0 != strcmp(file + ftw->base, FS_VALS_FILE) )
+        return 0;
+    /* the value's name is the file's folder, under the tree's root */
+    if ( ftw->base <= m_import_root + 1 )
+        return 0;
+    len = ftw->base - 1 - m_import_root;
+    memcpy( name, file + m_import_root, len );
+    name[ len ] = '\0';
+
+    f = open( file, O_RDONLY );
+    if ( f < 0 )
+        return 0;
+    tag  = cfgs_tags_read( f );
+    close( f );
+    vals = tag ? cfgs_entries_from_tags( tag ) : NULL;
+    CFGST_DLIST_FREE( tag, cfgs_tag_free );
+
+    if ( vals && !delta_put(m_importing, name, vals) ) {
+        CFGST_DLIST_FREE( vals, cfgs_entry_free );
+        return -1;
+    }
+    return 0;
+}
+
+
+static bool
+import_fs_bk( snap_layer *sl )
+{
+    char root[ FILENAME_MAX ];
+    int  ret;
+
+    snprintf( root, FILENAME_MAX-1, "%s/%s/%s/values",
+              CFGS_VALUES_ROOT_DIR, sl->name, FS_BK_NAME );
+    m_importing   = sl;
+    m_import_root = strlen( root );
+    ret = nftw( root, import_value, 16, FTW_PHYS );
+    m_importing   = NULL;
+    if ( ret != 0 && errno != ENOENT ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "import_fs_bk: cannot walk '%s'\n", root); );
+        return false;
+    }
+    errno = 0;
+
+    if ( !sl->nb_changes )
+        return true;
+    LOG( cfgs_log(CFGST_LL_INFO, "import_fs_bk: %d values from '%s'\n",
+            sl->nb_changes, root); );
+    return snap_merge( sl );
+}
+
+
+/*
+ * Layers
+ */
+static void
+layer_free( snap_layer *sl )
+{
+    if ( sl->map )
+        munmap( (void*)sl->map, sl->map_len );
+    if ( sl->gen )
+        munmap( (void*)sl->gen, sizeof(uint32_t) );
+    if ( sl->delta_fd >= 0 )
+        close( sl->delta_fd );
+    if ( sl->lock_fd >= 0 )
+        close( sl->lock_fd );
+    CFGST_DLIST_FREE( sl->changes, change_free );
+    if ( sl->delta )
+        cfgs_hash_free( sl->delta, NULL );
+    if ( sl->name )
+        xfree( sl->name );
+    pthread_rwlock_destroy( &sl->rwlock );
+    xfree( sl );
+}
+
+
+static snap_layer *
+layer_load( const char *layer )
+{
+    snap_layer *sl = XCALLOC( snap_layer, 1 );
+    bool       locked, ok;
+
+    if ( !sl )
+        return NULL;
+    sl->delta_fd = -1;
+    sl->lock_fd  = -1;
+    pthread_rwlock_init( &sl->rwlock, NULL );
+    sl->name     = xstrdup( layer );
+    sl->delta    = cfgs_hash_new( 0 );
+    if ( !sl->name || !sl->delta ) {
+        layer_free( sl );
+        return NULL;
+    }
+    snprintf( sl->dir, FILENAME_MAX-1, "%s/%s/%s/values",
+              CFGS_VALUES_ROOT_DIR, layer, SNAP_BK_NAME );
+
+    /* read only store: loaded as is, checked with stat */
+    locked = layer_open( sl );
+    while ( locked && flock(sl->lock_fd, LOCK_EX) != 0 ) 
+        locked = errno == EINTR;
+    errno = 0;
+    ok = snap_map( sl, &sl->map, &sl->map_len, &sl->map_ino )
+      && delta_replay( sl, locked );
+    if ( locked && sl->gen )
+        sl->gen_seen = *sl->gen;
+    if ( locked )
+        (void)flock( sl->lock_fd, LOCK_UN );
+
+    if ( !ok || (!sl->map && !sl->nb_changes && !import_fs_bk(sl)) ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "layer_load: cannot load layer '%s'\n", layer); );
+        layer_free( sl );
+        return NULL;
+    }
+
+    LOG( cfgs_log(CFGST_LL_INFO, "layer_load: layer '%s', %u values, %d changes\n",
+            layer, SNAP_NB(sl), sl->nb_changes); );
+    return sl;
+}
+
+
+snap_layer *
+snap_layer_get( const char *layer )
+{
+    snap_layer *sl;
+
+    lassert( layer );
+
+    pthread_mutex_lock( &m_layers_mutex );
+    for ( sl=m_layers; sl; sl=sl->next ) {
+        if ( 0 == strcmp(sl->name, layer) )
+            break;
+    }
+    if ( !sl ) {
+        sl = layer_load( layer );
+        if ( sl )
+            m_layers = (snap_layer*)cfgs_dlist_add_tail( (cfgs_dlist*)m_layers,
+                                                         (cfgs_dlist*)sl );
+    }
+    pthread_mutex_unlock( &m_layers_mutex );
+
+    return sl;
+}
+
+
+/* the first layer having CGFS_SNAP_DELTA_MAX changes logged, or NULL */
+static snap_layer *
+merge_due( void )
+{
+    snap_layer *sl;
+
+    pthread_mutex_lock( &m_layers_mutex );
+    for ( sl=m_layers; sl; sl=sl->next ) {
+        bool due;
+
+        pthread_rwlock_rdlock( &sl->rwlock );
+        due = sl->nb_records >= CGFS_SNAP_DELTA_MAX;
+        pthread_rwlock_unlock( &sl->rwlock );
+        if ( due )
+            break;
+    }
+    pthread_mutex_unlock( &m_layers_mutex );
+
+    return sl;
+}
+
+
+/*
+ * Merges the layers snap_log asks for, and every CGFS_SNAP_MERGE_SECS the
+ * ones other processes' changes, replayed, made due.  Layers live until
+ * snap_layers_free, which stops it first.
+ */
+static void *
+merger( void *arg )
+{
+    pthread_mutex_lock( &m_merge_mutex );
+    while ( m_merging ) {
+        snap_layer *sl;
+
+        if ( !m_merge_asked ) {
+            struct timespec ts;
+
+            clock_gettime( CLOCK_REALTIME, &ts );
+            ts.tv_sec += CGFS_SNAP_MERGE_SECS;
+            (void)pthread_cond_timedwait( &m_merge_wake, &m_merge_mutex, &ts );
+            if ( !m_merging )
+                break;
+        }
+        m_merge_asked = false;
+        pthread_mutex_unlock( &m_merge_mutex );
+
+        /* a layer failing is tried again next time */
+        while ( (sl = merge_due()) && snap_merge(sl) )
+            ;
+
+        pthread_mutex_lock( &m_merge_mutex );
+    }
+    pthread_mutex_unlock( &m_merge_mutex );
+
+    return NULL;
+}
+
+
+bool
+snap_init( void )
+{
+    pthread_mutex_lock( &m_merge_mutex );
+    m_merging = 0 == pthread_create( &m_merger, NULL, merger, NULL );
+    pthread_mutex_unlock( &m_merge_mutex );
+    if ( !m_merging ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "snap_init: cannot start the merger\n"); );
+        return false;
+    }
+
+    return true;
+}
+
+
+void
+snap_layers_free( void )
+{
+    snap_layer *sl;
+
+    pthread_mutex_lock( &m_merge_mutex );
+    if ( m_merging ) {
+        m_merging = false;
+        pthread_cond_signal( &m_merge_wake );
+        pthread_mutex_unlock( &m_merge_mutex );
+        pthread_join( m_merger, NULL );
+    } else
+        pthread_mutex_unlock( &m_merge_mutex );
+
+    pthread_mutex_lock( &m_layers_mutex );
+    while ( m_layers ) {
+        sl       = m_layers;
+        m_layers = sl->next;
+        /* next start maps it as is */
+        (void)snap_merge( sl );
+        layer_free( sl );
+    }
+    pthread_mutex_unlock( &m_layers_mutex );
+}
+
+
+/*
+ * Access
+ */
+cfgs_entry *
+snap_get( snap_layer *sl, const char *name )
+{
+    snap_change *c;
+    cfgs_entry  *vals = NULL;
+    int         i;
+
+    layer_rdlock( sl );
+    c = (snap_change*)cfgs_hash_find( sl->delta, name );
+    if ( c ) {
+        if ( c->vals )
+            vals = cfgs_entries_dup( c->vals );
+    } else if ( (i = snap_find(sl, name)) >= 0 ) {
+        vals = snap_vals_at( sl, i );
+    }
+    pthread_rwlock_unlock( &sl->rwlock );
+
+    return vals;
+}
+
+
+static int
+add_vals( cfgs_entry **vlist, cfgs_entry *vals )
+{
+    if ( !vals )
+        return 0;
+    *vlist = (cfgs_entry*)cfgs_dlist_cat( (cfgs_dlist*)*vlist, (cfgs_dlist*)vals );
+    return cfgs_dlist_length( (cfgs_dlist*)vals );
+}
+
+
+int
+snap_glob( snap_layer *sl, const char *pattern, cfgs_entry **vlist )
+{
+    size_t      plen = strcspn( pattern, "*?[\\" );
+    uint32_t    i;
+    snap_change *c;
+    int         num = 0;
+
+    layer_rdlock( sl );
+    /* sorted: the names starting with the pattern's literal part */
+    for ( i=snap_lower_bound(sl, pattern, plen); i<SNAP_NB(sl); i++ ) {
+        const char *name = snap_name_at( sl, i );
+
+        if ( 0 != strncmp(name, pattern, plen) )
+            break;
+        if ( 0 == fnmatch(pattern, name, 0) && !cfgs_hash_find(sl->delta, name) )
+            num += add_vals( vlist, snap_vals_at(sl, i) );
+    }
+
+    for ( c=sl->changes; c; c=c->next ) {
+        if ( c->vals && 0 == fnmatch(pattern, c->name, 0) )
+            num += add_vals( vlist, cfgs_entries_dup(c->vals) );
+    }
+    pthread_rwlock_unlock( &sl->rwlock );
+
+    return num;
+}
+
+
+static void
+add_subname( cfgs_str **subs, cfgs_hash *seen, const char *rest )
+{
+    char     seg[ FILENAME_MAX ];
+    size_t   len = strcspn( rest, "/" );
+    cfgs_str *s;
+
+    if ( !len || len >= sizeof(seg) )
+        return;
+    memcpy( seg, rest, len );
+    seg[ len ] = '\0';
+    if ( cfgs_hash_find(seen, seg) )
+        return;
+
+    s = cfgs_str_new( seg );
+    if ( !s )
+        return;
+    if ( cfgs_hash_insert(seen, s->name, s, 0) == CFGST_HASH_INVALID_IDX ) {
+        cfgs_str_free( s );
+        return;
+    }
+    *subs = (cfgs_str*)cfgs_dlist_add_tail( (cfgs_dlist*)*subs, (cfgs_dlist*)s );
+}
+
+
+cfgs_str *
+snap_subnames( snap_layer *sl, const char *name )
+{
+    char        prefix[ FILENAME_MAX ];
+    size_t      plen;
+    uint32_t    i;
+    snap_change *c;
+    cfgs_hash   *seen;
+    cfgs_str    *subs = NULL;
+
+    plen = strlen( name );
+    if ( plen + 2 > sizeof(prefix) )
+        return NULL;
+    memcpy( prefix, name, plen + 1 );
+    if ( !plen || prefix[plen-1] != '/' ) {
+        prefix[ plen++ ] = '/';
+        prefix[ plen ]   = '\0';
+    }
+
+    seen = cfgs_hash_new( 0 );
+    if ( !seen )
+        return NULL;
+
+    layer_rdlock( sl );
+    for ( i=snap_lower_bound(sl, prefix, plen); i<SNAP_NB(sl); i++ ) {
+        const char *n = snap_name_at( sl, i );
+
+        if ( 0 != strncmp(n, prefix, plen) )
+            break;
+        c = (snap_change*)cfgs_hash_find( sl->delta, n );
+        if ( !c || c->vals )
+            add_subname( &subs, seen, n + plen );
+    }
+    for ( c=sl->changes; c; c=c->next ) {
+        if ( c->vals && 0 == strncmp(c->name, prefix, plen) )
+            add_subname( &subs, seen, c->name + plen );
+    }
+    pthread_rwlock_unlock( &sl->rwlock );
+
+    cfgs_hash_free( seen, NULL );
+    return subs;
+}
+
+
+int
+snap_log( snap_layer *sl, const char *name, cfgs_entry *val )
+{
+    cfgs_entry  *copy = NULL;
+    snap_change *c;
+    bool        due = false;
+    int         ret = -1;
+
+    if ( val ) {
+        copy = cfgs_entry_dup( val );
+        if ( !copy )
+            return -1;
+    }
+
+    pthread_rwlock_wrlock( &sl->rwlock );
+    if ( !layer_lock(sl) )
+        goto out;
+
+    c = (snap_change*)cfgs_hash_find( sl->delta, name );
+    /* nothing to remove */
+    if ( !val && (c ? !c->vals : snap_find(sl, name) < 0) ) {
+        ret = 0;
+    } else {
+        layer_changed( sl );
+        if ( delta_append(sl, name, copy) && delta_put(sl, name, copy) ) {
+            copy = NULL;
+            ret  = 1;
+            sl->nb_records++;
+            due = sl->nb_records >= CGFS_SNAP_DELTA_MAX;
+        }
+    }
+    layer_unlock( sl );
+
+out:
+    pthread_rwlock_unlock( &sl->rwlock );
+    if ( copy )
+        CFGST_DLIST_FREE( copy, cfgs_entry_free );
+
+    /* not on the caller's time: without a merger, at snap_layers_free */
+    if ( due ) {
+        pthread_mutex_lock( &m_merge_mutex );
+        m_merge_asked = true;
+        pthread_cond_signal( &m_merge_wake );
+        pthread_mutex_unlock( &m_merge_mutex );
+    }
+    return ret;
+}
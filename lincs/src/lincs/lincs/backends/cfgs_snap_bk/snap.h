@@ -0,0 +1,121 @@
+/*
+ *  $Revision: 1.1 $
+ *  $Date: 2004/04/14 20:12:05 $
+ *
+ *  Layer snapshots: all the values of a layer in one mapped file.
+ */
+/*
+#
+# Copyright (c) 2003 Aurelian Melinte.
+# This file is part of LinCS/tiger.
+#
+# LinCS/tiger is distributed under the terms of the GNU Lesser General Public
+# License version 2 or any later version.  See the file COPYING.LIB for copying
+# permission or http://www.gnu.org.
+#
+# THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED OR
+# IMPLIED, without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  ANY USE IS AT YOUR OWN RISK.
+#
+# Permission to modify the code and to distribute modified code is granted,
+# provided the above notices are retained, and a notice that the code was
+# modified is included with the above copyright notice.
+#
+ */
+
+#ifndef SNAP_H
+#define SNAP_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "cfgs/cfgs_config.h"
+#include "cfgs_client_api.h"
+#include "cfgs_str.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+
+/*
+ * Under CFGS_VALUES_ROOT_DIR/<layer>/cfgs_snap_bk/values:
+ *   SNAP_FILE   the values, sorted by name, hash indexed; never modified,
+ *               replaced as a whole by a merge
+ *   DELTA_FILE  sets and removes since, appended to
+ *   LOCK_FILE   locked by the process changing the layer
+ */
+#define SNAP_FILE   "SNAPSHOT"
+#define DELTA_FILE  "DELTA"
+#define LOCK_FILE   "LOCK"
+
+#define SNAP_MAGIC  "CFGSSNP1"
+
+/* access rights  */
+#define SNAP_DIR_PERM   (0750)
+#define SNAP_FILE_PERM  (0640)
+
+/*
+ * SNAP_FILE layout, host byte order:
+ *   snap_hdr
+ *   snap_name[ nb_names ], sorted by name
+ *   uint32_t[ nb_buckets ], name index + 1 or 0 for a free bucket
+ *   names and values, see vals_encode() in snap.c
+ */
+typedef struct _snap_hdr {
+    char     magic[ 8 ];
+    uint32_t nb_names;
+    uint32_t nb_buckets;   /* a power of 2 */
+    uint32_t names_off;
+    uint32_t buckets_off;
+    uint32_t size;         /* of the file */
+    uint32_t pad;
+} snap_hdr;
+
+typedef struct _snap_name {
+    uint32_t hash;
+    uint32_t name_off;     /* NUL terminated */
+    uint32_t vals_off;
+    uint32_t vals_len;
+} snap_name;
+
+
+typedef struct _snap_layer snap_layer;
+
+/**
+ *  The snapshot of @param layer, mapped on first use.  A layer that has
+ *  no snapshot yet is imported from the cfgs_fs_bk tree, if any.
+ *  Lives until snap_layers_free.
+ */
+snap_layer *snap_layer_get( const char *layer );
+/** Start merging the layers in the background */
+bool        snap_init( void );
+/** Stop the merges, merge and unmap all layers */
+void        snap_layers_free( void );
+
+/** @return a copy of the values named @param name */
+cfgs_entry  *snap_get( snap_layer *sl, const char *name );
+/** Add copies of the values whose name match @param pattern to vlist.
+    @return their number */
+int         snap_glob( snap_layer *sl, const char *pattern, cfgs_entry **vlist );
+/** @return the next segment of the names under @param name */
+cfgs_str    *snap_subnames( snap_layer *sl, const char *name );
+
+/**
+ *  Log a set of @param name to a copy of @param val or, if NULL, its
+ *  removal.  The snapshot is merged, in the background, every
+ *  CGFS_SNAP_DELTA_MAX changes.
+ *  @return 1, 0 if there was nothing to remove or -1 on error.
+ */
+int         snap_log( snap_layer *sl, const char *name, cfgs_entry *val );
+/** Write a new snapshot with all changes logged and map it */
+bool        snap_merge( snap_layer *sl );
+
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*SNAP_H*/
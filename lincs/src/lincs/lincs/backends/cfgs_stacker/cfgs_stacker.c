@@ -28,9 +28,12 @@
 #include "cfgs/cfgs_config.h"
 
 #include <unistd.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <string.h>
+#include <pthread.h>
 
 
 #include "cfgs_backend.h"
@@ -52,7 +55,7 @@ const char g_progname[] = CFGS_BACKEND_NAME;
 #define on_unload                 cfgs_stacker ## _LTX_on_unload
 #define on_load                   cfgs_stacker ## _LTX_on_load
 
-#if CFGS_CRT_REV != 4
+#if CFGS_CRT_REV != 6
 #  error please update defines to CFGS_CRT_REV if needed
 #endif
 #define cfgs_getval                 cfgs_stacker ## _LTX_cfgs_getval
@@ -61,37 +64,150 @@ const char g_progname[] = CFGS_BACKEND_NAME;
 #define cfgs_getsubvals             cfgs_stacker ## _LTX_cfgs_getsubvals
 #define cfgs_getsublayers           cfgs_stacker ## _LTX_cfgs_getsublayers
 #define cfgs_getinfos               cfgs_stacker ## _LTX_cfgs_getinfos
+#define cfgs_getvals                cfgs_stacker ## _LTX_cfgs_getvals
 
 
 
-/* backends managed by the stacker backend */
+/* backends managed by the stacker backend, unless CFGS_ENV_STACKER_BACKENDS */
 static const char *m_modules[] = {
-    "cfgs_fs_bk",
+    CFGS_STORE_BACKEND,
     NULL
 };
+/* backends CFGS_ENV_STACKER_BACKENDS can name */
+#define STACK_MAX  (8)
 
 static cfgs_backend *m_backends = NULL;
+/* which backend holds a name */
+static cfgsb_routes *m_routes   = NULL;
 
 
+static cfgs_backend *load_stack( void );
+static cfgs_entry *get_one( cfgs_session *sess, const char *name, const char *layer );
+static cfgs_backend *route_of( cfgs_entry *e );
+static int set_routed( cfgs_session *sess, cfgs_entry *vl, cfgs_backend *routed );
+
+
+/*
+ * Fan-out: with several backends, a query not routed goes to all of them 
+ * at once on a small pool; the first backend, in their order, having an 
+ * answer wins.  Backends cannot be interrupted: the queries of a fan-out 
+ * not started yet when it is won are dropped, the others run to their end 
+ * and their answers are thrown away.  Each query runs in a session of its 
+ * own, the caller's credentials in it: the caller gets the first error of 
+ * the backends a walk would have asked.  With a single backend there is 
+ * no pool and no fan-out: it is called in the caller's session.  
+ */
+typedef enum {
+    FO_GETVAL = 0,
+    FO_GETSUBVALS,
+    FO_GETINFOS,
+} FO_CALL;
+
+typedef struct _fanout fanout;
+struct _fanout {
+    FO_CALL      call;
+    struct ucred creds;     /* the caller's: queries may outlive the request */
+    char         *name;
+    char         *layer;
+    int          nb;        /* backends */
+    int          refs;      /* the caller and the queries */
+    bool         won;       /* the caller has its answer */
+    void         **answers; /* in backends order */
+    cfgs_err     *errs;     /* idem */
+    bool         *done;
+};
+
+typedef struct _fo_query fo_query;
+struct _fo_query {
+    fo_query     *next;
+    fo_query     *prev;
+    fanout       *fo;
+    cfgs_backend *bk;
+    int          idx;
+};
+
+static pthread_mutex_t  m_fo_mutex      = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   m_fo_queued     = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t   m_fo_answered   = PTHREAD_COND_INITIALIZER;
+static fo_query         *m_fo_queries   = NULL;
+static pthread_t        *m_fo_threads   = NULL;
+static int              m_fo_nb_threads = 0;
+static bool             m_fo_stop       = false;
+static pid_t            m_fo_pid        = 0;   /* no pool in a forked child */
+/* queries still running after their fan-out was won against set and rm */
+static pthread_rwlock_t m_fo_rwlock     = PTHREAD_RWLOCK_INITIALIZER;
+
+
+static bool fan_out( FO_CALL call, cfgs_session *sess, const char *name, const char *layer, 
+                     bool all, void **answer, cfgs_backend **from );
+static void fo_start( void );
+static void fo_stop( void );
+
 
 cfgs_entry*
 cfgs_getval( cfgs_session *sess, const char *name, const char *layer )
 {
 #undef cfgs_getval /* pesky macros, need to work with other backends */
+    lassert( m_backends != NULL );
+    
+    if ( !sess || !name || !m_backends )
+        return NULL;
+
+    return get_one( sess, name, layer );
+}
+
+
+/* 
+ * The first backend holding name when it was learned, else the first having
+ * it.  The earlier ones had none and do not get it through us; gone from 
+ * it, the name is looked for again.  
+ */
+static cfgs_entry*
+get_one( cfgs_session *sess, const char *name, const char *layer )
+{
     cfgs_entry   *pv = NULL;
-    cfgs_backend *bk = m_backends;
+    cfgs_backend *bk = cfgsb_route( m_routes, name, layer );
+
+    if ( bk ) {
+        pv = (*bk->cfgs_getval)( sess, name, layer );
+        if ( pv || !m_backends->next )
+            return pv;
+        cfgsb_route_forget( m_routes, name, layer );
+    }
+
+    if ( fan_out(FO_GETVAL, sess, name, layer, false, (void**)&pv, &bk) ) {
+        if ( pv )
+            cfgsb_route_learn( m_routes, name, layer, bk );
+        return pv;
+    }
+
+    for ( bk=m_backends; bk && !pv; bk=bk->next ) {
+        pv = (*bk->cfgs_getval)( sess, name, layer );
+        if ( pv )
+            cfgsb_route_learn( m_routes, name, layer, bk );
+    }
+    
+    return pv;
+}
+
+
+cfgs_entry*
+cfgs_getvals( cfgs_session *sess, const char **names, int n, const char *layer )
+{
+#undef cfgs_getvals
+    cfgs_entry   *pv = NULL;
+    int          i;
 
     lassert( m_backends != NULL );
     
-    if ( !sess || !name || !bk )
+    if ( !sess || !names || !m_backends )
         return NULL;
 
-    /*
-     * FIXME: look in cache to find backend to poll for name, else poll all backends, then cache it
-     */
-    while ( bk && !pv ) {
-        pv = (*bk->cfgs_getval)( sess, name, layer );
-        bk = bk->next;
+    /* same as cfgs_getval: first backend having the value wins */
+    for ( i=0; i<n; i++ ) {
+        cfgs_entry *v = get_one( sess, names[i], layer );
+
+        pv = (cfgs_entry*)cfgs_dlist_cat( (cfgs_dlist*)pv, (cfgs_dlist*)v );
     }
     
     return pv;
@@ -102,46 +218,110 @@ int
 cfgs_setval( cfgs_session *sess, cfgs_entry *vl )
 {
 #undef cfgs_setval
-    cfgs_backend *bk   = m_backends;
+    cfgs_backend *routed;
+    cfgs_entry   *e;
+    bool         same = true;
     int          nvals = 0;
 
     lassert( m_backends != NULL );
     
-    if ( !sess || !vl || !bk )
+    if ( !sess || !vl || !m_backends )
         return -1;
 
-    /*
-     * FIXME: look in cache to find backend to poll for name, else poll all backends, then cache it
-     */
-    while ( bk ) {
-        nvals += (*bk->cfgs_setval)( sess, vl );
-        bk = bk->next;
+    /* each entry where its name is routed; all at once if the same */
+    routed = route_of( vl );
+    for ( e=vl->next; e && same; e=e->next ) 
+        same = route_of( e ) == routed;
+
+    pthread_rwlock_wrlock( &m_fo_rwlock );
+    if ( same ) {
+        nvals = set_routed( sess, vl, routed );
+    } else {
+        for ( e=vl; e; e=e->next ) {
+            cfgs_entry *one = cfgs_entry_dup( e );
+            int        ret  = one ? set_routed( sess, one, route_of(one) ) : -1;
+
+            if ( one )
+                cfgs_entry_free( one );
+            /* the ones set before stay, see cfgs_setval */
+            if ( ret < 0 ) {
+                if ( !nvals )
+                    nvals = -1;
+                break;
+            }
+            nvals += ret;
+        }
     }
+    pthread_rwlock_unlock( &m_fo_rwlock );
     
     return nvals;
 }
 
 
+static cfgs_backend *
+route_of( cfgs_entry *e )
+{
+    const char *name = cfgs_entry_attr( e, CFGS_EA_NAME );
+
+    return name ? cfgsb_route( m_routes, name, cfgs_entry_attr(e, CFGS_EA_LAYER) ) 
+                : NULL;
+}
+
+
+/* Set vl on routed or, if NULL, on all backends, learning where it went */
+static int
+set_routed( cfgs_session *sess, cfgs_entry *vl, cfgs_backend *routed )
+{
+    cfgs_backend *bk;
+    cfgs_entry   *e;
+    int          nvals = 0;
+
+    if ( routed ) 
+        return (*routed->cfgs_setval)( sess, vl );
+
+    for ( bk=m_backends; bk; bk=bk->next ) {
+        int ret = (*bk->cfgs_setval)( sess, vl );
+
+        for ( e=vl; ret > 0 && e; e=e->next ) {
+            const char *name = cfgs_entry_attr( e, CFGS_EA_NAME );
+            const char *layer = cfgs_entry_attr( e, CFGS_EA_LAYER );
+
+            if ( name && !cfgsb_route(m_routes, name, layer) )
+                cfgsb_route_learn( m_routes, name, layer, bk );
+        }
+        nvals += ret;
+    }
+
+    return nvals;
+}
+
+
 int 
 cfgs_rmval( cfgs_session *sess, const char *name, const char *layer )
 {
 #undef cfgs_rmval
     cfgs_backend *bk   = m_backends;
+    bool         failed = false;
     int          nvals = 0;
 
     lassert( m_backends != NULL );
     if ( !sess || !name || !bk ) 
         return -1;
 
-    /*
-     * FIXME: look in cache to find backend to poll for name, else poll all backends, then cache it
-     */
-    while ( bk ) {
-        nvals += (*bk->cfgs_rmval)( sess, name, layer );
-        bk = bk->next;
+    /* from all of them: several may hold the name */
+    pthread_rwlock_wrlock( &m_fo_rwlock );
+    for ( ; bk; bk=bk->next ) {
+        int ret = (*bk->cfgs_rmval)( sess, name, layer );
+
+        if ( ret < 0 )
+            failed = true;
+        else
+            nvals += ret;
     }
+    pthread_rwlock_unlock( &m_fo_rwlock );
+    cfgsb_route_forget( m_routes, name, layer );
     
-    return nvals;
+    return failed && !nvals ? -1 : nvals;
 }
 
 
@@ -154,6 +334,15 @@ cfgs_register_notif( cfgs_session *s, cfgs_notif *notif )
 }
 
 
+int 
+cfgs_unregister_notif( cfgs_session *s, cfgs_notif *notif )
+{
+    /* Not used.  Notifications are the responsability of the server.  */
+    lassert( false );
+    return 0; 
+}
+
+
 bool
 on_load( void )
 {
@@ -170,9 +359,12 @@ on_load( void )
     }
 #endif
         
-    m_backends = cfgsb_load_backends( m_modules );
-    if ( !m_backends ) 
+    m_backends = load_stack();
+    m_routes   = cfgsb_routes_new();
+    if ( !m_backends || !m_routes ) 
         ret = false;
+    else
+        fo_start();
         
     LOG( cfgs_log(CFGST_LL_INFO, "backend '%s' on_load, returning %d \n", g_progname, ret); );
     return ret;
@@ -184,8 +376,11 @@ on_unload( void )
 {
     bool ret;
     
+    fo_stop();
     ret = cfgsb_unload_backends( m_backends ); 
     m_backends = NULL;
+    cfgsb_routes_free( m_routes );
+    m_routes   = NULL;
     
     LOG( cfgs_log(CFGST_LL_INFO, "backend '%s' unloaded, returning %d \n", g_progname, ret); );
     return ret;
@@ -204,6 +399,9 @@ cfgs_getsubvals( cfgs_session *sess, const char *valname, const char *layer )
     if ( !sess || !valname || !layer || !bk )
         return NULL;
 
+    if ( fan_out(FO_GETSUBVALS, sess, valname, layer, false, (void**)&pv, NULL) )
+        return pv;
+    
     while ( bk && !pv ) {
         pv = (*bk->cfgs_getsubvals)( sess, valname, layer );
         bk = bk->next;
@@ -239,6 +437,7 @@ cfgs_getinfos( cfgs_session *sess )
 {
 #undef cfgs_getinfos 
     cfgs_backend *bk = m_backends;
+    cfgs_str     *infos, *s;
     cfgs_str *ret = cfgs_str_new( 
             "" PACKAGE " " VERSION "; "
             ";Backend " CFGS_BACKEND_NAME 
@@ -254,6 +453,13 @@ cfgs_getinfos( cfgs_session *sess )
     if ( !sess || !bk )
         return NULL;
 
+    if ( fan_out(FO_GETINFOS, sess, NULL, NULL, true, (void**)&infos, NULL) ) {
+        for ( s=infos; s; s=s->next )
+            cfgs_str_cat( ret, s->name );
+        CFGST_DLIST_FREE( infos, cfgs_str_free );
+        return ret;
+    }
+
     while ( bk ) {
         cfgs_str *pv = (*bk->cfgs_getinfos)( sess );
         if ( pv ) cfgs_str_cat( ret, pv->name );
@@ -265,3 +471,295 @@ cfgs_getinfos( cfgs_session *sess )
 }
 
 
+/* The backends CFGS_ENV_STACKER_BACKENDS names, in its order, else m_modules */
+static cfgs_backend *
+load_stack( void )
+{
+    const char   *env = getenv( CFGS_ENV_STACKER_BACKENDS );
+    const char   *names[ STACK_MAX+1 ];
+    char         *list, *s, *save;
+    cfgs_backend *bk;
+    int          n = 0;
+
+    if ( !env || !*env )
+        return cfgsb_load_backends( m_modules );
+
+    list = xstrdup( env );
+    if ( !list )
+        return NULL;
+    for ( s=strtok_r(list, ":", &save); s; s=strtok_r(NULL, ":", &save) ) {
+        if ( n == STACK_MAX ) {
+            LOG( cfgs_log(CFGST_LL_CRITIC, "backend '%s': more than %d backends in '%s'\n", 
+                          g_progname, STACK_MAX, env); );
+            break;
+        }
+        names[ n++ ] = s;
+    }
+    names[ n ] = NULL;
+
+    /* one failing to load is not stacked: none is, not to serve from less */
+    bk = cfgsb_load_backends( names );
+    if ( bk && cfgs_dlist_length((cfgs_dlist*)bk) != n ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "backend '%s': cannot stack '%s'\n", 
+                      g_progname, env); );
+        (void)cfgsb_unload_backends( bk );
+        bk = NULL;
+    }
+    xfree( list );
+
+    return bk;
+}
+
+
+/*-------- fan-out: after the API, its macros undefined ---------------*/
+
+static void
+fo_answer_free( FO_CALL call, void *answer )
+{
+    if ( !answer )
+        return;
+    if ( call == FO_GETVAL ) {
+        cfgs_entry *e = (cfgs_entry*)answer;
+        CFGST_DLIST_FREE( e, cfgs_entry_free );
+    } else {
+        cfgs_str *s = (cfgs_str*)answer;
+        CFGST_DLIST_FREE( s, cfgs_str_free );
+    }
+}
+
+
+/* With m_fo_mutex */
+static void
+fo_unref( fanout *fo )
+{
+    int i;
+
+    if ( --fo->refs > 0 )
+        return;
+    for ( i=0; fo->answers && i<fo->nb; i++ )
+        fo_answer_free( fo->call, fo->answers[i] );
+    if ( fo->answers )
+        xfree( fo->answers );
+    if ( fo->errs )
+        xfree( fo->errs );
+    if ( fo->done )
+        xfree( fo->done );
+    if ( fo->name )
+        xfree( fo->name );
+    if ( fo->layer )
+        xfree( fo->layer );
+    xfree( fo );
+}
+
+
+static void *
+fo_call( fanout *fo, cfgs_backend *bk, cfgs_session *sess )
+{
+    switch ( fo->call ) {
+    case FO_GETVAL:
+        return (*bk->cfgs_getval)( sess, fo->name, fo->layer );
+    case FO_GETSUBVALS:
+        return (*bk->cfgs_getsubvals)( sess, fo->name, fo->layer );
+    case FO_GETINFOS:
+        return (*bk->cfgs_getinfos)( sess );
+    }
+    return NULL;
+}
+
+
+static void *
+fo_worker( void *arg )
+{
+    pthread_mutex_lock( &m_fo_mutex );
+    for ( ;; ) {
+        fo_query *q;
+        fanout   *fo;
+        void     *answer = NULL;
+
+        while ( !m_fo_queries && !m_fo_stop )
+            pthread_cond_wait( &m_fo_queued, &m_fo_mutex );
+        q = m_fo_queries;
+        if ( !q )
+            break;
+        m_fo_queries = (fo_query*)cfgs_dlist_rem( (cfgs_dlist*)m_fo_queries, (cfgs_dlist*)q );
+        fo = q->fo;
+
+        if ( !fo->won ) {
+            cfgs_session *sess;
+
+            pthread_mutex_unlock( &m_fo_mutex );
+            sess = cfgs_session_new();
+            if ( sess ) {
+                cfgs_session_set_creds( sess, &fo->creds );
+                pthread_rwlock_rdlock( &m_fo_rwlock );
+                answer = fo_call( fo, q->bk, sess );
+                pthread_rwlock_unlock( &m_fo_rwlock );
+            }
+            pthread_mutex_lock( &m_fo_mutex );
+            if ( sess ) {
+                fo->errs[ q->idx ] = *cfgs_session_geterr( sess );
+                cfgs_session_free( sess );
+            } else {
+                cfgs_seterr( &fo->errs[q->idx], CFGS_ERRT_INTERNAL, CFGS_ERR_INTERNAL, 
+                             "fan-out: no session" );
+            }
+        }
+        if ( fo->won ) {
+            fo_answer_free( fo->call, answer );
+            answer = NULL;
+        }
+        fo->answers[ q->idx ] = answer;
+        fo->done[ q->idx ]    = true;
+        fo_unref( fo );
+        xfree( q );
+        pthread_cond_broadcast( &m_fo_answered );
+    }
+    pthread_mutex_unlock( &m_fo_mutex );
+
+    return NULL;
+}
+
+
+/* Not with less than two backends: fan_out() then walks them */
+static void
+fo_start( void )
+{
+    const char   *env = getenv( CFGS_ENV_STACKER_FANOUT );
+    int          nb   = env ? atoi( env ) : CGFS_STACKER_FANOUT;
+    cfgs_backend *bk;
+    int          nb_backends = 0;
+
+    for ( bk=m_backends; bk; bk=bk->next )
+        nb_backends++;
+    if ( nb <= 0 || nb_backends < 2 )
+        return;
+
+    m_fo_threads = XCALLOC( pthread_t, nb );
+    if ( !m_fo_threads )
+        return;
+    m_fo_stop = false;
+    for ( m_fo_nb_threads=0; m_fo_nb_threads<nb; m_fo_nb_threads++ ) {
+        if ( 0 != pthread_create(&m_fo_threads[m_fo_nb_threads], NULL, fo_worker, NULL) )
+            break;
+    }
+    m_fo_pid = getpid();
+    LOG( cfgs_log(CFGST_LL_INFO, "backend '%s' fans out to %d backends on %d threads \n", 
+                  g_progname, nb_backends, m_fo_nb_threads); );
+}
+
+
+static void
+fo_stop( void )
+{
+    int i;
+
+    if ( !m_fo_threads )
+        return;
+    pthread_mutex_lock( &m_fo_mutex );
+    m_fo_stop = true;
+    pthread_cond_broadcast( &m_fo_queued );
+    pthread_mutex_unlock( &m_fo_mutex );
+
+    if ( m_fo_pid == getpid() ) {
+        for ( i=0; i<m_fo_nb_threads; i++ )
+            pthread_join( m_fo_threads[i], NULL );
+    }
+    xfree( m_fo_threads );
+    m_fo_threads    = NULL;
+    m_fo_nb_threads = 0;
+}
+
+
+/*
+ *  Query all backends at once.  @param answer is set to the answer of the 
+ *  first backend, in their order, having one, and @param from to it; with 
+ *  @param all, to the answers of all of them, in order.  The first error of 
+ *  the backends asked up to the answer is stored into @param sess.  
+ *  @return false if there is no fan-out: query the backends one after the 
+ *  other.  
+ */
+static bool
+fan_out( FO_CALL call, cfgs_session *sess, const char *name, const char *layer, 
+         bool all, void **answer, cfgs_backend **from )
+{
+    fanout       *fo;
+    cfgs_backend *bk;
+    int          i, j;
+
+    *answer = NULL;
+    if ( !m_fo_nb_threads || m_fo_pid != getpid() ) 
+        return false;
+
+    fo = XCALLOC( fanout, 1 );
+    if ( !fo ) 
+        return false;
+    for ( bk=m_backends; bk; bk=bk->next )
+        fo->nb++;
+    fo->call    = call;
+    fo->refs    = 1;
+    fo->creds   = *cfgs_session_get_creds( sess );
+    fo->name    = name ? xstrdup( name ) : NULL;
+    fo->layer   = layer ? xstrdup( layer ) : NULL;
+    fo->answers = XCALLOC( void*, fo->nb );
+    fo->errs    = XCALLOC( cfgs_err, fo->nb );
+    fo->done    = XCALLOC( bool, fo->nb );
+    if (  !fo->answers || !fo->errs || !fo->done 
+       || (name && !fo->name) || (layer && !fo->layer) ) {
+        pthread_mutex_lock( &m_fo_mutex );
+        fo_unref( fo );
+        pthread_mutex_unlock( &m_fo_mutex );
+        return false;
+    }
+
+    pthread_mutex_lock( &m_fo_mutex );
+    for ( bk=m_backends, i=0; bk; bk=bk->next, i++ ) {
+        fo_query *q = XCALLOC( fo_query, 1 );
+
+        if ( !q ) {
+            /* no answer from this one */
+            fo->done[ i ] = true;
+            continue;
+        }
+        q->fo  = fo;
+        q->bk  = bk;
+        q->idx = i;
+        fo->refs++;
+        m_fo_queries = (fo_query*)cfgs_dlist_add_tail( (cfgs_dlist*)m_fo_queries, (cfgs_dlist*)q );
+    }
+    pthread_cond_broadcast( &m_fo_queued );
+
+    for ( ;; ) {
+        for ( i=0; i<fo->nb && fo->done[i]; i++ ) {
+            if ( !all && fo->answers[i] )
+                break;
+        }
+        if ( i == fo->nb || fo->done[i] )
+            break;
+        pthread_cond_wait( &m_fo_answered, &m_fo_mutex );
+    }
+
+    /* as the walk would have left it: the first error stored wins */
+    for ( j=0; j<fo->nb && j<=i; j++ ) {
+        if ( cfgs_iserr(&fo->errs[j]) && !cfgs_iserr(cfgs_session_geterr(sess)) ) 
+            *cfgs_session_geterr( sess ) = fo->errs[ j ];
+    }
+
+    if ( all ) {
+        for ( i=0; i<fo->nb; i++ ) {
+            *answer = cfgs_dlist_cat( (cfgs_dlist*)*answer, (cfgs_dlist*)fo->answers[i] );
+            fo->answers[ i ] = NULL;
+        }
+    } else if ( i < fo->nb ) {
+        *answer = fo->answers[ i ];
+        fo->answers[ i ] = NULL;
+        for ( bk=m_backends; bk && i; bk=bk->next, i-- )
+            ;
+        if ( from )
+            *from = bk;
+    }
+    fo->won = true;
+    fo_unref( fo );
+    pthread_mutex_unlock( &m_fo_mutex );
+
+    return true;
+}
@@ -83,12 +83,75 @@ typedef enum {false, true} bool;
 /* FIXME: make those flexible. CGFS_MAX_BODY_LEN belongs to cfgs_protocol.h ? */ 
 /** \def  CGFS_MAX_HDR_LEN http max accepted header length */
 #define CGFS_MAX_HDR_LEN       (4098-1)
-/** \def  CGFS_MAX_BODY_LEN max accepted xml body length */ 
-#define CGFS_MAX_BODY_LEN      (4098-1)
+/** \def  CGFS_MAX_BODY_LEN max accepted message body length; batched 
+    requests and their answers must fit */ 
+#define CGFS_MAX_BODY_LEN      (256*1024-1)
 /** \def CGFS_SOCK_TOUT Timeout(seconds) */
 #define CGFS_SOCK_TOUT         (5) 
 /** \def CGFS_MAX_CONNEXIONS Max. number of simultaneous connexions */
 #define CGFS_MAX_CONNEXIONS    (1000)
+/** \def CGFS_WORKER_THREADS Daemon worker pool size, 0 for one per online CPU */
+#define CGFS_WORKER_THREADS    (0)
+/** \def CGFS_PIPELINE_DEPTH Max. requests a client submits before it must 
+    collect answers.  Keep requests+answers within the socket buffers. */
+#define CGFS_PIPELINE_DEPTH    (64)
+/** \def CGFS_CACHE_SIZE Max. names a backend cache keeps, hits and misses */
+#define CGFS_CACHE_SIZE        (4096)
+/** Backend cache size - environment variable, overrides CGFS_CACHE_SIZE; 
+    0 turns caching off */
+#define CFGS_ENV_CACHE_SIZE    "CFGS_CACHE_SIZE"
+/** \def CGFS_ARENA_CHUNK Bytes a daemon thread sets aside for the objects 
+    of the request it works on; bigger requests take more chunks */
+#define CGFS_ARENA_CHUNK       (16*1024)
+/** \def CGFS_INTERN_NAMES Share the known tag types and attribute names 
+    (see cfgs_tags.h) between tags instead of copying them; 0 to copy */
+#define CGFS_INTERN_NAMES      (1)
+/** \def CGFS_NOTIF_BACKLOG Bytes of changes the daemon keeps for a 
+    subscriber not reading them; past it, changes are dropped */
+#define CGFS_NOTIF_BACKLOG     (1024*1024)
+/** \def CGFS_SNAP_DELTA_MAX Changes cfgs_snap_bk logs for a layer before 
+    merging them into a new snapshot */
+#define CGFS_SNAP_DELTA_MAX    (1024)
+/** \def CGFS_SNAP_MERGE_SECS How often cfgs_snap_bk looks for layers to 
+    merge that other processes' changes made due */
+#define CGFS_SNAP_MERGE_SECS   (5)
+/** \def CGFS_DIR_CACHE_SIZE Max. directories cfgs_fs_bk keeps open to 
+    search values from; mind the daemon's connections in RLIMIT_NOFILE */
+#define CGFS_DIR_CACHE_SIZE    (128)
+/** \def CGFS_FS_DURABILITY When cfgs_fs_bk has a change on disk: "sync", 
+    before acknowledging it; "async", within CGFS_WAL_SYNC_MS; "none", 
+    when the system sees fit */
+#define CGFS_FS_DURABILITY     "sync"
+/** cfgs_fs_bk durability - environment variable, overrides CGFS_FS_DURABILITY */
+#define CFGS_ENV_FS_DURABILITY "CFGS_FS_DURABILITY"
+/** \def CGFS_WAL_SYNC_MS How often cfgs_fs_bk syncs its log when "async" */
+#define CGFS_WAL_SYNC_MS       (100)
+/** \def CGFS_WAL_COMPACT_SECS Max. age of the changes cfgs_fs_bk logs 
+    before folding them into its tree */
+#define CGFS_WAL_COMPACT_SECS  (5)
+/** \def CGFS_WAL_MAX Changes cfgs_fs_bk logs before folding them sooner */
+#define CGFS_WAL_MAX           (4096)
+/** \def CGFS_ROUTES_MAX Names the daemon and cfgs_stacker remember 
+    the backend of, each */
+#define CGFS_ROUTES_MAX        (4096)
+/** \def CGFS_STACKER_FANOUT Threads cfgs_stacker queries its backends 
+    with, all at once, when it has several; 0: one after the other */
+#define CGFS_STACKER_FANOUT    (4)
+/** \def CGFS_CLIENT_POOL Daemon connections a client process keeps open 
+    for its next sessions once theirs disconnect */
+#define CGFS_CLIENT_POOL       (8)
+/** Daemon worker pool size - environment variable, overrides CGFS_WORKER_THREADS */
+#define CFGS_ENV_WORKERS       "CFGS_WORKERS"
+/** cfgs_stacker fan-out threads - environment variable, overrides CGFS_STACKER_FANOUT */
+#define CFGS_ENV_STACKER_FANOUT "CFGS_STACKER_FANOUT"
+/** cfgs_stacker backends - environment variable, overrides CFGS_STORE_BACKEND: 
+    ':' separated, the first ones first, e.g. "cfgs_fs_bk:cfgs_snap_bk" */
+#define CFGS_ENV_STACKER_BACKENDS "CFGS_STACKER_BACKENDS"
+/** Client connection pool size - environment variable, overrides CGFS_CLIENT_POOL */
+#define CFGS_ENV_CLIENT_POOL   "CFGS_CLIENT_POOL"
+/** Client: set to "http" to keep talking xml/http to the daemon instead of 
+    switching connections to binary frames */
+#define CFGS_ENV_HOST_PROTO    "CFGS_HOST_PROTO"
 
 
 
@@ -96,10 +159,30 @@ typedef enum {false, true} bool;
 #define CFGS_STACKER_BACKEND    "cfgs_stacker"
 /* not sure at bootstrap time we should not load directly cfgs_fs_bk */
 #define CFGS_BOOTSTRAP_BACKEND  CFGS_STACKER_BACKEND /*"cfgs_fs_bk"*/
+/** \def CFGS_STORE_BACKEND Backend the stacker keeps entries with: 
+    "cfgs_fs_bk", a file per value, or "cfgs_snap_bk", a mapped snapshot 
+    per layer */
+#ifndef CFGS_STORE_BACKEND
+#  define CFGS_STORE_BACKEND    "cfgs_fs_bk"
+#endif
 
 /** Default layer if none is specified */
 #define CFGS_DEFAULT_LAYER       "default"
 
+/**
+ *  \def CFGS_REGENERATED_FILES The /etc files cfgs_cat rebuilds, the 
+ *  pattern of the values each is built from and cfgs_cat's function.  
+ *  lib_cfgs_emul runs cfgs_cat for these only, and again only once their 
+ *  values changed.  
+ */
+#ifdef X
+#  error X already defined !
+#endif
+/*     file           values            cfgs_cat function */
+#define CFGS_REGENERATED_FILES \
+    X( "/etc/dummy",  "/etc/dummy/*",   regenerate_dummy ) \
+    /**/
+
 
 
 #ifdef __cplusplus
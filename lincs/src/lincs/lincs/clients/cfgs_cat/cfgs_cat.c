@@ -51,11 +51,17 @@ typedef struct _regenerated_file {
 } regenerated_file;
 
 
-static cfgs_buf* regenerate_dummy( const char *filename );
+#define X( file, values, func )  static cfgs_buf* func( const char *filename );
+CFGS_REGENERATED_FILES
+#undef X
+
+/* see CFGS_REGENERATED_FILES */
+#define X( file, values, func )  { file, func },
 const regenerated_file g_regenerated_files[] = {
-    { "/etc/dummy",            regenerate_dummy },
+    CFGS_REGENERATED_FILES
     { NULL, NULL },
 };
+#undef X
 
 
 
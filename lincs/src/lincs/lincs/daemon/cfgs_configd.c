@@ -34,21 +34,25 @@
 #include <syslog.h>
 #include <fcntl.h>
 #include <fnmatch.h>
+#include <time.h>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <arpa/inet.h> 
 #include <sys/uio.h>  /*iovec*/
+#include <poll.h>
 
 #include "cfgs_daemon.h"
 #include "cfgs_log.h"
+#include "cfgs_mem.h"
 #include "cfgs_tags.h"
 #include "cfgs_dlist.h"
 #include "cfgs_sock.h"
 #include "cfgs_backend.h"
 #include "cfgs_protocol.h"
 #include "cfgs_mutex.h"
+#include "cfgs_hash.h"
 
 
 #define PROGNAME   "cfgs_configd"
@@ -74,9 +78,11 @@ static const char *m_modules[] = {
     CFGS_BOOTSTRAP_BACKEND,
     NULL
 };
-/* List of backends loaded.  */
-static cfgs_backend    *m_backends  = NULL;
-static pthread_mutex_t m_backends_mutex  = PTHREAD_MUTEX_INITIALIZER;
+/* List of backends loaded.  Read-only requests share the lock and run in 
+   parallel, setval/rmval take it exclusively.  */
+static cfgs_backend     *m_backends  = NULL;
+static cfgsb_routes     *m_routes    = NULL;
+static pthread_rwlock_t m_backends_lock;
 
 /*
  *  Mechanism to control load of the server.  This really should be
@@ -90,10 +96,10 @@ static int             m_connexions = 0;
 /*
  *  Notifications.  
  */
-static cfgs_notif      *m_notif_requests   = NULL;
+typedef struct _notif_node notif_node;
+static notif_node      *m_notif_trie       = NULL;
 static pthread_mutex_t m_notif_list_mutex  = PTHREAD_MUTEX_INITIALIZER;
-static int             m_notif_queue[2]    = {-1, -1};
-static pthread_mutex_t m_notif_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int             m_notif_queue[2]    = {-1, -1};  /* doorbell */
 static pthread_t       m_notif_thr;
 
 
@@ -231,6 +237,25 @@ sighup_handler( int signum )
 }
 
 
+/* Set by sigusr1_handler, see notif_dispatcher */
+static volatile sig_atomic_t m_dump_mutexes = 0;
+
+/* 
+ * Mutexes' contention to the log.  Nothing of that is signal safe: the 
+ * notifications thread is woken up to do it.  
+ */
+static void
+sigusr1_handler( int signum )
+{
+    int old_errno = errno; 
+    
+    m_dump_mutexes = 1;
+    cfgst_rwrite( PIPE_OUT(m_notif_queue), " ", 1 );
+    
+    errno = old_errno;
+}
+
+
 static int stop_notifications_mechanism( void ); 
 
 static void
@@ -273,15 +298,45 @@ sigpipe_handler( int signum )
 
 /*------------------------------------------------------------------*/
 
+/* 
+ * Writers are preferred: with reads ~100x more frequent than writes, a 
+ * reader-preferring lock would starve setval/rmval.  
+ */
 static bool
-lock_backends( void )
+init_backends_lock( void )
 {
-    int ret;
+    pthread_rwlockattr_t attr;
+    int                  ret;
     
-    ret = cfgs_mutex_lock( &m_backends_mutex );
+    pthread_rwlockattr_init( &attr );
+    pthread_rwlockattr_setkind_np( &attr, 
+            PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP );
+    ret = pthread_rwlock_init( &m_backends_lock, &attr );
+    pthread_rwlockattr_destroy( &attr );
+    
+    return ret == 0;
+}
+
+
+/* Same timeout as cfgs_mutex_lock, for the same reasons */
+static bool
+lock_backends( bool exclusive )
+{
+    int             ret;
+    struct timespec ts;
+    
+    clock_gettime( CLOCK_REALTIME, &ts );
+    ts.tv_sec += MUTEX_LOCK_TOUT;
+    
+    if ( exclusive )
+        ret = pthread_rwlock_timedwrlock( &m_backends_lock, &ts );
+    else
+        ret = pthread_rwlock_timedrdlock( &m_backends_lock, &ts );
     lassert( ret == 0 );
-    if ( ret != 0 ) 
+    if ( ret != 0 ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "lock_backends(%d): %d\n", exclusive, ret); );
         return false;
+    }
     
     return true;
 }
@@ -292,7 +347,7 @@ unlock_backends( void )
 {
     int ret;
     
-    ret = cfgs_mutex_unlock( &m_backends_mutex );
+    ret = pthread_rwlock_unlock( &m_backends_lock );
     lassert( ret == 0 );
     if ( ret != 0 ) 
         return false;
@@ -300,188 +355,748 @@ unlock_backends( void )
     return true; 
 }
 
+
+/* Requests that change values need the backends for themselves */
+static bool
+is_write_rq( CFGS_FUNC_INDEX idx )
+{
+    switch ( idx ) {
+    case CFGS_SETVAL:
+    case CFGS_RMVAL:
+        return true;
+    default:
+        return false;
+    }
+}
+
 /*------------------------------------------------------------------*/
 /*
  * Notifications mechanism.  
  */
 
 /*
- * Read/write into m_notif_queue records with the following format: 
- *     start_rec
- *     total_length of what follows
- *     valname lenght
- *     valname
- *     layer length
- *     layer
- *     end_rec
- * This should actually be xml formatted to keep things consistent.  
+ * Changed values, queued by the threads serving setval/rmval for the one 
+ * thread that sends the notifications.  A writer pushes its record with 
+ * a single compare-and-swap on m_changes; the dispatcher takes the whole 
+ * list at once with an atomic exchange, so bulk updates are delivered in 
+ * batches and repeated changes to the same value are only sent once, 
+ * with the last value.  
  *
- * Writer threads communicate with one reader thread through a pipe.  
+ * m_notif_queue is only a doorbell: a writer rings it when it pushes on an 
+ * empty list, i.e. when the dispatcher is (or is about to be) waiting.  
+ * pipe[1] is non-blocking; EAGAIN means the bell rings already.  
  */
-static const char start_rec[] = "<%start%>"; 
-static const char end_rec[]   = "<%end%>"; 
+typedef struct _change_rec change_rec;
+struct _change_rec {
+    change_rec *next;
+    char       *valname;
+    char       *layer;
+    char       *value;    /* NULL if removed */
+    char       *key;      /* valname '\n' layer, see coalesce_changes */
+    bool       skip;      /* superseded by a later change */
+    /* valname, layer, value and key strings follow */
+};
 
+/* Most recent first */
+static change_rec * volatile m_changes = NULL;
 
-/*
- * Note that queuing the valname change notif is unreliable:
- *   -pipe[1] is non-blocking
- *   -write should deal with EAGAIN (EINTR should not occur)
- */
 
-/* FIXME: format the message in one buffer and write at once - atomic */
 static int 
-queue_change_notif( int fd, const char *valname, const char *layer )
+queue_change_notif( const char *valname, const char *layer, const char *value )
 {
-    unsigned short vlen, llen, tlen;
-    int            ret;
+    size_t     vlen, llen, dlen;
+    change_rec *rec, *head;
     
-    lassert( fd && valname && layer );
+    lassert( valname && layer );
     
     vlen = strlen( valname ) + 1;
     llen = strlen( layer ) + 1;
-    tlen = 
-         /*+ strlen(start_rec)+1*/
-         /*+ sizeof(short) /*tlen*/
-         + sizeof(short) /*vlen*/
-         + vlen
-         + sizeof(short) /*llen*/
-         + llen
-         + strlen(end_rec)
-         ;
-    
-    if (  (ret=cfgst_rwrite(PIPE_OUT(m_notif_queue), start_rec, strlen(start_rec))) 
-       != strlen(start_rec) ) {
-        return -1; 
+    dlen = value ? strlen( value ) + 1 : 0;
+    rec  = (change_rec*)xmalloc( sizeof(change_rec) + 2*(vlen + llen) + dlen );
+    if ( !rec ) {
+        return -1;
     }
-    if (  (ret=cfgst_rwrite(PIPE_OUT(m_notif_queue), &tlen, sizeof(short))) != sizeof(short) ) { 
-        return -1; 
+    rec->valname = (char*)(rec + 1);
+    rec->layer   = rec->valname + vlen;
+    rec->value   = value ? rec->layer + llen : NULL;
+    rec->key     = rec->layer + llen + dlen;
+    rec->skip    = false;
+    memcpy( rec->valname, valname, vlen );
+    memcpy( rec->layer,   layer,   llen );
+    if ( value ) 
+        memcpy( rec->value, value, dlen );
+    memcpy( rec->key, valname, vlen );
+    rec->key[ vlen - 1 ] = '\n';
+    memcpy( rec->key + vlen, layer, llen );
+    
+    do {
+        head      = m_changes;
+        rec->next = head;
+    } while ( !__sync_bool_compare_and_swap(&m_changes, head, rec) );
+    
+    if ( !head ) {
+        cfgst_rwrite( PIPE_OUT(m_notif_queue), " ", 1 );
     }
-    if (  (ret=cfgst_rwrite(PIPE_OUT(m_notif_queue), &vlen, sizeof(short))) != sizeof(short) ) { 
-        return -1; 
+    
+    LOG( cfgs_log(CFGST_LL_INFO, "queue_change_notif %s | %s\n", layer, valname); ); 
+    return 0;
+}
+
+
+/* Takes all the queued changes, oldest first */
+static change_rec *
+take_changes( void )
+{
+    change_rec *lifo = __sync_lock_test_and_set( &m_changes, NULL );
+    change_rec *fifo = NULL;
+    
+    while ( lifo ) {
+        change_rec *next = lifo->next;
+        lifo->next = fifo;
+        fifo       = lifo;
+        lifo       = next;
     }
-    if (  (ret=cfgst_rwrite(PIPE_OUT(m_notif_queue), valname, vlen)) != (vlen) ) { 
-        return -1; 
+    
+    return fifo;
+}
+
+
+/* Mark the changes a later one to the same value and layer supersedes.  
+   Returns the number of changes.  */
+static int
+coalesce_changes( change_rec *recs )
+{
+    cfgs_hash  *seen = NULL;  /* valname and layer -> their last change */
+    change_rec *rec;
+    int        nb_recs = 0;
+    
+    if ( recs && recs->next ) 
+        seen = cfgs_hash_new( 0 );
+    
+    for ( rec=recs; rec; rec=rec->next ) {
+        change_rec *prev = seen ? cfgs_hash_find( seen, rec->key ) : NULL;
+        
+        nb_recs++;
+        if ( !seen ) 
+            continue;
+        if ( prev ) {
+            prev->skip = true;
+            cfgs_hash_delete( seen, rec->key, prev, NULL );
+        }
+        cfgs_hash_insert( seen, rec->key, rec, 0 );
     }
-    if (  (ret=cfgst_rwrite(PIPE_OUT(m_notif_queue), &llen, sizeof(short))) != sizeof(short) ) { 
-        return -1; 
+    
+    if ( seen ) 
+        cfgs_hash_free( seen, NULL );
+    return nb_recs;
+}
+
+
+/* Numbers the batches of changes */
+static unsigned m_notif_batch = 0;
+
+
+/*
+ * CSNT_STREAM subscribers: connections that only carry changes, one 
+ * message per batch.  Messages are written without blocking; what the 
+ * socket does not take waits in out until the dispatcher sees the socket 
+ * writable.  A subscriber more than CGFS_NOTIF_BACKLOG bytes behind loses 
+ * the batches that follow, and gets a CFGS_CHANGES_LOST change once it 
+ * caught up.  
+ * The connections having CSNT_CONN requests get their changes the same 
+ * way, in line with the answers: one push each, framed in out by its 
+ * length, see cfgsp_push_send.  One too far behind has the pushes waiting 
+ * replaced by a single CFGS_CHANGES_LOST: all it knows may have changed.  
+ * Under m_notif_list_mutex.  
+ */
+typedef struct _notif_stream notif_stream;
+struct _notif_stream {
+    notif_stream *next;
+    notif_stream *prev;
+    int          sock;
+    int          hproto;
+    int          nb_notifs;  /* requests writing here */
+    bool         ready;      /* registration answered, see stream_start */
+    bool         in_line;    /* CSNT_CONN: pushes among the answers */
+    bool         lost;       /* batches were dropped */
+    const char   *last;      /* name of the last change put in batch */
+    cfgs_tag     *batch;     /* changes not encoded yet */
+    long         batch_len;  /* about their encoded size */
+    cfgs_buf     *out;       /* out->buf[sent..used) is still to send */
+    long         sent;
+};
+
+static notif_stream *m_streams = NULL;
+
+
+static notif_stream *
+stream_find( int sock )
+{
+    notif_stream *st;
+    
+    for ( st=m_streams; st; st=st->next ) {
+        if ( st->sock == sock )
+            return st;
     }
-    if (  (ret=cfgst_rwrite(PIPE_OUT(m_notif_queue), layer, llen)) != (llen) ) {
-        return -1; 
+    return NULL;
+}
+
+
+/* The stream of connection sock, made for its first request */
+static notif_stream *
+stream_get( int sock, int hproto, bool in_line )
+{
+    notif_stream *st = stream_find( sock );
+    
+    if ( st )
+        return st;
+    
+    st = XCALLOC( notif_stream, 1 );
+    if ( !st )
+        return NULL;
+    st->out = cfgs_buf_new( NULL, 0 );
+    if ( !st->out ) {
+        xfree( st );
+        return NULL;
     }
-    if (  (ret=cfgst_rwrite(PIPE_OUT(m_notif_queue), end_rec, strlen(end_rec))) 
-       != strlen(end_rec) ) {
-        return -1; 
+    st->sock    = sock;
+    st->hproto  = hproto;
+    st->in_line = in_line;
+    /* the answers wait for no registration */
+    st->ready   = in_line;
+    
+    m_streams = (notif_stream*)cfgs_dlist_add_tail( (cfgs_dlist*)m_streams, 
+                                                    (cfgs_dlist*)st );
+    return st;
+}
+
+
+/* One request less; the stream goes with the last one */
+static void
+stream_put( notif_stream *st )
+{
+    if ( --st->nb_notifs > 0 )
+        return;
+    
+    m_streams = (notif_stream*)cfgs_dlist_rem( (cfgs_dlist*)m_streams, 
+                                               (cfgs_dlist*)st );
+    if ( st->batch ) 
+        CFGST_DLIST_FREE( st->batch, cfgs_tag_free );
+    cfgs_buf_free( st->out );
+    xfree( st );
+}
+
+
+/* Encode the batch after what waits to be sent, unless too much does */
+static void
+stream_encode( notif_stream *st )
+{
+    st->last = NULL;
+    if ( !st->batch )
+        return;
+    
+    if (  st->lost 
+       || st->out->used - st->sent > CGFS_NOTIF_BACKLOG 
+       || !cfgsp_encode_changes(st->hproto, st->batch, st->out) ) {
+        LOG( if ( !st->lost ) 
+                cfgs_log(CFGST_LL_CRITIC, "stream %d: changes lost\n", st->sock); ); 
+        st->lost = true;
     }
     
-    LOG( cfgs_log(CFGST_LL_INFO, "queue_change_notif %s | %s\n", layer, valname); ); 
-    return 0;
+    CFGST_DLIST_FREE( st->batch, cfgs_tag_free );
+    st->batch     = NULL;
+    st->batch_len = 0;
 }
 
 
-static int
-full_read( int fd, void *buf, int len )
+/* A CSNT_CONN change after the pushes waiting, unless too many do */
+static bool
+stream_push( notif_stream *st, const char *valname, const char *layer )
 {
-    int ret = cfgst_rread( fd, buf, len );
-    LOG( cfgs_log(CFGST_LL_CRITIC, "full_read(%d, %p, %d) %d\n", fd, buf, len, ret); ); 
-    return ret;
+    long at;
+    int  len = 0;
+    
+    if ( st->out->used - st->sent > CGFS_NOTIF_BACKLOG ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "connection %d: pushes lost\n", st->sock); ); 
+        cfgs_buf_reset( st->out );
+        st->sent = 0;
+        valname  = CFGS_CHANGES_LOST;
+        layer    = NULL;
+    }
+    
+    at = st->out->used;
+    if (  !cfgs_buf_cat(st->out, (char*)&len, sizeof(len))
+       || !cfgsp_encode_push(st->hproto, valname, layer, st->out) ) {
+        st->out->used = at;
+        return false;
+    }
+    len = st->out->used - at - sizeof( len );
+    memcpy( st->out->buf + at, &len, sizeof(len) );
+    return true;
 }
 
 
-static inline int
-read_tag( int fd, const char *tag )
+static bool
+stream_add( notif_stream *st, const char *valname, const char *layer, const char *value )
 {
-    char c  = '\0';
-    const char *p = tag; 
+    cfgs_tag *t;
+    long     len;
+    
+    /* the change matched several requests of the subscriber */
+    if ( st->last == valname )
+        return true;
+    if ( st->in_line ) {
+        st->last = valname;
+        return stream_push( st, valname, layer );
+    }
     
-    lassert( tag );
-    LOG( cfgs_log(CFGST_LL_INFO, "read_tag(%d, %s)...\n", fd, tag); ); 
+    t = cfgsp_change_tag( valname, layer, value );
+    if ( !t ) {
+        st->lost = true;
+        return false;
+    }
     
-    while ( c != *p ) {
-        if ( -1 == full_read(fd, &c, 1) ) { 
-            return -1;
+    /* keep messages well under CGFS_MAX_BODY_LEN */
+    len = strlen( valname ) + strlen( SAFE_STR(layer) ) + strlen( SAFE_STR(value) ) + 32;
+    if ( st->batch && st->batch_len + len > CGFS_MAX_BODY_LEN/2 ) 
+        stream_encode( st );
+    
+    st->batch      = (cfgs_tag*)cfgs_dlist_cat( (cfgs_dlist*)st->batch, (cfgs_dlist*)t );
+    st->batch_len += len;
+    st->last       = valname;
+    return true;
+}
+
+
+/* Write the pushes the socket takes.  false if the connection is broken. */
+static bool
+pushes_send( notif_stream *st )
+{
+    int len, n;
+    
+    while ( st->sent < st->out->used ) {
+        memcpy( &len, st->out->buf + st->sent, sizeof(len) );
+        n = cfgsp_push_send( st->sock, st->out->buf + st->sent + sizeof(len), len );
+        if ( n == 0 )
+            return true;
+        if ( n < 0 ) {
+            st->ready = false;
+            return false;
         }
+        st->sent += sizeof( len ) + len;
     }
+    cfgs_buf_reset( st->out );
+    st->sent = 0;
     
-    for ( p++; *p; p++ ) {
-        if ( -1 == full_read(fd, &c, 1) ) { 
+    /* the last one the socket took part of */
+    return cfgsp_push_send( st->sock, NULL, 0 ) >= 0;
+}
+
+
+/* Write what the socket takes.  false if the connection is broken. */
+static bool
+stream_send( notif_stream *st )
+{
+    int n;
+    
+    if ( !st->ready )
+        return true;
+    if ( st->in_line )
+        return pushes_send( st );
+    
+    while ( true ) {
+        while ( st->sent < st->out->used ) {
+            n = cfgst_rsend( st->sock, st->out->buf + st->sent, 
+                             st->out->used - st->sent, MSG_DONTWAIT | MSG_NOSIGNAL );
+            if ( n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+                return true;
+            if ( n <= 0 ) {
+                /* the reactor will see it closed */
+                st->ready = false;
+                return false;
+            }
+            st->sent += n;
+        }
+        cfgs_buf_reset( st->out );
+        st->sent = 0;
+        
+        /* caught up: tell it changes were lost */
+        if ( !st->lost )
+            return true;
+        st->lost = false;
+        if ( stream_add(st, CFGS_CHANGES_LOST, NULL, NULL) )
+            stream_encode( st );
+        if ( st->out->used == 0 )
+            return true;
+    }
+}
+
+
+/* End of a batch: send the changes each stream got */
+static void
+streams_flush( void )
+{
+    notif_stream *st;
+    
+    for ( st=m_streams; st; st=st->next ) {
+        stream_encode( st );
+        (void)stream_send( st );
+    }
+}
+
+
+/* What the dispatcher waits for: (*fds)[0] is the doorbell, then the 
+   streams that wait for their socket to be writable.  -1 on error.  */
+static int
+streams_pollfds( struct pollfd **fds, int *nb_fds )
+{
+    notif_stream *st;
+    int          nfds = 1;
+    
+    for ( st=m_streams; st; st=st->next ) 
+        nfds++;
+    if ( nfds > *nb_fds ) {
+        struct pollfd *p = XREALLOC( struct pollfd, *fds, nfds );
+        
+        if ( p ) {
+            *fds    = p;
+            *nb_fds = nfds;
+        } else if ( !*fds ) {
             return -1;
         }
-        if ( c != *p ) {
-            return 0;
+    }
+    
+    (*fds)[0].fd     = PIPE_IN( m_notif_queue );
+    (*fds)[0].events = POLLIN;
+    nfds = 1;
+    for ( st=m_streams; st && nfds < *nb_fds; st=st->next ) {
+        if (  st->ready 
+           && (st->sent < st->out->used || (st->in_line && cfgsp_push_pending(st->sock))) ) {
+            (*fds)[nfds].fd     = st->sock;
+            (*fds)[nfds].events = POLLOUT;
+            nfds++;
         }
     }
     
-    return 1;
+    return nfds;
 }
 
 
-static int 
-read_change_notif( int fd, char *val_buf, char *layer_buf )
+/* Called once the registration is answered: changes can go out */
+static void
+stream_start( int sock )
 {
-    unsigned short vlen=0, llen=0, tlen=0;
+    notif_stream *st;
+    int          ret;
+    
+    ret = cfgs_mutex_lock( &m_notif_list_mutex );
+    lassert( ret == 0 );
+    if ( ret != 0 ) 
+        return;
     
-    lassert( fd && val_buf && layer_buf );
+    st = stream_find( sock );
+    if ( st )
+        st->ready = true;
     
-    if ( 1 != read_tag(fd, start_rec) ) {
-        return -1;
+    ret = cfgs_mutex_unlock( &m_notif_list_mutex );
+    lassert( ret == 0 );
+    
+    /* for the dispatcher to send what waits */
+    cfgst_rwrite( PIPE_OUT(m_notif_queue), " ", 1 );
+}
+
+
+/*
+ * Notification requests, indexed by the '/'-separated components of their 
+ * value name.  A name without wildcards is kept at the node of its last 
+ * component.  A pattern is kept at the node of the components preceding its 
+ * first wildcard and is checked there with fnmatch: since '*' matches '/' 
+ * as well, there is no telling how many components it spans.  A change 
+ * only looks at the requests along the path of its own name.  
+ */
+struct _notif_node {
+    notif_node *next;      /* siblings, as a cfgs_dlist */
+    notif_node *prev;
+    notif_node *parent;
+    char       *seg;       /* component, key in parent->children */
+    cfgs_hash  *children;  /* component -> notif_node, on first child */
+    notif_node *kids;      /* the same children, to walk them */
+    cfgs_notif *exact;     /* names ending here */
+    cfgs_notif *globs;     /* patterns having a wildcard past here */
+};
+
+
+/* End of the name component starting at s */
+static const char *
+seg_end( const char *s )
+{
+    const char *e = strchr( s, '/' );
+    
+    return e ? e : s + strlen( s );
+}
+
+
+static bool
+seg_is_glob( const char *s, const char *e )
+{
+    for ( ; s < e; s++ ) {
+        if ( strchr("*?[\\", *s) )
+            return true;
     }
+    return false;
+}
+
+
+static void
+node_free( notif_node *node )
+{
+    lassert( !node->exact && !node->globs && !node->kids );
     
-    if ( sizeof(short) != full_read(fd, &tlen, sizeof(short)) ) {
-        return -1;
+    if ( node->seg )      xfree( node->seg );
+    if ( node->children ) cfgs_hash_free( node->children, NULL );
+    xfree( node );
+}
+
+
+static notif_node *
+node_new( notif_node *parent, const char *seg )
+{
+    notif_node *node = XCALLOC( notif_node, 1 );
+    
+    if ( !node )
+        return NULL;
+    
+    node->parent = parent;
+    node->seg    = xstrdup( seg );
+    if ( !node->seg ) {
+        node_free( node );
+        return NULL;
     }
     
-    if ( sizeof(short) != full_read(fd, &vlen, sizeof(short)) ) {
-        return -1;
+    return node;
+}
+
+
+/* Child of node for the component [s, e), made if create */
+static notif_node *
+node_child( notif_node *node, const char *s, const char *e, bool create )
+{
+    char       seg[ FILENAME_MAX+1 ];
+    notif_node *child;
+    
+    if ( e - s > FILENAME_MAX )
+        return NULL;
+    memcpy( seg, s, e - s );
+    seg[ e - s ] = '\0';
+    
+    child = node->children ? cfgs_hash_find( node->children, seg ) : NULL;
+    if ( child || !create )
+        return child;
+    
+    if ( !node->children && !(node->children = cfgs_hash_new(0)) )
+        return NULL;
+    child = node_new( node, seg );
+    if ( !child )
+        return NULL;
+    if ( cfgs_hash_insert(node->children, child->seg, child, 0) == CFGST_HASH_INVALID_IDX ) {
+        node_free( child );
+        return NULL;
     }
-    if ( vlen > FILENAME_MAX ) {
-        return -1;
+    node->kids = (notif_node*)cfgs_dlist_add_tail( (cfgs_dlist*)node->kids, 
+                                                   (cfgs_dlist*)child );
+    return child;
+}
+
+
+/* Free node if it has no requests left.  Returns true if freed.  */
+static bool
+node_release( notif_node *node )
+{
+    notif_node *parent = node->parent;
+    
+    if ( node->exact || node->globs || node->kids )
+        return false;
+    
+    if ( parent ) {
+        cfgs_hash_delete( parent->children, node->seg, node, NULL );
+        parent->kids = (notif_node*)cfgs_dlist_rem( (cfgs_dlist*)parent->kids, 
+                                                    (cfgs_dlist*)node );
+    } else {
+        m_notif_trie = NULL;
     }
-    if ( vlen != full_read(fd, val_buf, vlen) ) {
-        return -1;
+    node_free( node );
+    return true;
+}
+
+
+/* Free node and its ancestors left without requests */
+static void
+node_prune( notif_node *node )
+{
+    while ( node ) {
+        notif_node *parent = node->parent;
+        
+        if ( !node_release(node) )
+            break;
+        node = parent;
     }
+}
+
+
+/* Node keeping the requests for name; *glob tells in which of its lists */
+static notif_node *
+node_for( const char *name, bool create, bool *glob )
+{
+    notif_node *node;
+    const char *s = name, *e;
     
-    if ( sizeof(short) != full_read(fd, &llen, sizeof(short)) ) {
-        return -1;
+    if ( !m_notif_trie && create ) 
+        m_notif_trie = node_new( NULL, "" );
+    
+    *glob = false;
+    for ( node=m_notif_trie; node; s=e+1 ) {
+        e = seg_end( s );
+        if ( seg_is_glob(s, e) ) {
+            *glob = true;
+            break;
+        }
+        node = node_child( node, s, e, create );
+        if ( !*e )
+            break;
     }
-    if ( llen > FILENAME_MAX ) {
-        return -1;
+    
+    return node;
+}
+
+
+/* true if pn is the request like describes; any value name if none given */
+static bool
+notif_matches( const cfgs_notif *pn, const cfgs_notif *like )
+{
+    /* a connection closing: all its requests */
+    if ( like->type == CSNT_CONN && !like->valname ) 
+        return (pn->type == CSNT_CONN || pn->type == CSNT_STREAM) 
+            && pn->sock == like->sock;
+    
+    if ( pn->type != like->type ) 
+        return false;
+    if ( like->valname && 0 != strcmp(pn->valname, like->valname) )
+        return false;
+    
+    switch ( like->type ) {
+    case CSNT_CONN:
+    case CSNT_STREAM:
+        return pn->sock == like->sock;
+    case CSNT_REMOTE:
+        return pn->port == like->port 
+            && 0 == strcmp( SAFE_STR(pn->host), SAFE_STR(like->host) );
+    default:
+        return pn->pid == like->pid && pn->signal == like->signal;
     }
-    if ( llen != full_read(fd, layer_buf, llen) ) {
-        return -1;
+}
+
+
+/* Unlink and free the requests matching like.  Returns the new list. */
+static cfgs_notif *
+notifs_drop( cfgs_notif *list, const cfgs_notif *like, int *nb_dropped )
+{
+    cfgs_notif *pn, *next;
+    
+    for ( pn=list; pn; pn=next ) {
+        next = pn->next;
+        if ( notif_matches(pn, like) ) {
+            list = (cfgs_notif*)cfgs_dlist_rem( (cfgs_dlist*)list, (cfgs_dlist*)pn );
+            if ( pn->conn ) 
+                stream_put( (notif_stream*)pn->conn );
+            cfgs_notif_free( pn );
+            (*nb_dropped)++;
+        }
     }
     
-    if ( 1 != read_tag(fd, end_rec) ) {
-        return -1;
+    return list;
+}
+
+
+/* notifs_drop over the whole subtree of node */
+static void
+node_drop( notif_node *node, const cfgs_notif *like, int *nb_dropped )
+{
+    notif_node *kid, *next;
+    
+    for ( kid=node->kids; kid; kid=next ) {
+        next = kid->next;
+        node_drop( kid, like, nb_dropped );
     }
     
-    LOG( cfgs_log(CFGST_LL_INFO, "read_change_notif %s | %s\n", layer_buf, val_buf); ); 
-    return 0;
+    node->exact = notifs_drop( node->exact, like, nb_dropped );
+    node->globs = notifs_drop( node->globs, like, nb_dropped );
+    (void)node_release( node );
 }
 
 
+/* Deliver valname's change to the requests in list */
 static int 
-send_notifications( const char *valname, const char *layer )
+notify_list( cfgs_notif *list, bool glob, 
+             const char *valname, const char *layer, const char *value )
 {
     int        nb_notifs = 0;
     cfgs_notif *pn;
     int        ret;
     
-    LOG( cfgs_log(CFGST_LL_INFO, "send_notifications \n"); ); 
-    for ( pn=m_notif_requests; pn; pn=pn->next ) {
-        ret = fnmatch( pn->valname, valname, 0 ); 
-        LOG( cfgs_log(CFGST_LL_INFO, 
-                "send_notifications %d fnmatch'%s' <-> '%s' \n", 
-                ret, valname, pn->valname); ); 
-        if ( 0 == ret ) {
-            /* FIXME: local/remote notif */ 
+    for ( pn=list; pn; pn=pn->next ) {
+        if ( glob ) {
+            ret = fnmatch( pn->valname, valname, 0 ); 
+            LOG( cfgs_log(CFGST_LL_INFO, 
+                    "send_notifications %d fnmatch'%s' <-> '%s' \n", 
+                    ret, valname, pn->valname); ); 
+            if ( 0 != ret )
+                continue;
+        }
+        
+        errno = 0;
+        switch ( pn->type ) {
+        case CSNT_CONN:
+            /* pushed on the client's connection, in line with answers */
+        case CSNT_STREAM:
+            ret = stream_add( (notif_stream*)pn->conn, valname, layer, value ) ? 0 : -1;
+            break;
+        default:
+            /* FIXME: remote notif */ 
             lassert( pn->pid > 0 && pn->signal > 0 );
-            errno = 0;
+            /* a signal does not tell what changed: one per batch will do */
+            if ( pn->batch == m_notif_batch ) 
+                continue;
+            pn->batch = m_notif_batch;
             ret = kill( pn->pid, pn->signal );
             LOG( cfgs_log(CFGST_LL_INFO, "send_notifications(%d) to %d, signal %d\n", 
                     ret, pn->pid, pn->signal); ); 
-            if ( ret == 0 )
-                nb_notifs++; 
+            break;
+        }
+        if ( ret == 0 )
+            nb_notifs++; 
+    }
+    
+    return nb_notifs;
+}
+
+
+static int 
+send_notifications( const char *valname, const char *layer, const char *value )
+{
+    int        nb_notifs = 0;
+    notif_node *node     = m_notif_trie;
+    const char *s        = valname, *e;
+    
+    LOG( cfgs_log(CFGST_LL_INFO, "send_notifications %s\n", valname); ); 
+    while ( node ) {
+        nb_notifs += notify_list( node->globs, true, valname, layer, value );
+        if ( !s ) {
+            nb_notifs += notify_list( node->exact, false, valname, layer, value );
+            break;
         }
+        e    = seg_end( s );
+        node = node_child( node, s, e, false );
+        s    = *e ? e + 1 : NULL;
     }
     
     return nb_notifs;
@@ -491,33 +1106,73 @@ send_notifications( const char *valname, const char *layer )
 static void *
 notif_dispatcher( void *arg )
 {
-    char valname[ FILENAME_MAX+1 ] = {0};
-    char layer[ FILENAME_MAX+1 ]   = {0};
+    struct pollfd *fds   = NULL;
+    int           nb_fds = 0;
+    char          wake[ 64 ];
     
     LOG( cfgs_log(CFGST_LL_INFO, 
             "notif_dispatcher started as thread %ld\n", pthread_self()); );
 
     while ( m_http_local_srv.run_flag && PIPE_IN(m_notif_queue) > 0 ) { 
-        int ret;
-    
-        memset( valname, '\0', FILENAME_MAX+1 );
-        memset( layer,   '\0', FILENAME_MAX+1 );
-    
+        change_rec *recs, *rec;
+        int        ret, nfds, nb_recs, nb_sent = 0;
+    
+        ret = cfgs_mutex_lock( &m_notif_list_mutex );
+        lassert( ret == 0 );
+        nfds = streams_pollfds( &fds, &nb_fds );
+        ret = cfgs_mutex_unlock( &m_notif_list_mutex );
+        lassert( ret == 0 );
+        if ( nfds < 0 ) {
+            break;
+        }
+        
         /* There is only one reader thread */
-        ret  = read_change_notif( PIPE_IN(m_notif_queue), valname, layer );
-    
-        if ( ret == 0 ) {
-            ret = cfgs_mutex_lock( &m_notif_list_mutex );
-            lassert( ret == 0 );
+        ret = poll( fds, nfds, -1 );
+        if ( ret < 0 && errno != EINTR ) {
+            break;
+        }
+        if ( ret > 0 && (fds[0].revents & POLLIN) ) {
+            ret = read( PIPE_IN(m_notif_queue), wake, sizeof(wake) );
+            if ( ret == 0 || (ret < 0 && errno != EINTR) ) {
+                break;
+            }
+        }
+        if ( m_dump_mutexes ) {
+            m_dump_mutexes = 0;
+            cfgs_mutex_dump( _cfgs_logfd() >= 0 ? _cfgs_logfd() : 2 );
+        }
+        
+        recs    = take_changes();
+        nb_recs = coalesce_changes( recs );
+        
+        ret = cfgs_mutex_lock( &m_notif_list_mutex );
+        lassert( ret == 0 );
+        
+        m_notif_batch++;
+        for ( rec=recs; rec; rec=rec->next ) {
+            if ( !rec->skip ) {
+                send_notifications( rec->valname, rec->layer, rec->value );
+                nb_sent++;
+            }
+        }
+        /* and what streams could not take so far */
+        streams_flush();
         
-            send_notifications( valname, layer );
+        ret = cfgs_mutex_unlock( &m_notif_list_mutex );
+        lassert( ret == 0 );
         
-            ret = cfgs_mutex_unlock( &m_notif_list_mutex );
-            lassert( ret == 0 );
+        while ( recs ) {
+            rec  = recs;
+            recs = recs->next;
+            xfree( rec );
         }
         
-        /*sleep( 1 ); */
+        LOG( if ( nb_recs ) cfgs_log(CFGST_LL_INFO, 
+                "notif_dispatcher %d changes, %d sent\n", nb_recs, nb_sent); ); 
     }
+    
+    if ( fds ) 
+        xfree( fds );
     return NULL;
 }
 
@@ -528,7 +1183,6 @@ start_notifications_mechanism( void )
     pthread_attr_t chld_attr;
     
     REGISTER_MUTEX( &m_notif_list_mutex,  CFGS_MO_NOTIF_LIST );
-    REGISTER_MUTEX( &m_notif_queue_mutex, CFGS_MO_NOTIF_QUEUE );
     
     if ( !open_pipe(m_notif_queue, PNB_IN) ) {
         return EXIT_FAILURE;
@@ -541,6 +1195,9 @@ start_notifications_mechanism( void )
     if ( 0 != pthread_attr_setdetachstate(&chld_attr, PTHREAD_CREATE_DETACHED) ) {
         return EXIT_FAILURE;
     }
+    /* notif_dispatcher quits when run_flag is false: do not let it race 
+       start_server */
+    m_http_local_srv.run_flag = true;
     if ( 0 != pthread_create(&m_notif_thr, &chld_attr, notif_dispatcher, NULL) ) {
         return EXIT_FAILURE;
     }
@@ -557,53 +1214,110 @@ stop_notifications_mechanism( void )
 
 
 static void 
-queue_notification( const char *valname, const char *layer )
+queue_notification( const char *valname, const char *layer, const char *value )
 {
-    int ret;
-    
-    ret = cfgs_mutex_lock( &m_notif_queue_mutex );
-    lassert( ret == 0 );
-    
     /* There is a specialized thread that sends notifications - it examines 
        messages with changed values and sends notifications if appropriate. 
        This function only queues a message that valname has changed.  */
     LOG( cfgs_log(CFGST_LL_INFO, "queue_notification %s : %s\n", 
             SAFE(layer), SAFE(valname)); ); 
         
-    queue_change_notif( PIPE_OUT(m_notif_queue), valname, layer );
-    
-    ret = cfgs_mutex_unlock( &m_notif_queue_mutex );
-    lassert( ret == 0 );
+    queue_change_notif( valname, layer, value );
 }
 
 static int
 add_notif( cfgs_notif *notif )
 {
-    int ret;
+    notif_node *node;
+    bool       glob;
+    int        ret;
     
-    lassert( notif );
-    if ( !notif )
-        return EXIT_FAILURE;
+    lassert( notif && notif->valname );
+    if ( !notif || !notif->valname )
+        return -1;
     
     LOG( cfgs_log(CFGST_LL_INFO, "add_notif %s\n", SAFE(notif->valname)); ); 
     
     ret = cfgs_mutex_lock( &m_notif_list_mutex );
     lassert( ret == 0 );
     if ( ret != 0 ) 
-        return ret;
+        return -1;
+    
+    if ( notif->type == CSNT_STREAM || notif->type == CSNT_CONN ) {
+        notif->conn = stream_get( notif->sock, notif->hproto, notif->type == CSNT_CONN );
+        if ( notif->conn ) 
+            ((notif_stream*)notif->conn)->nb_notifs++;
+    }
     
-    m_notif_requests = (cfgs_notif*)cfgs_dlist_add_tail( (cfgs_dlist*)m_notif_requests, 
-                               (cfgs_dlist*)notif );
+    node = NULL;
+    if ( (notif->type != CSNT_STREAM && notif->type != CSNT_CONN) || notif->conn ) 
+        node = node_for( notif->valname, true, &glob );
+    if ( node && glob ) {
+        node->globs = (cfgs_notif*)cfgs_dlist_add_tail( (cfgs_dlist*)node->globs, 
+                                                        (cfgs_dlist*)notif );
+    } else if ( node ) {
+        node->exact = (cfgs_notif*)cfgs_dlist_add_tail( (cfgs_dlist*)node->exact, 
+                                                        (cfgs_dlist*)notif );
+    } else if ( notif->conn ) {
+        stream_put( (notif_stream*)notif->conn );
+        notif->conn = NULL;
+    }
     
     ret = cfgs_mutex_unlock( &m_notif_list_mutex );
     lassert( ret == 0 );
     
-    if ( ret != 0 || !m_notif_requests ) 
-        return ret;
+    if ( ret != 0 || !node ) 
+        return -1;
     
     return EXIT_SUCCESS;
 }
 
+
+/* Drop the requests matching like.  Returns their number or -1.  */
+static int
+rem_notifs( const cfgs_notif *like )
+{
+    notif_node *node;
+    bool       glob;
+    int        nb_dropped = 0;
+    int        ret;
+    
+    ret = cfgs_mutex_lock( &m_notif_list_mutex );
+    lassert( ret == 0 );
+    if ( ret != 0 ) 
+        return -1;
+    
+    if ( !like->valname ) {
+        if ( m_notif_trie ) 
+            node_drop( m_notif_trie, like, &nb_dropped );
+    } else if ( (node = node_for(like->valname, false, &glob)) ) {
+        if ( glob ) 
+            node->globs = notifs_drop( node->globs, like, &nb_dropped );
+        else
+            node->exact = notifs_drop( node->exact, like, &nb_dropped );
+        node_prune( node );
+    }
+    
+    ret = cfgs_mutex_unlock( &m_notif_list_mutex );
+    lassert( ret == 0 );
+    
+    LOG( cfgs_log(CFGST_LL_INFO, "rem_notifs %s: %d\n", 
+            SAFE(like->valname), nb_dropped); ); 
+    return nb_dropped;
+}
+
+
+/* Connection csock is closing: drop its CSNT_CONN notifications */
+static void
+rem_conn_notifs( int csock )
+{
+    cfgs_notif like = {0};
+    
+    like.type = CSNT_CONN;
+    like.sock = csock;
+    (void)rem_notifs( &like );
+}
+
 /*------------------------------------------------------------------*/
 
 /*
@@ -696,63 +1410,144 @@ TEST_ERROR
 }
 
 
-static void*
-cfgs_setval_rq_handler( cfgsp_data *data )
+/* The entry described by tag attributes, in @param arena.  NULL on error. */
+static cfgs_entry *
+tag_entry( cfgs_arena *arena, cfgs_tag *tag )
 {
-    int            gret = 0, pret;
-    cfgs_backend   *bk  = m_backends;
-    cfgs_entry     *val = cfgs_entry_new();
+    cfgs_entry     *val = cfgs_entry_new_in( arena );
     cfgs_pair      *p;
 
-    lassert( data && data->attribs );
-    if ( !data || !data->attribs || !val ) 
-        return (void*)-1;
+    if ( !val ) 
+        return NULL;
     
     LOG( cfgs_log(CFGST_LL_INFO, "cfgs_setval_rq_handler %s\n", 
-            SAFE(cfgs_tag_attr(data->attribs, CFGS_EA_NAME))); );
+            SAFE(cfgs_tag_attr(tag, CFGS_EA_NAME))); );
 
     val->value_type = CFGS_VT_UCPTR;
-    for ( p=data->attribs->attr; p; p=p->next ) {
+    for ( p=tag->attr; p; p=p->next ) {
         if ( !cfgs_entry_add_attr(val, p->first, p->second) ) {
             cfgs_entry_free( val );
-            return (void*)-1;
+            return NULL;
         }
     }
     
-    /*
-     * FIXME: look in cache to find backend to poll for name, else poll all 
-     * backends, then cache it.  cs_get/set/rm/ val
-     */
-    while ( bk ) {
+    return val;
+}
+
+/* The backend known to hold the entry's name, NULL if none */
+static cfgs_backend *
+route_of( cfgs_entry *val )
+{
+    const char *valname = cfgs_entry_attr( val, CFGS_EA_NAME ); 
+
+    return valname ? cfgsb_route( m_routes, valname, cfgs_entry_attr(val, CFGS_EA_LAYER) )
+                   : NULL;
+}
+
+/* 
+ * Store vl, in one call: on @param routed or, if NULL, on the first backend 
+ * that takes it.  Returns the values stored, -1 on error.  
+ */
+static int
+set_entries( cfgs_session *sess, cfgs_entry *vl, cfgs_backend *routed )
+{
+    int            gret = 0, pret;
+    cfgs_backend   *bk  = routed ? routed : m_backends;
+    cfgs_entry     *e;
+
+    for ( ; bk; bk=bk->next ) {
 TEST_ERROR    
-        pret = (*bk->cfgs_setval)( data->sess, val );
-        /* only one backend stores the value */
+        pret = (*bk->cfgs_setval)( sess, vl );
+        /* only one backend stores the values */
         if ( pret < 0 ) {
             gret = -1;
+            if ( routed )
+                break;
             continue;
-        } else {
-            if ( pret ) {
-                const char *valname = cfgs_entry_attr( val, CFGS_EA_NAME ); 
-                const char *layer   = cfgs_entry_attr( val, CFGS_EA_LAYER ); 
-                lassert( valname && layer );
-                queue_notification( valname, layer );
-            }
-            gret += pret;
-            break; 
+        } 
+        /* all of them, even if it stopped before the last */
+        for ( e=vl; pret && e; e=e->next ) {
+            const char *valname = cfgs_entry_attr( e, CFGS_EA_NAME ); 
+            const char *layer   = cfgs_entry_attr( e, CFGS_EA_LAYER ); 
+
+            lassert( valname && layer );
+            queue_notification( valname, layer, cfgs_entry_attr(e, CFGS_EA_VALUE) );
+            if ( !routed )
+                cfgsb_route_learn( m_routes, valname, layer, bk );
         }
+        gret = pret;
+        break; 
 TEST_ERROR        
-        bk = bk->next;
     }
     
-    cfgs_entry_free( val );
-    return (void*)gret;
+    return gret;
+}
+
+static void*
+cfgs_setval_rq_handler( cfgsp_data *data )
+{
+    int            gret = 0, pret;
+    cfgs_tag       *t;
+    cfgs_entry     *run = NULL, *val;
+    cfgs_backend   *routed = NULL;
+
+    lassert( data && data->attribs );
+    if ( !data || !data->attribs ) 
+        return (void*)-1;
+    
+    /* Older clients send one entry as the call attributes */
+    t = data->attribs->next;
+    if ( !t || 0 != strcmp(CFGS_TAG_ENTRY, t->type) ) {
+        val = tag_entry( data->arena, data->attribs );
+        return (void*)( val ? set_entries(data->sess, val, route_of(val)) : -1 );
+    }
+    
+    /* 
+     * The whole batch under the lock taken by tag_callback, the entries in 
+     * a row going to the same backend in one call: their changes are synced 
+     * at once.  Not undone: it stops at the first call failing, the entries 
+     * before stay stored.  Their count is returned, the error set; -1 if 
+     * none was stored.  
+     */
+    for ( ; ; t=t->next ) {
+        bool         more = t && 0 == strcmp( CFGS_TAG_ENTRY, t->type );
+        cfgs_backend *bk;
+
+        val = more ? tag_entry( data->arena, t ) : NULL;
+        bk  = val ? route_of( val ) : NULL;
+        if ( run && (!val || bk != routed) ) {
+            pret = set_entries( data->sess, run, routed );
+            if ( pret > 0 )
+                gret += pret;
+            if ( pret < 0 || cfgs_iserr(cfgs_session_geterr(data->sess)) ) {
+                cfgs_session_store_error( data->sess, CFGS_ERRT_INTERNAL, 
+                        CFGSP_ERR_SERVER, "'%s' or an entry after it not stored, "
+                        "%d values before were", 
+                        SAFE(cfgs_entry_attr(run, CFGS_EA_NAME)), gret );
+                break;
+            }
+            run = NULL;
+        }
+        if ( !more )
+            break;
+        if ( !val ) {
+            cfgs_session_store_error( data->sess, CFGS_ERRT_INTERNAL, 
+                    CFGSP_ERR_SERVER, "'%s' not stored, %d values before it were", 
+                    SAFE(cfgs_tag_attr(t, CFGS_EA_NAME)), gret );
+            break;
+        }
+        run    = (cfgs_entry*)cfgs_dlist_add_tail( (cfgs_dlist*)run, (cfgs_dlist*)val );
+        routed = bk;
+    }
+    
+    return (void*)( gret ? gret : cfgs_iserr(cfgs_session_geterr(data->sess)) ? -1 : 0 );
 }
 
 static void*
 cfgs_rmval_rq_handler( cfgsp_data *data )
 {
     int            gret = 0, pret;
-    cfgs_backend   *bk  = m_backends;
+    cfgs_backend   *bk;
     const char     *valname, *layer; 
 
     lassert( data && data->attribs );
@@ -766,11 +1561,8 @@ cfgs_rmval_rq_handler( cfgsp_data *data )
         return (void*)-1;
     
 
-    /*
-     * FIXME: look in cache to find backend to poll for name, else poll all 
-     * backends, then cache it.  cs_get/set/rm/ val
-     */
-    while ( bk ) {
+    /* from all of them: several may hold the name */
+    for ( bk=m_backends; bk; bk=bk->next ) {
 TEST_ERROR    
         pret = (*bk->cfgs_rmval)( data->sess, valname, layer );
         if ( pret < 0 ) {
@@ -781,20 +1573,50 @@ TEST_ERROR
         
         if ( pret ) {
             lassert( valname && layer );
-            queue_notification( valname, layer );
+            queue_notification( valname, layer, NULL );
         }
 TEST_ERROR        
-        bk = bk->next;
     }
+    cfgsb_route_forget( m_routes, valname, layer );
     
     return (void*)gret;
 }
 
+static cfgs_entry*
+get_entry( cfgs_session *sess, const char *valname, const char *layer )
+{
+    cfgs_entry     *pv = NULL;
+    cfgs_backend   *routed = cfgsb_route( m_routes, valname, layer );
+    cfgs_backend   *bk;
+
+    /* 
+     * The first backend holding the name when it was learned: the earlier 
+     * ones had none and do not get it through us.  Gone from it, the name 
+     * is looked for again.  
+     */
+    if ( routed ) {
+        pv = (*routed->cfgs_getval)( sess, valname, layer );
+        if ( pv )
+            return pv;
+        cfgsb_route_forget( m_routes, valname, layer );
+    }
+    
+    for ( bk=m_backends; bk && !pv; bk=bk->next ) {
+        if ( bk == routed )
+            continue;
+TEST_ERROR    
+        pv = (*bk->cfgs_getval)( sess, valname, layer );
+TEST_ERROR        
+        if ( pv )
+            cfgsb_route_learn( m_routes, valname, layer, bk );
+    }
+    
+    return pv;
+}
+
 static void*
 cfgs_getval_rq_handler( cfgsp_data *data )
 {
-    cfgs_entry     *pv = NULL;
-    cfgs_backend   *bk = m_backends;
     const char     *valname, *layer; 
 
     lassert( data && data->attribs );
@@ -807,16 +1629,37 @@ cfgs_getval_rq_handler( cfgsp_data *data )
     if ( !valname || !layer )
         return NULL;
     
+    return (void*)get_entry( data->sess, valname, layer );
+}
+
+static void*
+cfgs_getvals_rq_handler( cfgsp_data *data )
+{
+    cfgs_entry     *pv = NULL;
+    const char     *layer; 
+    cfgs_tag       *t;
 
-    /*
-     * FIXME: look in cache to find backend to poll for name, else poll all 
-     * backends, then cache it.  cs_get/set/rm/ val
+    lassert( data && data->attribs );
+    if ( !data || !data->attribs ) 
+        return NULL;
+    
+    layer = cfgs_tag_attr( data->attribs, CFGS_EA_LAYER );
+    LOG( cfgs_log(CFGST_LL_INFO, "cfgs_getvals_rq_handler %s\n", SAFE(layer)); );
+    if ( !layer )
+        return NULL;
+    
+    /* 
+     * Names are in the cfgs:entry tags following the call.  The answer 
+     * has the entries found, in names order: a name may have several, 
+     * a missing one has none.  Each entry holds its name to match by.  
      */
-    while ( bk && !pv ) {
-TEST_ERROR    
-        pv = (*bk->cfgs_getval)( data->sess, valname, layer );
-TEST_ERROR        
-        bk = bk->next;
+    for ( t=data->attribs->next; t && 0 == strcmp(CFGS_TAG_ENTRY, t->type); t=t->next ) {
+        const char *valname = cfgs_tag_attr( t, CFGS_EA_NAME );
+        
+        if ( valname ) {
+            cfgs_entry *v = get_entry( data->sess, valname, layer );
+            pv = (cfgs_entry*)cfgs_dlist_cat( (cfgs_dlist*)pv, (cfgs_dlist*)v );
+        }
     }
     
     return (void*)pv;
@@ -843,29 +1686,84 @@ cfgs_register_notif_rq_handler( cfgsp_data *data )
     for ( n=nn; n; n=n->next ) {
         int ret;
         
+        if ( n->type == CSNT_CONN || n->type == CSNT_STREAM ) {
+            n->sock   = data->sock;
+            n->hproto = data->hproto;
+        }
+        /* streamed changes are bin messages */
+        if ( n->type == CSNT_STREAM && data->hproto != CFGSP_HOST_PROTO_BIN ) {
+            cfgs_notif_free( n );
+            break; 
+        }
         ret = add_notif( n );
         if ( ret < 0 ) {
             /*FIXME: set error*/
             break; 
         }
         
+        if ( n->type == CSNT_STREAM ) 
+            data->stream = true;
         gret += 1;
     }
     
-    /* Do NOT free, it is now appended to m_notif_requests */
+    /* Do NOT free, it is now in m_notif_trie */
     /*cfgs_notif_free( nn );*/
     return (void*)gret;
 }
 
+static void*
+cfgs_unregister_notif_rq_handler( cfgsp_data *data )
+{
+    int        gret;
+    cfgs_notif *like; 
+    
+    lassert( data && data->attribs );
+    if ( !data || !data->attribs ) {
+        return NULL;
+    }
+    
+    like = cfgs_notif_from_tag( data->attribs );
+    if ( !like ) {
+        return NULL;
+    }
+    
+    /* only the requests made on this connection */
+    if ( like->type == CSNT_CONN || like->type == CSNT_STREAM ) {
+        like->sock = data->sock;
+    }
+    gret = rem_notifs( like );
+    
+    cfgs_notif_free( like );
+    return (void*)gret;
+}
+
 
 /** @see CFGSP_CALLBACK definition */
 static void* 
 tag_callback( cfgsp_data *data )
 {
+    void *ret;
+    
     if ( !data->attribs )
         return NULL;
+    if ( !lock_backends(is_write_rq(data->idx)) ) {
+        cfgs_session_store_error( data->sess, CFGS_ERRT_INTERNAL, 
+                CFGSP_ERR_SERVER, "backends lock" );
+        return NULL;
+    }
 TEST_ERROR
-    return (*m_handlers[data->idx])( data );
+    /* the changes are synced past the lock: the writers meanwhile at once */
+    cfgs_session_defer_commits( data->sess, true );
+    ret = (*m_handlers[data->idx])( data );
+    cfgs_session_defer_commits( data->sess, false );
+    
+    (void)unlock_backends(); 
+    if ( !cfgs_session_commit(data->sess) ) {
+        cfgs_session_store_error( data->sess, CFGS_ERRT_INTERNAL, 
+                CFGSP_ERR_SERVER, "changes not synced" );
+        ret = (void*)-1;
+    }
+    return ret;
 }
 
 /*------------------------------------------------------------------*/
@@ -878,16 +1776,6 @@ report_error( int sock, CFGS_ERR err )
 }
 
 
-static inline void
-EXIT_HPR( int csock, int code )
-{
-    close( csock ); /*shutdown(,2)*/ 
-    lassert_no_mutex(); 
-    LOG( cfgs_log(CFGST_LL_INFO, "*** thread done ***\n"); ); 
-    pthread_exit( (void*)code ); 
-}
-
-
 /*
  * See Stevens - Unix Network Programming
  */
@@ -972,62 +1860,132 @@ authenticate_remote_user( int csock, cfgs_session *sess )
 }
 
 
-static void* 
-http_process_request( void* arg )
+/* Reactor callback: new client connection, before its first request */
+static bool
+http_open_conn( int csock, void **ctx )
 {
-    int          csock = (int)arg;
-    cfgs_session *sess; 
-    cfgsp_data   cb_data;
-    bool         keep_alive = true;
+    cfgsp_data   *cb_data;
     
-    lassert( arg && csock >= 0 );
+    lassert( csock >= 0 && ctx );
     
-    errno = h_errno = 0;
-
-    LOG( cfgs_log(CFGST_LL_CRITIC, 
-        "csconfigd http_process_request on socket %d, thread %ld \n", 
+    LOG( cfgs_log(CFGST_LL_INFO, 
+        "csconfigd http_open_conn on socket %d, thread %ld \n", 
         csock, pthread_self()); );
     
-    if ( (sess = cfgs_session_new()) == NULL ) {
-        EXIT_HPR( csock, ENOMEM );
+    if ( (cb_data = XCALLOC(cfgsp_data, 1)) == NULL ) {
+        return false;
+    }
+    if ( (cb_data->sess = cfgs_session_new()) == NULL ) {
+        xfree( cb_data );
+        return false;
     }
 TEST_ERROR    
-    if ( !authenticate_remote_user(csock, sess) ) {
+    if ( !authenticate_remote_user(csock, cb_data->sess) ) {
         /* This seems to fail sometimes.  Keep going, user will be anonymous. */
 	    /*FIXME: why*/
     }
 TEST_ERROR    
-    /* FIXME: This connection accounting should be done by the server itself
-       but complicates decrementing the connection counter - server must
-       keep track of threads. */
     if ( !inc_conn_num() ) {
         report_error( csock, CFGSP_MAX_CONN ); 
-        EXIT_HPR( csock, 0 );
+        cfgs_session_free( cb_data->sess );
+        xfree( cb_data );
+        return false;
     }
     
-    cb_data.sess = sess;
-    cb_data.idx  = INVALID_CFGS_FUNC_INDEX;
-TEST_ERROR    
-    while ( keep_alive ) {
-        if ( !lock_backends() ) {
-            break;
-        }
-        
-        /* Reset Keep-alive if errors */
-        keep_alive = cfgsp_process_rq( csock, CFGSP_HOST_PROTO_HTTP, 
-                         tag_callback, &cb_data ); 
+    cb_data->idx    = INVALID_CFGS_FUNC_INDEX;
+    cb_data->hproto = CFGSP_HOST_PROTO_HTTP;
+    cb_data->sock   = csock;
+    *ctx = cb_data;
+    return true;
+}
+
+
+/* 
+ * Reactor callback: serve one request.  Returning false closes the 
+ * connection.  Runs in a worker thread.  
+ */
+static bool
+http_process_request( int csock, void *ctx )
+{
+    cfgsp_data   *cb_data = (cfgsp_data*)ctx;
+    bool         keep_alive;
+    
+    lassert( csock >= 0 && cb_data );
+    
+    /* A subscriber's connection only carries changes: anything read on 
+       it, end of file included, closes it */
+    if ( cb_data->stream ) 
+        return false;
+    
+    /* First request might be a switch to another host protocol */
+    if ( !cb_data->negotiated ) {
+        cb_data->negotiated = true;
+        cb_data->hproto     = cfgsp_accept_proto( csock );
+        if ( cb_data->hproto != CFGSP_HOST_PROTO_HTTP ) 
+            return true;
+    }
+    
+    /* Reset Keep-alive if errors.  Backends are locked per call, see 
+       tag_callback.  */
+    keep_alive = cfgsp_process_rq( csock, cb_data->hproto, 
+                     tag_callback, cb_data ); 
 TEST_ERROR /*errno 11 EAGAIN detected */    
+    if ( keep_alive && cb_data->stream ) 
+        stream_start( csock );
 
-        if ( !unlock_backends() ) {
-            break;
-        }
-    } /*while*/
-TEST_ERROR
+    lassert_no_mutex(); 
+    return keep_alive;
+}
+
+
+/* 
+ * Reactor callback: is a whole request buffered?  Before the protocol is 
+ * negotiated hproto is http, which the negotiation uses.  
+ */
+static bool
+http_request_complete( int csock, void *ctx )
+{
+    cfgsp_data   *cb_data = (cfgsp_data*)ctx;
+    
+    lassert( csock >= 0 && cb_data );
+    
+    /* anything read on a subscriber's connection closes it */
+    if ( cb_data->stream ) 
+        return cfgst_rbuf_pending( csock ) > 0;
+    
+    return cfgsp_request_buffered( csock, cb_data->hproto );
+}
+
+
+/* Reactor callback: connection is about to be closed */
+static void
+http_close_conn( int csock, void *ctx )
+{
+    cfgsp_data   *cb_data = (cfgsp_data*)ctx;
+    
+    /* before csock can be reused by another connection */
+    rem_conn_notifs( csock );
+    cfgsp_push_forget( csock );
     if ( !dec_conn_num() ) {
-        LOG( cfgs_log(CFGST_LL_CRITIC, "http_process_request:dec_conn_num"); );
+        LOG( cfgs_log(CFGST_LL_CRITIC, "http_close_conn:dec_conn_num"); );
     }    
-    EXIT_HPR( csock, 0 );
-    return NULL; /* shut up compiler */
+    if ( cb_data ) {
+        cfgs_session_free( cb_data->sess );
+        xfree( cb_data );
+    }
+    LOG( cfgs_log(CFGST_LL_INFO, "*** connection %d done ***\n", csock); ); 
+}
+
+
+static int
+worker_threads( void )
+{
+    const char *env = getenv( CFGS_ENV_WORKERS );
+    
+    if ( env && atoi(env) > 0 ) 
+        return atoi( env );
+        
+    return CGFS_WORKER_THREADS;
 }
 
 
@@ -1036,9 +1994,13 @@ start_server( void )
 {
     REGISTER_MUTEX( &m_conn_mutex,   CFGS_MO_CONN );
     
-    m_http_local_srv.type       = CSST_UNIX;
-    m_http_local_srv.port       = CFGS_CONFIGD_PORT;
-    m_http_local_srv.start_func = http_process_request;
+    m_http_local_srv.type         = CSST_UNIX;
+    m_http_local_srv.port         = CFGS_CONFIGD_PORT;
+    m_http_local_srv.nworkers     = worker_threads();
+    m_http_local_srv.conn_open    = http_open_conn;
+    m_http_local_srv.conn_request = http_process_request;
+    m_http_local_srv.conn_close   = http_close_conn;
+    m_http_local_srv.conn_complete = http_request_complete;
     if ( !open_pipe(m_pipe_stop_srv, PNB_IN|PNB_OUT) ) {
         return EXIT_FAILURE;
     }
@@ -1071,7 +2033,15 @@ csconfigd( int argc, char **argv, char **envp )
         LOG( cfgs_log(CFGST_LL_CRITIC, "Could not load backends.\n"); );
         return EXIT_FAILURE;
     }
-    REGISTER_MUTEX( &m_backends_mutex, CFGS_MO_BACKENDS );
+    m_routes = cfgsb_routes_new();
+    if ( !m_routes ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "Could not init backends routes.\n"); );
+        return EXIT_FAILURE;
+    }
+    if ( !init_backends_lock() ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "Could not init backends lock.\n"); );
+        return EXIT_FAILURE;
+    }
     
 
     /* should unload ackends, etc. but we will exit anyway */ 
@@ -1089,6 +2059,7 @@ csconfigd( int argc, char **argv, char **envp )
     stop_notifications_mechanism(); 
         
     cfgsb_unload_backends( m_backends );
+    cfgsb_routes_free( m_routes );
     (void)cfgsb_shutdown();
     
     LOG( cfgs_log(CFGST_LL_INFO, "csconfigd " VERSION " exit.\n"); );
@@ -1113,7 +2084,7 @@ main( int argc, char **argv, char **envp )
     m_daemon.sighandlers[ SIGIO ]   = SIG_IGN;
     m_daemon.sighandlers[ SIGURG ]  = SIG_IGN;
     m_daemon.sighandlers[ SIGFPE ]  = SIG_IGN;
-    m_daemon.sighandlers[ SIGUSR1 ] = SIG_IGN;
+    m_daemon.sighandlers[ SIGUSR1 ] = sigusr1_handler;
     m_daemon.sighandlers[ SIGUSR2 ] = SIG_IGN;
     m_daemon.sighandlers[ SIGALRM ] = SIG_IGN;
     m_daemon.sighandlers[ SIGTERM ] = sigterm_handler;
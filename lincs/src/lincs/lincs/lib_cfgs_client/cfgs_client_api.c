@@ -27,6 +27,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include "cfgs/cfgs_config.h"
 #include "cfgs_client_api.h"
@@ -34,87 +38,464 @@
 #include "cfgs_mem.h"
 #include "cfgs_log.h"
 #include "cfgs_dlist.h"
+#include "cfgs_hash.h"
 #include "cfgs_sock.h"
 #include "cfgs_protocol.h"
 
 
 static const char    m_module[]  = CFGS_BOOTSTRAP_BACKEND; 
 
-static cfgs_backend  *m_backend  = NULL;
-static int           m_connect   = CFGST_INVALID_SOCKET;
+/* 
+ * A session talks to the daemon on a connection of its own, so that threads
+ * with sessions of their own have requests in flight at once.  Connections 
+ * come from a pool: a session takes an idle one, or opens one, and gives it 
+ * back on disconnect; beyond CGFS_CLIENT_POOL idle ones, or if a request 
+ * or its answer was cut short, by a timeout say, it is closed.  
+ * Without a daemon, the sessions share the bootstrap backend.  
+ */
+typedef struct _client_conn client_conn;
+struct _client_conn {
+    client_conn      *next;      /* in the pool */
+    int              sock;
+    CFGSP_HOST_PROTO hproto;
+    /* pipelining: calls submitted but not collected yet; tickets are counters */
+    CFGS_FUNC_INDEX  pending[CGFS_PIPELINE_DEPTH];
+    int              submitted;
+    int              collected;
+    bool             broken;     /* a request or an answer cut short */
+};
+#define SESS_CONN( sess )  ( (client_conn*)cfgs_session_get_conn(sess) )
+
+/* guards the pool, the session count and m_backend's loading */
+static pthread_mutex_t m_conn_mutex = PTHREAD_MUTEX_INITIALIZER;
+static client_conn     *m_idle      = NULL;
+static int             m_nidle      = 0;
+static int             m_pool_size  = -1;  /* from the environment, once */
+static int             m_nsessions  = 0;
+static cfgs_backend    *m_backend   = NULL;
 
-/* FIXME: logically, m_connect&co should be in session to allow threading ? */
+/* 
+ * Opt-in cache of cfgs_getval answers, see cfgs_set_cache.  Hashed by name; 
+ * the layers a name was read from are chained.  The daemon pushes the names 
+ * of changed values on a connection of the cache's own, m_cache_conn, and 
+ * those are dropped.  The cache is shared by the process' sessions.  
+ */
+typedef struct _cache_item cache_item;
+struct _cache_item {
+    cache_item  *next;
+    cache_item  *prev;
+    char        *name;      /* the hash key is the chain's head name */
+    char        *layer;
+    cfgs_entry  *vals;
+};
+#define CACHE_HASH_SIZE  (257)
+static pthread_mutex_t m_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cfgs_hash       *m_cache      = NULL;  /* written under m_cache_mutex */
+static client_conn     *m_cache_conn = NULL;
+/* bumped by each drop: an answer read meanwhile may be stale already */
+static unsigned long   m_cache_gen   = 0;
 
 
-static int 
-connect_daemon()
+static client_conn *
+conn_open( void )
 {
     /* FIXME: catch SIGPIPE, set alarm */
+    const char  *env = getenv( CFGS_ENV_HOST_PROTO );
+    client_conn *c   = XCALLOC( client_conn, 1 );
+    
+    if ( !c )
+        return NULL;
     
-    /*int sock = cfgst_connect( CSST_INET, "127.0.0.1", CFGS_CONFIGD_PORT );*/
-    int sock = cfgst_connect( CSST_UNIX, CFGS_CONFIGD_PATH, CFGS_CONFIGD_PORT/*useless*/ );
+    /*c->sock = cfgst_connect( CSST_INET, "127.0.0.1", CFGS_CONFIGD_PORT );*/
+    c->sock = cfgst_connect( CSST_UNIX, CFGS_CONFIGD_PATH, CFGS_CONFIGD_PORT/*useless*/ );
     //FIXME: send credentials ?
     
-    return sock;
+    c->hproto = CFGSP_HOST_PROTO_HTTP;
+    if ( c->sock >= 0 && !(env && 0 == strcmp(env, "http")) ) {
+        /* Older daemons drop the connection: reconnect and stay on xml/http */
+        if ( cfgsp_request_proto(c->sock, CFGSP_HOST_PROTO_BIN) ) {
+            c->hproto = CFGSP_HOST_PROTO_BIN;
+        } else {
+            cfgst_disconnect( c->sock );
+            close( c->sock );
+            c->sock = cfgst_connect( CSST_UNIX, CFGS_CONFIGD_PATH, CFGS_CONFIGD_PORT );
+        }
+    }
+    
+    if ( c->sock < 0 ) {
+        xfree( c );
+        return NULL;
+    }
+    return c;
+}
+
+
+static void
+conn_close( client_conn *c )
+{
+    cfgst_disconnect( c->sock );
+    close( c->sock );
+    xfree( c );
+}
+
+
+/* An idle connection must have nothing to read: else it is closed or late */
+static bool
+conn_clean( client_conn *c )
+{
+    struct pollfd pfd;
+    
+    if ( cfgst_rbuf_pending(c->sock) > 0 )
+        return false;
+    
+    pfd.fd      = c->sock;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+    return 0 == poll( &pfd, 1, 0 );
+}
+
+
+/* Under m_conn_mutex */
+static int
+pool_size( void )
+{
+    if ( m_pool_size < 0 ) {
+        const char *env = getenv( CFGS_ENV_CLIENT_POOL );
+        
+        m_pool_size = env ? atoi( env ) : CGFS_CLIENT_POOL;
+        if ( m_pool_size < 0 ) 
+            m_pool_size = 0;
+    }
+    return m_pool_size;
+}
+
+
+/* An idle connection from the pool, else a new one */
+static client_conn *
+conn_get( void )
+{
+    client_conn *c;
+    
+    for ( ;; ) {
+        pthread_mutex_lock( &m_conn_mutex );
+        c = m_idle;
+        if ( c ) {
+            m_idle = c->next;
+            m_nidle--;
+        }
+        pthread_mutex_unlock( &m_conn_mutex );
+        
+        if ( !c ) 
+            return conn_open();
+        
+        c->next = NULL;
+        if ( conn_clean(c) )
+            return c;
+        /* the daemon went away or restarted */
+        conn_close( c );
+    }
 }
 
 
 static void
-disconnect_daemon()
+conn_put( client_conn *c )
+{
+    /* answers not collected, or the rest of one cut short, would go to 
+       the next session; so would a request cut short be completed by its 
+       first one */
+    if ( !c->broken && c->submitted == c->collected ) {
+        c->submitted = c->collected = 0;
+        
+        pthread_mutex_lock( &m_conn_mutex );
+        if ( m_nidle < pool_size() ) {
+            c->next = m_idle;
+            m_idle  = c;
+            m_nidle++;
+            c = NULL;
+        }
+        pthread_mutex_unlock( &m_conn_mutex );
+    }
+    
+    if ( c ) 
+        conn_close( c );
+}
+
+
+static void cache_stop( void );
+
+
+/* Synchronous calls would read answers to submitted requests */
+static bool
+pipeline_idle( cfgs_session *sess, client_conn *c )
 {
-    cfgst_disconnect( m_connect );
+    if ( c->submitted != c->collected ) {
+        cfgs_session_store_error( sess, CFGS_ERRT_INTERNAL, 
+                CFGSP_ERR_PIPELINE, NULL );
+        return false;
+    }
+    return true;
 }
 
 
 cfgs_session *
 cfgs_connect( void )
 {
-    cfgs_session *sess = NULL;
+    cfgs_session *sess = cfgs_session_new();
+    client_conn  *c;
+    bool         ok;
+    
+    if ( !sess )
+        return (cfgs_session*)0;
     
     /* FIXME: if cannot connect to daemon, load bootstrap */  
-    m_connect = connect_daemon();
-    if ( m_connect < 0 ) {
+    c = conn_get();
+    
+    pthread_mutex_lock( &m_conn_mutex );
+    if ( !c && !m_backend ) {
         /* FIXME: move it out ? */
-        if ( !cfgsb_init() ) 
-            return (cfgs_session*)0;
-     
-        m_backend = cfgsb_load_backend( m_module );
+        if ( cfgsb_init() ) 
+            m_backend = cfgsb_load_backend( m_module );
     }
+    ok = ( c || m_backend );
+    if ( ok ) 
+        m_nsessions++;
+    pthread_mutex_unlock( &m_conn_mutex );
     
-    if ( !m_backend && m_connect == CFGST_INVALID_SOCKET ) 
+    if ( !ok ) {
+        cfgs_session_free( sess );
         return (cfgs_session*)0;
+    }
     
-    sess = cfgs_session_new();
-    
+    cfgs_session_set_conn( sess, c );
     return sess;
 }
 
 
 bool 
-cfgs_disconnect( cfgs_session *c )
+cfgs_disconnect( cfgs_session *s )
 {
-    lassert( m_backend != NULL || m_connect > 0 );
-    if ( m_connect > 0 ) {
-        disconnect_daemon();
-        m_connect = CFGST_INVALID_SOCKET;
-    } else {
+    client_conn *c;
+    bool        last;
+    
+    if ( !s )
+        return false;
+    
+    c = SESS_CONN( s );
+    if ( c ) 
+        conn_put( c );
+    
+    pthread_mutex_lock( &m_conn_mutex );
+    lassert( m_nsessions > 0 );
+    last = ( --m_nsessions == 0 );
+    if ( last && m_backend ) {
         cfgsb_unload_backend( m_backend ); 
         m_backend = NULL;
         /* FIXME: move it out ? */
         (void)cfgsb_shutdown();
     }
-    lassert( m_backend == NULL && m_connect == CFGST_INVALID_SOCKET );
+    pthread_mutex_unlock( &m_conn_mutex );
+    
+    /* the connections stay in the pool for the next sessions */
+    if ( last ) 
+        cache_stop();
     
-    cfgs_session_free( c );
+    cfgs_session_free( s );
     
     return true; 
 }
 
 
+static void
+cache_item_free( cache_item *ci )
+{
+    if ( ci->name )  xfree( ci->name );
+    if ( ci->layer ) xfree( ci->layer );
+    if ( ci->vals )  CFGST_DLIST_FREE( ci->vals, cfgs_entry_free );
+    xfree( ci );
+}
+
+
+static void
+cache_chain_free( void *chain )
+{
+    CFGST_DLIST_FREE( (cache_item*)chain, cache_item_free );
+}
+
+
+/* Under m_cache_mutex */
+static void
+cache_free( void )
+{
+    m_cache_gen++;
+    if ( m_cache ) {
+        cfgs_hash_free( m_cache, cache_chain_free );
+        __atomic_store_n( &m_cache, NULL, __ATOMIC_RELEASE );
+    }
+    if ( m_cache_conn ) {
+        conn_close( m_cache_conn );
+        m_cache_conn = NULL;
+    }
+}
+
+
+static void
+cache_stop( void )
+{
+    pthread_mutex_lock( &m_cache_mutex );
+    cache_free();
+    pthread_mutex_unlock( &m_cache_mutex );
+}
+
+
+/* 
+ * The cache key of name: '.' and '/' separators name the same value, as 
+ * in the backends.  Free it.  
+ */
+static char *
+cache_key( const char *name )
+{
+    char *key = xstrdup( name );
+    char *p;
+    
+    for ( p=key; p && *p; p++ ) {
+        if ( *p == '.' )
+            *p = '/';
+    }
+    
+    return key;
+}
+
+
+/* Drop name, for all layers.  A pattern drops everything.  Under m_cache_mutex */
+static void
+cache_drop( const char *name, const char *layer )
+{
+    char *key;
+    
+    if ( !m_cache || !name ) 
+        return;
+    
+    m_cache_gen++;
+    key = strpbrk( name, "*?[" ) ? NULL : cache_key( name );
+    if ( !key ) {
+        cfgs_hash_free( m_cache, cache_chain_free );
+        /* if out of memory, the cache is off until turned on again */
+        __atomic_store_n( &m_cache, cfgs_hash_new(CACHE_HASH_SIZE), __ATOMIC_RELEASE );
+    } else {
+        cfgs_hash_delete( m_cache, key, NULL, cache_chain_free );
+        xfree( key );
+    }
+}
+
+
+static void
+cache_drop_entries( cfgs_entry *vl )
+{
+    cfgs_entry *v;
+    
+    if ( !__atomic_load_n(&m_cache, __ATOMIC_ACQUIRE) ) 
+        return;
+    
+    pthread_mutex_lock( &m_cache_mutex );
+    for ( v=vl; v && m_cache; v=v->next ) {
+        cache_drop( cfgs_entry_attr(v, CFGS_EA_NAME), NULL );
+    }
+    pthread_mutex_unlock( &m_cache_mutex );
+}
+
+
+static void
+cache_drop_name( const char *name )
+{
+    if ( !__atomic_load_n(&m_cache, __ATOMIC_ACQUIRE) ) 
+        return;
+    
+    pthread_mutex_lock( &m_cache_mutex );
+    cache_drop( name, NULL );
+    pthread_mutex_unlock( &m_cache_mutex );
+}
+
+
+/* Under m_cache_mutex.  @param key from cache_key */
+static void
+cache_add( const char *key, const char *layer, cfgs_entry *vals )
+{
+    cache_item *chain, *ci = XCALLOC( cache_item, 1 );
+    
+    if ( !ci )
+        return;
+    ci->name  = xstrdup( key );
+    ci->layer = xstrdup( layer );
+    ci->vals  = cfgs_entries_dup( vals );
+    if ( !ci->name || !ci->layer || !ci->vals ) {
+        cache_item_free( ci );
+        return;
+    }
+    ci = (cache_item*)cfgs_dlist_cons( (cfgs_dlist*)ci );
+    
+    chain = (cache_item*)cfgs_hash_find( m_cache, key );
+    if ( chain ) {
+        (void)cfgs_dlist_add_tail( (cfgs_dlist*)chain, (cfgs_dlist*)ci );
+    } else if ( cfgs_hash_insert(m_cache, ci->name, ci, 0) == CFGST_HASH_INVALID_IDX ) {
+        cache_item_free( ci );
+    }
+}
+
+
+/* cfgs_getval through the cache.  Patterns are not cached. */
+static cfgs_entry*
+cache_getval( cfgs_session *sess, client_conn *c, const char *name, const char *layer )
+{
+    cache_item    *ci  = NULL;
+    cfgs_entry    *pv  = NULL;
+    char          *key = strpbrk( name, "*?[" ) ? NULL : cache_key( name );
+    unsigned long gen;
+    cfgs_err      err = *cfgs_session_geterr( sess );
+    
+    pthread_mutex_lock( &m_cache_mutex );
+    
+    /* apply the changes the daemon pushed so far; if the cache cannot 
+       follow them any more, it goes and the daemon answers: its error is 
+       not the caller's, errors stored are not overwritten */
+    if ( m_cache && !cfgsp_poll_push(sess, m_cache_conn->sock, m_cache_conn->hproto) ) {
+        cache_free();
+        *cfgs_session_geterr( sess ) = err;
+    }
+    
+    if ( m_cache && key ) 
+        ci = (cache_item*)cfgs_hash_find( m_cache, key );
+    for ( ; ci; ci=ci->next ) {
+        if ( 0 == strcmp(ci->layer, layer) ) {
+            pv = cfgs_entries_dup( ci->vals );
+            break;
+        }
+    }
+    gen = m_cache_gen;
+    pthread_mutex_unlock( &m_cache_mutex );
+    if ( ci ) {
+        xfree( key );
+        return pv;
+    }
+    
+    pv = (cfgs_entry*)cfgsp_send_rq( sess, c->sock, c->hproto, &c->broken, 
+            CFGS_GETVAL, name, layer );
+    if ( pv && key ) {
+        pthread_mutex_lock( &m_cache_mutex );
+        if ( m_cache && gen == m_cache_gen ) 
+            cache_add( key, layer, pv );
+        pthread_mutex_unlock( &m_cache_mutex );
+    }
+    
+    xfree( key );
+    return pv;
+}
+
+
 cfgs_entry*
 cfgs_getval( cfgs_session *sess, const char *name, const char *layer )
 {
     cfgs_entry     *pv = NULL;
+    client_conn    *c;
     
     if ( !sess || !name )
         return NULL;
@@ -123,8 +504,13 @@ cfgs_getval( cfgs_session *sess, const char *name, const char *layer )
         layer = CFGS_DEFAULT_LAYER; 
     }
     
-    if ( m_connect != CFGST_INVALID_SOCKET ) {
-        pv = (cfgs_entry*)cfgsp_send_rq( sess, m_connect, CFGSP_HOST_PROTO_HTTP, 
+    c = SESS_CONN( sess );
+    if ( c ) {
+        if ( !pipeline_idle(sess, c) )
+            return NULL;
+        if ( __atomic_load_n(&m_cache, __ATOMIC_ACQUIRE) ) 
+            return cache_getval( sess, c, name, layer );
+        pv = (cfgs_entry*)cfgsp_send_rq( sess, c->sock, c->hproto, &c->broken, 
                 CFGS_GETVAL, name, layer );
     } else {
         lassert( m_backend != NULL );
@@ -135,6 +521,34 @@ cfgs_getval( cfgs_session *sess, const char *name, const char *layer )
 }
 
 
+cfgs_entry*
+cfgs_getvals( cfgs_session *sess, const char **names, int n, const char *layer )
+{
+    cfgs_entry     *pv = NULL;
+    client_conn    *c;
+    
+    if ( !sess || !names || n <= 0 )
+        return NULL;
+    
+    if ( !layer ) {
+        layer = CFGS_DEFAULT_LAYER; 
+    }
+    
+    c = SESS_CONN( sess );
+    if ( c ) {
+        if ( !pipeline_idle(sess, c) )
+            return NULL;
+        pv = (cfgs_entry*)cfgsp_send_rq( sess, c->sock, c->hproto, &c->broken, 
+                CFGS_GETVALS, names, n, layer );
+    } else {
+        lassert( m_backend != NULL );
+        pv = (*m_backend->cfgs_getvals)( sess, names, n, layer );
+    }
+    
+    return pv;
+}
+
+
 static bool
 set_layer( cfgs_entry *head )
 {
@@ -155,7 +569,8 @@ set_layer( cfgs_entry *head )
 int 
 cfgs_setval( cfgs_session *sess, cfgs_entry *vl )
 {
-    int        nvals = 0;
+    int         nvals = 0;
+    client_conn *c;
     
     if ( !sess || !vl )
         return -1;
@@ -163,8 +578,12 @@ cfgs_setval( cfgs_session *sess, cfgs_entry *vl )
     if ( !set_layer(vl) )
             return -1;
     
-    if ( m_connect != CFGST_INVALID_SOCKET ) {
-        nvals = (int)cfgsp_send_rq( sess, m_connect, CFGSP_HOST_PROTO_HTTP, CFGS_SETVAL, vl ); 
+    c = SESS_CONN( sess );
+    if ( c ) {
+        if ( !pipeline_idle(sess, c) )
+            return -1;
+        cache_drop_entries( vl );
+        nvals = (int)cfgsp_send_rq( sess, c->sock, c->hproto, &c->broken, CFGS_SETVAL, vl ); 
     } else {
         lassert( m_backend != NULL );
         nvals = (*m_backend->cfgs_setval)( sess, vl );
@@ -177,7 +596,8 @@ cfgs_setval( cfgs_session *sess, cfgs_entry *vl )
 int 
 cfgs_rmval( cfgs_session *sess, const char *name, const char *layer )
 {
-    int nvals = 0;
+    int         nvals = 0;
+    client_conn *c;
     
     if ( !sess || !name )
         return -1;
@@ -186,8 +606,12 @@ cfgs_rmval( cfgs_session *sess, const char *name, const char *layer )
         layer = CFGS_DEFAULT_LAYER; 
     }
     
-    if ( m_connect != CFGST_INVALID_SOCKET ) {
-        nvals = (int)cfgsp_send_rq( sess, m_connect, CFGSP_HOST_PROTO_HTTP, 
+    c = SESS_CONN( sess );
+    if ( c ) {
+        if ( !pipeline_idle(sess, c) )
+            return -1;
+        cache_drop_name( name );
+        nvals = (int)cfgsp_send_rq( sess, c->sock, c->hproto, &c->broken, 
                 CFGS_RMVAL, name, layer ); 
     } else {
         lassert( m_backend != NULL );
@@ -204,7 +628,7 @@ cfgs_get_backends( void )
 {
     cfgs_str      *strs = NULL;
     
-    lassert( m_backend != NULL || m_connect > 0 );
+    lassert( m_nsessions > 0 );
     
     if ( m_backend ) {
         cfgs_backend  *bk   = m_backend;
@@ -220,8 +644,8 @@ cfgs_get_backends( void )
             
             bk = bk->next;
         }
-    } else if ( m_connect != CFGST_INVALID_SOCKET ) {
-        /*FIXME*/
+    } else {
+        /*FIXME: ask the daemon */
     }
     
     return strs;
@@ -246,27 +670,58 @@ getstats( cfgs_session *sess )
 int 
 cfgs_register_notif( cfgs_session *sess, cfgs_notif *notif )
 {
-    int ret;
+    int         ret;
+    client_conn *c;
     
     if ( !sess || !notif )
         return -1; 
     
-    if ( m_connect == CFGST_INVALID_SOCKET ) {
+    c = SESS_CONN( sess );
+    if ( !c ) {
         cfgs_session_store_error( sess, CFGS_ERRT_INTERNAL, 
                 CFGSP_ERR_SERVER_CONNECT, NULL );
         return -1; 
     }
     
-    ret = (int)cfgsp_send_rq( sess, m_connect, CFGSP_HOST_PROTO_HTTP, 
+    if ( !pipeline_idle(sess, c) )
+        return -1;
+    
+    ret = (int)cfgsp_send_rq( sess, c->sock, c->hproto, &c->broken, 
                     CFGS_REG_NOTIF, notif ); 
     return ret; 
 }
 
 
+int 
+cfgs_unregister_notif( cfgs_session *sess, cfgs_notif *notif )
+{
+    int         ret;
+    client_conn *c;
+    
+    if ( !sess || !notif )
+        return -1; 
+    
+    c = SESS_CONN( sess );
+    if ( !c ) {
+        cfgs_session_store_error( sess, CFGS_ERRT_INTERNAL, 
+                CFGSP_ERR_SERVER_CONNECT, NULL );
+        return -1; 
+    }
+    
+    if ( !pipeline_idle(sess, c) )
+        return -1;
+    
+    ret = (int)cfgsp_send_rq( sess, c->sock, c->hproto, &c->broken, 
+                    CFGS_UNREG_NOTIF, notif ); 
+    return ret; 
+}
+
+
 cfgs_str *
 cfgs_getsubvals( cfgs_session *sess, const char *valname, const char *layer )
 {
     cfgs_str     *pv = NULL;
+    client_conn  *c;
     
     if ( !sess || !valname )
         return NULL;
@@ -275,8 +730,11 @@ cfgs_getsubvals( cfgs_session *sess, const char *valname, const char *layer )
         layer = CFGS_DEFAULT_LAYER; 
     }
     
-    if ( m_connect != CFGST_INVALID_SOCKET ) {
-        pv = (cfgs_str*)cfgsp_send_rq( sess, m_connect, CFGSP_HOST_PROTO_HTTP, 
+    c = SESS_CONN( sess );
+    if ( c ) {
+        if ( !pipeline_idle(sess, c) )
+            return NULL;
+        pv = (cfgs_str*)cfgsp_send_rq( sess, c->sock, c->hproto, &c->broken, 
                 CFGS_GETSUBVALS, valname, layer );
     } else {
         lassert( m_backend != NULL );
@@ -291,12 +749,16 @@ cfgs_str *
 cfgs_getsublayers( cfgs_session *sess, const char *layername )
 {
     cfgs_str     *pv = NULL;
+    client_conn  *c;
     
     if ( !sess || !layername )
         return NULL;
     
-    if ( m_connect != CFGST_INVALID_SOCKET ) {
-        pv = (cfgs_str*)cfgsp_send_rq( sess, m_connect, CFGSP_HOST_PROTO_HTTP, 
+    c = SESS_CONN( sess );
+    if ( c ) {
+        if ( !pipeline_idle(sess, c) )
+            return NULL;
+        pv = (cfgs_str*)cfgsp_send_rq( sess, c->sock, c->hproto, &c->broken, 
                 CFGS_GETSUBLAYERS, layername );
     } else {
         lassert( m_backend != NULL );
@@ -311,12 +773,16 @@ cfgs_str *
 cfgs_getinfos( cfgs_session *sess )
 {
     cfgs_str     *pv = NULL;
+    client_conn  *c;
     
     if ( !sess )
         return NULL;
     
-    if ( m_connect != CFGST_INVALID_SOCKET ) {
-        pv = (cfgs_str*)cfgsp_send_rq( sess, m_connect, CFGSP_HOST_PROTO_HTTP, 
+    c = SESS_CONN( sess );
+    if ( c ) {
+        if ( !pipeline_idle(sess, c) )
+            return NULL;
+        pv = (cfgs_str*)cfgsp_send_rq( sess, c->sock, c->hproto, &c->broken, 
                 CFGS_GETINFOS );
     } else {
         lassert( m_backend != NULL );
@@ -335,3 +801,291 @@ cfgs_getinfos( cfgs_session *sess )
 }
 
 
+static int
+submitted( client_conn *c, CFGS_FUNC_INDEX idx, bool sent )
+{
+    if ( !sent ) 
+        return -1;
+    
+    c->pending[c->submitted % CGFS_PIPELINE_DEPTH] = idx;
+    return ++c->submitted;
+}
+
+
+/* Checks before submitting one more request.  @return the connection */
+static client_conn *
+can_submit( cfgs_session *sess )
+{
+    client_conn *c = SESS_CONN( sess );
+    
+    if ( !c ) {
+        cfgs_session_store_error( sess, CFGS_ERRT_INTERNAL, 
+                CFGSP_ERR_SERVER_CONNECT, NULL );
+        return NULL; 
+    }
+    if ( c->submitted - c->collected >= CGFS_PIPELINE_DEPTH ) {
+        cfgs_session_store_error( sess, CFGS_ERRT_INTERNAL, 
+                CFGSP_ERR_PIPELINE, NULL );
+        return NULL; 
+    }
+    
+    return c;
+}
+
+
+int 
+cfgs_submit_getval( cfgs_session *sess, const char *name, const char *layer )
+{
+    client_conn *c;
+    
+    if ( !sess || !name )
+        return -1;
+    
+    if ( !layer ) {
+        layer = CFGS_DEFAULT_LAYER; 
+    }
+    
+    if ( !(c = can_submit(sess)) )
+        return -1;
+    
+    return submitted( c, CFGS_GETVAL, 
+            cfgsp_submit_rq(sess, c->sock, c->hproto, &c->broken, CFGS_GETVAL, name, layer) );
+}
+
+
+int 
+cfgs_submit_setval( cfgs_session *sess, cfgs_entry *vl )
+{
+    client_conn *c;
+    
+    if ( !sess || !vl )
+        return -1;
+    
+    if ( !set_layer(vl) )
+            return -1;
+    
+    if ( !(c = can_submit(sess)) )
+        return -1;
+    
+    cache_drop_entries( vl );
+    return submitted( c, CFGS_SETVAL, 
+            cfgsp_submit_rq(sess, c->sock, c->hproto, &c->broken, CFGS_SETVAL, vl) );
+}
+
+
+int 
+cfgs_submit_rmval( cfgs_session *sess, const char *name, const char *layer )
+{
+    client_conn *c;
+    
+    if ( !sess || !name )
+        return -1;
+    
+    if ( !layer ) {
+        layer = CFGS_DEFAULT_LAYER; 
+    }
+    
+    if ( !(c = can_submit(sess)) )
+        return -1;
+    
+    cache_drop_name( name );
+    return submitted( c, CFGS_RMVAL, 
+            cfgsp_submit_rq(sess, c->sock, c->hproto, &c->broken, CFGS_RMVAL, name, layer) );
+}
+
+
+int 
+cfgs_collect( cfgs_session *sess, cfgs_entry **vals, int *nvals )
+{
+    CFGS_FUNC_INDEX idx;
+    void            *answer;
+    client_conn     *c;
+    
+    if ( !sess )
+        return -1;
+    
+    if ( vals ) *vals = NULL;
+    if ( nvals ) *nvals = 0;
+    
+    c = SESS_CONN( sess );
+    if ( !c || c->submitted == c->collected )
+        return 0;
+    
+    idx    = c->pending[c->collected % CGFS_PIPELINE_DEPTH];
+    answer = cfgsp_collect_rq( sess, c->sock, c->hproto, &c->broken );
+    
+    switch ( idx ) {
+    case CFGS_GETVAL:
+        if ( vals ) 
+            *vals = (cfgs_entry*)answer;
+        else 
+            CFGST_DLIST_FREE( (cfgs_entry*)answer, cfgs_entry_free );
+        break;
+    case CFGS_SETVAL:
+    case CFGS_RMVAL:
+        if ( nvals ) 
+            *nvals = (int)answer;
+        break;
+    default:
+        lassert( !"cfgs_collect: unexpected request" );
+        break;
+    }
+    
+    return ++c->collected;
+}
+
+
+/* Called by cfgsp_poll_push from cache_getval, under m_cache_mutex */
+static void
+cache_push( const char *name, const char *layer )
+{
+    LOG( cfgs_log(CFGST_LL_INFO, "cache_push %s\n", name); );
+    cache_drop( name, layer );
+}
+
+
+/* Have every change pushed on a connection of the cache's own.  Under m_cache_mutex */
+static bool
+cache_start( cfgs_session *sess )
+{
+    cfgs_notif *notif;
+    int        ret = -1;
+    
+    cache_free();
+    m_cache_conn = conn_open();
+    if ( !m_cache_conn ) {
+        cfgs_session_store_error( sess, CFGS_ERRT_INTERNAL, 
+                CFGSP_ERR_SERVER_CONNECT, NULL );
+        return false; 
+    }
+    
+    notif = cfgs_notif_conn_new( "*" );
+    if ( notif ) {
+        cfgsp_set_push_callback( cache_push );
+        ret = (int)cfgsp_send_rq( sess, m_cache_conn->sock, m_cache_conn->hproto, NULL, 
+                    CFGS_REG_NOTIF, notif ); 
+        cfgs_notif_free( notif );
+    }
+    /* older daemons do not know CSNT_CONN and drop the connection */
+    if ( ret == 1 ) 
+        __atomic_store_n( &m_cache, cfgs_hash_new(CACHE_HASH_SIZE), __ATOMIC_RELEASE );
+    if ( !m_cache ) {
+        cache_free();
+        return false;
+    }
+    
+    return true;
+}
+
+
+bool
+cfgs_set_cache( cfgs_session *sess, bool on )
+{
+    bool ok = true;
+    
+    if ( !sess )
+        return false;
+    
+    if ( !on ) {
+        cache_stop();
+        return true;
+    }
+    
+    if ( !SESS_CONN(sess) ) {
+        cfgs_session_store_error( sess, CFGS_ERRT_INTERNAL, 
+                CFGSP_ERR_SERVER_CONNECT, NULL );
+        return false; 
+    }
+    
+    pthread_mutex_lock( &m_cache_mutex );
+    if ( !m_cache ) 
+        ok = cache_start( sess );
+    pthread_mutex_unlock( &m_cache_mutex );
+    
+    return ok;
+}
+
+
+struct _cfgs_subscription {
+    int          sock;
+    cfgs_session *sess;  /* of its own: reading changes is not a request */
+};
+
+
+cfgs_subscription *
+cfgs_subscribe( cfgs_session *sess, const char *valname )
+{
+    cfgs_subscription *sub;
+    cfgs_notif        *notif;
+    int               ret;
+    
+    if ( !sess || !valname )
+        return NULL;
+    
+    sub = XCALLOC( cfgs_subscription, 1 );
+    if ( !sub ) 
+        return NULL;
+    sub->sess = cfgs_session_new();
+    sub->sock = cfgst_connect( CSST_UNIX, CFGS_CONFIGD_PATH, CFGS_CONFIGD_PORT );
+    if ( !sub->sess || sub->sock < 0 ) {
+        cfgs_session_store_error( sess, CFGS_ERRT_INTERNAL, 
+                CFGSP_ERR_SERVER_CONNECT, NULL );
+        cfgs_unsubscribe( sub );
+        return NULL; 
+    }
+    
+    /* changes are only streamed with the bin protocol */
+    ret   = -1;
+    notif = cfgs_notif_stream_new( valname );
+    if ( notif && cfgsp_request_proto(sub->sock, CFGSP_HOST_PROTO_BIN) ) {
+        ret = (int)cfgsp_send_rq( sess, sub->sock, CFGSP_HOST_PROTO_BIN, NULL, 
+                    CFGS_REG_NOTIF, notif ); 
+    }
+    if ( notif )
+        cfgs_notif_free( notif );
+    if ( ret != 1 ) {
+        if ( !cfgs_iserr(cfgs_session_geterr(sess)) ) 
+            cfgs_session_store_error( sess, CFGS_ERRT_INTERNAL, 
+                    CFGSP_ERR_SERVER, "subscribe" );
+        cfgs_unsubscribe( sub );
+        return NULL;
+    }
+    
+    return sub;
+}
+
+
+int
+cfgs_subscription_fd( cfgs_subscription *sub )
+{
+    return sub ? sub->sock : CFGST_INVALID_SOCKET;
+}
+
+
+int
+cfgs_read_changes( cfgs_subscription *sub, CFGS_CHANGE_CALLBACK *cb, 
+                   void *arg, int microsec )
+{
+    if ( !sub || !cb || sub->sock < 0 )
+        return -1;
+    
+    return cfgsp_read_changes( sub->sess, sub->sock, CFGSP_HOST_PROTO_BIN, 
+                               cb, arg, microsec );
+}
+
+
+void
+cfgs_unsubscribe( cfgs_subscription *sub )
+{
+    if ( !sub )
+        return;
+    
+    /* the daemon drops the requests of a closed connection */
+    if ( sub->sock >= 0 ) {
+        cfgst_disconnect( sub->sock );
+        close( sub->sock );
+    }
+    if ( sub->sess ) 
+        cfgs_session_free( sub->sess );
+    xfree( sub );
+}
@@ -53,19 +53,26 @@ extern "C" {
     X( CFGS_GETSUBVALS,    cfgs_getsubvals )   /* key/layer namespace navigation */ \
     X( CFGS_GETSUBLAYERS,  cfgs_getsublayers )   \
     X( CFGS_GETINFOS,      cfgs_getinfos )   \
+    X( CFGS_GETVALS,       cfgs_getvals )    /* batched cfgs_getval */ \
+    X( CFGS_UNREG_NOTIF,   cfgs_unregister_notif )   \
     /**/
 /**
  *  \def CFGS_CRT_REV
  *  Increment it each time CFGS_API_EXPORTS changes and inspect
  *  code where compiler fails.  
  */
-#define CFGS_CRT_REV      4
+#define CFGS_CRT_REV      6
 /* increment when API changes */
 #define CFGS_API_VERSION  "1.0"
 
 
 
 /* FIXME scurit: a dfinir modalits d'authentification: c'est quoi credentials/session */
+/**
+ * A session has a daemon connection of its own, from the process' pool (see 
+ * CGFS_CLIENT_POOL): threads using sessions of their own do not wait for 
+ * each other.  A session is used by one thread at a time.  
+ */
 cfgs_session *cfgs_connect( void );
 bool         cfgs_disconnect( cfgs_session *s );
 
@@ -77,10 +84,21 @@ bool         cfgs_disconnect( cfgs_session *s );
  * If attribute 'layer' is NULL, it defaults to CFGS_DEFAULT_LAYER.  
  */
 cfgs_entry *cfgs_getval( cfgs_session *s, const char *name, const char *layer );
+/** 
+ * cfgs_getval for @param n names at once, in one round trip to the daemon.  
+ * @return the entries found, in @param names order, or NULL.  There is no 
+ * entry for a name not found and there may be several for one: match them 
+ * to @param names by their CFGS_EA_NAME, not by position.  
+ * Free the list after usage.  
+ */
+cfgs_entry *cfgs_getvals( cfgs_session *s, const char **names, int n, const char *layer );
 
 /** 
- * Set value(s) - @param v is a chained list. @return number of stored values or
- * -1 on error. 
+ * Set value(s) - @param v is a chained list, sent to the daemon as one 
+ * request. @return number of stored values or -1 on error. 
+ * The list is stored in order up to the first value failing, which sets 
+ * the error: the values before it stay stored and are counted.  -1 if it 
+ * is the first one.  
  */
 int cfgs_setval( cfgs_session *s, cfgs_entry *v );
 /**
@@ -142,6 +160,61 @@ cfgs_str   *cfgs_get_backends( void );
  * or -1 if error on client' side.  
  */
 int     cfgs_register_notif( cfgs_session *s, cfgs_notif *notif );
+/**
+ * Drop the notification requests registered for the same value name and 
+ * recipient as @param notif.  Returns the number of requests removed 
+ * or -1 if error on client' side.  
+ */
+int     cfgs_unregister_notif( cfgs_session *s, cfgs_notif *notif );
+
+/** 
+ * Pipelining: submit requests to the daemon without waiting for the answers, 
+ * then collect the answers in submit order.  At most CGFS_PIPELINE_DEPTH 
+ * answers can be pending; meanwhile the calls above fail with 
+ * CFGSP_ERR_PIPELINE.  Needs a running daemon.  
+ * @return a ticket (>0) identifying the request or -1 on error.  
+ */
+int     cfgs_submit_getval( cfgs_session *s, const char *name, const char *layer );
+int     cfgs_submit_setval( cfgs_session *s, cfgs_entry *v );
+int     cfgs_submit_rmval( cfgs_session *s, const char *name, const char *layer );
+/**
+ * Collect the answer to the oldest submitted request: the getval entry in 
+ * @param vals (free it), the setval/rmval count in @param nvals.  
+ * @return the request's ticket, 0 if nothing pending or -1 on error.  
+ */
+int     cfgs_collect( cfgs_session *s, cfgs_entry **vals, int *nvals );
+
+/**
+ * Turn on/off the process' cache of cfgs_getval answers, shared by its 
+ * sessions.  The daemon pushes value changes on a connection of the cache's 
+ * and the cache drops them; a hit costs no round trip.  A process more 
+ * than CGFS_NOTIF_BACKLOG bytes behind reading them has its cache dropped 
+ * whole.  Needs a running daemon.  @return false on error.  
+ */
+bool    cfgs_set_cache( cfgs_session *s, bool on );
+
+/**
+ * Subscriptions: the daemon streams the changes of the values matching 
+ * @param valname (an fnmatch pattern), with their new value, on a connection
+ * of the subscription's own.  Changes come in batches.  A subscriber more 
+ * than CGFS_NOTIF_BACKLOG bytes behind loses changes, then gets one named 
+ * CFGS_CHANGES_LOST once it caught up.  Needs a running daemon.  
+ */
+#define CFGS_CHANGES_LOST  "*"
+typedef struct _cfgs_subscription cfgs_subscription;
+/** @param value is NULL if the value was removed */
+typedef void (CFGS_CHANGE_CALLBACK)( const char *valname, const char *layer, 
+                                     const char *value, void *arg );
+cfgs_subscription *cfgs_subscribe( cfgs_session *s, const char *valname );
+/** To wait for changes with select/poll */
+int     cfgs_subscription_fd( cfgs_subscription *sub );
+/**
+ * Wait up to @param microsec for changes then pass all those arrived to 
+ * @param cb.  @return their number or -1 if the subscription is broken.  
+ */
+int     cfgs_read_changes( cfgs_subscription *sub, CFGS_CHANGE_CALLBACK *cb, 
+                           void *arg, int microsec );
+void    cfgs_unsubscribe( cfgs_subscription *sub );
 
 /* free returned pointer */
 cfgs_stats *cs_getstats( cfgs_session *s );
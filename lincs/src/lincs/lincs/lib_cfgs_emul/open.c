@@ -27,24 +27,35 @@
 
 
 #include "cfgs/cfgs_config.h"
+#include "cfgs_client_api.h"
+#include "cfgs_sock.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>  /*memfd_create*/
+#include <sys/wait.h>
 #include <fcntl.h>
 #include <stdarg.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
 
 
-#define INVALID_FD    (-1)
+#define INVALID_FD       (-1)
+#define NOT_REGENERATED  (-2)
 
 #define TMPFILE_BUFSZ (128)
 #define TMPFILE_TEMPL "/tmp/cs_emul.XXXXXX"
 
 #define REGENERATE_CMD "exec " CFGS_BIN_PATH "/" "cfgs_cat %s"
 
+/* opening it gives a descriptor of its own, offset included, on fd's file; 
+   without /proc, a copy of the file is served */
+#define FD_PATH_FMT    "/proc/self/fd/%d"
+
 
 //-------------------------------------------------------------------
 #if 0
@@ -62,62 +73,280 @@ elog( const char *s )
 #endif
 //-------------------------------------------------------------------
 
- 
-/* FIXME: a 64 version ? */
-#define check_if_regenerated64  check_if_regenerated
 
 /*
- * If returned val is > 0 (a valid file descriptor) all went ok, else
- * returns INVALID_FD.  tmpfile has been closed.  
+ * The files cfgs_cat regenerates, see CFGS_REGENERATED_FILES; any other 
+ * file is opened right away.  Once regenerated, the content is kept and the 
+ * daemon streams the changes of the values it was built from: it is 
+ * regenerated again only after one.  Without a daemon, nothing is kept.  
+ * cfgs_cat and the subscription run off m_files_mutex: the file is marked 
+ * loading meanwhile and the others opening it wait.  
  */
-#define CMDBUF_SZ  (2*FILENAME_MAX + 128)
+typedef enum {
+    RS_UNKNOWN = 0,       /* ask cfgs_cat */
+    RS_LOADING,           /* a thread does, wait for m_files_loaded */
+    RS_REGENERATED,       /* content in fd */
+    RS_NOT_REGENERATED,   /* cfgs_cat failed: open the file itself */
+} REGEN_STATE;
+
+typedef struct _regen_file {
+    const char        *filename;
+    const char        *values;   /* the values it is built from */
+    REGEN_STATE       state;
+    int               fd;
+    cfgs_subscription *sub;
+    pid_t             pid;       /* fd and sub are not a child's to use */
+} regen_file;
+
+#define X( file, values, func )  { file, values, RS_UNKNOWN, INVALID_FD, NULL, 0 },
+static regen_file m_files[] = {
+    CFGS_REGENERATED_FILES
+    { NULL, NULL, RS_UNKNOWN, INVALID_FD, NULL, 0 },
+};
+#undef X
+
+static pthread_mutex_t m_files_mutex  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  m_files_loaded = PTHREAD_COND_INITIALIZER;
+static pthread_once_t  m_files_once   = PTHREAD_ONCE_INIT;
+
+
+/* A fork while another thread holds m_files_mutex must not leave it held */
+static void
+files_prepare( void )
+{
+    pthread_mutex_lock( &m_files_mutex );
+}
+
+
+static void
+files_release( void )
+{
+    pthread_mutex_unlock( &m_files_mutex );
+}
+
+
+/* ... nor a file loading: the thread loading it is not in the child */
+static void
+files_child( void )
+{
+    regen_file *rf;
+    
+    for ( rf=m_files; rf->filename; rf++ ) {
+        if ( rf->state == RS_LOADING ) 
+            rf->state = RS_UNKNOWN;
+    }
+    (void)pthread_cond_init( &m_files_loaded, NULL );
+    pthread_mutex_unlock( &m_files_mutex );
+}
+
+
+static void
+files_atfork( void )
+{
+    (void)pthread_atfork( files_prepare, files_release, files_child );
+}
+
+
+/* Names are matched the way cfgs_cat builds them: cwd/pathname if relative */
+static regen_file *
+find_file( const char *pathname )
+{
+    char       cwd[ FILENAME_MAX ];
+    regen_file *rf;
+    size_t     len = strlen( pathname );
+    
+    for ( rf=m_files; rf->filename; rf++ ) {
+        size_t flen = strlen( rf->filename );
+        
+        if ( *pathname == '/' ) {
+            if ( 0 == strcmp(rf->filename, pathname) ) 
+                return rf;
+            continue;
+        }
+        
+        /* relative: only if the name ends with it ask for the cwd */
+        if (   flen <= len 
+            || rf->filename[flen-len-1] != '/'
+            || 0 != strcmp(rf->filename + flen - len, pathname) ) 
+            continue;
+        if ( getcwd(cwd, FILENAME_MAX) 
+            && strlen(cwd) == flen-len-1 
+            && 0 == strncmp(rf->filename, cwd, flen-len-1) ) 
+            return rf;
+    }
+    
+    return NULL;
+}
+
+
+/* An anonymous file: a memfd, or an unlinked temporary file */
 static int
-check_if_regenerated( const char *pathname, int flags, char *tmpfile )
+content_fd( void )
 {
-    char cmdbuf[ CMDBUF_SZ ] = {0};
-    FILE *regf = NULL;
+    char tmpfile[ TMPFILE_BUFSZ ] = TMPFILE_TEMPL;
+    int  fd;
     
-    /* FIXME: 
-           if !pathname starts with /etc then 
-               if !cwd is /etc then
-                   return
-     */
+#ifdef MFD_ALLOW_SEALING
+    fd = memfd_create( "cs_emul", MFD_CLOEXEC | MFD_ALLOW_SEALING );
+    if ( fd != INVALID_FD ) 
+        return fd;
+#endif
+    
+    /* do not leave behind a bunch of TMPFILE_TEMPL files in /tmp */
+    fd = mkstemp( tmpfile );
+    if ( fd != INVALID_FD ) 
+        unlink( tmpfile );
+    return fd;
+}
+
+
+/*
+ * Run cfgs_cat.  @return a file with what it wrote, at offset 0, or 
+ * INVALID_FD if it could not regenerate pathname.  
+ */
+#define CMDBUF_SZ  (2*FILENAME_MAX + 128)
+static int
+regenerate( const char *pathname )
+{
+    char   cmdbuf[ CMDBUF_SZ ] = {0};
+    char   buf[ 1024 ];
+    FILE   *regf = NULL;
+    int    fd, status;
+    size_t len;
+    bool   ok = true;
     
-    /* avoid a popen loop when opening /dev/tty on some machines */
-    if ( pathname == strstr(pathname, "/dev") )
+    fd = content_fd();
+    if ( fd == INVALID_FD ) 
         return INVALID_FD;
     
     snprintf( cmdbuf, CMDBUF_SZ-1, REGENERATE_CMD, pathname );
     /*FIXME: get rid of popen => pipe+fork+execl+wait4*/
     regf = popen( cmdbuf, "r" );
-    if ( regf ) {
-        int tmpfd = INVALID_FD;
+    if ( !regf ) {
+        __libc_close( fd );
+        return INVALID_FD;
+    }
+    
+    while ( ok && (len = fread(buf, 1, sizeof(buf), regf)) > 0 ) {
+        ok = ( __libc_write(fd, buf, len) == (ssize_t)len );
+    }
+    
+    /* cfgs_cat fails with the files it does not know */
+    status = pclose( regf );
+    if ( !ok || status == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0 ) {
+        __libc_close( fd );
+        return INVALID_FD;
+    }
+    
+#ifdef F_ADD_SEALS
+    (void)fcntl( fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL );
+#endif
+    (void)lseek( fd, 0, SEEK_SET );
+    return fd;
+}
 
-    tmpfd = mkstemp( tmpfile );
 
-        if ( tmpfd == INVALID_FD ) {
-            pclose( regf );
-            return INVALID_FD;
-        }
+/* A copy of what regenerate wrote in from, at offset 0, or INVALID_FD */
+static int
+copy_content( int from, int flags )
+{
+    char    buf[ 1024 ];
+    off_t   off = 0;
+    ssize_t len;
+    int     fd;
+    
+    fd = content_fd();
+    if ( fd == INVALID_FD ) 
+        return INVALID_FD;
+    
+    while ( (len = pread(from, buf, sizeof(buf), off)) > 0 ) {
+        if ( __libc_write(fd, buf, len) != len ) 
+            break;
+        off += len;
+    }
+    if ( len != 0 ) {
+        __libc_close( fd );
+        return INVALID_FD;
+    }
+    
+#ifdef F_ADD_SEALS
+    (void)fcntl( fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL );
+#endif
+    if ( !(flags & O_CLOEXEC) ) 
+        (void)fcntl( fd, F_SETFD, 0 );
+    (void)lseek( fd, 0, SEEK_SET );
+    return fd;
+}
 
-        while ( !feof(regf) ) {
-            char    buf[ 1024 ];
-            size_t  len;
-            len  = fread( buf, 1, 1024, regf );
-            __libc_write( tmpfd, buf, len );
-        }
-       
-        if ( pclose(regf) == -1 ) {
-            __libc_close( tmpfd );
-            unlink( tmpfile );
-            return INVALID_FD;
+
+static void
+ignore_change( const char *valname, const char *layer, const char *value, void *arg )
+{
+}
+
+
+/* Under m_files_mutex.  @return false if rf's values changed, or if unsure */
+static bool
+up_to_date( regen_file *rf )
+{
+    if ( rf->pid != getpid() || !rf->sub ) 
+        return false;
+    return 0 == cfgs_read_changes( rf->sub, ignore_change, NULL, 0 );
+}
+
+
+/* Under m_files_mutex */
+static void
+forget( regen_file *rf )
+{
+    if ( rf->sub ) {
+        if ( rf->pid == getpid() ) {
+            cfgs_unsubscribe( rf->sub );
+        } else {
+            /* FIXME: leaks sub; unsubscribing would shut the parent's connection down */
+            cfgst_rbuf_drop( cfgs_subscription_fd(rf->sub) );
+            __libc_close( cfgs_subscription_fd(rf->sub) );
         }
-        
-        __libc_close( tmpfd );
-        return tmpfd;
-    } /*regf*/
+    }
+    if ( rf->fd != INVALID_FD ) 
+        __libc_close( rf->fd );
+    
+    rf->sub   = NULL;
+    rf->fd    = INVALID_FD;
+    rf->state = RS_UNKNOWN;
+}
+
+
+/* 
+ * Under m_files_mutex, released meanwhile: popen may fork, which takes it 
+ * (see files_prepare), and the daemon may be slow to answer.  
+ */
+static void
+load( regen_file *rf )
+{
+    cfgs_session      *sess;
+    cfgs_subscription *sub = NULL;
+    int               fd;
+    
+    rf->state = RS_LOADING;
+    pthread_mutex_unlock( &m_files_mutex );
     
-    return INVALID_FD;
+    /* subscribe first: a change while cfgs_cat runs is not missed */
+    sess = cfgs_session_new();
+    if ( sess ) {
+        sub = cfgs_subscribe( sess, rf->values );
+        cfgs_session_free( sess );
+    }
+    if ( sub ) 
+        (void)fcntl( cfgs_subscription_fd(sub), F_SETFD, FD_CLOEXEC );
+    fd = regenerate( rf->filename );
+    
+    pthread_mutex_lock( &m_files_mutex );
+    rf->sub   = sub;
+    rf->pid   = getpid();
+    rf->fd    = fd;
+    rf->state = ( fd != INVALID_FD ) ? RS_REGENERATED : RS_NOT_REGENERATED;
+    pthread_cond_broadcast( &m_files_loaded );
 }
 
 
@@ -126,29 +355,60 @@ check_if_regenerated( const char *pathname, int flags, char *tmpfile )
  *      if O_WRONLY || O_RDWR || O_CREAT then return invalid handle
  *      return regenerated
  *
- *  return __libc_open...
+ *  return NOT_REGENERATED
  */
-int 
-open( const char *pathname, int flags, ... ) 
+static int
+open_regenerated( const char *pathname, int flags )
 {
-    int  ret = INVALID_FD;
-    char tmpfile[ TMPFILE_BUFSZ ] = TMPFILE_TEMPL;
-
-    ret = check_if_regenerated( pathname, flags, tmpfile );
-    if ( ret != INVALID_FD ) {
-        int fd;
+    regen_file *rf = find_file( pathname );
+    int        fd  = NOT_REGENERATED;
+    int        err = 0;
+    
+    if ( !rf ) 
+        return NOT_REGENERATED;
     
+    (void)pthread_once( &m_files_once, files_atfork );
+    pthread_mutex_lock( &m_files_mutex );
+    while ( rf->state == RS_LOADING ) 
+        pthread_cond_wait( &m_files_loaded, &m_files_mutex );
+    if ( rf->state != RS_UNKNOWN && !up_to_date(rf) ) 
+        forget( rf );
+    if ( rf->state == RS_UNKNOWN ) 
+        load( rf );
+    
+    if ( rf->state == RS_REGENERATED ) {
         if ( flags & O_WRONLY || flags & O_RDWR || flags & O_CREAT ) {
-            unlink( tmpfile );
-            errno = EACCES; /*EROFS*/
-            return INVALID_FD;
+            fd  = INVALID_FD;
+            err = EACCES; /*EROFS*/
+        } else {
+            char path[ 64 ];
+            
+            snprintf( path, sizeof(path), FD_PATH_FMT, rf->fd );
+            fd  = __libc_open( path, flags & ~(O_TRUNC | O_EXCL) );
+            if ( fd == INVALID_FD && errno == ENOENT ) 
+                fd = copy_content( rf->fd, flags );
+            err = errno;
         }
-        
-        fd = __libc_open( tmpfile, flags );
-        /* do not leave behind a bunch of TMPFILE_TEMPL files in /tmp */
-        unlink( tmpfile );
-        return fd;
     }
+    
+    /* no daemon to tell when to regenerate again */
+    if ( !rf->sub ) 
+        forget( rf );
+    pthread_mutex_unlock( &m_files_mutex );
+    
+    if ( fd == INVALID_FD ) 
+        errno = err;
+    return fd;
+}
+
+
+int 
+open( const char *pathname, int flags, ... ) 
+{
+    int ret = open_regenerated( pathname, flags );
+    
+    if ( ret != NOT_REGENERATED ) 
+        return ret;
 
     if ( flags && O_CREAT ) {
         mode_t mode;
@@ -166,23 +426,10 @@ open( const char *pathname, int flags, ... )
 int 
 open64( const char *pathname, int flags, ... ) 
 {
-    int  ret = INVALID_FD;
-    char tmpfile[ TMPFILE_BUFSZ ] = TMPFILE_TEMPL;
-
-    ret = check_if_regenerated64( pathname, flags, tmpfile );
-    if ( ret != INVALID_FD ) {
-        int fd;
+    int ret = open_regenerated( pathname, flags | O_LARGEFILE );
     
-        if ( flags & O_WRONLY || flags & O_RDWR || flags & O_CREAT ) {
-            unlink( tmpfile );
-            errno = EACCES; /*EROFS*/
-            return INVALID_FD;
-        }
-        
-        fd = __libc_open64( tmpfile, flags );
-        unlink( tmpfile );
-        return fd;
-    }
+    if ( ret != NOT_REGENERATED ) 
+        return ret;
 
     if ( flags && O_CREAT ) {
         mode_t mode;
@@ -196,4 +443,3 @@ open64( const char *pathname, int flags, ... )
         return __libc_open64( pathname, flags );
 }
 
-
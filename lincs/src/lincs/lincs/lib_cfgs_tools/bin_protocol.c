@@ -0,0 +1,456 @@
+/*
+ *  $Revision$
+ *  $Date$
+ *
+ *  \file 
+ *  \brief  Binary hosting protocol: length-prefixed frames
+ */
+/*
+# 
+# Copyright (c) 2003 Aurelian Melinte. 
+# This file is part of LinCS/tiger.  
+# 
+# LinCS/tiger is distributed under the terms of the GNU Lesser General Public
+# License version 2 or any later version.  See the file COPYING.LIB for copying 
+# permission or http://www.gnu.org. 
+#                                                                            
+# THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED OR  
+# IMPLIED, without even the implied warranty of MERCHANTABILITY or FITNESS 
+# FOR A PARTICULAR PURPOSE.  ANY USE IS AT YOUR OWN RISK. 
+#                                                                            
+# Permission to modify the code and to distribute modified code is granted, 
+# provided the above notices are retained, and a notice that the code was 
+# modified is included with the above copyright notice. 
+# 
+ */ 
+
+
+#include "cfgs/cfgs_config.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <netinet/in.h>  /*htonl*/
+
+#include "bin_protocol.h"
+#include "cfgs_protocol.h"
+#include "cfgs_mem.h"
+#include "cfgs_log.h"
+#include "cfgs_dlist.h"
+#include "cfgs_str.h"
+#include "cfgs_sock.h"
+#include "cfgs_tags.h"
+
+
+#define FRAME_PREFIX_LEN  (4)
+#define STR_LEN_MAX       (0xFFFF)
+
+
+/*
+ * tag types sent as indexes.  Keep the order: append only.  
+ */
+static const char *m_tag_types[] = {
+    CFGS_TAG_CFGS,
+    CFGS_TAG_FUNC_CALL,
+    CFGS_TAG_ENTRY,
+    CFGS_TAG_ERROR,
+    CFGS_TAG_NOTIF_REG,
+    CFGS_TAG_NOTIF_UNREG,
+    CFGS_TAG_NOTIF,
+    CFGS_TAG_CALL_RETURN,
+    CFGS_TAG_SUBKEY,
+    CFGS_TAG_INFOS,
+    CFGS_TAG_STR,
+    NULL
+};
+
+
+/*
+ * function names sent as indexes 
+ */
+#define X(a,b)  #b, 
+static const char *m_func_names[] = {
+    CFGS_API_EXPORTS
+    NULL
+};
+#undef X
+
+
+static int
+table_index( const char **table, const char *s )
+{
+    int idx;
+    
+    if ( !s )
+        return BIN_LITERAL;
+    
+    for ( idx=0; table[idx] && idx < BIN_LITERAL; idx++ ) {
+        if ( 0 == strcmp(table[idx], s) )
+            return idx;
+    }
+    
+    return BIN_LITERAL;
+}
+
+
+static const char*
+table_entry( const char **table, int idx )
+{
+    int n;
+    
+    for ( n=0; table[n]; n++ ) {
+        if ( n == idx )
+            return table[n];
+    }
+    
+    return NULL;
+}
+
+
+/*----------------------------------------------------*/
+
+static bool
+put_u8( cfgs_buf *b, int v )
+{
+    return cfgs_buf_cat_ch( b, (char)(v & 0xFF) );
+}
+
+
+static bool
+put_u16( cfgs_buf *b, int v )
+{
+    unsigned short nv = htons( (unsigned short)v );
+    
+    return cfgs_buf_cat( b, (const char*)&nv, sizeof(nv) );
+}
+
+
+static bool
+put_str( cfgs_buf *b, const char *s )
+{
+    int len = strlen( s ) + 1;
+    
+    if ( len > STR_LEN_MAX ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "bin put_str: string too long (%d)\n", len); );
+        return false;
+    }
+    
+    if ( !put_u16(b, len) )        return false;
+    if ( !cfgs_buf_cat(b, s, len) ) return false;
+    
+    return true;
+}
+
+
+static bool
+put_tag( cfgs_buf *b, cfgs_tag *t )
+{
+    int        type = table_index( m_tag_types, t->type );
+    int        func = BIN_LITERAL;
+    cfgs_pair  *att; 
+    
+    lassert( t->type );
+    if ( !t->type )
+        return false;
+
+    if ( !put_u8(b, type) ) return false;
+    if ( type == BIN_LITERAL && !put_str(b, t->type) ) return false;
+    
+    if ( 0 == strcmp(CFGS_TAG_FUNC_CALL, t->type) ) {
+        func = table_index( m_func_names, cfgs_tag_attr(t, CFGS_TA_FUNCTION) );
+        if ( !put_u8(b, func) ) return false;
+    }
+    
+    for ( att=t->attr; att; att=att->next ) {
+        if ( !att->first || !att->second )
+            continue;
+        /* already sent as index */
+        if ( func != BIN_LITERAL && 0 == strcmp(CFGS_TA_FUNCTION, att->first) )
+            continue;
+        if ( !put_str(b, att->first) )  return false;
+        if ( !put_str(b, att->second) ) return false;
+    }
+    
+    return put_u16( b, 0 );
+}
+
+
+cfgs_buf *
+bin_tags_encode( cfgs_tag *tags )
+{
+    cfgs_buf     *b = cfgs_buf_new( NULL, 256 );
+    cfgs_tag     *t;
+    unsigned int nlen;
+    
+    if ( !b )
+        return NULL;
+    
+    /* length prefix, patched below */
+    b->used = FRAME_PREFIX_LEN;
+    if ( !put_u8(b, BIN_PROTOCOL_VERSION) ) {
+        cfgs_buf_free( b );
+        return NULL;
+    }
+    
+    for ( t=tags; t; t=t->next ) {
+        if ( !put_tag(b, t) ) {
+            cfgs_buf_free( b );
+            return NULL;
+        }
+    }
+    
+    nlen = htonl( b->used - FRAME_PREFIX_LEN );
+    memmove( b->buf, &nlen, FRAME_PREFIX_LEN );
+    
+    return b;
+}
+
+
+/*----------------------------------------------------*/
+
+/* Decoding cursor */
+typedef struct _bin_cursor {
+    const unsigned char *p;
+    const unsigned char *end;
+} bin_cursor;
+
+
+static int
+get_u8( bin_cursor *c )
+{
+    if ( c->p + 1 > c->end )
+        return -1;
+    return *c->p++;
+}
+
+
+static int
+get_u16( bin_cursor *c )
+{
+    unsigned short nv;
+    
+    if ( c->p + sizeof(nv) > c->end )
+        return -1;
+    memmove( &nv, c->p, sizeof(nv) );
+    c->p += sizeof(nv);
+    
+    return ntohs( nv );
+}
+
+
+/* Strings are NUL terminated on the wire: point into the frame */
+static const char*
+get_str_body( bin_cursor *c, int len )
+{
+    const char *s = (const char*)c->p;
+    
+    if ( len <= 0 || c->p + len > c->end || s[len-1] != '\0' )
+        return NULL;
+    c->p += len;
+    
+    return s;
+}
+
+
+static const char*
+get_str( bin_cursor *c )
+{
+    return get_str_body( c, get_u16(c) );
+}
+
+
+static cfgs_tag*
+get_tag( bin_cursor *c, cfgs_arena *arena )
+{
+    int        type = get_u8( c );
+    const char *stype;
+    cfgs_tag   *t;
+    
+    if ( type == BIN_LITERAL ) 
+        stype = get_str( c );
+    else 
+        stype = table_entry( m_tag_types, type );
+    if ( !stype ) 
+        return NULL;
+    
+    t = cfgs_tag_new_in( arena, stype );
+    if ( !t )
+        return NULL;
+    
+    if ( 0 == strcmp(CFGS_TAG_FUNC_CALL, stype) ) {
+        int func = get_u8( c );
+    
+        if ( func != BIN_LITERAL ) {
+            const char *sfunc = table_entry( m_func_names, func );
+            if ( !sfunc || !cfgs_tag_add_attr(t, CFGS_TA_FUNCTION, sfunc) ) {
+                cfgs_tag_free( t );
+                return NULL;
+            }
+        }
+    }
+    
+    while ( true ) {
+        int        klen = get_u16( c );
+        const char *key, *val;
+    
+        if ( klen == 0 )
+            break;
+        key = get_str_body( c, klen );
+        val = get_str( c );
+        if ( !key || !val || !cfgs_tag_add_attr(t, key, val) ) {
+            cfgs_tag_free( t );
+            return NULL;
+        }
+    }
+    
+    return t;
+}
+
+
+cfgs_tag *
+bin_tags_decode( cfgs_arena *arena, const char *buf, int len )
+{
+    bin_cursor c;
+    cfgs_tag   *tags;
+    
+    lassert( buf );
+    
+    c.p   = (const unsigned char*)buf;
+    c.end = c.p + len;
+    if ( get_u8(&c) != BIN_PROTOCOL_VERSION ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "bin_tags_decode: unknown version\n"); );
+        return NULL;
+    }
+    
+    /* same shape as the xml parse */
+    tags = cfgs_tag_new_in( arena, CFGS_TAG_CFGS );
+    if ( !tags || !cfgs_tag_add_attr(tags, CFGS_EA_VERSION, CFGS_PROTOCOL_VERSION) ) {
+        cfgs_tag_free( tags );
+        return NULL;
+    }
+    tags = (cfgs_tag*)cfgs_dlist_cons( (cfgs_dlist*)tags );
+    
+    while ( c.p < c.end ) {
+        cfgs_tag *t = get_tag( &c, arena );
+        
+        if ( !t ) {
+            LOG( cfgs_log(CFGST_LL_CRITIC, "bin_tags_decode: invalid frame\n"); );
+            CFGST_DLIST_FREE( tags, cfgs_tag_free );
+            return NULL;
+        }
+        tags = (cfgs_tag*)cfgs_dlist_add_tail( (cfgs_dlist*)tags, (cfgs_dlist*)t );
+    }
+    
+    return tags;
+}
+
+
+/*----------------------------------------------------*/
+
+static bool
+bin_send( int sock, char *buf, int len )
+{
+    lassert( len >= FRAME_PREFIX_LEN );
+    
+    return cfgst_fullsend( sock, buf, len, 0 ) == len;
+}
+
+
+static cfgs_buf *
+bin_recv( int sock )
+{
+    cfgst_rbuf   *rb   = cfgst_rbuf_get( sock );
+    cfgs_buf     *body = NULL;
+    unsigned int nlen;
+    int          len;
+    
+    if ( !rb ) {
+        return NULL;
+    }
+    
+    if ( cfgst_rbuf_recv(sock, rb, (char*)&nlen, FRAME_PREFIX_LEN) != FRAME_PREFIX_LEN ) {
+        return NULL;
+    }
+    len = ntohl( nlen );
+    /* the stream cannot be resynchronized past a bogus length */
+    if ( len <= 0 || len > CGFS_MAX_BODY_LEN ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "bin_recv: invalid frame length %d\n", len); );
+        return NULL;
+    }
+    
+    body = cfgs_buf_new( NULL, len );
+    if ( !body ) {
+        return NULL;
+    }
+    
+    body->used = cfgst_rbuf_recv( sock, rb, body->buf, len );
+    if ( body->used != len ) {
+        cfgs_buf_free( body );
+        return NULL;
+    }
+    
+    return body;
+}
+
+
+int
+bin_request_len( int sock )
+{
+    cfgst_rbuf   *rb = cfgst_rbuf_get( sock );
+    unsigned int nlen;
+    int          len;
+    
+    if ( !rb ) {
+        return -1;
+    }
+    
+    if ( rb->end - rb->start < FRAME_PREFIX_LEN ) {
+        return 0;
+    }
+    memcpy( &nlen, rb->buf + rb->start, FRAME_PREFIX_LEN );
+    len = ntohl( nlen );
+    if ( len <= 0 || len > CGFS_MAX_BODY_LEN ) {
+        return -1;
+    }
+    
+    return FRAME_PREFIX_LEN + len;
+}
+
+
+bool   
+bin_client_send( int sock, char *buf, int len, cfgs_err *err )
+{
+    return bin_send( sock, buf, len );
+}
+
+
+cfgs_buf *
+bin_client_recv( int sock, cfgs_err *err )
+{
+    return bin_recv( sock );
+}
+
+
+bool   
+bin_server_send( int sock, char *buf, int len, cfgs_err *err )
+{
+    return bin_send( sock, buf, len );
+}
+
+
+bool   
+bin_server_frame( cfgs_buf *out, char *buf, int len )
+{
+    /* framed by bin_tags_encode already */
+    lassert( len >= FRAME_PREFIX_LEN );
+    
+    return cfgs_buf_cat( out, buf, len );
+}
+
+
+cfgs_buf *
+bin_server_recv( int sock, cfgs_err *err )
+{
+    return bin_recv( sock );
+}
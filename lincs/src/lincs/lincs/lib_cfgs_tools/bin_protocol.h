@@ -0,0 +1,80 @@
+/*
+ *  $Revision$
+ *  $Date$
+ *
+ *  \file 
+ *  \brief  Send/Receive data as length-prefixed binary frames
+ */
+/*
+# 
+# Copyright (c) 2003 Aurelian Melinte. 
+# This file is part of LinCS/tiger.  
+# 
+# LinCS/tiger is distributed under the terms of the GNU Lesser General Public
+# License version 2 or any later version.  See the file COPYING.LIB for copying 
+# permission or http://www.gnu.org. 
+#                                                                            
+# THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED OR  
+# IMPLIED, without even the implied warranty of MERCHANTABILITY or FITNESS 
+# FOR A PARTICULAR PURPOSE.  ANY USE IS AT YOUR OWN RISK. 
+#                                                                            
+# Permission to modify the code and to distribute modified code is granted, 
+# provided the above notices are retained, and a notice that the code was 
+# modified is included with the above copyright notice. 
+# 
+ */ 
+
+#ifndef BIN_PROTOCOL_H
+#define BIN_PROTOCOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include "cfgs_str.h"
+#include "cfgs_error.h"
+
+
+/** Token of the http Upgrade: header that switches a connection to binary 
+    frames. */
+#define BIN_PROTOCOL_TOKEN    "cfgs-bin/1.0"
+#define BIN_PROTOCOL_VERSION  (1)
+
+/**
+ * Frame layout (integers in network byte order): 
+ *   frame   := u32 payload length, payload 
+ *   payload := u8 version, tag* 
+ *   tag     := u8 type [u8 function], attr*, u16 0 
+ *   attr    := str key, str value 
+ *   str     := u16 length (NUL included), bytes, NUL 
+ * Known tag types and API function names travel as table indexes;  
+ * BIN_LITERAL stands for a str following instead.  
+ */
+#define BIN_LITERAL  (0xFF)
+
+
+/** The buffer holds a whole frame, as built by bin_tags_encode */
+bool      bin_client_send( int sock, char *buf, int len, cfgs_err *err );
+/** Receive a frame.  Returns its payload.  Free returned poiter */ 
+cfgs_buf *bin_client_recv( int sock, cfgs_err *err );
+
+bool      bin_server_send( int sock, char *buf, int len, cfgs_err *err );
+bool      bin_server_frame( cfgs_buf *out, char *buf, int len );
+cfgs_buf *bin_server_recv( int sock, cfgs_err *err );
+/** Length of the frame starting the receive buffer of @param sock, as 
+    http_request_len */
+int       bin_request_len( int sock );
+
+/** Frame a tag list.  Free returned pointer */
+cfgs_buf *bin_tags_encode( cfgs_tag *tags );
+/** Payload to tag list, first tag being &lt;cfgs&gt;, in @param arena if 
+    not NULL.  Free returned list */
+cfgs_tag *bin_tags_decode( cfgs_arena *arena, const char *buf, int len );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*BIN_PROTOCOL_H*/
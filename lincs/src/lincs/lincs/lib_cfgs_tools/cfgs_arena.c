@@ -0,0 +1,176 @@
+
+/*
+ *  $Revision: 1.1 $
+ *  $Date: 2004/03/19 16:36:24 $
+ *
+ *  Arena: objects allocated one by one, released all at once
+ */
+/*
+# 
+# Copyright (c) 2003 Aurelian Melinte. 
+# This file is part of LinCS/tiger.  
+# 
+# LinCS/tiger is distributed under the terms of the GNU Lesser General Public
+# License version 2 or any later version.  See the file COPYING.LIB for copying 
+# permission or http://www.gnu.org. 
+#                                                                            
+# THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED OR  
+# IMPLIED, without even the implied warranty of MERCHANTABILITY or FITNESS 
+# FOR A PARTICULAR PURPOSE.  ANY USE IS AT YOUR OWN RISK. 
+#                                                                            
+# Permission to modify the code and to distribute modified code is granted, 
+# provided the above notices are retained, and a notice that the code was 
+# modified is included with the above copyright notice. 
+# 
+ */ 
+
+
+#include "cfgs/cfgs_config.h"
+
+#include <string.h>
+
+#include "cfgs_log.h"
+#include "cfgs_mem.h"
+#include "cfgs_arena.h"
+
+
+/* Alignment of the returned pointers */
+#define ARENA_ALIGN      ( 2*sizeof(void*) )
+#define ALIGNED( n )     ( ((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1) )
+
+typedef struct _arena_chunk arena_chunk;
+struct _arena_chunk {
+    arena_chunk  *next;
+    size_t       size;                     /* usable bytes */
+    size_t       used;
+};
+/* usable memory follows the header */
+#define CHUNK_HDR        ALIGNED( sizeof(arena_chunk) )
+#define CHUNK_MEM( c )   ( (char*)(c) + CHUNK_HDR )
+
+struct _cfgs_arena
+{
+    arena_chunk  *chunks;                  /* current chunk first */
+    arena_chunk  *first;                   /* kept by cfgs_arena_reset */
+    size_t       chunk;
+    /* stats */
+    unsigned long nallocs;
+    unsigned long nchunks;
+};
+
+
+static arena_chunk *
+chunk_new( size_t size )
+{
+    arena_chunk *c = (arena_chunk*)xmalloc( CHUNK_HDR + size );
+    
+    if ( c ) {
+        c->next = NULL;
+        c->size = size;
+        c->used = 0;
+    }
+    return c;
+}
+
+
+cfgs_arena *
+cfgs_arena_new( size_t chunk )
+{
+    cfgs_arena *a = XCALLOC( cfgs_arena, 1 );
+    
+    if ( a ) {
+        a->chunk  = ALIGNED( chunk > 0 ? chunk : CGFS_ARENA_CHUNK );
+        a->first  = chunk_new( a->chunk );
+        a->chunks = a->first;
+        if ( !a->first ) {
+            xfree( a );
+            return NULL;
+        }
+    }
+    
+    return a;
+}
+
+
+void *
+cfgs_arena_alloc( cfgs_arena *a, size_t size )
+{
+    arena_chunk *c;
+    void        *p;
+    
+    if ( !a )
+        return xcalloc( 1, size );
+    
+    size = ALIGNED( size > 0 ? size : 1 );
+    c    = a->chunks;
+    if ( c->used + size > c->size ) {
+        /* big ones get a chunk of their own */
+        c = chunk_new( size > a->chunk/4 ? size : a->chunk );
+        if ( !c ) 
+            return NULL;
+        c->next   = a->chunks;
+        a->chunks = c;
+        a->nchunks++;
+    }
+    
+    p = CHUNK_MEM( c ) + c->used;
+    c->used += size;
+    a->nallocs++;
+    
+    memset( p, 0, size );
+    return p;
+}
+
+
+char *
+cfgs_arena_strdup( cfgs_arena *a, const char *s )
+{
+    size_t len;
+    char   *p;
+    
+    if ( !a )
+        return xstrdup( s );
+    if ( !s )
+        return NULL;
+    
+    len = strlen( s ) + 1;
+    p   = (char*)cfgs_arena_alloc( a, len );
+    if ( p )
+        memcpy( p, s, len );
+    return p;
+}
+
+
+void 
+cfgs_arena_reset( cfgs_arena *a )
+{
+    arena_chunk *c, *next;
+    
+    if ( !a )
+        return;
+    
+    for ( c=a->chunks; c != a->first; c=next ) {
+        next = c->next;
+        xfree( c );
+    }
+    a->chunks       = a->first;
+    a->first->next  = NULL;
+    a->first->used  = 0;
+}
+
+
+void 
+cfgs_arena_free( cfgs_arena *a )
+{
+    if ( !a )
+        return;
+    
+    LOG( cfgs_log(CFGST_LL_INFO, "cfgs_arena: %lu allocs, %lu extra chunks\n", 
+            a->nallocs, a->nchunks); );
+    
+    cfgs_arena_reset( a );
+    xfree( a->first );
+    xfree( a );
+}
+
+
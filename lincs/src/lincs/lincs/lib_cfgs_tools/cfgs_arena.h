@@ -0,0 +1,63 @@
+/*
+ *  $Revision: 1.1 $
+ *  $Date: 2004/03/19 16:36:24 $
+ *
+ *  Arena: objects allocated one by one, released all at once
+ */
+/*
+# 
+# Copyright (c) 2003 Aurelian Melinte. 
+# This file is part of LinCS/tiger.  
+# 
+# LinCS/tiger is distributed under the terms of the GNU Lesser General Public
+# License version 2 or any later version.  See the file COPYING.LIB for copying 
+# permission or http://www.gnu.org. 
+#                                                                            
+# THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED OR  
+# IMPLIED, without even the implied warranty of MERCHANTABILITY or FITNESS 
+# FOR A PARTICULAR PURPOSE.  ANY USE IS AT YOUR OWN RISK. 
+#                                                                            
+# Permission to modify the code and to distribute modified code is granted, 
+# provided the above notices are retained, and a notice that the code was 
+# modified is included with the above copyright notice. 
+# 
+ */ 
+
+#ifndef CSARENA_H
+#define CSARENA_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#include <stddef.h>
+
+#include "cfgs/cfgs_config.h"  /*bool*/
+
+
+typedef struct _cfgs_arena cfgs_arena;
+
+/*
+ *  Bump allocator for objects all dying at the same time, e.g. the tags of 
+ *  one request.  There is no per object free: cfgs_arena_reset releases 
+ *  everything at once.  Not thread safe.  
+ *  A NULL arena stands for the heap: cfgs_arena_alloc and cfgs_arena_strdup
+ *  then fall back to xcalloc and xstrdup.  
+ *  If @param chunk is 0, CGFS_ARENA_CHUNK is used.  
+ */
+cfgs_arena *cfgs_arena_new( size_t chunk );
+void       cfgs_arena_free( cfgs_arena *a );
+/** Zeroed memory, valid until the next cfgs_arena_reset */
+void       *cfgs_arena_alloc( cfgs_arena *a, size_t size );
+char       *cfgs_arena_strdup( cfgs_arena *a, const char *s );
+/** Release all allocations.  The first chunk is kept for reuse */
+void       cfgs_arena_reset( cfgs_arena *a );
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*CSARENA_H*/
+ 
@@ -31,10 +31,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "cfgs_backend.h"
 #include "cfgs_mem.h"
 #include "cfgs_dlist.h"
+#include "cfgs_hash.h"
 #include "cfgs_log.h"
 
 
@@ -239,4 +241,159 @@ cfgsb_find_backend( cfgs_backend *bklist, const char *name )
 }
 
 
+typedef struct _cfgsb_route cfgsb_route_t;
+struct _cfgsb_route {
+    cfgsb_route_t *next;
+    cfgsb_route_t *prev;
+    char          *key;     /* hash key */
+    cfgs_backend  *bk;
+};
+
+struct _cfgsb_routes {
+    pthread_mutex_t mutex;
+    cfgs_hash       *keys;  /* key -> cfgsb_route_t */
+    cfgsb_route_t   *list;  /* oldest first */
+    int             nb;
+};
+
+
+/* 
+ * "layer:/a/b/c" for /a/b/c in layer.  A name, not a prefix: names under 
+ * a prefix may be in several backends, the earlier shadowing the later.  
+ * @return false if the name is a pattern: its values may be anywhere 
+ */
+static bool
+route_key( char *key, size_t size, const char *name, const char *layer )
+{
+    if ( name[strcspn(name, "*?[\\")] )
+        return false;
+
+    if ( snprintf(key, size, "%s:%s", layer ? layer : "", name) >= (int)size )
+        return false;
+    return true;
+}
+
+
+static void
+route_free( cfgsb_route_t *r )
+{
+    xfree( r->key );
+    xfree( r );
+}
+
+
+/* under routes->mutex */
+static void
+route_drop( cfgsb_routes *routes, cfgsb_route_t *r )
+{
+    cfgs_hash_delete( routes->keys, r->key, r, NULL );
+    routes->list = (cfgsb_route_t*)cfgs_dlist_rem( (cfgs_dlist*)routes->list, 
+                                                   (cfgs_dlist*)r );
+    routes->nb--;
+    route_free( r );
+}
+
+
+cfgsb_routes *
+cfgsb_routes_new( void )
+{
+    cfgsb_routes *routes = XCALLOC( cfgsb_routes, 1 );
+
+    if ( !routes )
+        return NULL;
+    routes->keys = cfgs_hash_new( 0 );
+    if ( !routes->keys ) {
+        xfree( routes );
+        return NULL;
+    }
+    pthread_mutex_init( &routes->mutex, NULL );
+    return routes;
+}
+
+
+void
+cfgsb_routes_free( cfgsb_routes *routes )
+{
+    if ( !routes )
+        return;
+    cfgs_hash_free( routes->keys, NULL );
+    CFGST_DLIST_FREE( routes->list, route_free );
+    pthread_mutex_destroy( &routes->mutex );
+    xfree( routes );
+}
+
+
+cfgs_backend *
+cfgsb_route( cfgsb_routes *routes, const char *name, const char *layer )
+{
+    char          key[ FILENAME_MAX ];
+    cfgsb_route_t *r;
+    cfgs_backend  *bk = NULL;
+
+    if ( !routes || !name || !route_key(key, sizeof(key), name, layer) )
+        return NULL;
+
+    pthread_mutex_lock( &routes->mutex );
+    r = (cfgsb_route_t*)cfgs_hash_find( routes->keys, key );
+    if ( r )
+        bk = r->bk;
+    pthread_mutex_unlock( &routes->mutex );
+
+    return bk;
+}
+
+
+void
+cfgsb_route_learn( cfgsb_routes *routes, const char *name, const char *layer, 
+                   cfgs_backend *bk )
+{
+    char          key[ FILENAME_MAX ];
+    cfgsb_route_t *r;
+
+    if ( !routes || !name || !bk || !route_key(key, sizeof(key), name, layer) )
+        return;
+
+    pthread_mutex_lock( &routes->mutex );
+    r = (cfgsb_route_t*)cfgs_hash_find( routes->keys, key );
+    if ( r ) {
+        r->bk = bk;
+    } else {
+        /* the oldest make room */
+        if ( routes->nb >= CGFS_ROUTES_MAX )
+            route_drop( routes, routes->list );
+        r = XCALLOC( cfgsb_route_t, 1 );
+        if ( r ) 
+            r->key = xstrdup( key );
+        if ( !r || !r->key 
+           || cfgs_hash_insert(routes->keys, r->key, r, 0) == CFGST_HASH_INVALID_IDX ) {
+            if ( r )
+                route_free( r );
+        } else {
+            routes->list = (cfgsb_route_t*)cfgs_dlist_add_tail( (cfgs_dlist*)routes->list, 
+                                                                (cfgs_dlist*)r );
+            routes->nb++;
+            LOG( cfgs_log(CFGST_LL_INFO, "cfgsb_route_learn: '%s' in '%s'\n", key, bk->name); );
+        }
+    }
+    pthread_mutex_unlock( &routes->mutex );
+}
+
+
+void
+cfgsb_route_forget( cfgsb_routes *routes, const char *name, const char *layer )
+{
+    char          key[ FILENAME_MAX ];
+    cfgsb_route_t *r;
+
+    if ( !routes || !name || !route_key(key, sizeof(key), name, layer) )
+        return;
+
+    pthread_mutex_lock( &routes->mutex );
+    r = (cfgsb_route_t*)cfgs_hash_find( routes->keys, key );
+    if ( r ) 
+        route_drop( routes, r );
+    pthread_mutex_unlock( &routes->mutex );
+}
+
+
 
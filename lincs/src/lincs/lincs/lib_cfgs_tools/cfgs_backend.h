@@ -51,7 +51,7 @@ bool cfgsb_shutdown( void );
 
 
 
-#if CFGS_CRT_REV != 4
+#if CFGS_CRT_REV != 6
 #  error please update _cfgs_backend to CFGS_CRT_REV if needed
 #endif
 typedef struct _cfgs_backend cfgs_backend;
@@ -72,6 +72,8 @@ struct _cfgs_backend {
     cfgs_str*   (*cfgs_getsubvals)( cfgs_session *s, const char *valname, const char *layer );
     cfgs_str*   (*cfgs_getsublayers)( cfgs_session *s, const char *layername );
     cfgs_str*   (*cfgs_getinfos)( cfgs_session *s );
+    cfgs_entry* (*cfgs_getvals)( cfgs_session *sess, const char **names, int n, const char *layer );
+    int         (*cfgs_unregister_notif)( cfgs_session *s, cfgs_notif *notif );
 };
 
 cfgs_backend *cfgsb_backend_new( void );
@@ -90,6 +92,25 @@ bool         cfgsb_unload_backends( cfgs_backend *backends );
 cfgs_backend *cfgsb_find_backend( cfgs_backend *bklist, const char *name );
 
 
+/**
+ *  Routes: the first backend holding a name in a layer, learned from the 
+ *  backends' answers so that a request goes to one backend.  The last 
+ *  CGFS_ROUTES_MAX learned are kept.  Thread safe.  
+ */
+typedef struct _cfgsb_routes cfgsb_routes;
+
+cfgsb_routes *cfgsb_routes_new( void );
+void         cfgsb_routes_free( cfgsb_routes *routes );
+
+/** @return the backend holding @param name, NULL if not known yet */
+cfgs_backend *cfgsb_route( cfgsb_routes *routes, const char *name, const char *layer );
+/** @param bk answered for @param name */
+void         cfgsb_route_learn( cfgsb_routes *routes, const char *name, const char *layer, 
+                                cfgs_backend *bk );
+/** @param name was removed: its backend is to be found again */
+void         cfgsb_route_forget( cfgsb_routes *routes, const char *name, const char *layer );
+
+
 
 #ifdef __cplusplus
 }
@@ -36,47 +36,234 @@
 #include "cfgs_cache.h"
 
 
+/* 
+ * One name in the cache.  Nodes are in LRU order: the list's head is the 
+ * least recently used, its tail the most recently used.  
+ */
+typedef struct _cache_node cache_node;
+struct _cache_node {
+    cache_node  *next;
+    cache_node  *prev;
+    char        *name;                     /* hash key */
+    void        *elem;                     /* NULL for a negative hit */
+};
+
 struct _cfgs_cache
 {
-    pthread_mutex_t   mutex;               /* PTHREAD_MUTEX_INITIALIZER; */
-    cfgs_dlist       *pos_elems;           /* keep positive hits in */
-    cfgs_hash        *pos_hits;
-    cfgs_hash        *neg_hits;            /* names of the negative hits */
-    const char* (*get_name)( void* );      /* func to retrieve elem's name */
+    pthread_mutex_t   mutex;               
+    cache_node       *lru;                 /* positive and negative hits */
+    cfgs_hash        *hits;                /* name to cache_node */
+    int              size;                 /* max. number of nodes */
+    int              nnodes;
+    void* (*dup_item)( void* );            /* copies handed out */
+    void  (*free_item)( void* ); 
+    /* stats */
+    unsigned long    pos_hits;
+    unsigned long    neg_hits;
+    unsigned long    misses;
 };
 
 
 cfgs_cache *
-cfgs_cache_new( const char* (*get_name)(void*) )
+cfgs_cache_new( int size, void* (*dup_item)(void*), void (*free_item)(void*) )
 {
     cfgs_cache *c = XCALLOC( cfgs_cache, 1 );
     
-    lassert( get_name != NULL );
+    lassert( dup_item != NULL && free_item != NULL );
     
     if ( c ) {
         pthread_mutex_init( &c->mutex, NULL );
-        c->get_name = get_name;
-        /*FIXME: hashes, list*/
+        c->size      = size > 0 ? size : CGFS_CACHE_SIZE;
+        c->dup_item  = dup_item;
+        c->free_item = free_item;
+        c->hits      = cfgs_hash_new( c->size );
+        if ( !c->hits ) {
+            pthread_mutex_destroy( &c->mutex );
+            xfree( c );
+            return NULL;
+        }
     }
     
     return c;
 }
 
 
-void    
-cfgs_cache_free( cfgs_cache *c, void (*free_item)(void *) )
+static void
+node_free( cfgs_cache *c, cache_node *n )
 {
-    if ( !c )
-        return;
+    if ( n->elem ) 
+        (*c->free_item)( n->elem );
+    xfree( n->name );
+    xfree( n );
+}
+
+
+/* Unlink n from the hash and the LRU list, then free it.  Locked. */
+static void
+node_rm( cfgs_cache *c, cache_node *n )
+{
+    cfgs_hash_delete( c->hits, n->name, n, NULL );
+    c->lru = (cache_node*)cfgs_dlist_rem( (cfgs_dlist*)c->lru, (cfgs_dlist*)n );
+    c->nnodes--;
+    node_free( c, n );
+}
+
+
+/* Move n at the most recently used end.  Locked. */
+static void
+node_touch( cfgs_cache *c, cache_node *n )
+{
+    c->lru = (cache_node*)cfgs_dlist_rem( (cfgs_dlist*)c->lru, (cfgs_dlist*)n );
+    c->lru = (cache_node*)cfgs_dlist_add_tail( (cfgs_dlist*)c->lru, (cfgs_dlist*)n );
+}
+
+
+/* Store elem (NULL: negative hit) under name, evicting if full. */
+static bool
+cache_put( cfgs_cache *c, const char *name, void *elem )
+{
+    cache_node *n;
     
-    if ( free_item && c->pos_elems ) {
-        CFGST_DLIST_FREE( c->pos_elems, free_item );
+    n = XCALLOC( cache_node, 1 );
+    if ( !n )
+        return false;
+    n->name = xstrdup( name );
+    if ( !n->name ) {
+        xfree( n );
+        return false;
     }
+    n->elem = elem;
     
-    /*FIXME*/
+    pthread_mutex_lock( &c->mutex );
+    {
+        cache_node *old = (cache_node*)cfgs_hash_find( c->hits, name );
+        if ( old ) 
+            node_rm( c, old );
+        while ( c->nnodes >= c->size && c->lru ) 
+            node_rm( c, c->lru );
+        
+        if ( cfgs_hash_insert(c->hits, n->name, n, 0) != CFGST_HASH_INVALID_IDX ) {
+            c->lru = (cache_node*)cfgs_dlist_add_tail( (cfgs_dlist*)c->lru, (cfgs_dlist*)n );
+            c->nnodes++;
+        } else {
+            n->elem = NULL; /* caller still owns it */
+            node_free( c, n );
+            n = NULL;
+        }
+    }
+    pthread_mutex_unlock( &c->mutex );
     
-    xfree( c );
+    return n != NULL;
 }
 
 
+bool
+cfgs_cache_add( cfgs_cache *c, const char *name, void *elem )
+{
+    if ( !c || !name || !elem )
+        return false;
+    
+    return cache_put( c, name, elem );
+}
+
 
+bool
+cfgs_cache_add_neg( cfgs_cache *c, const char *name )
+{
+    if ( !c || !name )
+        return false;
+    
+    return cache_put( c, name, NULL );
+}
+
+
+bool
+cfgs_neg_hit( cfgs_cache *c, const char *name )
+{
+    cache_node *n;
+    bool       hit = false;
+    
+    if ( !c || !name )
+        return false;
+    
+    pthread_mutex_lock( &c->mutex );
+    n = (cache_node*)cfgs_hash_find( c->hits, name );
+    if ( n && !n->elem ) {
+        node_touch( c, n );
+        c->neg_hits++;
+        hit = true;
+    }
+    pthread_mutex_unlock( &c->mutex );
+    
+    return hit;
+}
+
+
+void *
+cfgs_pos_hit( cfgs_cache *c, const char *name )
+{
+    cache_node *n;
+    void       *elem = NULL;
+    
+    if ( !c || !name )
+        return NULL;
+    
+    pthread_mutex_lock( &c->mutex );
+    n = (cache_node*)cfgs_hash_find( c->hits, name );
+    if ( n && n->elem ) {
+        node_touch( c, n );
+        c->pos_hits++;
+        /* copied while locked: evictions free the element */
+        elem = (*c->dup_item)( n->elem );
+    } else if ( !n ) {
+        c->misses++;
+    }
+    pthread_mutex_unlock( &c->mutex );
+    
+    return elem;
+}
+
+
+void
+cfgs_cache_rm( cfgs_cache *c, const char *name )
+{
+    cache_node *n;
+    
+    if ( !c || !name )
+        return;
+    
+    pthread_mutex_lock( &c->mutex );
+    n = (cache_node*)cfgs_hash_find( c->hits, name );
+    if ( n ) 
+        node_rm( c, n );
+    pthread_mutex_unlock( &c->mutex );
+}
+
+
+void
+cfgs_cache_flush( cfgs_cache *c )
+{
+    if ( !c )
+        return;
+    
+    pthread_mutex_lock( &c->mutex );
+    while ( c->lru ) 
+        node_rm( c, c->lru );
+    pthread_mutex_unlock( &c->mutex );
+}
+
+
+void    
+cfgs_cache_free( cfgs_cache *c )
+{
+    if ( !c )
+        return;
+    
+    LOG( cfgs_log(CFGST_LL_INFO, "cfgs_cache_free: %d names, %lu+%lu hits, %lu misses\n", 
+            c->nnodes, c->pos_hits, c->neg_hits, c->misses); );
+    
+    cfgs_cache_flush( c );
+    cfgs_hash_free( c->hits, NULL );
+    pthread_mutex_destroy( &c->mutex );
+    xfree( c );
+}
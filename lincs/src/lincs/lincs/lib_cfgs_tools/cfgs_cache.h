@@ -38,14 +38,24 @@ extern "C" {
 typedef struct _cfgs_cache cfgs_cache;
 
 /*
- *  Elements in the cache are identified by name.  get_name is used to dig for the name in
- *  a struct.  
+ *  Bounded LRU cache, thread safe.  Elements are identified by name.  A name 
+ *  is either a positive hit, with an element, or a negative hit (known not 
+ *  to exist).  When full, the least recently used name is evicted.  
+ *  The cache owns the elements it keeps: dup_item makes the copies handed 
+ *  out by cfgs_pos_hit, free_item frees them.  
+ *  If @param size is 0, CGFS_CACHE_SIZE is used.  
  */
-cfgs_cache *cfgs_cache_new( const char* (*get_name)(void*) );
-void       cfgs_cache_free( cfgs_cache *c, void (*free_item)(void *) );
-bool       cfgs_cache_add( cfgs_cache *c, void *elem );
+cfgs_cache *cfgs_cache_new( int size, void* (*dup_item)(void*), void (*free_item)(void*) );
+void       cfgs_cache_free( cfgs_cache *c );
+/** Store elem as name's positive hit.  On success elem belongs to the cache */
+bool       cfgs_cache_add( cfgs_cache *c, const char *name, void *elem );
+bool       cfgs_cache_add_neg( cfgs_cache *c, const char *name );
 bool       cfgs_neg_hit( cfgs_cache *c, const char *name );
+/** @return a copy of the element or NULL if name is not a positive hit */
 void       *cfgs_pos_hit( cfgs_cache *c, const char *name );
+/** Forget about name, positive or negative hit */
+void       cfgs_cache_rm( cfgs_cache *c, const char *name );
+void       cfgs_cache_flush( cfgs_cache *c );
 
 
 #ifdef __cplusplus
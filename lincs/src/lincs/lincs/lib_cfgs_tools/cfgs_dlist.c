@@ -137,6 +137,52 @@ cfgs_dlist_rem_tail( cfgs_dlist *head )
 }
 
 
+cfgs_dlist *      
+cfgs_dlist_cat( cfgs_dlist *head, cfgs_dlist *list )
+{
+    cfgs_dlist *tail;
+    
+    if ( !list )
+        return head;
+    if ( !head )
+        return list;
+    
+    tail = cfgs_dlist_tail( head );
+    lassert( tail != NULL && list->prev != NULL );
+    
+    tail->next = list;
+    head->prev = list->prev;  /* new tail */
+    list->prev = tail;
+    
+    return head; 
+}
+
+
+cfgs_dlist *      
+cfgs_dlist_rem( cfgs_dlist *head, cfgs_dlist *item )
+{
+    lassert( head && item );
+    if ( !head || !item )
+        return head;
+    
+    if ( item == head ) {
+        if ( head->next ) 
+            head->next->prev = head->prev;  /* tail */
+        head = head->next;
+    } else {
+        item->prev->next = item->next;
+        if ( item->next ) 
+            item->next->prev = item->prev;
+        else 
+            head->prev = item->prev;        /* new tail */
+    }
+    
+    item->next = NULL;
+    item->prev = item;
+    return head; 
+}
+
+
 void      
 cfgs_dlist_free( cfgs_dlist *head, void (*free)(void *) )
 {
@@ -65,6 +65,10 @@ extern void      cfgs_dlist_free( cfgs_dlist *head, void (*free)(void *) );
 /** If head is NULL, transform item into a valis list.  Returns head or NULL.  */
 extern cfgs_dlist *cfgs_dlist_add_tail( cfgs_dlist *head, cfgs_dlist *item );
 extern bool       cfgs_dlist_rem_tail( cfgs_dlist *head );
+/** Append list to head, both built with cfgs_dlist_cons/add_tail.  Returns head.  */
+extern cfgs_dlist *cfgs_dlist_cat( cfgs_dlist *head, cfgs_dlist *list );
+/** Unlink item from the list.  Returns the new head, NULL if list is now empty.  */
+extern cfgs_dlist *cfgs_dlist_rem( cfgs_dlist *head, cfgs_dlist *item );
 
 
 #ifdef __cplusplus
@@ -71,7 +71,6 @@ cfgs_strerror( CFGS_ERR err )
    so_error/<sys/socketvar.h> */
 
 
-/*FIXME: err to cfgs_buf* tag func to be reworked and exposed */
 /**
  *  Prints tag string into @param err xml buffer.  
  *  @return number of chars printed ( see snprintf(3) ) or -1 on error.  
@@ -213,6 +212,37 @@ cfgs_err_from_tag( cfgs_err *err, cfgs_tag *t )
 }
 
 
+#define NUM_BUF_LEN  (15)
+cfgs_tag *
+cfgs_err_to_tag( const cfgs_err *err )
+{
+    char     stype[ NUM_BUF_LEN+1 ] = {0};
+    char     scode[ NUM_BUF_LEN+1 ] = {0};
+    cfgs_tag *t;
+    
+    lassert( err != NULL );
+    if ( !err )
+        return NULL;
+    
+    t = cfgs_tag_new( CFGS_TAG_ERROR );
+    if ( !t )
+        return NULL;
+    
+    snprintf( stype, NUM_BUF_LEN, "%d", err->errtype );
+    snprintf( scode, NUM_BUF_LEN, "%d", err->code );
+    if (  !cfgs_tag_add_attr(t, CFGS_EA_ERR_TYPE,        stype)
+       || !cfgs_tag_add_attr(t, CFGS_EA_ERR_EXPLANATION, m_errstr[err->errtype])
+       || !cfgs_tag_add_attr(t, CFGS_EA_ERR_CODE,        scode)
+       || !cfgs_tag_add_attr(t, CFGS_EA_ERR_STRERROR,    err->host_strerror)
+       || !cfgs_tag_add_attr(t, CFGS_EA_ERR_INFO,        err->extra_infos) ) {
+        cfgs_tag_free( t );
+        return NULL;
+    }
+    
+    return t;
+}
+
+
 bool       
 cfgs_iserr( const cfgs_err *err )
 {
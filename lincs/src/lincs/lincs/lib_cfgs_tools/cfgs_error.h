@@ -67,6 +67,7 @@ typedef enum {
     X( CFGSP_ERR_SERVER_CONNECT,   "Not connected to server" ) \
     X( CFGSP_ERR_SERVER,           "Unknown Server error" ) \
     X( CFGSP_MAX_CONN,             "Maximum number of clients connected to server" ) \
+    X( CFGSP_ERR_PIPELINE,         "Answers to submitted requests not collected" ) \
     /*  */ \
     X( CFGS_ERR_MAX,        "Keep last")
     
@@ -125,6 +126,8 @@ bool       cfgs_iserr( const cfgs_err *err );
 /** Will not override a previous stored error.
     @return true if operation successfull. */
 bool       cfgs_err_from_tag( cfgs_err *err, cfgs_tag *tag ); 
+/** &lt;cfgs:error&gt; tag for @param err.  Free returned pointer. */
+cfgs_tag   *cfgs_err_to_tag( const cfgs_err *err ); 
 
 /** perror like printing with the followig format: <br>
  *  [CFGS_ERRT errtype] errtype explanation [code] host_strerror (extra_infos) <br>
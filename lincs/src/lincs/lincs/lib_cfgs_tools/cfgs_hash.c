@@ -4,6 +4,7 @@
  *  $Date: 2004/03/17 19:19:24 $
  *
  *  Adapted from mutt/hash.c/.h ver 3.0
+ *  Open addressing & incremental resize, FNV-1a hashing.
  *
  */
 /*
@@ -33,146 +34,292 @@
 #include "cfgs_mem.h"
 #include "cfgs_log.h"
 
-#define SOMEPRIME 149711
+/* initial size, in slots */
+#define HASH_MIN_SIZE      (8)
+/* slots moved from the old table at each insert/delete while resizing */
+#define HASH_MIGRATE_STEP  (8)
+
+#define IS_LIVE(e)     ( (e)->hash > CFGST_HASH_DELETED )
+#define ELEM_KEY(e)    ( (e)->klen < CFGST_HASH_INLINE_KEY ? (e)->k.ikey : (e)->k.key )
+
+
+/*
+ * FNV-1a. Values CFGST_HASH_FREE and CFGST_HASH_DELETED mark slot states 
+ * and are never returned.
+ */
+static unsigned int
+hash_key( const char *s, unsigned int *len )
+{
+  const unsigned char *p = (const unsigned char *)s;
+  unsigned int        h  = 2166136261U;
+
+  for ( ; *p; p++ ) {
+      h ^= *p;
+      h *= 16777619U;
+  }
+  *len = p - (const unsigned char *)s;
+
+  if ( h <= CFGST_HASH_DELETED )
+      h += 2;
+  return h;
+}
 
 
 int 
 cfgs_hash_string( const unsigned char *s, int n )
 {
-  int h = 0;
+  unsigned int len;
   
-  lassert( s != NULL );
-
-#if 0
-  while (*s)
-    h += *s++;
-#else
-  while (*s)
-    h += (h << 7) + *s++;
-  h = (h * SOMEPRIME) % n;
-  h = (h >= 0) ? h : h + n;
-#endif
+  lassert( s != NULL && n > 0 );
 
-  return (h % n);
+  return (int)( hash_key((const char *)s, &len) % (unsigned int)n );
 }
 
 
 cfgs_hash*
-cfgs_hash_new( unsigned int nelem )
+cfgs_hash_new_in( cfgs_arena *arena, unsigned int nelem )
 {
-  cfgs_hash *table = XCALLOC( cfgs_hash, 1 );
+  cfgs_hash    *table = (cfgs_hash*)cfgs_arena_alloc( arena, sizeof(cfgs_hash) );
+  unsigned int n;
+  
   if ( !table )
       return NULL;
       
-  if( nelem == 0 )
-    nelem = 5; /*default*/
+  /* slots are allocated on the first insert */
+  for ( n = HASH_MIN_SIZE; n < nelem; n <<= 1 )
+      ;
+  table->nelem = n;
+  table->arena = arena;
+
+  return table;
+}
+
+
+cfgs_hash*
+cfgs_hash_new( unsigned int nelem )
+{
+  return cfgs_hash_new_in( NULL, nelem );
+}
+
+
+static cfgs_hash_elem *
+slots_new( cfgs_hash *table, unsigned int nelem )
+{
+  return (cfgs_hash_elem*)cfgs_arena_alloc( table->arena, nelem * sizeof(cfgs_hash_elem) );
+}
+
+
+static void 
+slots_free( cfgs_hash *table, cfgs_hash_elem *slots )
+{
+  if ( !table->arena )
+      xfree( slots );
+}
+
+
+/*
+ * @param data    if not NULL, look for this ->data instead of the first match.
+ *                This is required for the case where we have multiple entries 
+ *                with the same key.
+ * @return slot index or CFGST_HASH_INVALID_IDX
+ */
+static int 
+hash_probe( const cfgs_hash_elem *tab, unsigned int nelem, 
+            unsigned int h, const char *key, unsigned int len, 
+            const void *data )
+{
+  unsigned int mask = nelem - 1;
+  unsigned int i, n;
+
+  for ( i = h & mask, n = 0; n < nelem; i = (i + 1) & mask, n++ ) {
+    const cfgs_hash_elem *e = &tab[i];
     
-  table->nelem = nelem;
-  table->table = XCALLOC( cfgs_hash_elem*, nelem );
-  if ( !table->table ) {
-      xfree( table );
-      return NULL;
+    if ( e->hash == CFGST_HASH_FREE )
+        break;
+    if ( e->hash != h || e->klen != len )
+        continue;
+    if ( data ? (e->data == data) : (memcmp(ELEM_KEY(e), key, len) == 0) )
+        return (int)i;
   }
+  return CFGST_HASH_INVALID_IDX;
+}
 
-  return table;
+
+/* store in the first free or deleted slot; the caller made sure there's one */
+static int 
+hash_put( cfgs_hash *table, unsigned int h, const char *key, unsigned int len, 
+          void *data )
+{
+  unsigned int   mask = table->nelem - 1;
+  unsigned int   i;
+  cfgs_hash_elem *e;
+
+  for ( i = h & mask; IS_LIVE(&table->table[i]); i = (i + 1) & mask )
+    ;
+  
+  e = &table->table[i];
+  if ( e->hash == CFGST_HASH_DELETED )
+      table->deleted--;
+  e->hash = h;
+  e->klen = len;
+  if ( len < CFGST_HASH_INLINE_KEY )
+      memcpy( e->k.ikey, key, len + 1 );
+  else
+      e->k.key = key;
+  e->data = data;
+
+  return (int)i;
+}
+
+
+/* move up to `n' old slots in the new table */
+static void 
+hash_migrate( cfgs_hash *table, unsigned int n )
+{
+  if ( !table->old )
+      return;
+
+  for ( ; n && table->old_pos < table->old_nelem; n--, table->old_pos++ ) {
+    cfgs_hash_elem *e = &table->old[table->old_pos];
+    
+    if ( IS_LIVE(e) ) {
+        hash_put( table, e->hash, ELEM_KEY(e), e->klen, e->data );
+        /* keep the probe chains of the elements still to move unbroken */
+        e->hash = CFGST_HASH_DELETED; 
+    }
+  }
+  
+  if ( table->old_pos == table->old_nelem ) {
+      slots_free( table, table->old );
+      table->old       = NULL;
+      table->old_nelem = 0;
+      table->old_pos   = 0;
+  }
+}
+
+
+/* make room for one more element */
+static bool 
+hash_reserve( cfgs_hash *table )
+{
+  cfgs_hash_elem *tab;
+  unsigned int   nelem;
+  
+  if ( !table->table ) {
+      table->table = slots_new( table, table->nelem );
+      return table->table != NULL;
+  }
+  
+  /* keep the load (deleted slots included) under 3/4 */
+  if ( (table->used + table->deleted + 1) * 4 <= table->nelem * 3 )
+      return true;
+  
+  /* finish any pending resize first */
+  hash_migrate( table, table->old_nelem );
+  
+  /* only drop the deleted slots if it's them filling the table */
+  nelem = table->nelem;
+  if ( table->used * 2 >= table->nelem )
+      nelem <<= 1;
+
+  tab = slots_new( table, nelem );
+  if ( !tab ) {
+      LOG( cfgs_log(CFGST_LL_CRITIC, "cfgs_hash: cannot grow to %u slots\n", nelem); );
+      return (table->used + table->deleted) < table->nelem;
+  }
+  
+  table->old       = table->table;
+  table->old_nelem = table->nelem;
+  table->old_pos   = 0;
+  table->table     = tab;
+  table->nelem     = nelem;
+  table->deleted   = 0;
+  
+  return true;
 }
 
 
 int 
 cfgs_hash_insert( cfgs_hash *table, const char *key, void *data, int allow_dup )
 {
-  cfgs_hash_elem *ptr;
-  int            h;
+  unsigned int h, len;
+  int          idx;
 
   if ( !table || !key )
       return CFGST_HASH_INVALID_IDX;
       
-  ptr = XCALLOC( cfgs_hash_elem, 1 );
-  if ( !ptr )
-      return CFGST_HASH_INVALID_IDX;
-      
-  h   = cfgs_hash_string( (const unsigned char *) key, table->nelem );
-  ptr->key  = key;
-  ptr->data = data;
-
-  if( allow_dup ) {
-    ptr->next = table->table[h];
-    table->table[h] = ptr;
-  } else {
-    cfgs_hash_elem *tmp, *last;
-    int r;
-
-    for ( tmp = table->table[h], last = NULL; tmp; last = tmp, tmp = tmp->next ) {
-      r = strcmp( tmp->key, key );
-      if (r == 0) {
-          xfree( ptr );
-          LOG( cfgs_log(CFGST_LL_CRITIC, "cfgs_hash_insert failed\n"); );
-          return CFGST_HASH_INVALID_IDX;
-      }
-      if ( r > 0 )
-          break;
+  h = hash_key( key, &len );
+  
+  if ( !allow_dup && table->table ) {
+    if ( hash_probe(table->table, table->nelem, h, key, len, NULL) != CFGST_HASH_INVALID_IDX
+         || (table->old 
+             && hash_probe(table->old, table->old_nelem, h, key, len, NULL) != CFGST_HASH_INVALID_IDX) ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "cfgs_hash_insert failed\n"); );
+        return CFGST_HASH_INVALID_IDX;
     }
-    if ( last )
-      last->next = ptr;
-    else
-      table->table[h] = ptr;
-    ptr->next = tmp;
   }
 
-  return h;
-}
-
-
-static void *
-hash_find( const cfgs_hash * table, int hash, const char *key )
-{
-  cfgs_hash_elem *ptr;
+  if ( !hash_reserve(table) )
+      return CFGST_HASH_INVALID_IDX;
   
-  lassert( table && key );
+  idx = hash_put( table, h, key, len, data );
+  table->used++;
   
-  ptr = table->table[hash];
-  for( ; ptr; ptr = ptr->next ) {
-    if (strcmp(key, ptr->key) == 0)
-      return (ptr->data);
-  }
-  return NULL;
+  hash_migrate( table, HASH_MIGRATE_STEP );
+
+  return idx;
 }
 
 
 void *
 cfgs_hash_find( const cfgs_hash * table, const char *key )
 {
-    void *d;
+  unsigned int h, len;
+  int          idx;
     
-    if ( !table || !key )
-        return NULL;
-    
-    d = hash_find( table, cfgs_hash_string((const unsigned char *)key, table->nelem), key );
-    
-    return d;
+  if ( !table || !key || !table->table )
+      return NULL;
+  
+  h   = hash_key( key, &len );
+  idx = hash_probe( table->table, table->nelem, h, key, len, NULL );
+  if ( idx != CFGST_HASH_INVALID_IDX )
+      return table->table[idx].data;
+  
+  if ( table->old ) {
+      idx = hash_probe( table->old, table->old_nelem, h, key, len, NULL );
+      if ( idx != CFGST_HASH_INVALID_IDX )
+          return table->old[idx].data;
+  }
+  
+  return NULL;
 }
 
 
-static void 
-hash_delete( cfgs_hash * table, int hash, const char *key, const void *data,
-               void (*destroy) (void *) )
+/* @return the new state of the slot or CFGST_HASH_INVALID_IDX if not found */
+static int 
+hash_delete( cfgs_hash_elem *tab, unsigned int nelem, 
+             unsigned int h, const char *key, unsigned int len, 
+             const void *data, void (*destroy) (void *) )
 {
-  cfgs_hash_elem *ptr   = table->table[hash];
-  cfgs_hash_elem **last = &table->table[hash];
-
-  for ( ; ptr; last = &ptr->next, ptr = ptr->next ) {
-    /* if `data' is given, look for a matching ->data member.  this is
-     * required for the case where we have multiple entries with the same
-     * key
-     */
-    if ( (data == ptr->data) || (!data && strcmp (ptr->key, key) == 0) ) {
-      *last = ptr->next;
-      if ( destroy ) 
-          destroy (ptr->data);
-      xfree( ptr );
-      return;
-    }
-  }
+  cfgs_hash_elem *e;
+  int            idx;
+  
+  idx = hash_probe( tab, nelem, h, key, len, data );
+  if ( idx == CFGST_HASH_INVALID_IDX )
+      return CFGST_HASH_INVALID_IDX;
+  
+  e = &tab[idx];
+  if ( destroy ) 
+      destroy( e->data );
+  
+  /* no probe chain goes past a free slot: this one can be freed as well */
+  if ( tab[(idx + 1) & (nelem - 1)].hash == CFGST_HASH_FREE )
+      e->hash = CFGST_HASH_FREE;
+  else
+      e->hash = CFGST_HASH_DELETED;
+  e->data = NULL;
+  
+  return (int)e->hash;
 }
 
 
@@ -180,32 +327,50 @@ void
 cfgs_hash_delete( cfgs_hash * table, const char *key, const void *data,
                void (*destroy) (void *) )
 {
-    if ( !table || !key )
-        return;
-    hash_delete( table, 
-            cfgs_hash_string((const unsigned char *)key, table->nelem), 
-            key, data, destroy );
+  unsigned int h, len;
+  int          st;
+  
+  if ( !table || !key || !table->table )
+      return;
+  
+  h  = hash_key( key, &len );
+  st = hash_delete( table->table, table->nelem, h, key, len, data, destroy );
+  if ( st == CFGST_HASH_DELETED )
+      table->deleted++;
+  if ( st == CFGST_HASH_INVALID_IDX && table->old )
+      st = hash_delete( table->old, table->old_nelem, h, key, len, data, destroy );
+  if ( st != CFGST_HASH_INVALID_IDX )
+      table->used--;
+  
+  hash_migrate( table, HASH_MIGRATE_STEP );
 }
 
 
 void 
 cfgs_hash_free( cfgs_hash *ptr, void (*destroy) (void *) )
 {
-  int i;
-  cfgs_hash *pptr = ptr;
-  cfgs_hash_elem *elem, *tmp;
-
-  for ( i = 0 ; i < pptr->nelem; i++ ) {
-    for ( elem = pptr->table[i]; elem; ) {
-      tmp = elem;
-      elem = elem->next;
-      if ( destroy )
-          destroy (tmp->data);
-      xfree( (void *) tmp );
-    }
+  unsigned int i;
+
+  if ( !ptr )
+      return;
+
+  if ( destroy ) {
+      for ( i = 0; ptr->table && i < ptr->nelem; i++ ) {
+          if ( IS_LIVE(&ptr->table[i]) )
+              destroy( ptr->table[i].data );
+      }
+      for ( i = 0; ptr->old && i < ptr->old_nelem; i++ ) {
+          if ( IS_LIVE(&ptr->old[i]) )
+              destroy( ptr->old[i].data );
+      }
   }
-  xfree( (void *) pptr->table );
-  xfree( (void *) pptr );
+  
+  if ( ptr->arena )
+      return;
+  
+  xfree( (void *) ptr->table );
+  xfree( (void *) ptr->old );
+  xfree( (void *) ptr );
 }
 
 
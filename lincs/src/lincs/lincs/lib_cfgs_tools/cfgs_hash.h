@@ -32,24 +32,52 @@ extern "C" {
 #endif
 
 
+#include "cfgs_arena.h"
+
+
 #define CFGST_HASH_INVALID_IDX  (-1)
 
-typedef struct _hash_elem cfgs_hash_elem;
+/* keys shorter than this are copied in the slot */
+#define CFGST_HASH_INLINE_KEY   (16)
 
-struct _hash_elem
+/*
+ * Open addressing with linear probing.  The table grows by rehashing a few 
+ * slots at each insert/delete into a table twice as big so no single insert
+ * pays for a whole rehash; lookups check both tables while this happens. 
+ */
+typedef struct
 {
-  const char     *key;
+  unsigned int   hash;           /* CFGST_HASH_FREE, CFGST_HASH_DELETED or hash */
+  unsigned int   klen;           /* key in ikey if klen < CFGST_HASH_INLINE_KEY */
+  union {
+      const char *key;
+      char       ikey[CFGST_HASH_INLINE_KEY];
+  } k;
   void           *data;
-  cfgs_hash_elem *next;
-} ;
+} cfgs_hash_elem;
+
+#define CFGST_HASH_FREE     (0)
+#define CFGST_HASH_DELETED  (1)
 
 typedef struct
 {
-  int            nelem;
-  cfgs_hash_elem **table;
+  unsigned int   nelem;          /* slots in table; a power of 2 */
+  unsigned int   used;           /* live elements, both tables */
+  unsigned int   deleted;        /* deleted slots in table */
+  cfgs_hash_elem *table;         /* allocated on first insert */
+  /* resizing: elements left in old[old_pos..old_nelem) are still to move */
+  cfgs_hash_elem *old;
+  unsigned int   old_nelem;
+  unsigned int   old_pos;
+  cfgs_arena     *arena;         /* NULL: slots on the heap */
 } cfgs_hash;
 
+/**
+ * @param nelem        expected number of elements; the table grows as needed
+ */
 cfgs_hash *cfgs_hash_new( unsigned int nelem );
+/** Table and slots in @param arena; cfgs_hash_free only calls destroy() */
+cfgs_hash *cfgs_hash_new_in( cfgs_arena *arena, unsigned int nelem );
 int  cfgs_hash_string( const unsigned char *s, int n );
 
 /**
@@ -26,6 +26,8 @@
 
 #include "cfgs/cfgs_config.h"
 #include "cfgs_log.h"
+/* the function, not the gate */
+#undef cfgs_log
 
 #include <unistd.h>
 #include <stdio.h>
@@ -36,6 +38,7 @@
 #include <execinfo.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <stdint.h>
 
 #include <sys/types.h>
 
@@ -57,7 +60,8 @@
 #define FTOK_FILE     CFGST_LOGFILE_DIR "/" CFGST_LOGFILE_DEFAULT
 
 static FILE          *m_log_fd  = NULL;
-static CFGST_LOGLEVEL m_loglevel = CFGST_LL_DEFAULT;
+/* CFGST_LL_DEFAULT until the log is open: the first line opens it */
+int                   g_cfgs_loglevel = CFGST_LL_DEFAULT;
 static char           m_logname[FILENAME_MAX] = FTOK_FILE;
 
 
@@ -74,6 +78,52 @@ static int    m_shmid = -1;
 static pthread_mutex_t m_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 
+/*
+ *  Async mode: each thread formats its lines into a ring of its own, 
+ *  without locking; the writer thread drains the rings into the file. 
+ *  Positions in a ring grow forever, the offset is pos & (size - 1).  
+ */
+#if (CFGST_LOG_RING_SIZE & (CFGST_LOG_RING_SIZE - 1)) != 0
+#  error CFGST_LOG_RING_SIZE must be a power of 2
+#endif
+
+#define LOG_REC_SKIP   (-1)   /* level of the padding up to the ring's end */
+#define LOG_REC_ALIGN  (8)
+
+typedef struct _log_rec {
+    uint32_t        len;        /* of the record, frames and text, aligned */
+    int16_t         level;
+    int16_t         nb_frames;  /* CRITIC: stack, resolved by the writer */
+    int             err;
+    int             herr;
+    struct timespec ts;
+} log_rec;  /* followed by nb_frames void*, then the text with its NUL */
+
+typedef struct _log_ring log_ring;
+struct _log_ring {
+    log_ring *next;
+    uint32_t head;              /* written by the thread only */
+    uint32_t tail;              /* written by the writer only */
+    uint32_t dropped;
+    int      dead;              /* the thread is gone */
+    char     buf[ CFGST_LOG_RING_SIZE ] __attribute__((aligned(LOG_REC_ALIGN)));
+};
+
+static bool             m_async       = false;
+static bool             m_async_stop  = false;
+static bool             m_forked      = false;  /* writer to restart */
+static pthread_t        m_writer;
+static pthread_once_t   m_async_once  = PTHREAD_ONCE_INIT;
+static pthread_key_t    m_ring_key;
+static pthread_mutex_t  m_rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t  m_wake_mutex  = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   m_wake        = PTHREAD_COND_INITIALIZER;  /* a ring is full */
+static log_ring         *m_rings      = NULL;
+static __thread log_ring *m_ring      = NULL;
+
+static void async_start( void );
+
+
 #if 1
 /* debugging help - put a breakpoint here */
 #include <netdb.h>
@@ -163,7 +213,7 @@ get_pid( void )
 static bool
 can_log( CFGST_LOGLEVEL ll )
 {
-    if ( ll <= m_loglevel )
+    if ( (int)ll <= __atomic_load_n(&g_cfgs_loglevel, __ATOMIC_RELAXED) )
         return true;
     
     return false;
@@ -184,7 +234,19 @@ log_level( void )
 
 
 static bool
-initialize( void )
+log_async( void )
+{
+    const char *mode = getenv( CFGS_LOGMODE );
+    
+    if ( !mode || !*mode )
+        mode = CFGST_LOGMODE_DEFAULT;
+    
+    return 0 == strcmp( mode, "async" );
+}
+
+
+static bool
+open_log( void )
 {
     FILE *fd;
     int  file_flags;
@@ -193,15 +255,17 @@ initialize( void )
     if ( m_log_fd != NULL ) 
         return true;
     
-    /* set m_loglevel based on CFGS_LOGLEVEL env. var. */
-    m_loglevel = log_level();
+    /* set g_cfgs_loglevel based on CFGS_LOGLEVEL env. var. */
+    __atomic_store_n( &g_cfgs_loglevel, log_level(), __ATOMIC_RELAXED );
     
     fd = fopen( m_logname, "a" ); 
     if ( !fd ) {
         perror( "open LOGFILE" );
         return false;
     }
-    setvbuf( fd, NULL, _IONBF, 0 );
+    /* the writer of the async mode flushes by itself */
+    if ( !log_async() )
+        setvbuf( fd, NULL, _IONBF, 0 );
 
     /* next call sets errno 38 ENOSYS */
     if ( (file_flags = fcntl(fileno(fd), F_GETFL, 0)) == -1 ) {
@@ -224,11 +288,30 @@ initialize( void )
 #endif
     
     m_log_fd = fd;
+    (void)pthread_once( &m_async_once, async_start );
     errno = old_errno;
     return true;
 }
 
 
+/* once: with buffered lines in async mode, a second FILE would lose some */
+static bool
+initialize( void )
+{
+    static pthread_mutex_t init_mutex = PTHREAD_MUTEX_INITIALIZER;
+    bool                   ret;
+    
+    if ( m_log_fd != NULL ) 
+        return true;
+    
+    pthread_mutex_lock( &init_mutex );
+    ret = open_log();
+    pthread_mutex_unlock( &init_mutex );
+    
+    return ret;
+}
+
+
 #define STACK_DUMP_SZ  (20)
 inline static void 
 dump_stack( FILE *fp )
@@ -249,6 +332,295 @@ dump_stack( FILE *fp )
 }
 
 
+static void
+ring_exit( void *r )
+{
+    __atomic_store_n( &((log_ring*)r)->dead, 1, __ATOMIC_RELEASE );
+    m_ring = NULL;
+}
+
+
+static log_ring *
+my_ring( void )
+{
+    log_ring *r = m_ring;
+    
+    if ( r )
+        return r;
+    
+    /* not xmalloc: it may log */
+    r = calloc( 1, sizeof(log_ring) );
+    if ( !r )
+        return NULL;
+    pthread_setspecific( m_ring_key, r );
+    
+    pthread_mutex_lock( &m_rings_mutex );
+    r->next = m_rings;
+    m_rings = r;
+    pthread_mutex_unlock( &m_rings_mutex );
+    
+    m_ring = r;
+    return r;
+}
+
+
+/* @return false if the line is to be written the old way */
+static bool
+ring_log( CFGST_LOGLEVEL level, const char *fmt, va_list args )
+{
+    char     line[ CFGST_LOG_LINE_MAX ];
+    void     *frames[ STACK_DUMP_SZ ];
+    log_rec  rec;
+    log_ring *r;
+    uint32_t head, tail, off, pad, text;
+    int      n, waits;
+
+    rec.err  = errno;
+    rec.herr = h_errno;
+    
+    r = my_ring();
+    if ( !r )
+        return false;
+
+#ifdef CLOCK_REALTIME_COARSE
+    clock_gettime( CLOCK_REALTIME_COARSE, &rec.ts );
+#else
+    clock_gettime( CLOCK_REALTIME, &rec.ts );
+#endif
+    rec.level     = level;
+    rec.nb_frames = level == CFGST_LL_CRITIC ? backtrace( frames, STACK_DUMP_SZ ) : 0;
+    
+    n = vsnprintf( line, sizeof(line), fmt, args );
+    if ( n < 0 )
+        return true;
+    text = (uint32_t)n < sizeof(line) ? n + 1 : sizeof(line);
+    line[ text - 1 ] = '\0';
+    
+    rec.len = sizeof(log_rec) + rec.nb_frames * sizeof(void*) + text;
+    rec.len = (rec.len + LOG_REC_ALIGN - 1) & ~(LOG_REC_ALIGN - 1);
+
+    head = r->head;
+    tail = __atomic_load_n( &r->tail, __ATOMIC_ACQUIRE );
+    off  = head & (CFGST_LOG_RING_SIZE - 1);
+    pad  = off + rec.len > CFGST_LOG_RING_SIZE ? CFGST_LOG_RING_SIZE - off : 0;
+    /* full: wake the writer up and give it some time */
+    for ( waits=0; CFGST_LOG_RING_SIZE - (head - tail) < pad + rec.len; waits++ ) {
+        struct timespec ts = { 0, 1000000L };
+
+        if ( waits == CFGST_LOG_FLUSH_MS ) {
+            __atomic_add_fetch( &r->dropped, 1, __ATOMIC_RELAXED );
+            return true;
+        }
+        pthread_cond_signal( &m_wake );
+        nanosleep( &ts, NULL );
+        tail = __atomic_load_n( &r->tail, __ATOMIC_ACQUIRE );
+    }
+    
+    if ( pad ) {
+        log_rec skip;
+
+        skip.len   = pad;
+        skip.level = LOG_REC_SKIP;
+        memcpy( r->buf + off, &skip, sizeof(uint32_t) + sizeof(int16_t) );
+        off = 0;
+    }
+    memcpy( r->buf + off, &rec, sizeof(rec) );
+    memcpy( r->buf + off + sizeof(rec), frames, rec.nb_frames * sizeof(void*) );
+    memcpy( r->buf + off + sizeof(rec) + rec.nb_frames * sizeof(void*), line, text );
+
+    __atomic_store_n( &r->head, head + pad + rec.len, __ATOMIC_RELEASE );
+    return true;
+}
+
+
+/* Writer, with m_rings_mutex.  @return false if r is empty */
+static bool
+ring_drain( log_ring *r )
+{
+    static time_t last_sec = 0;
+    static char   stamp[ 64 ];
+    static int    year;
+    uint32_t      tail = r->tail;
+    uint32_t      head = __atomic_load_n( &r->head, __ATOMIC_ACQUIRE );
+    uint32_t      dropped;
+    pid_t         pid  = get_pid();
+    
+    if ( tail == head && !r->dropped )
+        return false;
+    
+    while ( tail != head ) {
+        const char *p = r->buf + (tail & (CFGST_LOG_RING_SIZE - 1));
+        log_rec    rec;
+
+        memcpy( &rec, p, sizeof(uint32_t) + sizeof(int16_t) );
+        if ( rec.level == LOG_REC_SKIP ) {
+            tail += rec.len;
+            continue;
+        }
+        memcpy( &rec, p, sizeof(rec) );
+
+        if ( rec.ts.tv_sec != last_sec ) {
+            struct tm tm;
+
+            localtime_r( &rec.ts.tv_sec, &tm );
+            strftime( stamp, sizeof(stamp), "%a %b %e %H:%M:%S", &tm );
+            year     = tm.tm_year + 1900;
+            last_sec = rec.ts.tv_sec;
+        }
+        /* as ctime(), with ms */
+        fprintf( m_log_fd, "\n[%ld] %s.%03ld %d\n", 
+                 (long)pid, stamp, rec.ts.tv_nsec / 1000000, year );
+        if ( rec.level <= CFGST_LL_CRITIC )
+            fprintf( m_log_fd, "(errno=[%d] %s, h_errno=[%d] )\n", 
+                    rec.err, strerror(rec.err), rec.herr );
+        fputs( p + sizeof(rec) + rec.nb_frames * sizeof(void*), m_log_fd );
+        if ( rec.nb_frames > 0 ) {
+            fflush( m_log_fd );
+            backtrace_symbols_fd( (void* const*)(p + sizeof(rec)), rec.nb_frames, 
+                                  fileno(m_log_fd) );
+        }
+        tail += rec.len;
+    }
+    __atomic_store_n( &r->tail, tail, __ATOMIC_RELEASE );
+
+    dropped = __atomic_exchange_n( &r->dropped, 0, __ATOMIC_RELAXED );
+    if ( dropped )
+        fprintf( m_log_fd, "\n[%ld] %u lines dropped\n", (long)pid, dropped );
+    return true;
+}
+
+
+/* Writer: one pass over the rings, freeing those of the threads gone */
+static void
+rings_drain( void )
+{
+    log_ring **pr;
+    bool     wrote = false;
+
+    pthread_mutex_lock( &m_rings_mutex );
+    if ( !lock() ) {
+        pthread_mutex_unlock( &m_rings_mutex );
+        return;
+    }
+    for ( pr=&m_rings; *pr; ) {
+        log_ring *r = *pr;
+        /* dead first: nothing is added to it after */
+        bool     dead = __atomic_load_n( &r->dead, __ATOMIC_ACQUIRE );
+
+        if ( ring_drain(r) ) 
+            wrote = true;
+        if ( dead ) {
+            *pr = r->next;
+            free( r );
+        } else {
+            pr = &r->next;
+        }
+    }
+    if ( wrote ) 
+        fflush( m_log_fd );
+    unlock();
+    pthread_mutex_unlock( &m_rings_mutex );
+}
+
+
+static void *
+log_writer( void *arg )
+{
+    while ( !__atomic_load_n(&m_async_stop, __ATOMIC_ACQUIRE) ) {
+        struct timespec ts;
+        
+        rings_drain();
+        
+        clock_gettime( CLOCK_REALTIME, &ts );
+        ts.tv_nsec += CFGST_LOG_FLUSH_MS * 1000000L;
+        ts.tv_sec  += ts.tv_nsec / 1000000000L;
+        ts.tv_nsec %= 1000000000L;
+        pthread_mutex_lock( &m_wake_mutex );
+        pthread_cond_timedwait( &m_wake, &m_wake_mutex, &ts );
+        pthread_mutex_unlock( &m_wake_mutex );
+    }
+    rings_drain();
+    
+    return NULL;
+}
+
+
+static void
+async_stop( void )
+{
+    if ( !m_async )
+        return;
+    m_async = false;
+    __atomic_store_n( &m_async_stop, true, __ATOMIC_RELEASE );
+    pthread_join( m_writer, NULL );
+}
+
+
+/* Around fork: the child gets a writer of its own on its first line */
+static void
+fork_prepare( void )
+{
+    pthread_mutex_lock( &m_rings_mutex );
+    pthread_mutex_lock( &m_mutex );
+}
+
+static void
+fork_parent( void )
+{
+    pthread_mutex_unlock( &m_mutex );
+    pthread_mutex_unlock( &m_rings_mutex );
+}
+
+static void
+fork_child( void )
+{
+    log_ring *r;
+
+    /* the rings of the parent's threads, the forking one's too */
+    while ( (r = m_rings) ) {
+        m_rings = r->next;
+        free( r );
+    }
+    if ( m_async )
+        pthread_setspecific( m_ring_key, NULL );
+    m_ring   = NULL;
+    m_forked = m_async;
+    m_async  = false;
+    pthread_mutex_unlock( &m_mutex );
+    pthread_mutex_unlock( &m_rings_mutex );
+}
+
+
+static void
+writer_restart( void )
+{
+    pthread_mutex_lock( &m_rings_mutex );
+    if ( m_forked ) {
+        m_forked     = false;
+        m_async_stop = false;
+        if ( 0 == pthread_create(&m_writer, NULL, log_writer, NULL) )
+            m_async = true;
+    }
+    pthread_mutex_unlock( &m_rings_mutex );
+}
+
+
+static void
+async_start( void )
+{
+    if ( !log_async() )
+        return;
+    
+    if ( 0 != pthread_key_create(&m_ring_key, ring_exit) )
+        return;
+    if ( 0 != pthread_create(&m_writer, NULL, log_writer, NULL) )
+        return;
+    pthread_atfork( fork_prepare, fork_parent, fork_child );
+    atexit( async_stop );
+    m_async = true;
+}
+
+
 void 
 cfgs_log( CFGST_LOGLEVEL level, const char* fmt, ... )
 {
@@ -265,6 +637,17 @@ cfgs_log( CFGST_LOGLEVEL level, const char* fmt, ... )
         return;
     }
 
+    if ( m_forked )
+        writer_restart();
+    if ( m_async ) {
+        bool done;
+        
+        va_start( args, fmt );
+        done = ring_log( level, fmt, args );
+        va_end( args );
+        if ( done )
+            return;
+    }
 
     if ( !lock() )
         return;
@@ -290,9 +673,20 @@ cfgs_log( CFGST_LOGLEVEL level, const char* fmt, ... )
 }
 
 
+void 
+cfgs_set_loglevel( CFGST_LOGLEVEL level )
+{
+    /* the log open later would override it */
+    if ( initialize() )
+        __atomic_store_n( &g_cfgs_loglevel, level, __ATOMIC_RELAXED );
+}
+
+
 void 
 cfgs_close_log( void )
 {
+    async_stop();
+
 #ifdef CFGST_LOG_MULTIPROCESS
     if ( m_semid != -1 ) 
         semctl( m_semid, 0, IPC_RMID, 0), m_semid = -1;
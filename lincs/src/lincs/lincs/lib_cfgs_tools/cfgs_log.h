@@ -39,7 +39,13 @@ extern "C" {
 #include <assert.h>
 
 
-#if 1
+/*\def CFGST_LL_COMPILED. Lines of a higher level are compiled out, 
+  CFGST_LL_NONE removes all logging; e.g. -DCFGST_LL_COMPILED=1 */
+#ifndef CFGST_LL_COMPILED
+#  define CFGST_LL_COMPILED  255  /* CFGST_LL_ALL */
+#endif
+
+#if CFGST_LL_COMPILED > 0
 #  define LOG( a )    {a}
 #else
 #  define LOG( a )
@@ -85,6 +91,10 @@ typedef enum
 /*\def CFGS_LOGLEVEL. Environment variable to set current logging level, which is
   read only at init time. Value range 0...255 */
 #define CFGS_LOGLEVEL "CFGS_LOGLEVEL"
+/*\def CFGS_LOGMODE. Environment variable, read at init time: "async" to have 
+  each thread queue its lines, written by a background thread every 
+  CFGST_LOG_FLUSH_MS, instead of writing them itself under a lock */
+#define CFGS_LOGMODE  "CFGS_LOGMODE"
 
 
 #ifndef CFGST_LL_DEFAULT
@@ -96,6 +106,19 @@ typedef enum
 #ifndef CFGST_LOGFILE_DIR
 #  define CFGST_LOGFILE_DIR        "/tmp"
 #endif
+#ifndef CFGST_LOGMODE_DEFAULT
+#  define CFGST_LOGMODE_DEFAULT    "sync" /* "async" */
+#endif
+/* async mode: bytes queued per thread, a power of 2; a thread finding its 
+   ring full waits up to CFGST_LOG_FLUSH_MS for room, then drops the line */
+#ifndef CFGST_LOG_RING_SIZE
+#  define CFGST_LOG_RING_SIZE      (256*1024)
+#endif
+#ifndef CFGST_LOG_FLUSH_MS
+#  define CFGST_LOG_FLUSH_MS       (50)
+#endif
+/* async mode: longer lines are truncated */
+#define CFGST_LOG_LINE_MAX         (2048)
 
 
 
@@ -109,6 +132,23 @@ extern void cfgs_log_bin( CFGST_LOGLEVEL level, const char *msg,
                 const char* buf, long len );
 extern void cfgs_close_log( void );
 
+/** Current level, CFGS_LOGLEVEL once the log is open: read it with cfgs_log_on */
+extern int  g_cfgs_loglevel;
+/** Change the current level, e.g. on a signal */
+extern void cfgs_set_loglevel( CFGST_LOGLEVEL level );
+
+/** Would a line of @param level be logged.  Cheap: guard costly debugging with it */
+#define cfgs_log_on( level ) \
+    ( (level) <= CFGST_LL_COMPILED \
+      && (int)(level) <= __atomic_load_n(&g_cfgs_loglevel, __ATOMIC_RELAXED) )
+
+/* Arguments of a line not logged are not evaluated, nor is cfgs_log called */
+#define cfgs_log( level, ... ) \
+    do { \
+        if ( cfgs_log_on(level) ) \
+            (cfgs_log)( level, __VA_ARGS__ ); \
+    } while ( 0 )
+
 
 /** Exposed only to allow mutex table dumping.  
     @return -1 if log file not open.  */
@@ -31,7 +31,9 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
 #include <time.h>
+#include <errno.h>
 
 #include "cfgs_mutex.h"
 
@@ -44,33 +46,66 @@ typedef struct _cfgs_mutex {
     int             order;  /**< priority...*/
     pthread_t       thread; 
     const char      *infos;
+    /* contention, written with the mutex held */
+    unsigned long   locks;
+    unsigned long   waits;      /**< locks that had to wait */
+    long long       wait_ns;
+    long long       wait_max_ns;
+    long long       hold_max_ns;
+    long long       locked_at;  /**< ns, by the holder */
 } cfgs_mutex;
 
 
-/* FIXME: replace it with a map */ 
 /* +one for cfgs_log mutex, last entry */
 static cfgs_mutex m_mutexes[ CFGS_MO_MAX+1 ] = {0};
 
+/* 
+ * Registered mutexes by address: open addressing, filled by 
+ * cfgs_mutex_register before the threads using them start.  
+ */
+#define MO_HASH_SIZE  (256)   /* > CFGS_MO_MAX, a power of 2 */
+static cfgs_mutex *m_by_addr[ MO_HASH_SIZE ] = {0};
+
+/* Orders of the mutexes the thread holds, a bit each */
+#define MO_WORDS  ((CFGS_MO_MAX + 1 + 63) / 64)
+static __thread uint64_t m_held[ MO_WORDS ];
 
 
-static int 
-find_ord( pthread_mutex_t *m )
+static unsigned
+addr_hash( pthread_mutex_t *m )
 {
-    int ord = -1, i;
+    uintptr_t h = (uintptr_t)m;
     
-    for ( i=0; i<CFGS_MO_MAX; i++ ) {
-        if ( m_mutexes[i].mutex == m ) {
-            ord = m_mutexes[i].order; 
-            break;
-        }
-    }
+    h ^= h >> 17;
+    h *= 0x9E3779B1u;
+    return (unsigned)(h >> 8) & (MO_HASH_SIZE - 1);
+}
+
 
-    if ( ord < 0 ) {
-        LOG( cfgs_log(CFGST_LL_CRITIC, "mutex not cfgs_mutex_register'ed \n"); );
+static cfgs_mutex *
+find_mutex( pthread_mutex_t *m )
+{
+    unsigned i = addr_hash( m );
+    
+    while ( m_by_addr[i] ) {
+        if ( m_by_addr[i]->mutex == m )
+            return m_by_addr[ i ];
+        i = (i + 1) & (MO_HASH_SIZE - 1);
     }
-    lassert( ord >= 0 );
-        
-    return ord;
+
+    LOG( cfgs_log(CFGST_LL_CRITIC, "mutex not cfgs_mutex_register'ed \n"); );
+    lassert( false );
+    return NULL;
+}
+
+
+static long long
+now_ns( void )
+{
+    struct timespec ts;
+    
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
 
@@ -78,18 +113,19 @@ find_ord( pthread_mutex_t *m )
 static void
 assert_no_higher( int ord )
 {
-    pthread_t self = pthread_self(); 
-    int       i;
-    int       fd = _cfgs_logfd() >= 0 ? _cfgs_logfd() : 2; 
+    int i   = ord / 64;
+    int fd  = _cfgs_logfd() >= 0 ? _cfgs_logfd() : 2; 
+    bool higher;
     
-    for ( i=0; i<CFGS_MO_MAX; i++ ) {
-        if (  m_mutexes[i].thread == self 
-           && m_mutexes[i].order > ord
-           ) {
-             cfgs_mutex_dump( fd ); 
-             cfgs_mutex_dump( 2 ); 
-             lassert( false );
-        }
+    /* bits above ord in its word, then the next words */
+    higher = ( m_held[i] & ~((((uint64_t)2) << (ord % 64)) - 1) ) != 0;
+    for ( i++; !higher && i<MO_WORDS; i++ )
+        higher = m_held[ i ] != 0;
+    
+    if ( higher ) {
+        cfgs_mutex_dump( fd ); 
+        cfgs_mutex_dump( 2 ); 
+        lassert( false );
     }
 }
 
@@ -97,6 +133,8 @@ assert_no_higher( int ord )
 void 
 cfgs_mutex_register( pthread_mutex_t *m, int ord, const char *infos )
 {
+    unsigned i;
+    
     lassert( ord <= CFGS_MO_MAX );
     
     if ( m_mutexes[ord].mutex ) {
@@ -108,44 +146,54 @@ cfgs_mutex_register( pthread_mutex_t *m, int ord, const char *infos )
     m_mutexes[ord].mutex  = m;
     m_mutexes[ord].infos  = infos;
     m_mutexes[ord].thread = CFGS_INVALID_THR; 
+    
+    for ( i=addr_hash(m); m_by_addr[i]; i=(i + 1) & (MO_HASH_SIZE - 1) )
+        ;
+    m_by_addr[ i ] = &m_mutexes[ ord ];
 }
 
 
-/* How often we try  to lock the mutex, tries per second */
-/* FIXME: use a cond var instead */
-#define LOCK_RESOLUTION  (20)
-#define NANOS            (1000000000)
-#define ATTEMPTS         (MUTEX_LOCK_TOUT * LOCK_RESOLUTION)
+/*
+ *  Uncontended: one trylock.  Else spin a little - the holders keep it for 
+ *  short - then block until it is free or for MUTEX_LOCK_TOUT. 
+ */
+#define LOCK_SPINS  (100)
 int 
 cfgs_mutex_lock( pthread_mutex_t *m )
 {
-    int      ret = 0;
-    int      ord;
-    long     attempts = ATTEMPTS; 
-    int      fd = _cfgs_logfd() >= 0 ? _cfgs_logfd() : 2; 
+    int        ret;
+    int        spins;
+    int        fd = _cfgs_logfd() >= 0 ? _cfgs_logfd() : 2; 
+    cfgs_mutex *cm;
+    long long  start = 0;
     
     lassert( m != NULL );
     
-    ord = find_ord( m );
+    cm = find_mutex( m );
     
-    LOG( cfgs_log(CFGST_LL_CRITIC, 
+    LOG( cfgs_log(CFGST_LL_DEBUG, 
             "cfgs_mutex_lock %p attempt by thread %ld ...\n", 
             m, pthread_self()); );
-    assert_no_higher( ord ); 
+    if ( cm )
+        assert_no_higher( cm->order ); 
     
-    do {
-        const struct timespec ts = { 0, NANOS/LOCK_RESOLUTION };
-
+    ret = pthread_mutex_trylock( m );
+    for ( spins=0; ret == EBUSY && spins<LOCK_SPINS; spins++ ) {
+        if ( !start )
+            start = now_ns();
         ret = pthread_mutex_trylock( m );
-        if ( ret == 0 )
-            break;
-        nanosleep( &ts, NULL ); /*FIXME: remaining time, ret code */
-        /*pthread_yield();  /* mising in older versions */
-    } while ( --attempts > 0 );
+    }
+    if ( ret == EBUSY ) {
+        struct timespec tout;
+        
+        clock_gettime( CLOCK_REALTIME, &tout );
+        tout.tv_sec += MUTEX_LOCK_TOUT;
+        ret = pthread_mutex_timedlock( m, &tout );
+    }
     
     if ( ret != 0 ) {
         LOG( cfgs_log(CFGST_LL_CRITIC, 
-                "cfgs_mutex_lock(%d): %ld pthread_mutex_trylock(%p) \n", 
+                "cfgs_mutex_lock(%d): %ld pthread_mutex_timedlock(%p) \n", 
                 ret, pthread_self(), m); );
         cfgs_mutex_dump( fd ); 
         cfgs_mutex_dump( 2 ); 
@@ -153,11 +201,24 @@ cfgs_mutex_lock( pthread_mutex_t *m )
     }
 
     /* account it */
-    if ( ord >= 0 ) {
-        m_mutexes[ord].thread = pthread_self(); 
+    if ( cm ) {
+        long long t = now_ns();
+        
+        cm->thread    = pthread_self(); 
+        cm->locked_at = t;
+        cm->locks++;
+        if ( start ) {
+            long long w = t - start;
+            
+            cm->waits++;
+            cm->wait_ns += w;
+            if ( w > cm->wait_max_ns )
+                cm->wait_max_ns = w;
+        }
+        m_held[ cm->order / 64 ] |= ((uint64_t)1) << (cm->order % 64);
     }
     
-    LOG( cfgs_log(CFGST_LL_CRITIC, 
+    LOG( cfgs_log(CFGST_LL_DEBUG, 
             "cfgs_mutex_lock %p by thread %ld \n", 
             m, pthread_self()); );
     return ret;
@@ -167,18 +228,29 @@ cfgs_mutex_lock( pthread_mutex_t *m )
 int 
 cfgs_mutex_unlock( pthread_mutex_t *m )
 {
-    int ret;
-    int ord;
-    int fd = _cfgs_logfd() >= 0 ? _cfgs_logfd() : 2; 
+    int        ret;
+    int        fd = _cfgs_logfd() >= 0 ? _cfgs_logfd() : 2; 
+    cfgs_mutex *cm;
     
     lassert( m != NULL );
     
-    ord = find_ord( m );
-    lassert( ord >= 0 );
+    cm = find_mutex( m );
+    lassert( cm != NULL );
     
-    LOG( cfgs_log(CFGST_LL_CRITIC, 
+    LOG( cfgs_log(CFGST_LL_DEBUG, 
             "cfgs_mutex_UNlock %p attempt by thread %ld ...\n", 
             m, pthread_self()); );
+    
+    /* cleanup corresponding entry, while it is ours */
+    if ( cm ) {
+        long long h = now_ns() - cm->locked_at;
+        
+        if ( h > cm->hold_max_ns )
+            cm->hold_max_ns = h;
+        cm->thread = CFGS_INVALID_THR; 
+        m_held[ cm->order / 64 ] &= ~(((uint64_t)1) << (cm->order % 64));
+    }
+    
     ret = pthread_mutex_unlock( m );
     if ( ret != 0 ) {
         LOG( cfgs_log(CFGST_LL_CRITIC, 
@@ -189,19 +261,14 @@ cfgs_mutex_unlock( pthread_mutex_t *m )
         return ret;
     }
     
-    /* cleanup corresponding entry */
-    if ( ord >= 0 ) {
-        m_mutexes[ord].thread = CFGS_INVALID_THR; 
-    }
-    
-    LOG( cfgs_log(CFGST_LL_CRITIC, 
+    LOG( cfgs_log(CFGST_LL_DEBUG, 
             "cfgs_mutex_UNlock %p by thread %ld \n", 
             m, pthread_self()); );
     return ret;
 }
 
 
-#define LINE_SZ (128)
+#define LINE_SZ (192)
 void 
 cfgs_mutex_dump( int fd )
 {
@@ -209,7 +276,8 @@ cfgs_mutex_dump( int fd )
     int        i;
     const char hdr[] = 
         "From thread %ld: \n"
-        "  Order Mutex   Thread  infos \n";
+        "  Order Mutex   Thread  infos \n"
+        "        locks waits wait(ms) wait max(us) hold max(us) \n";
         /* 0123456789.123456789.123456789.123456789. */
     char       line[ LINE_SZ+1 ] = {0};
     unsigned   llen;
@@ -221,11 +289,18 @@ cfgs_mutex_dump( int fd )
         if ( !(m_mutexes[i].mutex) )
             continue;
             
-        /* print it */
+        /* print it; the counters may be being updated */
         memset( line, 0, LINE_SZ );
-        llen = snprintf( line, LINE_SZ, "  %03d %p %ld \t%s \n", 
+        llen = snprintf( line, LINE_SZ, "  %03d %p %ld \t%s \n"
+                "        %lu %lu %lld %lld %lld \n", 
                 m_mutexes[i].order,  m_mutexes[i].mutex, 
-        m_mutexes[i].thread, SAFE(m_mutexes[i].infos) );
+                m_mutexes[i].thread, SAFE(m_mutexes[i].infos),
+                m_mutexes[i].locks, m_mutexes[i].waits, 
+                m_mutexes[i].wait_ns / 1000000, 
+                m_mutexes[i].wait_max_ns / 1000, 
+                m_mutexes[i].hold_max_ns / 1000 );
+        if ( llen > LINE_SZ )
+            llen = LINE_SZ;
         cfgst_rwrite( fd, line, llen );
     }
     
@@ -49,8 +49,7 @@ extern "C" {
  * the mutex used by cfgs_log.c, which has a prio of CFGS_MO_MAX+1.  
  */
 #define CFGS_MO_CONN         (10)  /* cfgs_configd.c */
-#define CFGS_MO_BACKENDS     (20)  /* cfgs_configd.c */
-#define CFGS_MO_NOTIF_QUEUE  (30)  /* cfgs_configd.c */
+#define CFGS_MO_BACKENDS     (20)  /* cfgs_configd.c, rwlock: not registered */
 #define CFGS_MO_NOTIF_LIST   (40)  /* cfgs_configd.c */
 
 
@@ -77,7 +76,8 @@ int cfgs_mutex_islocked( pthread_mutex_t *m );
 int cfgs_mutex_unlock( pthread_mutex_t *m );
 
 /**
- *  Prints to file descriptor @param fd the current situation. 
+ *  Prints to file descriptor @param fd the current situation and, for each 
+ *  mutex, its locks, how many and how long waited, its longest hold.  
  */
 void cfgs_mutex_dump( int fd );
 
@@ -32,9 +32,11 @@
 #include <stdio.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "cfgs_protocol.h"
 #include "http_protocol.h"
+#include "bin_protocol.h"
 #include "cfgs_mem.h"
 #include "cfgs_log.h"
 #include "cfgs_dlist.h"
@@ -56,14 +58,14 @@ static char *m_request_strings[] = {
 
 
 /*
- * requests to text (client)
+ * requests to tags (client)
  */
-typedef cfgs_buf* rq_to_xml_func( va_list );
-#define X(a,b)  static cfgs_buf * b##_rq_to_xml( va_list );
+typedef cfgs_tag* rq_to_tags_func( va_list );
+#define X(a,b)  static cfgs_tag * b##_rq_to_tags( va_list );
 CFGS_API_EXPORTS
 #undef X
-#define X(a,b)  b##_rq_to_xml,
-rq_to_xml_func *m_rq_to_xml[] = {
+#define X(a,b)  b##_rq_to_tags,
+rq_to_tags_func *m_rq_to_tags[] = {
     CFGS_API_EXPORTS
 };
 #undef X
@@ -71,8 +73,8 @@ rq_to_xml_func *m_rq_to_xml[] = {
 /*
  * request handlers (server)
  */
-typedef cfgs_buf* rqh_handler_func( cfgs_tag*, CFGSP_CALLBACK*, cfgsp_data *cb_data );
-#define X(a,b)  static cfgs_buf * b##_rqh_handler( cfgs_tag*, CFGSP_CALLBACK*, cfgsp_data *cb_data );
+typedef cfgs_tag* rqh_handler_func( cfgs_tag*, CFGSP_CALLBACK*, cfgsp_data *cb_data );
+#define X(a,b)  static cfgs_tag * b##_rqh_handler( cfgs_tag*, CFGSP_CALLBACK*, cfgsp_data *cb_data );
 CFGS_API_EXPORTS
 #undef X
 #define X(a,b)  b##_rqh_handler,
@@ -82,24 +84,109 @@ rqh_handler_func *m_rqh_handler[] = {
 #undef X
  
 /*
- * answers to text (server).  Will free 'in'.  
+ * answers to tags (server), in the request's arena.  Will free 'in'.  
  */
-typedef cfgs_buf* answer_to_xml_func( void* /*in*/ );
-#define X(a,b)  static cfgs_buf * b##_answer_to_xml( void* );
+typedef cfgs_tag* answer_to_tags_func( cfgs_arena*, void* /*in*/ );
+#define X(a,b)  static cfgs_tag * b##_answer_to_tags( cfgs_arena*, void* );
 CFGS_API_EXPORTS
 #undef X
-#define X(a,b)  b##_answer_to_xml,
-answer_to_xml_func *m_answer_to_xml[] = {
+#define X(a,b)  b##_answer_to_tags,
+answer_to_tags_func *m_answer_to_tags[] = {
     CFGS_API_EXPORTS
 };
 #undef X
  
 
+static cfgs_buf *xml_tags_encode( cfgs_tag *tags );
+static cfgs_tag *xml_tags_decode( cfgs_arena *arena, const char *buf, int len );
 
 cfgsp_hosting_protocol m_hosting_protocols[] = {
     /*CFGSP_HOST_PROTO_HTTP*/
-    { http_client_send, http_client_recv, http_server_send, http_server_recv, }, 
+    { http_client_send, http_client_recv, http_server_send, http_server_recv, 
+      http_server_frame, xml_tags_encode, xml_tags_decode, http_request_len, }, 
+    /*CFGSP_HOST_PROTO_BIN*/
+    { bin_client_send,  bin_client_recv,  bin_server_send,  bin_server_recv, 
+      bin_server_frame, bin_tags_encode,  bin_tags_decode,  bin_request_len, }, 
 };
+#define HOST_PROTO_NUM  ( sizeof(m_hosting_protocols)/sizeof(cfgsp_hosting_protocol) )
+
+
+/* 
+ * Server side: answers and pushed changes can be written to the same socket 
+ * by different threads.  Sockets are striped over a few send locks.  
+ */
+#define SEND_LOCKS  (16)
+static pthread_mutex_t m_send_locks[SEND_LOCKS] = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, 
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, 
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, 
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, 
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, 
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, 
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, 
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, 
+};
+#define SEND_LOCK( sock )  ( &m_send_locks[(sock) % SEND_LOCKS] )
+
+/* 
+ * Server side: a pushed change the socket took part of.  The rest goes 
+ * before anything else written there.  Under SEND_LOCK(sock), in the list 
+ * of its lock.  
+ */
+typedef struct _push_rest push_rest;
+struct _push_rest {
+    push_rest *next;
+    push_rest *prev;
+    int       sock;
+    char      *buf;
+    int       len;     /* buf[sent..len) is still to send */
+    int       sent;
+};
+static push_rest *m_push_rests[SEND_LOCKS];
+
+static int push_rest_send( int sock, bool wait );
+
+
+/* 
+ * Server side: the tags of a request and of its answer are built in an 
+ * arena owned by the thread processing it, released once the answer is sent. 
+ */
+static pthread_key_t  m_arena_key;
+static pthread_once_t m_arena_once = PTHREAD_ONCE_INIT;
+
+static void
+arena_destroy( void *arena )
+{
+    cfgs_arena_free( (cfgs_arena*)arena );
+}
+
+static void
+arena_key_create( void )
+{
+    (void)pthread_key_create( &m_arena_key, arena_destroy );
+}
+
+/* NULL if out of memory: the heap is then used */
+static cfgs_arena *
+thread_arena( void )
+{
+    cfgs_arena *arena;
+    
+    (void)pthread_once( &m_arena_once, arena_key_create );
+    arena = (cfgs_arena*)pthread_getspecific( m_arena_key );
+    if ( !arena ) {
+        arena = cfgs_arena_new( 0 );
+        if ( arena && 0 != pthread_setspecific(m_arena_key, arena) ) {
+            cfgs_arena_free( arena );
+            arena = NULL;
+        }
+    }
+    
+    return arena;
+}
+
+/* Client side: where pushed changes go */
+static CFGSP_PUSH_CALLBACK *m_push_callback = NULL;
 
 
 
@@ -168,60 +255,81 @@ xml_footer( cfgs_buf *b )
             "</" CFGS_TAG_CFGS ">\r\n"
             "\r\n") )
         return false;
+    /* NULL terminated for logging, not part of the message */
     if ( !cfgs_buf_cat_ch(b, '\0') ) return false;
+    b->used--;
     
     return true;
 }
 
 
-/* FIXME: this belongs to cfgs_str.h ? */
-static bool
-xml_add_attr( cfgs_buf *b, const char* name, const char *val )
+/** tags to a xml document */
+static cfgs_buf *
+xml_tags_encode( cfgs_tag *tags )
 {
-    lassert( b && name && val );
-    /* FIXME: on malloc err, should reset b so that we do not propagate invalid tags */
-    if ( !cfgs_buf_cat_str(b, name) )  { return false; }
-    if ( !cfgs_buf_cat_str(b, "=\"") ) { return false; }
-    if ( !cfgs_buf_cat_str(b, val) )   { return false; }
-    if ( !cfgs_buf_cat_str(b, "\" ") ) { return false; }
+    cfgs_buf *b = cfgs_buf_new( NULL, 256 );
+    cfgs_tag *t;
     
-    return true;
+    if ( !b )
+        return NULL;
+    
+    if ( !xml_header(b) ) {
+        cfgs_buf_free( b );
+        return NULL;
+    }
+    for ( t=tags; t; t=t->next ) {
+        /*FIXME: name/vals should be checked for forbidden contest, such as <,>,& etc. */
+        if ( !cfgs_buf_cat_str(b, "    ") || !cfgs_tag_to_cfgs_buf(t, b) ) {
+            cfgs_buf_free( b );
+            return NULL;
+        }
+    }
+    if ( !xml_footer(b) ) {
+        cfgs_buf_free( b );
+        return NULL;
+    }
+    
+    return b;
 }
 
 
-static cfgs_buf*
-cfgs_getval_rq_to_xml( va_list ap )
+static cfgs_tag *
+xml_tags_decode( cfgs_arena *arena, const char *buf, int len )
 {
-    cfgs_buf   *brq     = cfgs_buf_new( NULL, 0 );
-    const char *valname = va_arg( ap, char* );
-    const char *layer   = va_arg( ap, char* );
+    return cfgs_tags_from_str_in( arena, buf, len );
+}
 
-    if ( !brq ) {
-        return NULL;
-    }
-    
-    xml_header( brq );
+
+/** A function call tag for @param idx, with name & layer attributes if any */
+static cfgs_tag*
+func_call_tag( CFGS_FUNC_INDEX idx, const char *name, const char *layer )
+{
+    cfgs_tag *t = cfgs_tag_new( CFGS_TAG_FUNC_CALL );
     
-    if ( !cfgs_buf_cat_str(brq, "    " "<" CFGS_TAG_FUNC_CALL " ") ) {
-        cfgs_buf_free( brq );
+    if ( !t )
         return NULL;
-    }
-    xml_add_attr( brq, CFGS_TA_FUNCTION, m_request_strings[CFGS_GETVAL] ); 
-    if ( valname )
-        xml_add_attr( brq, CFGS_EA_NAME, valname );
-    if ( layer )
-        xml_add_attr( brq, CFGS_EA_LAYER, layer ); 
-    if ( !cfgs_buf_cat_str(brq, "/>\r\n") ) {
-        cfgs_buf_free( brq );
+    
+    if (  !cfgs_tag_add_attr(t, CFGS_TA_FUNCTION, m_request_strings[idx])
+       || (name  && !cfgs_tag_add_attr(t, CFGS_EA_NAME, name))
+       || (layer && !cfgs_tag_add_attr(t, CFGS_EA_LAYER, layer)) ) {
+        cfgs_tag_free( t );
         return NULL;
     }
+    
+    return (cfgs_tag*)cfgs_dlist_cons( (cfgs_dlist*)t );
+}
 
-    xml_footer( brq );
 
-    return brq;
+static cfgs_tag*
+cfgs_getval_rq_to_tags( va_list ap )
+{
+    const char *valname = va_arg( ap, char* );
+    const char *layer   = va_arg( ap, char* );
+
+    return func_call_tag( CFGS_GETVAL, valname, layer );
 }
 
-static cfgs_buf*
+static cfgs_tag*
 cfgs_getval_rqh_handler( 
     cfgs_tag       *tag, 
     CFGSP_CALLBACK *tag_callback,
@@ -242,87 +350,72 @@ TEST_ERROR
     pv = (*tag_callback)( cb_data ); 
 TEST_ERROR
     
-    return (*m_answer_to_xml[CFGS_GETVAL])( pv );
+    return (*m_answer_to_tags[CFGS_GETVAL])( cb_data->arena, pv );
 }
 
-/* transform entry list into a string */
-static cfgs_buf*
-cfgs_getval_answer_to_xml( void *in )
+/* transform entry list into tags */
+static cfgs_tag*
+cfgs_getval_answer_to_tags( cfgs_arena *arena, void *in )
 {
     cfgs_entry *vals = (cfgs_entry*)in;
-    cfgs_buf   *ret  = NULL; 
     cfgs_tag   *tags;
     
     if ( !vals )
         return NULL;
     
-    tags = cs_tags_from_entries( vals );
-    if ( tags ) {
-        ret = cfgs_tags_to_cfgs_buf( tags );
-        CFGST_DLIST_FREE( tags, cfgs_tag_free );
-    }
+    tags = cs_tags_from_entries( arena, vals );
     
     CFGST_DLIST_FREE( vals, cfgs_entry_free );
     
-    return ret;
+    return tags;
 }
 
 /*----------------------------------------------------*/
 
-static bool
-add_entry_as_xml( cfgs_buf* brq, cfgs_entry *val )
+static cfgs_tag*
+entry_to_tag( cfgs_entry *val )
 {
-    lassert( brq && val );
+    cfgs_tag   *t = cfgs_tag_new( CFGS_TAG_ENTRY );
+    cfgs_pair  *attr;
     
-    if ( !cfgs_buf_cat_str(brq, "    " "<" CFGS_TAG_FUNC_CALL " ") ) {
-        return false;
-    }
-    xml_add_attr( brq, CFGS_TA_FUNCTION, m_request_strings[CFGS_SETVAL] ); 
+    lassert( val );
+    if ( !t )
+        return NULL;
     
-    if ( val ) {
-        cfgs_pair  *attr;
-        /*FIXME: name/vals should be checked for forbidden contest, such as <,>,& etc. */
-        for ( attr=val->attr; attr; attr=attr->next ) {
-            if ( attr->first && attr->second ) {
-                xml_add_attr( brq, attr->first, attr->second );
+    for ( attr=val->attr; attr; attr=attr->next ) {
+        if ( attr->first && attr->second ) {
+            if ( !cfgs_tag_add_attr(t, attr->first, attr->second) ) {
+                cfgs_tag_free( t );
+                return NULL;
             }
         }
-        /*FIXME: value type CFGS_EA_VALUE_TYPE */
-    }
-    
-    if ( !cfgs_buf_cat_str(brq, "/>\r\n") ) {
-        return false;
     }
+    /*FIXME: value type CFGS_EA_VALUE_TYPE */
     
-    return true;
+    return t;
 }
 
 
-static cfgs_buf*
-cfgs_setval_rq_to_xml( va_list ap )
+/* One call, the entries following it as arguments */
+static cfgs_tag*
+cfgs_setval_rq_to_tags( va_list ap )
 {
-    cfgs_buf   *brq  = cfgs_buf_new( NULL, 0 );
     cfgs_entry *val  = va_arg( ap, cfgs_entry* );
+    cfgs_tag   *tags = func_call_tag( CFGS_SETVAL, NULL, NULL );
 
-    if ( !brq ) {
-        return NULL;
-    }
-    
-    xml_header( brq );
-    
-    for ( ; val; val=val->next ) {
-        if ( !add_entry_as_xml(brq, val) ) {
-            cfgs_buf_free( brq );
+    for ( ; tags && val; val=val->next ) {
+        cfgs_tag *t = entry_to_tag( val );
+        if ( !t ) {
+            CFGST_DLIST_FREE( tags, cfgs_tag_free );
             return NULL;
         }
+        tags = (cfgs_tag*)cfgs_dlist_add_tail( (cfgs_dlist*)tags, (cfgs_dlist*)t );
     }
     
-    xml_footer( brq );
-
-    return brq;
+    return tags;
 }
 
-static cfgs_buf*
+static cfgs_tag*
 cfgs_setval_rqh_handler( 
     cfgs_tag       *tag, 
     CFGSP_CALLBACK *tag_callback,
@@ -343,92 +436,48 @@ TEST_ERROR
     pv = (*tag_callback)( cb_data ); 
 TEST_ERROR
     
-    return (*m_answer_to_xml[CFGS_SETVAL])( pv );
+    return (*m_answer_to_tags[CFGS_SETVAL])( cb_data->arena, pv );
 }
 
 
-#define SVAL_TAG \
-    "<" CFGS_TAG_CALL_RETURN " " CFGS_EA_VALUE "=\"%d\" />\r\n" 
-#define SVAL_TAG_LEN   ( strlen(SVAL_TAG) )
-#define SVAL_BUF_LEN   ( 128 )
-static bool
-xml_call_return( cfgs_buf *buf, int val )
+#define SVAL_BUF_LEN   ( 15 )
+static cfgs_tag*
+call_return_tag( cfgs_arena *arena, int val )
 {
-    char sval[ SVAL_BUF_LEN+1 ] = {0};
-    int  snret;
+    char     sval[ SVAL_BUF_LEN+1 ] = {0};
+    cfgs_tag *t = cfgs_tag_new_in( arena, CFGS_TAG_CALL_RETURN );
     
-    lassert( SVAL_BUF_LEN > 2*SVAL_TAG_LEN );
-
-    snret = snprintf( sval, SVAL_BUF_LEN, SVAL_TAG, val ); 
-    lassert( snret > 0 && snret <= SVAL_BUF_LEN ); 
-    if ( snret < 0 || snret > SVAL_BUF_LEN ) {
-        return false; 
-    }
-    if ( !cfgs_buf_cat_str(buf, sval) ) { 
-        return false; 
-    }
+    if ( !t )
+        return NULL;
     
-    if ( !cfgs_buf_cat_ch(buf, '\0') ) {
-        return false;
+    snprintf( sval, SVAL_BUF_LEN, "%d", val ); 
+    if ( !cfgs_tag_add_attr(t, CFGS_EA_VALUE, sval) ) { 
+        cfgs_tag_free( t );
+        return NULL; 
     }
-
-    return true; 
+    
+    return (cfgs_tag*)cfgs_dlist_cons( (cfgs_dlist*)t );
 }
 
 
-static cfgs_buf*
-cfgs_setval_answer_to_xml( void *in )
+static cfgs_tag*
+cfgs_setval_answer_to_tags( cfgs_arena *arena, void *in )
 {
-    cfgs_buf   *brq  = cfgs_buf_new( NULL, 0 );
-    int        ret   = (int)in; 
-    
-    if ( !brq ) {
-        return NULL;
-    }
-    
-    if ( !xml_call_return(brq, ret) ) {
-        cfgs_buf_free( brq );
-        return NULL;
-    }
-    
-    return brq;
+    return call_return_tag( arena, (int)(long)in );
 }
 
 /*----------------------------------------------------*/
 
-static cfgs_buf*
-cfgs_rmval_rq_to_xml( va_list ap )
+static cfgs_tag*
+cfgs_rmval_rq_to_tags( va_list ap )
 {
-    cfgs_buf   *brq     = cfgs_buf_new( NULL, 0 );
     const char *valname = va_arg( ap, char* );
     const char *layer   = va_arg( ap, char* );
 
-    if ( !brq ) {
-        return NULL;
-    }
-    
-    xml_header( brq );
-    
-    if ( !cfgs_buf_cat_str(brq, "    " "<" CFGS_TAG_FUNC_CALL " ") ) {
-        cfgs_buf_free( brq );
-        return NULL;
-    }
-    xml_add_attr( brq, CFGS_TA_FUNCTION, m_request_strings[CFGS_RMVAL] ); 
-    if ( valname )
-        xml_add_attr( brq, CFGS_EA_NAME, valname );
-    if ( layer )
-        xml_add_attr( brq, CFGS_EA_LAYER, layer ); 
-    if ( !cfgs_buf_cat_str(brq, "/>\r\n") ) {
-        cfgs_buf_free( brq );
-        return NULL;
-    }
-
-    xml_footer( brq );
-
-    return brq;
+    return func_call_tag( CFGS_RMVAL, valname, layer );
 }
 
-static cfgs_buf*
+static cfgs_tag*
 cfgs_rmval_rqh_handler( 
     cfgs_tag       *tag, 
     CFGSP_CALLBACK *tag_callback,
@@ -449,13 +498,13 @@ TEST_ERROR
     pv = (*tag_callback)( cb_data ); 
 TEST_ERROR
     
-    return (*m_answer_to_xml[CFGS_RMVAL])( pv );
+    return (*m_answer_to_tags[CFGS_RMVAL])( cb_data->arena, pv );
 }
 
-static cfgs_buf*
-cfgs_rmval_answer_to_xml( void *in )
+static cfgs_tag*
+cfgs_rmval_answer_to_tags( cfgs_arena *arena, void *in )
 {
-    return cfgs_setval_answer_to_xml( in ); 
+    return cfgs_setval_answer_to_tags( arena, in ); 
 }
 
 /*----------------------------------------------------*/
@@ -465,51 +514,46 @@ cfgs_rmval_answer_to_xml( void *in )
 error NBUFSZ already defined 
 #endif
 
-static cfgs_buf*
-cfgs_register_notif_rq_to_xml( va_list ap )
+/* CFGS_TAG_NOTIF_REG or CFGS_TAG_NOTIF_UNREG request */
+static cfgs_tag*
+notif_rq_to_tags( const char *tag_type, const cfgs_notif *notif )
 {
-    cfgs_buf         *brq     = cfgs_buf_new( NULL, 0 );
-    const cfgs_notif *notif   = va_arg( ap, cfgs_notif* );
-    char             buf[ NBUFSZ+1 ] = {0};
+    cfgs_tag         *t       = cfgs_tag_new( tag_type );
+    char             pid[ NBUFSZ+1 ]    = {0};
+    char             signal[ NBUFSZ+1 ] = {0};
+    char             type[ NBUFSZ+1 ]   = {0};
+    char             port[ NBUFSZ+1 ]   = {0};
 
-    if ( !brq ) {
+    if ( !t ) {
         return NULL;
     }
     
-    xml_header( brq );
-    
-    if ( !cfgs_buf_cat_str(brq, "    " "<" CFGS_TAG_NOTIF_REG " ") ) {
-        cfgs_buf_free( brq );
-        return NULL;
-    }
-    
-    snprintf( buf, NBUFSZ, "%d", notif->pid );
-    xml_add_attr( brq, CFGS_EA_PID, buf );
-    
-    snprintf( buf, NBUFSZ, "%d", notif->signal );
-    xml_add_attr( brq, CFGS_EA_SIGNAL, buf );
-    
-    snprintf( buf, NBUFSZ, "%d", notif->type );
-    xml_add_attr( brq, CFGS_EA_NOTIF_TYPE, buf );
-    
-    snprintf( buf, NBUFSZ, "%d", notif->port );
-    xml_add_attr( brq, CFGS_EA_PORT, buf );
-    
-    xml_add_attr( brq, CFGS_EA_HOST,  SAFE_STR(notif->host) );
-    xml_add_attr( brq, CFGS_EA_VALUE, SAFE_STR(notif->valname) );
-
-    if ( !cfgs_buf_cat_str(brq, "/>\r\n") ) {
-        cfgs_buf_free( brq );
+    snprintf( pid,    NBUFSZ, "%d", notif->pid );
+    snprintf( signal, NBUFSZ, "%d", notif->signal );
+    snprintf( type,   NBUFSZ, "%d", notif->type );
+    snprintf( port,   NBUFSZ, "%d", notif->port );
+    
+    if (  !cfgs_tag_add_attr(t, CFGS_EA_PID,        pid)
+       || !cfgs_tag_add_attr(t, CFGS_EA_SIGNAL,     signal)
+       || !cfgs_tag_add_attr(t, CFGS_EA_NOTIF_TYPE, type)
+       || !cfgs_tag_add_attr(t, CFGS_EA_PORT,       port)
+       || !cfgs_tag_add_attr(t, CFGS_EA_HOST,  SAFE_STR(notif->host))
+       || !cfgs_tag_add_attr(t, CFGS_EA_VALUE, SAFE_STR(notif->valname)) ) {
+        cfgs_tag_free( t );
         return NULL;
     }
 
-    xml_footer( brq );
+    return (cfgs_tag*)cfgs_dlist_cons( (cfgs_dlist*)t );
+}
 
-    return brq;
+static cfgs_tag*
+cfgs_register_notif_rq_to_tags( va_list ap )
+{
+    return notif_rq_to_tags( CFGS_TAG_NOTIF_REG, va_arg(ap, cfgs_notif*) );
 }
 
 /* server called */
-static cfgs_buf*
+static cfgs_tag*
 cfgs_register_notif_rqh_handler( 
     cfgs_tag       *tag, 
     CFGSP_CALLBACK *tag_callback,
@@ -530,53 +574,68 @@ TEST_ERROR
     pv = (*tag_callback)( cb_data ); 
 TEST_ERROR
     
-    return (*m_answer_to_xml[CFGS_REG_NOTIF])( pv );
+    return (*m_answer_to_tags[CFGS_REG_NOTIF])( cb_data->arena, pv );
 }
 
-static cfgs_buf*
-cfgs_register_notif_answer_to_xml( void *in )
+static cfgs_tag*
+cfgs_register_notif_answer_to_tags( cfgs_arena *arena, void *in )
 {
     /* Number of notification requests added to the list*/
-    return cfgs_setval_answer_to_xml( in ); 
+    return cfgs_setval_answer_to_tags( arena, in ); 
 }
 
-/*----------------------------------------------------*/
-/*FIXME navigate*/
+static cfgs_tag*
+cfgs_unregister_notif_rq_to_tags( va_list ap )
+{
+    return notif_rq_to_tags( CFGS_TAG_NOTIF_UNREG, va_arg(ap, cfgs_notif*) );
+}
 
-static cfgs_buf*
-cfgs_getsubvals_rq_to_xml( va_list ap )
+/* server called */
+static cfgs_tag*
+cfgs_unregister_notif_rqh_handler( 
+    cfgs_tag       *tag, 
+    CFGSP_CALLBACK *tag_callback,
+    cfgsp_data     *cb_data 
+    )
 {
-    cfgs_buf   *brq     = cfgs_buf_new( NULL, 0 );
-    const char *valname = va_arg( ap, char* );
-    const char *layer   = va_arg( ap, char* );
+    void           *pv = NULL;
 
-    if ( !brq ) {
+    lassert( cb_data->idx == CFGS_UNREG_NOTIF );
+    lassert( tag != NULL );
+    if ( !tag || !cb_data || !tag_callback ) 
         return NULL;
-    }
     
-    xml_header( brq );
+    LOG( cfgs_log(CFGST_LL_INFO, "cfgs_unregister_notif_rqh_handler %s\n", 
+            SAFE(cfgs_tag_attr(tag, CFGS_EA_VALUE))); );
+TEST_ERROR    
+    cb_data->attribs = tag; 
+    pv = (*tag_callback)( cb_data ); 
+TEST_ERROR
     
-    if ( !cfgs_buf_cat_str(brq, "    " "<" CFGS_TAG_FUNC_CALL " ") ) {
-        cfgs_buf_free( brq );
-        return NULL;
-    }
-    xml_add_attr( brq, CFGS_TA_FUNCTION, m_request_strings[CFGS_GETSUBVALS] ); 
-    if ( valname )
-        xml_add_attr( brq, CFGS_EA_NAME, valname );
-    if ( layer )
-        xml_add_attr( brq, CFGS_EA_LAYER, layer ); 
-    if ( !cfgs_buf_cat_str(brq, "/>\r\n") ) {
-        cfgs_buf_free( brq );
-        return NULL;
-    }
+    return (*m_answer_to_tags[CFGS_UNREG_NOTIF])( cb_data->arena, pv );
+}
 
-    xml_footer( brq );
+static cfgs_tag*
+cfgs_unregister_notif_answer_to_tags( cfgs_arena *arena, void *in )
+{
+    /* Number of notification requests removed from the list*/
+    return cfgs_setval_answer_to_tags( arena, in ); 
+}
+
+/*----------------------------------------------------*/
+/*FIXME navigate*/
+
+static cfgs_tag*
+cfgs_getsubvals_rq_to_tags( va_list ap )
+{
+    const char *valname = va_arg( ap, char* );
+    const char *layer   = va_arg( ap, char* );
 
-    return brq;
+    return func_call_tag( CFGS_GETSUBVALS, valname, layer );
 }
 
 /* server called */
-static cfgs_buf*
+static cfgs_tag*
 cfgs_getsubvals_rqh_handler( 
     cfgs_tag       *tag, 
     CFGSP_CALLBACK *tag_callback,
@@ -598,63 +657,37 @@ TEST_ERROR
     pv = (*tag_callback)( cb_data ); 
 TEST_ERROR
     
-    return (*m_answer_to_xml[CFGS_GETSUBVALS])( pv );
+    return (*m_answer_to_tags[CFGS_GETSUBVALS])( cb_data->arena, pv );
 }
 
-static cfgs_buf*
-cfgs_getsubvals_answer_to_xml( void *in )
+static cfgs_tag*
+cfgs_getsubvals_answer_to_tags( cfgs_arena *arena, void *in )
 {
     cfgs_str   *subs = (cfgs_str*)in;
-    cfgs_buf   *ret  = NULL; 
     cfgs_tag   *tags;
     
     if ( !subs )
         return NULL;
     
-    tags = cs_subkeytags_from_strings( subs );
-    if ( tags ) {
-        ret = cfgs_tags_to_cfgs_buf( tags );
-        CFGST_DLIST_FREE( tags, cfgs_tag_free );
-    }
+    tags = cs_subkeytags_from_strings( arena, subs );
     
     CFGST_DLIST_FREE( subs, cfgs_str_free );
     
-    return ret;
+    return tags;
 }
 
 
 
-static cfgs_buf*
-cfgs_getsublayers_rq_to_xml( va_list ap )
+static cfgs_tag*
+cfgs_getsublayers_rq_to_tags( va_list ap )
 {
-    cfgs_buf   *brq     = cfgs_buf_new( NULL, 0 );
     const char *layer   = va_arg( ap, char* );
 
-    if ( !brq ) {
-        return NULL;
-    }
-    
-    xml_header( brq );
-    
-    if ( !cfgs_buf_cat_str(brq, "    " "<" CFGS_TAG_FUNC_CALL " ") ) {
-        cfgs_buf_free( brq );
-        return NULL;
-    }
-    xml_add_attr( brq, CFGS_TA_FUNCTION, m_request_strings[CFGS_GETSUBLAYERS] ); 
-    if ( layer )
-        xml_add_attr( brq, CFGS_EA_NAME, layer ); 
-    if ( !cfgs_buf_cat_str(brq, "/>\r\n") ) {
-        cfgs_buf_free( brq );
-        return NULL;
-    }
-
-    xml_footer( brq );
-
-    return brq;
+    return func_call_tag( CFGS_GETSUBLAYERS, layer, NULL );
 }
 
 /* server called */
-static cfgs_buf*
+static cfgs_tag*
 cfgs_getsublayers_rqh_handler( 
     cfgs_tag       *tag, 
     CFGSP_CALLBACK *tag_callback,
@@ -675,61 +708,25 @@ TEST_ERROR
     pv = (*tag_callback)( cb_data ); 
 TEST_ERROR
     
-    return (*m_answer_to_xml[CFGS_GETSUBLAYERS])( pv );
+    return (*m_answer_to_tags[CFGS_GETSUBLAYERS])( cb_data->arena, pv );
 }
 
-static cfgs_buf*
-cfgs_getsublayers_answer_to_xml( void *in )
+static cfgs_tag*
+cfgs_getsublayers_answer_to_tags( cfgs_arena *arena, void *in )
 {
-    cfgs_str   *subs = (cfgs_str*)in;
-    cfgs_buf   *ret  = NULL; 
-    cfgs_tag   *tags;
-    
-    if ( !subs )
-        return NULL;
-    
-    tags = cs_subkeytags_from_strings( subs );
-    if ( tags ) {
-        ret = cfgs_tags_to_cfgs_buf( tags );
-        CFGST_DLIST_FREE( tags, cfgs_tag_free );
-    }
-    
-    CFGST_DLIST_FREE( subs, cfgs_str_free );
-    
-    return ret;
+    return cfgs_getsubvals_answer_to_tags( arena, in );
 }
 
 /*----------------------------------------------------*/
 
-static cfgs_buf* 
-cfgs_getinfos_rq_to_xml( va_list ap )
+static cfgs_tag* 
+cfgs_getinfos_rq_to_tags( va_list ap )
 {
-    cfgs_buf   *brq     = cfgs_buf_new( NULL, 0 );
-    const char *layer   = va_arg( ap, char* );
-
-    if ( !brq ) {
-        return NULL;
-    }
-    
-    xml_header( brq );
-    
-    if ( !cfgs_buf_cat_str(brq, "    " "<" CFGS_TAG_FUNC_CALL " ") ) {
-        cfgs_buf_free( brq );
-        return NULL;
-    }
-    xml_add_attr( brq, CFGS_TA_FUNCTION, m_request_strings[CFGS_GETINFOS] ); 
-    if ( !cfgs_buf_cat_str(brq, "/>\r\n") ) {
-        cfgs_buf_free( brq );
-        return NULL;
-    }
-
-    xml_footer( brq );
-
-    return brq;
+    return func_call_tag( CFGS_GETINFOS, NULL, NULL );
 }
 
 /* server called */
-static cfgs_buf*  
+static cfgs_tag*  
 cfgs_getinfos_rqh_handler( 
     cfgs_tag       *tag, 
     CFGSP_CALLBACK *tag_callback,
@@ -749,26 +746,26 @@ TEST_ERROR
     pv = (*tag_callback)( cb_data ); 
 TEST_ERROR
     
-    return (*m_answer_to_xml[CFGS_GETINFOS])( pv );
+    return (*m_answer_to_tags[CFGS_GETINFOS])( cb_data->arena, pv );
 }
 
 static cfgs_tag  *
-cs_infos_to_tag( cfgs_str *str )
+cs_infos_to_tag( cfgs_arena *arena, cfgs_str *str )
 {
     cfgs_tag   *t = NULL;
     cfgs_str   *v; 
     
     for ( v=str; v; v=v->next ) {
-        cfgs_tag  *tt = cfgs_tag_new( CFGS_TAG_INFOS );
+        cfgs_tag  *tt = cfgs_tag_new_in( arena, CFGS_TAG_INFOS );
         if ( !tt ) {
-             cfgs_tag_free( t );
+             CFGST_DLIST_FREE( t, cfgs_tag_free );
              return NULL;
         }
     
         t = (cfgs_tag*)cfgs_dlist_add_tail( (cfgs_dlist*)t, (cfgs_dlist*)tt );
 	
         if ( !cfgs_tag_add_attr(tt, CFGS_EA_NAME, v->name) ) {
-             cfgs_tag_free( t );
+             CFGST_DLIST_FREE( t, cfgs_tag_free );
              return NULL;
         }
     } /*for*/
@@ -776,25 +773,76 @@ cs_infos_to_tag( cfgs_str *str )
     return t;
 }
 
-static cfgs_buf*  
-cfgs_getinfos_answer_to_xml( void *in )
+static cfgs_tag*  
+cfgs_getinfos_answer_to_tags( cfgs_arena *arena, void *in )
 {
     cfgs_str   *subs = (cfgs_str*)in;
-    cfgs_buf   *ret  = NULL; 
     cfgs_tag   *tags;
     
     if ( !subs )
         return NULL;
     
-    tags = cs_infos_to_tag( subs );
-    if ( tags ) {
-        ret = cfgs_tags_to_cfgs_buf( tags );
-        CFGST_DLIST_FREE( tags, cfgs_tag_free );
-    }
+    tags = cs_infos_to_tag( arena, subs );
     
     CFGST_DLIST_FREE( subs, cfgs_str_free );
     
-    return ret;
+    return tags;
+}
+
+/*----------------------------------------------------*/
+
+/* One call, the names following it as entry arguments */
+static cfgs_tag*
+cfgs_getvals_rq_to_tags( va_list ap )
+{
+    const char **names = va_arg( ap, const char** );
+    int        n       = va_arg( ap, int );
+    const char *layer  = va_arg( ap, char* );
+    cfgs_tag   *tags   = func_call_tag( CFGS_GETVALS, NULL, layer );
+    int        i;
+
+    for ( i=0; tags && i<n; i++ ) {
+        cfgs_tag *t = cfgs_tag_new( CFGS_TAG_ENTRY );
+        if ( !t || !cfgs_tag_add_attr(t, CFGS_EA_NAME, names[i]) ) {
+            cfgs_tag_free( t );
+            CFGST_DLIST_FREE( tags, cfgs_tag_free );
+            return NULL;
+        }
+        tags = (cfgs_tag*)cfgs_dlist_add_tail( (cfgs_dlist*)tags, (cfgs_dlist*)t );
+    }
+    
+    return tags;
+}
+
+/* server called */
+static cfgs_tag*
+cfgs_getvals_rqh_handler( 
+    cfgs_tag       *tag, 
+    CFGSP_CALLBACK *tag_callback,
+    cfgsp_data     *cb_data 
+    )
+{
+    cfgs_entry     *pv = NULL;
+
+    lassert( cb_data->idx == CFGS_GETVALS );
+    lassert( tag != NULL );
+    if ( !tag || !cb_data || !tag_callback ) 
+        return NULL;
+    
+    LOG( cfgs_log(CFGST_LL_INFO, "cfgs_getvals_rqh_handler %s\n", 
+            SAFE(cfgs_tag_attr(tag, CFGS_EA_LAYER))); );
+TEST_ERROR    
+    cb_data->attribs = tag; 
+    pv = (*tag_callback)( cb_data ); 
+TEST_ERROR
+    
+    return (*m_answer_to_tags[CFGS_GETVALS])( cb_data->arena, pv );
+}
+
+static cfgs_tag*
+cfgs_getvals_answer_to_tags( cfgs_arena *arena, void *in )
+{
+    return cfgs_getval_answer_to_tags( arena, in ); 
 }
 
 /*----------------------------------------------------*/
@@ -841,9 +889,11 @@ client_1_0( cfgs_session *sess, cfgs_tag *tags, void **out )
         /* Numeric return type: add them if multiple such tags */
         } else if ( 0 == strcmp(CFGS_TAG_CALL_RETURN, t->type) ) {
             int iret = call_ret_value( t );
-            if ( iret <= 0 ) {
-                /*FIXME: error*/
-            } else {
+            if ( iret < 0 ) {
+                /* -1 as when called in process: nothing done, the error set */
+                if ( !ret )
+                    ret = (cfgs_entry*)-1L;
+            } else if ( iret > 0 ) {
                 /*FIXME: unnatural cast if int*/
                 ret = (cfgs_entry*)( (long)ret + iret );
             }
@@ -869,66 +919,145 @@ client_1_0( cfgs_session *sess, cfgs_tag *tags, void **out )
 }
 
 
-void *
-cfgsp_send_rq( 
+static bool
+submit_rq( 
         cfgs_session     *sess, 
         int              sock, 
         CFGSP_HOST_PROTO hproto,
+        bool             *broken,
         CFGS_FUNC_INDEX  idx, 
-        ... )
+        va_list          ap )
 {
     cfgs_buf   *brq = NULL;
-    cfgs_buf   *txt;        /* results */
-    va_list     ap;
-    void       *ret  = NULL;
     cfgs_tag   *tags = NULL;
+    bool       ret;
     cfgsp_hosting_protocol   proto;
 
     lassert( sess );    
-    lassert(  hproto >= 0 
-           && hproto <= sizeof(m_hosting_protocols)/sizeof(cfgsp_hosting_protocol) ); 
+    lassert( hproto >= 0 && hproto < HOST_PROTO_NUM ); 
     proto = m_hosting_protocols[ hproto ];
 
-
-    /* turn request into xml */
-    va_start( ap, idx );
-    brq = (*m_rq_to_xml[idx])( ap );
-    va_end( ap );
+    /* turn request into tags, then into the wire format */
+    tags = (*m_rq_to_tags[idx])( ap );
+    if ( !tags ) {
+        /*FIXME: report err*/
+        return false;
+    }
+    brq = (proto.encode)( tags );
+    CFGST_DLIST_FREE( tags, cfgs_tag_free );
     if ( !brq ) {
         /*FIXME: report err*/
-        return NULL;
+        return false;
     }
-    LOG( cfgs_log(CFGST_LL_INFO, "cfgsp_send_rq\n%s", brq->buf); );
-    
+    LOG( if ( hproto == CFGSP_HOST_PROTO_HTTP ) 
+            cfgs_log(CFGST_LL_INFO, "cfgsp_send_rq\n%s", brq->buf); );
     
     /* Send it */
-    if ( !(proto.client_send)(sock, brq->buf, brq->len-1, cfgs_session_geterr(sess)) ) {
-        cfgs_buf_free( brq );
-        return NULL;
-    }
+    ret = (proto.client_send)( sock, brq->buf, brq->used, cfgs_session_geterr(sess) );
+    if ( !ret && broken ) 
+        *broken = true;
+    
+    cfgs_buf_free( brq );
+    return ret;
+}
+
+
+bool
+cfgsp_submit_rq( 
+        cfgs_session     *sess, 
+        int              sock, 
+        CFGSP_HOST_PROTO hproto,
+        bool             *broken,
+        CFGS_FUNC_INDEX  idx, 
+        ... )
+{
+    va_list     ap;
+    bool        ret;
+
+    va_start( ap, idx );
+    ret = submit_rq( sess, sock, hproto, broken, idx, ap );
+    va_end( ap );
+    
+    return ret;
+}
+
+
+/* 
+ * Read and decode one message.  Free returned tags, <cfgs> first.  
+ * @param broken, if not NULL, is set if the message was not read whole.  
+ */
+static cfgs_tag *
+recv_tags( cfgs_session *sess, int sock, cfgsp_hosting_protocol *proto, bool *broken )
+{
+    cfgs_buf   *txt;
+    cfgs_tag   *tags;
     
-    /* Read xml answer */
-    txt = (proto.client_recv)( sock, cfgs_session_geterr(sess) );
+    txt = (proto->client_recv)( sock, cfgs_session_geterr(sess) );
     if ( !txt ) {
-        cfgs_buf_free( brq );
-        /* assume http_client_recv has set the proper error */ 
+        /* assume client_recv has set the proper error */ 
+        if ( broken ) 
+            *broken = true;
         return NULL;
     }
-    tags = cfgs_tags_from_str( txt->buf, txt->len-1 );
+    tags = (proto->decode)( NULL, txt->buf, txt->used );
+    cfgs_buf_free( txt );
     if ( !tags ) {
-        cfgs_buf_free( brq );
-        cfgs_buf_free( txt );
         /*FIXME: report err*/
         return NULL;
     }
+    
+    return tags;
+}
+
+
+/* true if tags are a change pushed by the server rather than an answer */
+static bool
+got_push( cfgs_tag *tags )
+{
+    cfgs_tag *t = tags->next;
+    
+    if ( !t || !t->type || 0 != strcmp(CFGS_TAG_NOTIF, t->type) ) 
+        return false;
+    
+    LOG( cfgs_log(CFGST_LL_INFO, "got_push %s\n", 
+            SAFE(cfgs_tag_attr(t, CFGS_EA_VALUE))); );
+    if ( m_push_callback && cfgs_tag_attr(t, CFGS_EA_VALUE) ) 
+        (*m_push_callback)( cfgs_tag_attr(t, CFGS_EA_VALUE), 
+                            cfgs_tag_attr(t, CFGS_EA_LAYER) );
+    return true;
+}
+
+
+void *
+cfgsp_collect_rq( 
+        cfgs_session     *sess, 
+        int              sock, 
+        CFGSP_HOST_PROTO hproto,
+        bool             *broken )
+{
+    void       *ret  = NULL;
+    cfgs_tag   *tags = NULL;
+    cfgsp_hosting_protocol   proto;
+
+    lassert( sess );    
+    lassert( hproto >= 0 && hproto < HOST_PROTO_NUM ); 
+    proto = m_hosting_protocols[ hproto ];
+    
+    /* Read answer; changes pushed meanwhile might come first */
+    while ( (tags = recv_tags(sess, sock, &proto, broken)) && got_push(tags) ) {
+        CFGST_DLIST_FREE( tags, cfgs_tag_free );
+    }
+    if ( !tags ) {
+        return NULL;
+    }
 
     if ( 0 == strcmp(CFGS_TAG_CFGS, tags->type) ) {
         const char *version = cfgs_tag_attr( tags, CFGS_EA_VERSION );
     
-        tags = tags->next; /* first tag is <cfgs> */
-        if ( version && tags ) {
+        /* first tag is <cfgs> */
+        if ( version && tags->next ) {
             if ( 0 == strcmp(version, CFGS_PROTOCOL_VERSION_1_0 ) ) {
-                client_1_0( sess, tags, &ret ); 
+                client_1_0( sess, tags->next, &ret ); 
             } else {
                 /*unsupported version*/
             }
@@ -939,23 +1068,46 @@ cfgsp_send_rq(
 
 
     CFGST_DLIST_FREE( tags, cfgs_tag_free );
-    cfgs_buf_free( brq );
-    cfgs_buf_free( txt );
     return ret;
 }
 
 
-/* process 'tags' and return results 'rez' */
-static void 
+void *
+cfgsp_send_rq( 
+        cfgs_session     *sess, 
+        int              sock, 
+        CFGSP_HOST_PROTO hproto,
+        bool             *broken,
+        CFGS_FUNC_INDEX  idx, 
+        ... )
+{
+    va_list     ap;
+    bool        sent;
+
+    va_start( ap, idx );
+    sent = submit_rq( sess, sock, hproto, broken, idx, ap );
+    va_end( ap );
+    if ( !sent ) {
+        return NULL;
+    }
+    
+    return cfgsp_collect_rq( sess, sock, hproto, broken );
+}
+
+
+/* process 'tags' and return results */
+static cfgs_tag * 
 server_1_0(
-    cfgs_tag *tags,  cfgs_buf *rez,
+    cfgs_tag *tags,
     CFGSP_CALLBACK *tag_callback, cfgsp_data *cb_data 
     )
 {
-    lassert( rez && cb_data );
+    cfgs_tag *rez = NULL;
+    
+    lassert( cb_data );
     
     for ( ; tags; tags=tags->next ) {
-        cfgs_buf  *buf = NULL;
+        cfgs_tag  *answer = NULL;
     
         lassert( tags->type );
     
@@ -976,14 +1128,19 @@ server_1_0(
                 break;
             }
 TEST_ERROR            
-            buf = (*m_rqh_handler[cb_data->idx])( tags, tag_callback, cb_data ); 
+            answer = (*m_rqh_handler[cb_data->idx])( tags, tag_callback, cb_data ); 
 TEST_ERROR   /* errno 2 no such file or dir */         
+            /* entries following a call are its arguments, already used */
+            while ( tags->next && 0 == strcmp(CFGS_TAG_ENTRY, tags->next->type) ) 
+                tags = tags->next;
         } else if ( 0 == strcmp(CFGS_TAG_NOTIF_REG, tags->type) ) {
             cb_data->idx = CFGS_REG_NOTIF; 
             /*cfgs_register_notif_rqh_handler*/
-            buf = (*m_rqh_handler[CFGS_REG_NOTIF])( tags, tag_callback, cb_data ); 
+            answer = (*m_rqh_handler[CFGS_REG_NOTIF])( tags, tag_callback, cb_data ); 
         } else if ( 0 == strcmp(CFGS_TAG_NOTIF_UNREG, tags->type) ) {
-            /*FIXME*/
+            cb_data->idx = CFGS_UNREG_NOTIF; 
+            /*cfgs_unregister_notif_rqh_handler*/
+            answer = (*m_rqh_handler[CFGS_UNREG_NOTIF])( tags, tag_callback, cb_data ); 
         } else if ( 0 == strcmp(CFGS_TAG_ERROR, tags->type) ) {
             /* actually, there should be no error tag in the request */ 
             cfgs_err_from_tag( cfgs_session_geterr(cb_data->sess), tags );
@@ -992,50 +1149,34 @@ TEST_ERROR   /* errno 2 no such file or dir */
             lassert( false );
         } /*tag type*/
     
-        if ( buf ) {
-            cfgs_buf_cat_str( rez, buf->buf );
-            LOG( cfgs_log(CFGST_LL_INFO, "cfgsp_process_request (%p): \n%s\n", buf, 
-                    buf&&buf->buf ? buf->buf : "NULL"); );
-            cfgs_buf_free( buf );
-        }
+        rez = (cfgs_tag*)cfgs_dlist_cat( (cfgs_dlist*)rez, (cfgs_dlist*)answer );
     } /*for*/
+    
+    return rez;
 }
 
 
 /** Server side.  Free pointer.  */
-static cfgs_buf *
+static cfgs_tag *
 process_request( 
-    cfgs_buf       *xreq,  /**< xml formatted request to be parsed */
+    cfgs_tag       *tags,  /**< parsed request, <cfgs> first */
     CFGSP_CALLBACK *tag_callback, 
     cfgsp_data     *cb_data 
     )
 {
-    cfgs_buf *rez  = cfgs_buf_new( NULL, 128 );
-    cfgs_tag *tags; 
+    cfgs_tag *rez = NULL;
+    cfgs_tag *err; 
     
-    lassert( xreq && cb_data && cb_data->sess && tag_callback ); 
+    lassert( tags && cb_data && cb_data->sess && tag_callback ); 
     
-    if ( !rez ) {
-        return NULL;
-        /*FIXME: report err*/
-    }
-TEST_ERROR    
-    tags = cfgs_tags_from_str( xreq->buf, xreq->len-1 );
-    if ( !tags ) {
-        cfgs_buf_free( rez );
-        return NULL;
-    }
-
-    xml_header( rez );
-        
-    if ( tags && tags->type && 0 == strcmp(CFGS_TAG_CFGS, tags->type) ) { 
+    if ( tags->type && 0 == strcmp(CFGS_TAG_CFGS, tags->type) ) { 
         const char *version = cfgs_tag_attr( tags, CFGS_EA_VERSION );
     
-        tags = tags->next; /* first tag is <cfgs> */
+        /* first tag is <cfgs> */
         if ( version ) {
             if ( 0 == strcmp(version, CFGS_PROTOCOL_VERSION_1_0 ) ) {
 TEST_ERROR            
-                server_1_0( tags, rez, tag_callback, cb_data ); 
+                rez = server_1_0( tags->next, tag_callback, cb_data ); 
 TEST_ERROR                
             } else {
                 cfgs_session_store_error( cb_data->sess, CFGS_ERRT_INTERNAL, 
@@ -1047,24 +1188,25 @@ TEST_ERROR
         }
     } /*if <cfgs>*/
 
-    if ( !cfgs_buf_cat_str(rez, cfgs_session_xml_err(cb_data->sess)) ) {
-        cfgs_tag_free( tags );
-        cfgs_buf_free( rez );
+    err = cfgs_err_to_tag( cfgs_session_geterr(cb_data->sess) );
+    if ( !err ) {
+        CFGST_DLIST_FREE( rez, cfgs_tag_free );
         return NULL;
     }
-    xml_footer( rez );
+    err = (cfgs_tag*)cfgs_dlist_cons( (cfgs_dlist*)err );
     
-    cfgs_tag_free( tags );
-    return rez;
+    return (cfgs_tag*)cfgs_dlist_cat( (cfgs_dlist*)rez, (cfgs_dlist*)err );
 }
 
 
-/** Report err to client, close connection */
+/** Report err to client, shut connection down.  The caller still owns and
+    closes the socket: closing it here would let a concurrent accept reuse 
+    the descriptor before the caller closes it again.  */
 static inline void 
 report_error( int sock, CFGS_ERR err )
 {
     /*FIXME*/
-    close( sock ); /*shutdown(,2)*/
+    shutdown( sock, 2 ); 
 }
 
 
@@ -1077,17 +1219,19 @@ cfgsp_process_rq(
     )
 {
     cfgs_buf     *body = NULL;
+    cfgs_tag     *tags = NULL;
+    cfgs_tag     *rez  = NULL;
     cfgs_buf     *results = NULL;
+    cfgs_arena   *arena;
     bool         ret = false;
     cfgsp_hosting_protocol   proto;
     
     lassert( cb_data );
-    lassert(  hproto >= 0 
-           && hproto <= sizeof(m_hosting_protocols)/sizeof(cfgsp_hosting_protocol) ); 
+    lassert( hproto >= 0 && hproto < HOST_PROTO_NUM ); 
           
     proto = m_hosting_protocols[ hproto ];
+    arena = thread_arena();
 TEST_ERROR
-    /*only http supported now*/ 
     body = (proto.server_recv)( csock, cfgs_session_geterr(cb_data->sess) );
     if ( errno ) {
         /* might happen because of a timeout, errnoneous content-length, etc */
@@ -1100,17 +1244,364 @@ TEST_ERROR
     }
 TEST_ERROR    /*errno 11*/
     
-    results = process_request( body, tag_callback, cb_data ); 
+    tags = (proto.decode)( arena, body->buf, body->used );
+    cfgs_buf_free( body ); 
+    if ( !tags ) {
+        cfgs_arena_reset( arena );
+        report_error( csock, CFGSP_ERR_VERSION );
+        return false;
+    }
+    
+    cb_data->arena = arena;
+    rez = process_request( tags, tag_callback, cb_data ); 
+    cb_data->arena = NULL;
+    CFGST_DLIST_FREE( tags, cfgs_tag_free );
+    if ( rez ) {
+        results = (proto.encode)( rez );
+        /* only frees what is on the heap, e.g. the error tag */
+        CFGST_DLIST_FREE( rez, cfgs_tag_free );
+    }
+    cfgs_arena_reset( arena );
     if ( !results ) {
         report_error( csock, CFGSP_ERR_SERVER );
-        cfgs_buf_free( body ); 
-        cfgs_buf_free( results );  
         return false;
     }
+    LOG( if ( hproto == CFGSP_HOST_PROTO_HTTP ) 
+            cfgs_log(CFGST_LL_INFO, "cfgsp_process_rq: \n%s\n", results->buf); );
 TEST_ERROR
-    ret = (proto.server_send)( csock, results->buf, results->len-1, 
-            cfgs_session_geterr(cb_data->sess) ); 
+    pthread_mutex_lock( SEND_LOCK(csock) );
+    /* after the push the socket took part of, if any */
+    ret =  push_rest_send( csock, true ) > 0
+        && (proto.server_send)( csock, results->buf, results->used, 
+                                cfgs_session_geterr(cb_data->sess) ); 
+    pthread_mutex_unlock( SEND_LOCK(csock) );
+    cfgs_buf_free( results );
 TEST_ERROR    
     return ret;
 }
 
+
+/*----------------------------------------------------*/
+
+bool
+cfgsp_request_proto( int sock, CFGSP_HOST_PROTO hproto )
+{
+    lassert( hproto >= 0 && hproto < HOST_PROTO_NUM ); 
+    
+    switch ( hproto ) {
+    case CFGSP_HOST_PROTO_HTTP:
+        return true;
+    case CFGSP_HOST_PROTO_BIN:
+        return http_client_upgrade( sock, BIN_PROTOCOL_TOKEN );
+    default:
+        return false;
+    }
+}
+
+
+CFGSP_HOST_PROTO
+cfgsp_accept_proto( int sock )
+{
+    if ( http_server_upgrade(sock, BIN_PROTOCOL_TOKEN) )
+        return CFGSP_HOST_PROTO_BIN;
+    
+    return CFGSP_HOST_PROTO_HTTP;
+}
+
+
+bool
+cfgsp_request_buffered( int sock, CFGSP_HOST_PROTO hproto )
+{
+    cfgst_rbuf *rb = cfgst_rbuf_get( sock );
+    int        len;
+    
+    lassert( hproto >= 0 && hproto < HOST_PROTO_NUM ); 
+    if ( !rb )
+        return true;
+    
+    len = (m_hosting_protocols[hproto].request_len)( sock );
+    if ( len < 0 )
+        return true;
+    if ( len > 0 && rb->end - rb->start >= len )
+        return true;
+    
+    /* no memory: the reader will wait for the rest */
+    return !cfgst_rbuf_reserve( rb, len > 0 ? len : CFGST_RBUF_LEN );
+}
+
+
+/*----------------------------------------------------*/
+
+void
+cfgsp_set_push_callback( CFGSP_PUSH_CALLBACK *cb )
+{
+    m_push_callback = cb;
+}
+
+
+bool
+cfgsp_poll_push( cfgs_session *sess, int sock, CFGSP_HOST_PROTO hproto )
+{
+    cfgs_tag   *tags;
+    bool       push;
+    
+    lassert( sess );    
+    lassert( hproto >= 0 && hproto < HOST_PROTO_NUM ); 
+    
+    while (  cfgst_rbuf_pending(sock) > 0 
+          || cfgst_microsleep(sock, CFGST_SE_READ, 0) > 0 ) {
+        tags = recv_tags( sess, sock, &m_hosting_protocols[hproto], NULL );
+        if ( !tags ) 
+            return false;
+        
+        /* nothing was asked: anything else is a protocol error */
+        push = got_push( tags );
+        CFGST_DLIST_FREE( tags, cfgs_tag_free );
+        if ( !push ) 
+            return false;
+    }
+    
+    errno = 0;
+    return true;
+}
+
+
+cfgs_tag *
+cfgsp_change_tag( const char *valname, const char *layer, const char *value )
+{
+    cfgs_tag   *t = cfgs_tag_new( CFGS_TAG_NOTIF );
+    
+    lassert( valname );
+    if ( !t )
+        return NULL;
+    if (  !cfgs_tag_add_attr(t, CFGS_EA_VALUE, valname)
+       || (layer && !cfgs_tag_add_attr(t, CFGS_EA_LAYER, layer)) 
+       || (value && !cfgs_tag_add_attr(t, CFGS_EA_ON_CHANGE_VAL, value)) ) {
+        cfgs_tag_free( t );
+        return NULL;
+    }
+    
+    return (cfgs_tag*)cfgs_dlist_cons( (cfgs_dlist*)t );
+}
+
+
+bool
+cfgsp_encode_push( 
+    CFGSP_HOST_PROTO hproto, 
+    const char       *valname, 
+    const char       *layer, 
+    cfgs_buf         *out )
+{
+    cfgs_tag   *t;
+    cfgs_buf   *msg;
+    bool       ret;
+    cfgsp_hosting_protocol   proto;
+    
+    lassert( valname && out );    
+    lassert( hproto >= 0 && hproto < HOST_PROTO_NUM ); 
+    proto = m_hosting_protocols[ hproto ];
+    
+    t = cfgsp_change_tag( valname, layer, NULL );
+    if ( !t )
+        return false;
+    
+    msg = (proto.encode)( t );
+    CFGST_DLIST_FREE( t, cfgs_tag_free );
+    if ( !msg )
+        return false;
+    
+    ret = (proto.server_frame)( out, msg->buf, msg->used );
+    cfgs_buf_free( msg );
+    return ret;
+}
+
+
+static push_rest *
+push_rest_find( int sock )
+{
+    push_rest *pr;
+    
+    for ( pr=m_push_rests[sock % SEND_LOCKS]; pr; pr=pr->next ) {
+        if ( pr->sock == sock )
+            return pr;
+    }
+    return NULL;
+}
+
+
+static void
+push_rest_free( push_rest *pr )
+{
+    m_push_rests[pr->sock % SEND_LOCKS] = (push_rest*)cfgs_dlist_rem( 
+            (cfgs_dlist*)m_push_rests[pr->sock % SEND_LOCKS], (cfgs_dlist*)pr );
+    xfree( pr->buf );
+    xfree( pr );
+}
+
+
+/* 
+ * Under SEND_LOCK(sock).  Send what is left of a push cut short, waiting 
+ * for the socket if @param wait.  @return 1 if nothing is left, 0 if some 
+ * is, -1 if the connection is broken.  
+ */
+static int
+push_rest_send( int sock, bool wait )
+{
+    push_rest *pr = push_rest_find( sock );
+    int       n;
+    
+    if ( !pr )
+        return 1;
+    
+    if ( wait ) {
+        n = cfgst_fullsend( sock, pr->buf + pr->sent, pr->len - pr->sent, 0 );
+        n = n == pr->len - pr->sent ? 1 : -1;
+        push_rest_free( pr );
+        return n;
+    }
+    
+    while ( pr->sent < pr->len ) {
+        n = cfgst_rsend( sock, pr->buf + pr->sent, pr->len - pr->sent, 
+                         MSG_DONTWAIT | MSG_NOSIGNAL );
+        if ( n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+            return 0;
+        if ( n <= 0 ) {
+            push_rest_free( pr );
+            return -1;
+        }
+        pr->sent += n;
+    }
+    push_rest_free( pr );
+    return 1;
+}
+
+
+int
+cfgsp_push_send( int sock, const char *msg, int len )
+{
+    push_rest  *pr;
+    int        ret, n;
+    
+    lassert( sock >= 0 && (msg ? len > 0 : !len) );    
+    pthread_mutex_lock( SEND_LOCK(sock) );
+    ret = push_rest_send( sock, false );
+    if ( ret > 0 && msg ) {
+        n = cfgst_rsend( sock, msg, len, MSG_DONTWAIT | MSG_NOSIGNAL );
+        if ( n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ) 
+            ret = 0;
+        else if ( n <= 0 ) 
+            ret = -1;
+        else if ( n < len ) {
+            /* taken: the rest goes before anything else */
+            pr = XCALLOC( push_rest, 1 );
+            if ( pr )
+                pr->buf = XMALLOC( char, len - n );
+            if ( pr && pr->buf ) {
+                memcpy( pr->buf, msg + n, len - n );
+                pr->sock = sock;
+                pr->len  = len - n;
+                m_push_rests[sock % SEND_LOCKS] = (push_rest*)cfgs_dlist_add_tail( 
+                        (cfgs_dlist*)m_push_rests[sock % SEND_LOCKS], (cfgs_dlist*)pr );
+            } else {
+                if ( pr )
+                    xfree( pr );
+                /* out of memory: the stream would be garbled */
+                ret = cfgst_fullsend( sock, msg + n, len - n, 0 ) == len - n ? 1 : -1;
+            }
+        }
+    }
+    pthread_mutex_unlock( SEND_LOCK(sock) );
+    
+    return ret;
+}
+
+
+bool
+cfgsp_push_pending( int sock )
+{
+    bool ret;
+    
+    pthread_mutex_lock( SEND_LOCK(sock) );
+    ret = push_rest_find( sock ) != NULL;
+    pthread_mutex_unlock( SEND_LOCK(sock) );
+    
+    return ret;
+}
+
+
+void
+cfgsp_push_forget( int sock )
+{
+    push_rest *pr;
+    
+    pthread_mutex_lock( SEND_LOCK(sock) );
+    pr = push_rest_find( sock );
+    if ( pr )
+        push_rest_free( pr );
+    pthread_mutex_unlock( SEND_LOCK(sock) );
+}
+
+
+bool
+cfgsp_encode_changes( CFGSP_HOST_PROTO hproto, cfgs_tag *changes, cfgs_buf *out )
+{
+    cfgs_buf   *msg;
+    bool       ret;
+    
+    /* only bin messages are framed by encode */
+    lassert( hproto == CFGSP_HOST_PROTO_BIN && changes && out ); 
+    if ( hproto != CFGSP_HOST_PROTO_BIN ) 
+        return false;
+    
+    msg = (m_hosting_protocols[hproto].encode)( changes );
+    if ( !msg )
+        return false;
+    
+    ret = cfgs_buf_cat( out, msg->buf, msg->used );
+    cfgs_buf_free( msg );
+    return ret;
+}
+
+
+int
+cfgsp_read_changes( 
+    cfgs_session         *sess, 
+    int                  sock, 
+    CFGSP_HOST_PROTO     hproto, 
+    CFGS_CHANGE_CALLBACK *cb, 
+    void                 *arg, 
+    int                  microsec )
+{
+    cfgs_tag   *tags, *t;
+    int        ret, nb_changes = 0;
+    
+    lassert( sess && cb );    
+    lassert( hproto >= 0 && hproto < HOST_PROTO_NUM ); 
+    
+    if ( cfgst_rbuf_pending(sock) <= 0 ) {
+        ret = cfgst_microsleep( sock, CFGST_SE_READ, microsec );
+        if ( ret <= 0 )
+            return ( ret < 0 && errno != EINTR ) ? -1 : 0;
+    }
+    
+    do {
+        tags = recv_tags( sess, sock, &m_hosting_protocols[hproto], NULL );
+        if ( !tags ) 
+            return -1;
+        
+        for ( t=tags->next; t; t=t->next ) {
+            const char *valname = cfgs_tag_attr( t, CFGS_EA_VALUE );
+            
+            if ( !t->type || 0 != strcmp(CFGS_TAG_NOTIF, t->type) || !valname ) 
+                continue;
+            (*cb)( valname, cfgs_tag_attr(t, CFGS_EA_LAYER), 
+                   cfgs_tag_attr(t, CFGS_EA_ON_CHANGE_VAL), arg );
+            nb_changes++;
+        }
+        CFGST_DLIST_FREE( tags, cfgs_tag_free );
+    } while (  cfgst_rbuf_pending(sock) > 0 
+            || cfgst_microsleep(sock, CFGST_SE_READ, 0) > 0 );
+    
+    errno = 0;
+    return nb_changes;
+}
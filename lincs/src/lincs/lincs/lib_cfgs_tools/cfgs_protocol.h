@@ -52,30 +52,66 @@ typedef enum {
 #define INVALID_CFGS_FUNC_INDEX  (-1)
 
 
-/** Host protocol - the protocol that transports the xml messages.  
-    Server/client side. */
+/** Host protocol - the protocol that transports the messages, and how 
+    tag lists are laid out in them.  Server/client side. */
 typedef struct _cfgsp_hosting_protocol {
     bool      (*client_send)( int sock, char *buf, int len, cfgs_err *err );
     cfgs_buf* (*client_recv)( int sock, cfgs_err *err );
     bool      (*server_send)( int sock, char *buf, int len, cfgs_err *err );
     cfgs_buf* (*server_recv)( int sock, cfgs_err *err );
+    /** appends to out the message server_send writes */
+    bool      (*server_frame)( cfgs_buf *out, char *buf, int len );
+    /** tags to message; buf->used bytes are to be sent */
+    cfgs_buf* (*encode)( cfgs_tag *tags );
+    /** received message to tags, &lt;cfgs&gt; tag first; tags are 
+        allocated in arena, or on the heap if NULL */
+    cfgs_tag* (*decode)( cfgs_arena *arena, const char *buf, int len );
+    /** length of the message starting the receive buffer of sock, 0 if 
+        not known yet, -1 if invalid */
+    int       (*request_len)( int sock );
 } cfgsp_hosting_protocol;
 
 /** Which protocol to use to transport messages */ 
 typedef enum {
-    CFGSP_HOST_PROTO_HTTP,
+    CFGSP_HOST_PROTO_HTTP,  /**< xml over http, always available */
+    CFGSP_HOST_PROTO_BIN,   /**< binary frames, see bin_protocol.h */
 } CFGSP_HOST_PROTO;
 
 
 /*FIXME: include in session sock & hproto ? */
-/** entry point for client */
+/** 
+ * entry point for client.  @param broken, if not NULL, is set when the 
+ * request was not sent whole or its answer not read whole: the connection 
+ * is out of step, other requests on it would get wrong answers.  It is left 
+ * alone otherwise.  
+ */
 void *cfgsp_send_rq( 
     cfgs_session     *sess, 
     int              sock, 
     CFGSP_HOST_PROTO hproto,
+    bool             *broken,
+    CFGS_FUNC_INDEX  idx, 
+    ... 
+    );
+/** 
+ * Pipelining, client side: cfgsp_send_rq in two steps.  Requests can be 
+ * submitted back to back; the server answers them in order, each answer 
+ * to be read by one cfgsp_collect_rq.  
+ */
+bool cfgsp_submit_rq( 
+    cfgs_session     *sess, 
+    int              sock, 
+    CFGSP_HOST_PROTO hproto,
+    bool             *broken,
     CFGS_FUNC_INDEX  idx, 
     ... 
     );
+void *cfgsp_collect_rq( 
+    cfgs_session     *sess, 
+    int              sock, 
+    CFGSP_HOST_PROTO hproto,
+    bool             *broken
+    );
 
 
 
@@ -83,8 +119,15 @@ void *cfgsp_send_rq(
 typedef struct _cfgsp_data {
     cfgs_session    *sess;
     CFGS_FUNC_INDEX idx;
+    /* connection: host protocol, set by cfgsp_accept_proto */
+    CFGSP_HOST_PROTO hproto;
+    bool             negotiated;
+    bool             stream;   /* CSNT_STREAM registered: changes only */
+    int              sock;
+    /* the request being processed lives here; released once answered */
+    cfgs_arena       *arena;
     /***/
-    cfgs_tag *attribs; /* do not free! */
+    cfgs_tag *attribs; /* do not free!  cfgs:entry arguments, if any, follow */
 } cfgsp_data;
 /** Tag processing callback */
 typedef void* (CFGSP_CALLBACK)( cfgsp_data* );
@@ -97,6 +140,76 @@ bool cfgsp_process_rq(
     CFGSP_CALLBACK    *tag_callback, 
     cfgsp_data        *cb_data 
     );
+
+
+/** 
+ * Client side.  Ask the server to switch the connection to @param hproto.  
+ * On false, servers not knowing about it have dropped the connection:  
+ * reconnect and use CFGSP_HOST_PROTO_HTTP.  
+ */
+bool cfgsp_request_proto( int sock, CFGSP_HOST_PROTO hproto ); 
+/** 
+ * Server side, before the first request of a connection.  Answers a 
+ * cfgsp_request_proto and returns the protocol to use on @param sock.  
+ */
+CFGSP_HOST_PROTO cfgsp_accept_proto( int sock ); 
+/** 
+ * Server side.  True if a whole request is in the receive buffer of 
+ * @param sock, or if it is invalid.  Else makes room for the rest.  
+ */
+bool cfgsp_request_buffered( int sock, CFGSP_HOST_PROTO hproto ); 
+
+
+/** 
+ * Value changes pushed by the server to CSNT_CONN notification requests.  
+ * Client side, the callback is called as pushes are read from the 
+ * connection, either while waiting for an answer or by cfgsp_poll_push.  
+ */
+typedef void (CFGSP_PUSH_CALLBACK)( const char *valname, const char *layer );
+void cfgsp_set_push_callback( CFGSP_PUSH_CALLBACK *cb ); 
+/** Client side.  Reads the pushes already arrived, without blocking. 
+    false if the connection is broken.  */
+bool cfgsp_poll_push( cfgs_session *sess, int sock, CFGSP_HOST_PROTO hproto );
+/** Server side.  Appends the change to @param out as one message, as 
+    server_send would write it.  */
+bool cfgsp_encode_push( 
+    CFGSP_HOST_PROTO hproto, 
+    const char       *valname, 
+    const char       *layer, 
+    cfgs_buf         *out 
+    );
+/** 
+ * Server side.  Writes a message of cfgsp_encode_push without blocking, in 
+ * line with the answers: one cut short is finished before anything else is 
+ * written to @param sock; with @param msg NULL, only that one is.  
+ * @return 1 if the message was taken, 0 if the socket is full, -1 if the 
+ * connection is broken.  
+ */
+int  cfgsp_push_send( int sock, const char *msg, int len );
+/** Server side.  True if a message was cut short: sock is to be polled 
+    for writing, then cfgsp_push_send finishes it.  */
+bool cfgsp_push_pending( int sock );
+/** Server side.  The connection closes: what was cut short is dropped.  */
+void cfgsp_push_forget( int sock );
+/** 
+ * CSNT_STREAM subscriptions.  Server side: a change as streamed, 
+ * @param value NULL if the value was removed.  
+ */
+cfgs_tag *cfgsp_change_tag( const char *valname, const char *layer, const char *value ); 
+/** Server side.  Appends @param changes to @param out as one message, 
+    ready to be written to the socket.  CFGSP_HOST_PROTO_BIN only.  */
+bool cfgsp_encode_changes( CFGSP_HOST_PROTO hproto, cfgs_tag *changes, cfgs_buf *out ); 
+/** Client side.  Waits up to @param microsec for changes then reads all 
+    those arrived.  Returns how many were passed to @param cb, -1 if the 
+    connection is broken.  */
+int  cfgsp_read_changes( 
+    cfgs_session         *sess, 
+    int                  sock, 
+    CFGSP_HOST_PROTO     hproto, 
+    CFGS_CHANGE_CALLBACK *cb, 
+    void                 *arg, 
+    int                  microsec 
+    );
     
 
 #ifdef __cplusplus
@@ -36,6 +36,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/un.h>
+#include <sys/epoll.h>
 
 
 #include <pthread.h>
@@ -47,6 +48,7 @@
 
 #include "cfgs_sock.h"
 #include "cfgs_log.h"
+#include "cfgs_mem.h"
 
 
 #define SOCKET_ERROR  (-1)
@@ -134,7 +136,8 @@ prepare_server_socket_bsd( int *sock, int port )
         return false;
     }
 
-    ret = listen( *sock, 5 ); 
+    /* clients connect in bursts: a thread pool opening its sessions */
+    ret = listen( *sock, SOMAXCONN ); 
     if ( ret < 0 ) {
         LOG( cfgs_log(CFGST_LL_CRITIC, "listen failed: %d\n", ret); );
         close( *sock );
@@ -263,7 +266,8 @@ prepare_server_socket_unix( int *sock, const char *path )
         return false;
     }
 
-    ret = listen( *sock, 5 ); 
+    /* clients connect in bursts: a thread pool opening its sessions */
+    ret = listen( *sock, SOMAXCONN ); 
     if ( ret < 0 ) {
         LOG( cfgs_log(CFGST_LL_CRITIC, "listen failed: %d\n", ret); );
         close( *sock );
@@ -275,21 +279,368 @@ prepare_server_socket_unix( int *sock, const char *path )
 }
 
 
-bool 
-cfgst_start_server( cfgs_sock_srv *ss )
+/*
+ *  Socket server: one epoll thread owns the client sockets and hands 
+ *  readable ones to a fixed pool of worker threads.  
+ */
+
+/** Max. number of events fetched by one epoll_wait */
+#define SRV_MAX_EVENTS  (64)
+/** Events a client socket is (re)armed with.  ONESHOT: only one worker 
+    at a time owns a client socket.  */
+#define SRV_CONN_EVENTS (EPOLLIN | EPOLLRDHUP | EPOLLET | EPOLLONESHOT)
+
+typedef struct _srv_conn srv_conn;
+struct _srv_conn {
+    srv_conn *next;
+    srv_conn *prev;
+    int      sock;
+    bool     opened;   /**< conn_open called */
+    void     *ctx;     /**< conn_open data */
+};
+
+typedef struct _srv_pool {
+    cfgs_sock_srv   *ss;
+    int             epfd;
+    pthread_mutex_t mutex;    /**< guards all below */
+    pthread_cond_t  cond;     /**< signaled when ready is not empty */
+    srv_conn        *conns;   /**< all open client connections */
+    int             nconns;
+    srv_conn        **ready;  /**< ring of connections waiting for a worker */
+    int             head;
+    int             count;
+    int             size;
+    pthread_t       *workers;
+    int             nworkers;
+} srv_pool;
+
+
+static void
+pool_add_conn( srv_pool *pool, srv_conn *conn )
+{
+    conn->prev = NULL;
+    conn->next = pool->conns;
+    if ( pool->conns )
+        pool->conns->prev = conn;
+    pool->conns = conn;
+    pool->nconns++;
+}
+
+
+static void
+pool_rem_conn( srv_pool *pool, srv_conn *conn )
+{
+    if ( conn->prev )
+        conn->prev->next = conn->next;
+    else
+        pool->conns = conn->next;
+    if ( conn->next )
+        conn->next->prev = conn->prev;
+    pool->nconns--;
+}
+
+
+/* Close conn, which must not be in the ready ring or owned by a worker */
+static void
+close_conn( srv_pool *pool, srv_conn *conn )
 {
-    fd_set    recv_fdset;
+    if ( conn->opened && pool->ss->conn_close ) 
+        (*pool->ss->conn_close)( conn->sock, conn->ctx );
+
+    pthread_mutex_lock( &pool->mutex );
+    pool_rem_conn( pool, conn );
+    pthread_mutex_unlock( &pool->mutex );
+
+    /* closing removes it from the epoll set too */
+    cfgst_rbuf_drop( conn->sock );
+    close( conn->sock );
+    xfree( conn );
+}
+
+
+/* 
+ * Reads what has arrived on conn, without waiting, until a whole request 
+ * is buffered.  False if it is not complete yet.  
+ */
+static bool
+request_ready( cfgs_sock_srv *ss, srv_conn *conn )
+{
+    cfgst_rbuf *rb;
+    
+    if ( !ss->conn_complete ) 
+        return true;
+    if ( (rb = cfgst_rbuf_get(conn->sock)) == NULL ) 
+        return true;
+    
+    while ( !(*ss->conn_complete)(conn->sock, conn->ctx) ) {
+        int len = cfgst_rbuf_read( conn->sock, rb );
+        
+        if ( len > 0 ) 
+            continue;
+        /* end of file, full buffer or error: for conn_request to see */
+        if ( len == 0 || errno != EAGAIN ) 
+            return true;
+        errno = 0;
+        return false;
+    }
+    
+    return true;
+}
+
+
+/* Requests on conn.  Re-arm or close the connection afterwards. */
+static void
+serve_conn( srv_pool *pool, srv_conn *conn )
+{
+    cfgs_sock_srv      *ss = pool->ss;
+    bool               keep;
+    struct epoll_event ev;
+
+    if ( !conn->opened ) {
+        conn->opened = true;
+        if ( ss->conn_open && !(*ss->conn_open)(conn->sock, &conn->ctx) ) {
+            conn->opened = false; 
+            close_conn( pool, conn );
+            return;
+        }
+    }
+
+    /* Edge-triggered: requests already in the receive buffer will not 
+       be signaled again.  The rest of a partial request will be: the 
+       connection goes back to epoll until it comes.  */
+    keep = true;
+    while ( keep && ss->run_flag && request_ready(ss, conn) ) {
+        errno = h_errno = 0;
+        keep = (*ss->conn_request)( conn->sock, conn->ctx );
+        if ( !ss->conn_complete && cfgst_rbuf_pending(conn->sock) <= 0 ) 
+            break;
+    }
+    
+    if ( keep && ss->run_flag ) {
+        ev.events   = SRV_CONN_EVENTS;
+        ev.data.ptr = conn;
+        if ( epoll_ctl(pool->epfd, EPOLL_CTL_MOD, conn->sock, &ev) == 0 ) 
+            return;
+        LOG( cfgs_log(CFGST_LL_CRITIC, "serve_conn:epoll_ctl(MOD, %d)\n", conn->sock); );
+    }
+    
+    close_conn( pool, conn );
+}
+
+
+static void*
+srv_worker( void *arg )
+{
+    srv_pool *pool = (srv_pool*)arg; 
+    srv_conn *conn;
+    
+    LOG( cfgs_log(CFGST_LL_INFO, "srv_worker %ld started\n", (long)pthread_self()); );
+    
+    while ( true ) {
+        pthread_mutex_lock( &pool->mutex );
+        while ( pool->count == 0 && pool->ss->run_flag ) 
+            pthread_cond_wait( &pool->cond, &pool->mutex );
+        if ( !pool->ss->run_flag ) {
+            pthread_mutex_unlock( &pool->mutex );
+            break; 
+        }
+        conn = pool->ready[ pool->head ];
+        pool->head = (pool->head + 1) % pool->size;
+        pool->count--;
+        pthread_mutex_unlock( &pool->mutex );
+        
+        serve_conn( pool, conn ); 
+    }
+    
+    LOG( cfgs_log(CFGST_LL_INFO, "srv_worker %ld done\n", (long)pthread_self()); );
+    return NULL;
+}
+
+
+/* Hand conn to the worker pool */
+static void
+dispatch_conn( srv_pool *pool, srv_conn *conn )
+{
+#if defined(ONE_SHOT)
+    /* no threading */
+    serve_conn( pool, conn ); 
+#else
+    pthread_mutex_lock( &pool->mutex );
+    /* cannot overflow: connections are limited to size-1 and a ONESHOT 
+       socket is queued at most once */
+    lassert( pool->count < pool->size );
+    pool->ready[ (pool->head + pool->count) % pool->size ] = conn;
+    pool->count++;
+    pthread_cond_signal( &pool->cond );
+    pthread_mutex_unlock( &pool->mutex );
+#endif
+}
+
+
+/* Old style: a detached start_func thread owns the client socket */
+static void
+start_conn_thread( cfgs_sock_srv *ss, int chldsock )
+{
+#if defined(ONE_SHOT)
+    /* no threading */
+    (*ss->start_func)( (void*)chldsock );
+#else
     pthread_t      chld_thr;
     pthread_attr_t chld_attr;
-    int       ret;
-    int       maxfd; 
-    const char *path = CFGS_CONFIGD_PATH;
-    bool      bret = false; 
-    
-    lassert( ss->type == CSST_UNIX || ss->type == CSST_INET );
 
     pthread_attr_init( &chld_attr );
     pthread_attr_setdetachstate( &chld_attr, PTHREAD_CREATE_DETACHED );
+    pthread_create( &chld_thr, &chld_attr, ss->start_func, (void*)chldsock );
+    pthread_attr_destroy( &chld_attr );
+    LOG( cfgs_log(CFGST_LL_INFO, "Thread %ld serving incoming request \n", (long)chld_thr); );
+#endif
+}
+
+
+/* Accept all pending connections.  Edge-triggered: loop until EAGAIN. */
+static bool
+accept_conns( srv_pool *pool )
+{
+    cfgs_sock_srv *ss = pool->ss;
+    
+    while ( true ) {
+        socklen_t          clilen;
+        int                chldsock;
+        struct sockaddr_in cli_addr; 
+        srv_conn           *conn;
+        struct epoll_event ev;
+        int                nconns;
+        bool               bret;
+
+        clilen = sizeof(cli_addr);
+        chldsock = raccept( ss->srvsock, (struct sockaddr*)&cli_addr, &clilen );
+        if ( chldsock < 0 ) {
+            if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                errno = 0;
+                return true;
+            }
+            /* client gave up before we got to it */
+            if ( errno == ECONNABORTED ) 
+                continue;
+            LOG( cfgs_log(CFGST_LL_CRITIC, "accept failed: %d\n", chldsock); );
+            return false;
+        }
+    
+        bret = false;
+        if ( ss->type == CSST_UNIX ) {
+            bret = prepare_client_socket_unix( &chldsock, ss->accept_conn );
+        } else if ( ss->type == CSST_INET ) {
+            bret = prepare_client_socket_bsd( &chldsock, ss->accept_conn );
+        }
+        if ( !bret ) {
+            /* connection refused, socket closed */
+            continue; 
+        }
+        lassert( chldsock != CFGST_INVALID_SOCKET );
+        /* the descriptor may have been closed without its buffer dropped */
+        cfgst_rbuf_drop( chldsock );
+        
+        if ( ss->conn_request == NULL ) {
+            start_conn_thread( ss, chldsock );
+            continue; 
+        }
+        
+        if ( (conn = XCALLOC(srv_conn, 1)) == NULL ) {
+            close( chldsock );
+            continue;
+        }
+        conn->sock = chldsock;
+        
+        /* workers close connections meanwhile: counted under the lock */
+        pthread_mutex_lock( &pool->mutex );
+        nconns = pool->nconns;
+        if ( nconns < pool->size - 1 ) 
+            pool_add_conn( pool, conn );
+        pthread_mutex_unlock( &pool->mutex );
+        if ( nconns >= pool->size - 1 ) {
+            LOG( cfgs_log(CFGST_LL_CRITIC, 
+                    "accept_conns: too many connections (%d)\n", nconns); );
+            xfree( conn );
+            close( chldsock );
+            continue;
+        }
+        
+        ev.events   = SRV_CONN_EVENTS;
+        ev.data.ptr = conn;
+        if ( epoll_ctl(pool->epfd, EPOLL_CTL_ADD, chldsock, &ev) != 0 ) {
+            LOG( cfgs_log(CFGST_LL_CRITIC, "accept_conns:epoll_ctl(ADD, %d)\n", chldsock); );
+            close_conn( pool, conn );
+            continue;
+        }
+        LOG( cfgs_log(CFGST_LL_INFO, "accept_conns: socket %d\n", chldsock); );
+    }
+}
+
+
+static bool
+start_workers( srv_pool *pool, int nworkers )
+{
+    int i;
+    
+    if ( nworkers <= 0 ) 
+        nworkers = (int)sysconf( _SC_NPROCESSORS_ONLN );
+    if ( nworkers <= 0 ) 
+        nworkers = 1;
+#if defined(ONE_SHOT)
+    nworkers = 0;
+#endif
+
+    pool->workers = XCALLOC( pthread_t, nworkers + 1 );
+    if ( !pool->workers ) 
+        return false; 
+    
+    for ( i=0; i<nworkers; i++ ) {
+        if ( 0 != pthread_create(&pool->workers[i], NULL, srv_worker, pool) ) {
+            LOG( cfgs_log(CFGST_LL_CRITIC, "start_workers: pthread_create\n"); );
+            break; 
+        }
+        pool->nworkers++;
+    }
+    
+    LOG( cfgs_log(CFGST_LL_INFO, "start_workers: %d workers\n", pool->nworkers); );
+    return pool->nworkers == nworkers; 
+}
+
+
+static void
+stop_workers( srv_pool *pool )
+{
+    int      i;
+    srv_conn *conn;
+    
+    pthread_mutex_lock( &pool->mutex );
+    pool->ss->run_flag = false; 
+    pthread_cond_broadcast( &pool->cond );
+    pthread_mutex_unlock( &pool->mutex );
+    
+    for ( i=0; i<pool->nworkers; i++ ) {
+        pthread_join( pool->workers[i], NULL );
+    }
+    pool->nworkers = 0;
+    
+    /* no more workers: the remaining connections are ours */
+    while ( (conn = pool->conns) != NULL ) {
+        close_conn( pool, conn ); 
+    }
+}
+
+
+bool
+cfgst_start_server( cfgs_sock_srv *ss )
+{
+    const char *path = CFGS_CONFIGD_PATH;
+    bool       bret  = false; 
+    srv_pool   pool;
+    srv_conn   lsn_mark, sig_mark; /* tell listening & sigpipe events apart */
+    struct epoll_event ev;
+    struct epoll_event events[ SRV_MAX_EVENTS ];
+    
+    lassert( ss->type == CSST_UNIX || ss->type == CSST_INET );
 
     if ( ss->accept_conn == NULL )
         ss->accept_conn = cfgst_accept_conn;
@@ -300,75 +651,93 @@ cfgst_start_server( cfgs_sock_srv *ss )
     } else if ( ss->type == CSST_INET ) {
         bret = prepare_server_socket_bsd( &ss->srvsock, ss->port );
     }
-    if (  !ret || !ss->srvsock > 0 ) {
+    if ( !bret || !(ss->srvsock > 0) ) {
         return false;
     }
     
+    memset( &pool, 0, sizeof(pool) );
+    pool.ss   = ss;
+    pool.size = CGFS_MAX_CONNEXIONS + 1;
+    pthread_mutex_init( &pool.mutex, NULL );
+    pthread_cond_init( &pool.cond, NULL );
+    
+    pool.ready = XCALLOC( srv_conn*, pool.size );
+    pool.epfd  = epoll_create( SRV_MAX_EVENTS );
+    if ( !pool.ready || pool.epfd < 0 ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "cfgst_start_server: epoll_create\n"); );
+        bret = false;
+        goto out;
+    }
+    
+    ev.events   = EPOLLIN | EPOLLET;
+    ev.data.ptr = &lsn_mark;
+    if ( epoll_ctl(pool.epfd, EPOLL_CTL_ADD, ss->srvsock, &ev) != 0 ) {
+        bret = false;
+        goto out;
+    }
+    if ( ss->sigpipe > 0 ) {
+        ev.events   = EPOLLIN;
+        ev.data.ptr = &sig_mark;
+        if ( epoll_ctl(pool.epfd, EPOLL_CTL_ADD, ss->sigpipe, &ev) != 0 ) {
+            bret = false;
+            goto out;
+        }
+    }
+    
+    if ( ss->conn_request && !start_workers(&pool, ss->nworkers) ) {
+        bret = false;
+        goto out;
+    }
+    
     LOG( cfgs_log(CFGST_LL_INFO, "Server waiting on : %s\n", path); );
     LOG( cfgs_log(CFGST_LL_INFO, "cfgst_start_server sigpipe=%d, srvsock=%d \n", 
             ss->sigpipe, ss->srvsock); );
     while ( ss->run_flag == true ) {
-        FD_ZERO(&recv_fdset);
-        FD_SET( ss->srvsock, &recv_fdset );
-        if ( ss->sigpipe > 0 ) {
-            FD_SET( ss->sigpipe, &recv_fdset );
-        }
-        maxfd = (ss->sigpipe > ss->srvsock) ? ss->sigpipe : ss->srvsock; 
-    
-        ret = rselect( maxfd + 1, &recv_fdset, NULL, NULL, NULL ); 
+        int nev, i;
         
-        if ( ret < 0 )  {
-            LOG( cfgs_log(CFGST_LL_CRITIC, "select failed: %d\n", ret); );
-            return false;
+        nev = epoll_wait( pool.epfd, events, SRV_MAX_EVENTS, -1 ); 
+        if ( nev < 0 )  {
+            /* interrupted system call */    
+            if ( errno == EINTR )
+                continue;
+            LOG( cfgs_log(CFGST_LL_CRITIC, "epoll_wait failed: %d\n", nev); );
+            bret = false;
+            break;
         }
-        /* interrupted system call */    
         errno   = 0;
         h_errno = 0;
-
-        /* Socket server shutdown has been requested */ 
-        if ( ss->sigpipe > 0 && FD_ISSET(ss->sigpipe, &recv_fdset) ) {
-            ss->run_flag = false; 
-            break; 
-        }
-        
-        /* Serve client */
-        if ( FD_ISSET(ss->srvsock, &recv_fdset) ) {
-            int       clilen;
-            int       chldsock;
-            struct sockaddr_in cli_addr; 
-    
-            clilen = sizeof(cli_addr);
-            chldsock = raccept( ss->srvsock, (struct sockaddr*)&cli_addr, &clilen );
-            if ( chldsock < 0 )             {
-                LOG( cfgs_log(CFGST_LL_CRITIC, "accept failed: %d\n", ret); );
-                return false;
-            }
-        
-            bret = false;
-            if ( ss->type == CSST_UNIX ) {
-                bret = prepare_client_socket_unix( &chldsock, ss->accept_conn );
-            } else if ( ss->type == CSST_INET ) {
-                bret = prepare_client_socket_bsd( &chldsock, ss->accept_conn );
-            }
-            if ( !bret ) {
-                return false; 
+        bret    = true;
+
+        for ( i=0; i<nev && ss->run_flag; i++ ) {
+            void *p = events[i].data.ptr;
+            
+            /* Socket server shutdown has been requested */ 
+            if ( p == &sig_mark ) {
+                ss->run_flag = false; 
+            } else if ( p == &lsn_mark ) {
+                if ( !accept_conns(&pool) ) {
+                    ss->run_flag = false;
+                    bret = false;
+                }
+            } else {
+                /* Serve client; hang-ups are detected by the reader */
+                dispatch_conn( &pool, (srv_conn*)p );
             }
-            lassert( chldsock != CFGST_INVALID_SOCKET );
-    
-#if defined(ONE_SHOT)
-            /* no threading */
-            (*ss->start_func)( (void*)chldsock );
-#else
-            /* process incoming request */
-            pthread_create( &chld_thr, &chld_attr, ss->start_func, (void*)chldsock );
-            LOG( cfgs_log(CFGST_LL_INFO, "Thread %ld serving incoming request \n", (long)chld_thr); );
-#endif
-        } /*serve client*/
+        }
     } /*while*/
     
+out:    
+    stop_workers( &pool );
+    if ( pool.epfd >= 0 )
+        close( pool.epfd );
+    xfree( pool.ready );
+    xfree( pool.workers );
+    pthread_cond_destroy( &pool.cond );
+    pthread_mutex_destroy( &pool.mutex );
+    
     close( ss->srvsock ), ss->srvsock = CFGST_INVALID_SOCKET; 
-    LOG( cfgs_log(CFGST_LL_INFO, "cfgst_start_server_unix exit \n"); );
-    return true;
+    LOG( cfgs_log(CFGST_LL_INFO, "cfgst_start_server exit \n"); );
+    return bret;
 }
 
 
@@ -467,6 +836,7 @@ cfgst_connect_unix( const char* path )
     int                    sockfd = CFGST_INVALID_SOCKET;
     struct sockaddr_un    cliaddr;
     int                 ret;
+    int                 ms;
     
     sockfd = socket( AF_LOCAL, SOCK_STREAM, 0 );
     
@@ -479,7 +849,13 @@ cfgst_connect_unix( const char* path )
     cliaddr.sun_family = AF_LOCAL;
     strcpy( cliaddr.sun_path, path ); //FIXME: overflow
 
-    ret = connect( sockfd, (struct sockaddr *) &cliaddr, sizeof(cliaddr) );
+    /* EAGAIN: the daemon's backlog is full, wait for it to accept */
+    for ( ms=0; ; ms++ ) {
+        ret = connect( sockfd, (struct sockaddr *) &cliaddr, sizeof(cliaddr) );
+        if ( ret == 0 || errno != EAGAIN || ms >= CGFS_SOCK_TOUT*1000 ) 
+            break;
+        usleep( 1000 );
+    }
     if ( ret < 0 ) {
         //FIXME
         close( sockfd );
@@ -494,16 +870,23 @@ cfgst_connect_unix( const char* path )
 int 
 cfgst_connect( CSST  type, const char* host, int port )
 {
+    int sock;
+    
     lassert( type == AF_UNIX || type == AF_INET );
     
     if ( type == CSST_INET ) {
-        return cfgst_connect_bsd( host, port );
+        sock = cfgst_connect_bsd( host, port );
     } else if ( type == CSST_UNIX ) {
-        return cfgst_connect_unix( host/*path*/ );
+        sock = cfgst_connect_unix( host/*path*/ );
     } else {
         //FIXME: set errno
         return CFGST_INVALID_SOCKET;
     }
+    
+    /* the descriptor may have been closed without its buffer dropped */
+    if ( sock >= 0 ) 
+        cfgst_rbuf_drop( sock );
+    return sock;
 }
 
 
@@ -513,6 +896,8 @@ cfgst_disconnect( int sock )
     /* 2: send and receives disallowed */
     int ret = shutdown( sock, 2 );
     
+    cfgst_rbuf_drop( sock );
+    
     if ( ret != 0 ) {
         LOG( cfgs_log(CFGST_LL_CRITIC, "Error shuting down socket %d\n", sock); );
     }
@@ -598,6 +983,199 @@ TEST_ERROR
 }
 
 
+/*
+ * Receive buffers, indexed by socket.  The mutex only guards the table; 
+ * a buffer belongs to whoever reads its socket.  
+ */
+static cfgst_rbuf      **m_rbufs = NULL;
+static int             m_nrbufs  = 0;
+static pthread_mutex_t m_rbufs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+
+cfgst_rbuf *
+cfgst_rbuf_get( int sock )
+{
+    cfgst_rbuf *rb = NULL;
+    
+    lassert( sock >= 0 );
+    if ( sock < 0 ) 
+        return NULL;
+    
+    pthread_mutex_lock( &m_rbufs_mutex );
+    if ( sock >= m_nrbufs ) {
+        int        n   = (sock + 1 > 2*m_nrbufs) ? sock + 1 : 2*m_nrbufs;
+        cfgst_rbuf **t = XREALLOC( cfgst_rbuf*, m_rbufs, n );
+        
+        if ( !t ) 
+            goto out;
+        memset( &t[m_nrbufs], 0, (n - m_nrbufs)*sizeof(cfgst_rbuf*) );
+        m_rbufs  = t;
+        m_nrbufs = n;
+    }
+    
+    if ( !m_rbufs[sock] ) {
+        rb = XCALLOC( cfgst_rbuf, 1 );
+        if ( !rb ) 
+            goto out;
+        rb->buf = XCALLOC( char, CFGST_RBUF_LEN );
+        if ( !rb->buf ) {
+            xfree( rb ), rb = NULL;
+            goto out;
+        }
+        rb->size      = CFGST_RBUF_LEN;
+        m_rbufs[sock] = rb;
+    }
+    rb = m_rbufs[sock];
+    
+out:
+    pthread_mutex_unlock( &m_rbufs_mutex );
+    return rb;
+}
+
+
+void
+cfgst_rbuf_drop( int sock )
+{
+    cfgst_rbuf *rb = NULL;
+    
+    if ( sock < 0 ) 
+        return;
+    
+    pthread_mutex_lock( &m_rbufs_mutex );
+    if ( sock < m_nrbufs ) {
+        rb = m_rbufs[sock];
+        m_rbufs[sock] = NULL;
+    }
+    pthread_mutex_unlock( &m_rbufs_mutex );
+    
+    if ( rb ) {
+        xfree( rb->buf );
+        xfree( rb );
+    }
+}
+
+
+int
+cfgst_rbuf_pending( int sock )
+{
+    int pending = 0;
+    
+    if ( sock < 0 ) 
+        return 0;
+    
+    pthread_mutex_lock( &m_rbufs_mutex );
+    if ( sock < m_nrbufs && m_rbufs[sock] ) 
+        pending = m_rbufs[sock]->end - m_rbufs[sock]->start;
+    pthread_mutex_unlock( &m_rbufs_mutex );
+    
+    return pending;
+}
+
+
+bool
+cfgst_rbuf_reserve( cfgst_rbuf *rb, int len )
+{
+    lassert( rb && rb->start <= rb->end && len >= 0 );
+    
+    if ( rb->start > 0 && rb->start + len > rb->size ) {
+        memmove( rb->buf, rb->buf + rb->start, rb->end - rb->start );
+        rb->end  -= rb->start;
+        rb->start = 0;
+    }
+    if ( len > rb->size ) {
+        char *buf = XREALLOC( char, rb->buf, len );
+        
+        if ( !buf ) 
+            return false;
+        rb->buf  = buf;
+        rb->size = len;
+    }
+    
+    return true;
+}
+
+
+int
+cfgst_rbuf_read( int sock, cfgst_rbuf *rb )
+{
+    int len;
+    
+    lassert( rb && rb->start <= rb->end );
+    
+    /* make room at the end */
+    if ( rb->start > 0 ) {
+        memmove( rb->buf, rb->buf + rb->start, rb->end - rb->start );
+        rb->end  -= rb->start;
+        rb->start = 0;
+    }
+    if ( rb->end >= rb->size ) 
+        return 0;
+    
+    errno = 0;
+    len = cfgst_rrecv( sock, rb->buf + rb->end, rb->size - rb->end, 0 );
+    if ( len > 0 ) 
+        rb->end += len;
+    
+    return len;
+}
+
+
+int
+cfgst_rbuf_fill( int sock, cfgst_rbuf *rb )
+{
+    int len;
+    
+    while ( (len = cfgst_rbuf_read(sock, rb)) < 0 ) {
+        if ( errno != EAGAIN ) 
+            return -1;
+        
+        /* Nothing there yet */
+        errno = 0;
+        if ( cfgst_microsleep(sock, CFGST_SE_READ, CGFS_SOCK_TOUT*1000000) <= 0 ) {
+            LOG( cfgs_log(CFGST_LL_CRITIC, "cfgst_rbuf_fill(%d): timeout\n", sock); );
+            return -1;
+        }
+    }
+    
+    LOG( cfgs_log(CFGST_LL_INFO, "cfgst_rbuf_fill(%d): %d\n", sock, len); );
+    return len;
+}
+
+
+int
+cfgst_rbuf_recv( int sock, cfgst_rbuf *rb, char *buf, int buflen )
+{
+    int got = rb->end - rb->start;
+    
+    lassert( rb && buf );
+    
+    if ( got > buflen ) 
+        got = buflen;
+    memcpy( buf, rb->buf + rb->start, got );
+    rb->start += got;
+    if ( rb->start == rb->end ) {
+        rb->start = rb->end = 0;
+        /* back to its usual size once a long message is read */
+        if ( rb->size > CFGST_RBUF_LEN ) {
+            char *small = XREALLOC( char, rb->buf, CFGST_RBUF_LEN );
+            
+            if ( small ) {
+                rb->buf  = small;
+                rb->size = CFGST_RBUF_LEN;
+            }
+        }
+    }
+    
+    if ( got < buflen ) {
+        int ret = cfgst_fullrecv( sock, buf + got, buflen - got, 0 );
+        if ( ret > 0 ) 
+            got += ret;
+    }
+    
+    return got;
+}
+
+
 in_addr_t 
 cfgst_host_to_ip( const char* name )
 {
@@ -648,8 +1226,8 @@ cfgst_microsleep( int sock, CFGST_SE se, int microsec )
     
     LOG( cfgs_log(CFGST_LL_CRITIC, "cfgst_microsleep(%d) \n", sock); );
     
-    tv.tv_sec  = 0;
-    tv.tv_usec = microsec;
+    tv.tv_sec  = microsec / 1000000;
+    tv.tv_usec = microsec % 1000000;
     
     if ( sock == CFGST_INVALID_SOCKET ) {
 TEST_ERROR    
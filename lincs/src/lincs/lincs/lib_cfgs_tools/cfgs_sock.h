@@ -47,9 +47,28 @@ typedef enum {
 bool cfgst_accept_conn( int clisock );
 
 /**
- *  Starts a stream AF_INET/AF_UNIX server on port and serve clients by starting 
- *  a start_func thread, as long as run_flag is true.  Will store the socket 
- *  in srvsock.  Newly created thread is detached.  Socket is non-blocking.  
+ *  Starts a stream AF_INET/AF_UNIX server on port and serve clients as long 
+ *  as run_flag is true.  Will store the socket in srvsock.  Socket is 
+ *  non-blocking.  
+ *
+ *  One thread (the caller's) runs an edge-triggered epoll loop that owns 
+ *  all client sockets; when a client socket becomes readable it is handed 
+ *  to one of nworkers worker threads, which calls conn_request once.  If 
+ *  conn_request returns true the socket is re-armed for the next request, 
+ *  else it is closed.  A socket is served by at most one worker at a time.  
+ *  conn_open is called by a worker before the first request on a socket and 
+ *  may store per-connection data in *ctx; conn_close is called before the 
+ *  socket is closed by the server.  Both are optional.  
+ *
+ *  If conn_complete is set, the worker first reads what has arrived into 
+ *  the socket's receive buffer, without waiting, until conn_complete says 
+ *  a whole request is there: a request not complete yet goes back to the 
+ *  epoll loop instead of keeping the worker waiting for the rest.  
+ *  conn_complete must return true too when reading more would not help 
+ *  (invalid request): conn_request will find out.  
+ *
+ *  If conn_request is NULL, a detached start_func thread is started for 
+ *  every connection and owns the client socket, as before.  
  *
  *  @param accept_conn is a user supplied function to check on the newly
  *  created client socket 'clisock' if to accept connection or not.  If 
@@ -68,6 +87,11 @@ typedef struct _cfgs_sock_srv {
             to signal the socket server that it has to finish.  
             Useful if signals are blocked and the server is stuck in 
             select.  */
+    int   nworkers; /**< Worker pool size; 0 means one per online CPU.  */
+    bool  (*conn_open)(int clisock, void **ctx);
+    bool  (*conn_request)(int clisock, void *ctx);
+    void  (*conn_close)(int clisock, void *ctx);
+    bool  (*conn_complete)(int clisock, void *ctx);
 } cfgs_sock_srv; 
 
 bool cfgst_start_server( cfgs_sock_srv *ss );
@@ -79,7 +103,7 @@ int  cfgst_connect( CSST  type, const char* host, int port );
 
 /** 
  * Returns 0 on success, returns -1 on error and errno is set.  
- * See shutdown man page.  
+ * See shutdown man page.  Also drops the receive buffer of @param sock.  
  */
 int  cfgst_disconnect( int sock );
 
@@ -114,6 +138,52 @@ in_addr_t cfgst_host_to_ip( const char* name );
 int cfgst_microsleep( int sock, CFGST_SE se, int microsec );
 
 
+/** Size of a socket receive buffer */
+#define CFGST_RBUF_LEN  (2*(CGFS_MAX_HDR_LEN+1))
+
+/**
+ * Per-socket receive buffer.  Data is read in chunks of up to 
+ * CFGST_RBUF_LEN bytes; whatever the caller does not consume stays in 
+ * buf[start, end) for the next read on the same socket.  A socket must be 
+ * read by one thread at a time.  
+ */
+typedef struct _cfgst_rbuf {
+    char  *buf;
+    int   size;   /**< CFGST_RBUF_LEN, more while a long message is read */
+    int   start;  /**< first unread byte */
+    int   end;    /**< one past the last unread byte */
+} cfgst_rbuf;
+
+/** Returns the receive buffer of @param sock, creates it if needed. */
+cfgst_rbuf *cfgst_rbuf_get( int sock );
+/** 
+ * Frees the receive buffer of @param sock.  Call it before closing sock.  
+ * Sockets made by cfgst_connect and the server drop whatever a socket 
+ * closed without it left under the same descriptor.  
+ */
+void        cfgst_rbuf_drop( int sock );
+/** Number of bytes already received on @param sock and not consumed yet. */
+int         cfgst_rbuf_pending( int sock );
+/** 
+ * One recv into the free space of @param rb, waiting up to CGFS_SOCK_TOUT 
+ * for data.  Returns the number of bytes added, 0 if the socket was closed 
+ * or the buffer is full, -1 on error or timeout.  
+ */
+int         cfgst_rbuf_fill( int sock, cfgst_rbuf *rb );
+/** 
+ * Same as cfgst_rbuf_fill without waiting: -1 and errno EAGAIN if 
+ * nothing has arrived.  
+ */
+int         cfgst_rbuf_read( int sock, cfgst_rbuf *rb );
+/** Makes room in @param rb for @param len unread bytes.  False if no memory. */
+bool        cfgst_rbuf_reserve( cfgst_rbuf *rb, int len );
+/** 
+ * Like cfgst_fullrecv but takes buffered bytes first.  Bytes beyond 
+ * @param buflen that are already buffered are left for the next read.  
+ */
+int         cfgst_rbuf_recv( int sock, cfgst_rbuf *rb, char *buf, int buflen );
+
+
 #ifdef __cplusplus
 }
 #endif
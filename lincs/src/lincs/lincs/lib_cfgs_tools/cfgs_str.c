@@ -30,6 +30,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
 /* read tags from file */
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -48,6 +49,95 @@
 #endif
 
 
+/*
+ * Interned names.  The known tag types and attribute names are copied once 
+ * in one block; tags and pairs point in it instead of duplicating them. 
+ * That block is how free functions tell them apart.  
+ */
+#if CGFS_INTERN_NAMES
+static const char *m_known_names[] = {
+    CFGS_TAG_CFGS,       CFGS_TAG_FUNC_CALL,   CFGS_TAG_ENTRY, 
+    CFGS_TAG_ERROR,      CFGS_TAG_NOTIF_REG,   CFGS_TAG_NOTIF_UNREG, 
+    CFGS_TAG_NOTIF,      CFGS_TAG_CALL_RETURN, CFGS_TAG_SUBKEY, 
+    CFGS_TAG_INFOS,      CFGS_TAG_STR, 
+    CFGS_EA_VERSION,     CFGS_EA_NAME,         CFGS_EA_LAYER, 
+    CFGS_EA_SCHEME,      CFGS_EA_VALUE,        CFGS_EA_ENTRY_TYPE, 
+    CFGS_EA_VALUE_TYPE,  CFGS_EA_ERR_TYPE,     CFGS_EA_ERR_EXPLANATION, 
+    CFGS_EA_ERR_CODE,    CFGS_EA_ERR_STRERROR, CFGS_EA_ERR_INFO, 
+    CFGS_EA_PID,         CFGS_EA_SIGNAL,       CFGS_EA_IP, 
+    CFGS_EA_PORT,        CFGS_EA_NOTIF_TYPE,   CFGS_EA_ON_CHANGE_VAL, 
+    CFGS_TA_FUNCTION, 
+};
+#define KNOWN_NAMES  ( sizeof(m_known_names)/sizeof(m_known_names[0]) )
+
+static char           *m_names     = NULL;
+static size_t         m_names_len  = 0;
+static cfgs_hash      *m_names_hash = NULL;   /* read only once built */
+static pthread_once_t m_names_once = PTHREAD_ONCE_INIT;
+
+static void
+names_init( void )
+{
+    size_t i, len = 0;
+    char   *p;
+    
+    for ( i=0; i<KNOWN_NAMES; i++ ) 
+        len += strlen( m_known_names[i] ) + 1;
+    
+    m_names      = XMALLOC( char, len );
+    m_names_hash = cfgs_hash_new( KNOWN_NAMES );
+    if ( !m_names || !m_names_hash ) {
+        xfree( m_names ), m_names = NULL;
+        cfgs_hash_free( m_names_hash, NULL ), m_names_hash = NULL;
+        return;
+    }
+    
+    for ( i=0, p=m_names; i<KNOWN_NAMES; i++ ) {
+        if ( cfgs_hash_find(m_names_hash, m_known_names[i]) ) 
+            continue; /* aliases */
+        strcpy( p, m_known_names[i] );
+        (void)cfgs_hash_insert( m_names_hash, p, p, 0 );
+        p += strlen( p ) + 1;
+    }
+    m_names_len = p - m_names;
+}
+#endif /*CGFS_INTERN_NAMES*/
+
+
+/* @return the shared copy of name, or NULL if it is not a known one */
+static char *
+intern( const char *name )
+{
+#if CGFS_INTERN_NAMES
+    (void)pthread_once( &m_names_once, names_init );
+    return (char*)cfgs_hash_find( m_names_hash, name );
+#else
+    return NULL;
+#endif
+}
+
+
+static bool
+is_interned( const char *name )
+{
+#if CGFS_INTERN_NAMES
+    return m_names && name >= m_names && name < m_names + m_names_len;
+#else
+    return false;
+#endif
+}
+
+
+/* Known names are shared, the others go in arena (or heap) */
+static char *
+name_dup( cfgs_arena *arena, const char *name )
+{
+    char *n = intern( name );
+    
+    return n ? n : cfgs_arena_strdup( arena, name );
+}
+
+
 cfgs_str *
 cfgs_str_new( const char *s )
 {
@@ -94,23 +184,23 @@ cfgs_str_cat(  cfgs_str *css, const char *s )
 
 
 cfgs_pair *
-cfgs_pair_new( const char *f, const char *s )
+cfgs_pair_new_in( cfgs_arena *arena, const char *f, const char *s )
 {
-    cfgs_pair *new = XCALLOC( cfgs_pair, 1 );
+    cfgs_pair *new = (cfgs_pair*)cfgs_arena_alloc( arena, sizeof(cfgs_pair) );
     if ( !new )
         return NULL;
     
     if ( f ) { 
-        new->first  = xstrdup( f );
+        new->first  = name_dup( arena, f );
         if ( !new->first ) {
-            cfgs_pair_free( new );
+            if ( !arena ) cfgs_pair_free( new );
             return NULL;
         }
     }
     if ( s ) {
-        new->second = xstrdup( s );
+        new->second = cfgs_arena_strdup( arena, s );
         if ( !new->second ) {
-            cfgs_pair_free( new );
+            if ( !arena ) cfgs_pair_free( new );
             return NULL;
         }
     }
@@ -119,20 +209,28 @@ cfgs_pair_new( const char *f, const char *s )
 }
 
 
+cfgs_pair *
+cfgs_pair_new( const char *f, const char *s )
+{
+    return cfgs_pair_new_in( NULL, f, s );
+}
+
+
 void  
 cfgs_pair_free( cfgs_pair *css )
 {
     if ( !css )
         return;
     
-    xfree( css->first );
+    if ( !is_interned(css->first) )
+        xfree( css->first );
     xfree( css->second );
     xfree( css );
 }
 
 
 cfgs_pair *
-cfgs_pair_dup( cfgs_pair *l )
+cfgs_pair_dup_in( cfgs_arena *arena, cfgs_pair *l )
 {
     cfgs_pair *new = NULL;
     cfgs_pair *next; 
@@ -140,16 +238,16 @@ cfgs_pair_dup( cfgs_pair *l )
     if ( !l )
         return NULL;
     
-    new = cfgs_pair_new( l->first, l->second );
+    new = cfgs_pair_new_in( arena, l->first, l->second );
     if ( !new )
         return NULL;
     new = (cfgs_pair*)cfgs_dlist_add_tail( NULL, (cfgs_dlist*)new );
     
     next = l;
     while ( (next = next->next) != NULL ) {
-        cfgs_pair *p = cfgs_pair_new( next->first, next->second );
+        cfgs_pair *p = cfgs_pair_new_in( arena, next->first, next->second );
         if ( !p ) {
-            cfgs_pair_free( new );
+            if ( !arena ) cfgs_pair_free( new );
             return NULL;
         }
         
@@ -160,6 +258,13 @@ cfgs_pair_dup( cfgs_pair *l )
 }
 
 
+cfgs_pair *
+cfgs_pair_dup( cfgs_pair *l )
+{
+    return cfgs_pair_dup_in( NULL, l );
+}
+
+
 cfgs_buf *
 cfgs_buf_new( const char *s, long len )
 {
@@ -259,14 +364,15 @@ cfgs_buf_cat_ch( cfgs_buf *css, char ch )
 #define CFGS_TAG_HASH_SIZE  (10)
 
 cfgs_tag *
-cfgs_tag_new( const char *type )
+cfgs_tag_new_in( cfgs_arena *arena, const char *type )
 {
-    cfgs_tag  *t  = XCALLOC( cfgs_tag, 1 );
+    cfgs_tag  *t  = (cfgs_tag*)cfgs_arena_alloc( arena, sizeof(cfgs_tag) );
 
     if ( !t )
         return NULL;
+    t->arena = arena;
     
-    t->attr_hash = cfgs_hash_new( CFGS_TAG_HASH_SIZE );
+    t->attr_hash = cfgs_hash_new_in( arena, CFGS_TAG_HASH_SIZE );
     if ( !t->attr_hash ) {
         cfgs_tag_free(t); 
         return NULL;
@@ -278,7 +384,7 @@ cfgs_tag_new( const char *type )
         t->type  = cfgs_tag_attr( t, CFGS_EA_NAME );
         lassert( 0 == strcmp(type, t->type) );
         */
-        t->type = xstrdup( type );
+        t->type = name_dup( arena, type );
         if ( !t->type ) {
             cfgs_tag_free(t); 
             return NULL;
@@ -289,15 +395,23 @@ cfgs_tag_new( const char *type )
 }
 
 
+cfgs_tag *
+cfgs_tag_new( const char *type )
+{
+    return cfgs_tag_new_in( NULL, type );
+}
+
+
 void  
 cfgs_tag_free( cfgs_tag *tag )
 {
-    if ( !tag )
+    /* arena tags go all at once with the arena */
+    if ( !tag || tag->arena )
         return;
     
     CFGST_DLIST_FREE( tag->attr, cfgs_pair_free );
 
-    if ( tag->type )
+    if ( tag->type && !is_interned(tag->type) )
         xfree( tag->type );
     if ( tag->attr_hash )
         cfgs_hash_free( tag->attr_hash, NULL );
@@ -316,7 +430,7 @@ cfgs_tag_add_attr( cfgs_tag* tag, const char *name, const char *val )
     if ( !tag || !name )
         return false;
     
-    att = cfgs_pair_new( name, val );
+    att = cfgs_pair_new_in( tag->arena, name, val );
     if ( !att ) {
         return false; 
     }
@@ -325,7 +439,7 @@ cfgs_tag_add_attr( cfgs_tag* tag, const char *name, const char *val )
                         (cfgs_dlist*)att );
 
     if ( !tag->attr_hash )
-        tag->attr_hash = cfgs_hash_new( CFGS_TAG_HASH_SIZE );
+        tag->attr_hash = cfgs_hash_new_in( tag->arena, CFGS_TAG_HASH_SIZE );
     if ( !tag->attr_hash )
         return false;
     idx = cfgs_hash_insert( tag->attr_hash, att->first, att, 1/*allow dup*/ ); 
@@ -467,29 +581,33 @@ cfgs_tags_read( int file )
 
 #define IS_STR( a, b )   (0 == strcmp(a,b))
 
+/* expat user data */
+typedef struct _parse_data {
+    cfgs_tag   *tags;
+    cfgs_arena *arena;
+} parse_data;
+
 static void
 handle_elem_start(void *userData, const char *name, const char **atts)
 {
-    cfgs_tag   **tags = (cfgs_tag**)userData;
+    parse_data *pd = (parse_data*)userData;
     cfgs_tag   *tag; 
     int        i;
 
-    lassert( tags != NULL );
+    lassert( pd != NULL );
     
     if ( !name )
         return;
     
-    tag = cfgs_tag_new( name );
+    tag = cfgs_tag_new_in( pd->arena, name );
     if ( !tag )
         return;
     
-    *tags = (cfgs_tag*)cfgs_dlist_add_tail( (cfgs_dlist*)*tags, (cfgs_dlist*)tag );
+    pd->tags = (cfgs_tag*)cfgs_dlist_add_tail( (cfgs_dlist*)pd->tags, (cfgs_dlist*)tag );
 
     for ( i=0; atts[i]; i+=2 ) {
-        cfgs_pair *p = cfgs_pair_new( atts[i], atts[i+1] );
-        if ( p )
-            if ( !cfgs_tag_add_attr(tag, p->first, p->second) )
-                break; 
+        if ( !cfgs_tag_add_attr(tag, atts[i], atts[i+1]) )
+            break; 
     }
 }
 
@@ -505,21 +623,67 @@ handle_char_data( void *userData, const XML_Char *s, int len )
 {
 }
 
+/*
+ * One parser per thread, reset between documents.  It is taken out of the 
+ * thread's slot while in use: a nested parse gets a parser of its own.  
+ */
+static pthread_key_t  m_parser_key;
+static pthread_once_t m_parser_once = PTHREAD_ONCE_INIT;
+
+static void
+parser_destroy( void *parser )
+{
+    XML_ParserFree( (XML_Parser)parser );
+}
+
+static void
+parser_key_create( void )
+{
+    (void)pthread_key_create( &m_parser_key, parser_destroy );
+}
+
+static XML_Parser
+parser_get( void )
+{
+    XML_Parser parser;
+    
+    (void)pthread_once( &m_parser_once, parser_key_create );
+    parser = (XML_Parser)pthread_getspecific( m_parser_key );
+    if ( parser ) {
+        (void)pthread_setspecific( m_parser_key, NULL );
+        if ( XML_ParserReset(parser, NULL) ) 
+            return parser;
+        XML_ParserFree( parser );
+    }
+    
+    return XML_ParserCreate( NULL );
+}
+
+static void
+parser_put( XML_Parser parser )
+{
+    if (  pthread_getspecific(m_parser_key) 
+       || 0 != pthread_setspecific(m_parser_key, parser) )
+        XML_ParserFree( parser );
+}
+
+
 cfgs_tag *
-cfgs_tags_from_str( const char *buf, int len )
+cfgs_tags_from_str_in( cfgs_arena *arena, const char *buf, int len )
 {
-    cfgs_tag   *ret   = NULL;
-    XML_Parser parser = XML_ParserCreate( NULL );
-    /*FIXME: one parser created for each file we manipulate*/
+    parse_data pd     = { NULL, NULL };
+    XML_Parser parser = parser_get();
     
     if ( !parser ) {
         LOG( cfgs_log(CFGST_LL_CRITIC, "_cfgs_tags_from_str: XML_ParserCreate failed.\n"); );
         return NULL;
     }
     
+    /* a reset parser has no handlers */
     XML_SetElementHandler( parser, handle_elem_start, handle_elem_end );
     XML_SetCharacterDataHandler( parser, handle_char_data );
-    XML_SetUserData( parser, (void*)&ret ); 
+    pd.arena = arena;
+    XML_SetUserData( parser, (void*)&pd ); 
     if ( !XML_Parse(parser, buf, len, true) ) {
         cfgs_log(CFGST_LL_CRITIC, "XML_Parse error: %s at line %d \n",
               XML_ErrorString(XML_GetErrorCode(parser)),
@@ -527,8 +691,15 @@ cfgs_tags_from_str( const char *buf, int len )
     }
     
     
-    XML_ParserFree( parser );
-    return ret;
+    parser_put( parser );
+    return pd.tags;
+}
+
+
+cfgs_tag *
+cfgs_tags_from_str( const char *buf, int len )
+{
+    return cfgs_tags_from_str_in( NULL, buf, len );
 }
 
 
@@ -33,6 +33,7 @@ extern "C" {
 #endif
 
 
+#include "cfgs_arena.h"
 #include "cfgs_hash.h"
 #include "cfgs_tags.h"
 
@@ -49,6 +50,10 @@ bool  cfgs_str_cat(  cfgs_str *css, const char *s );
 void  cfgs_str_free( cfgs_str *css );
 
 
+/** 
+ * Known names (see cfgs_tags.h) may be shared between pairs and tags: 
+ * never modify the first member of a pair or the type of a tag. 
+ */
 typedef struct _cfgs_pair cfgs_pair;
 struct _cfgs_pair {
     cfgs_pair  *next;
@@ -58,9 +63,12 @@ struct _cfgs_pair {
 };
 
 cfgs_pair *cfgs_pair_new( const char *f, const char *s );
+/** Pair & strings in @param arena.  Do not cfgs_pair_free it */
+cfgs_pair *cfgs_pair_new_in( cfgs_arena *arena, const char *f, const char *s );
 void   cfgs_pair_free( cfgs_pair *css );
 /* duplicates attribs list */
 cfgs_pair *cfgs_pair_dup( cfgs_pair *l );
+cfgs_pair *cfgs_pair_dup_in( cfgs_arena *arena, cfgs_pair *l );
 
 
 typedef struct _cfgs_buf cfgs_buf;
@@ -89,9 +97,15 @@ struct _cfgs_tag {
     char      *type;
     cfgs_pair *attr;
     cfgs_hash *attr_hash; 
+    cfgs_arena *arena;     /* NULL: on the heap */
 };
 
 cfgs_tag *cfgs_tag_new( const char *type );
+/** 
+ * Tag in @param arena.  Its attributes go in the same arena.  cfgs_tag_free 
+ * does nothing on it: the memory goes with the arena's next reset.  
+ */
+cfgs_tag *cfgs_tag_new_in( cfgs_arena *arena, const char *type );
 void     cfgs_tag_free( cfgs_tag *tag );
 bool     cfgs_tag_add_attr( cfgs_tag* tag, const char *name, const char *val ); 
 /** @return value of 'name' attribute */
@@ -108,8 +122,11 @@ bool     cfgs_tag_to_cfgs_buf( cfgs_tag *tag, cfgs_buf *buf );
 /**
  * @param buf should contain well formatted tags, i.e. start with '<' and 
  * end with '>' in balanced pairs.  @param buf has @param len bytes.  
+ * Each thread reuses its own parser from one call to the next. 
  */
 cfgs_tag *cfgs_tags_from_str( const char *buf, int len );
+/** Same, the tags being allocated in @param arena */
+cfgs_tag *cfgs_tags_from_str_in( cfgs_arena *arena, const char *buf, int len );
 
 
 
@@ -85,11 +85,12 @@ cfgs_entry_attr( cfgs_entry *v, const char *name )
 #define CFGS_ENTRY_HASH_SIZE  (10)
 
 cfgs_entry * 
-cfgs_entry_new( void )
+cfgs_entry_new_in( cfgs_arena *arena )
 {
-    cfgs_entry *e = XCALLOC( cfgs_entry, 1 );
+    cfgs_entry *e = (cfgs_entry*)cfgs_arena_alloc( arena, sizeof(cfgs_entry) );
     if ( e ) {
-        e->attr_hash = cfgs_hash_new( CFGS_ENTRY_HASH_SIZE );
+        e->arena     = arena;
+        e->attr_hash = cfgs_hash_new_in( arena, CFGS_ENTRY_HASH_SIZE );
         if ( !e->attr_hash )
             cfgs_entry_free(e), e = NULL;
     }
@@ -98,10 +99,18 @@ cfgs_entry_new( void )
 }
 
 
+cfgs_entry * 
+cfgs_entry_new( void )
+{
+    return cfgs_entry_new_in( NULL );
+}
+
+
 void    
 cfgs_entry_free( cfgs_entry *v )
 {
-    if ( !v )
+    /* arena entries go all at once with the arena */
+    if ( !v || v->arena )
         return; 
     CFGST_DLIST_FREE( v->attr, cfgs_pair_free );
     if ( v->attr_hash )
@@ -110,6 +119,49 @@ cfgs_entry_free( cfgs_entry *v )
 }
 
 
+cfgs_entry *
+cfgs_entry_dup( cfgs_entry *v )
+{
+    cfgs_entry *e;
+    cfgs_pair  *p;
+    
+    lassert( v );
+    
+    e = cfgs_entry_new();
+    if ( !e )
+        return NULL;
+    
+    e->value_type = v->value_type;
+    e->entry_type = v->entry_type;
+    for ( p=v->attr; p; p=p->next ) {
+        if ( !cfgs_entry_add_attr(e, p->first, p->second) ) {
+            cfgs_entry_free( e );
+            return NULL;
+        }
+    }
+    
+    return e;
+}
+
+
+cfgs_entry *
+cfgs_entries_dup( cfgs_entry *vals )
+{
+    cfgs_entry *v, *copy = NULL;
+    
+    for ( v=vals; v; v=v->next ) {
+        cfgs_entry *c = cfgs_entry_dup( v );
+        if ( !c ) {
+            CFGST_DLIST_FREE( copy, cfgs_entry_free );
+            return NULL;
+        }
+        copy = (cfgs_entry*)cfgs_dlist_add_tail( (cfgs_dlist*)copy, (cfgs_dlist*)c );
+    }
+    
+    return copy;
+}
+
+
 bool  
 cfgs_entry_add_attr( cfgs_entry* v, const char *attr_name, const char *attr_val )
 {
@@ -121,7 +173,7 @@ cfgs_entry_add_attr( cfgs_entry* v, const char *attr_name, const char *attr_val
     lassert( v != NULL && attr_name );
     
     if ( !v->attr_hash )
-        v->attr_hash = cfgs_hash_new( CFGS_ENTRY_HASH_SIZE );
+        v->attr_hash = cfgs_hash_new_in( v->arena, CFGS_ENTRY_HASH_SIZE );
     if ( !v->attr_hash )
         return false;
     
@@ -130,7 +182,7 @@ cfgs_entry_add_attr( cfgs_entry* v, const char *attr_name, const char *attr_val
     if ( aval )
         return true;
     
-    att = cfgs_pair_new( attr_name, attr_val );
+    att = cfgs_pair_new_in( v->arena, attr_name, attr_val );
     if ( !att )
         return false;
 	
@@ -149,7 +201,7 @@ cfgs_entry_add_attr( cfgs_entry* v, const char *attr_name, const char *attr_val
 
 
 cfgs_entry *
-cfgs_entry_from_tag( cfgs_tag *t )
+cfgs_entry_from_tag_in( cfgs_arena *arena, cfgs_tag *t )
 {
     cfgs_entry *vv; 
     cfgs_pair  *p;
@@ -160,7 +212,7 @@ cfgs_entry_from_tag( cfgs_tag *t )
     if ( !t || !t->type || 0 != strcmp(CFGS_TAG_ENTRY, t->type) ) 
         return NULL;
 
-    vv = cfgs_entry_new();
+    vv = cfgs_entry_new_in( arena );
     if ( !vv ) {
         return NULL;
     }
@@ -174,6 +226,13 @@ cfgs_entry_from_tag( cfgs_tag *t )
 }
 
 
+cfgs_entry *
+cfgs_entry_from_tag( cfgs_tag *t )
+{
+    return cfgs_entry_from_tag_in( NULL, t );
+}
+
+
 cfgs_entry *
 cfgs_entries_from_tags( cfgs_tag *tag )
 {
@@ -195,13 +254,13 @@ cfgs_entries_from_tags( cfgs_tag *tag )
 
 
 cfgs_tag  *
-cs_tags_from_entries( cfgs_entry *val )
+cs_tags_from_entries( cfgs_arena *arena, cfgs_entry *val )
 {
     cfgs_tag   *t = NULL;
     cfgs_entry *v; 
     
     for ( v=val; v; v=v->next ) {
-        cfgs_tag  *tt = cfgs_tag_new( CFGS_TAG_ENTRY );
+        cfgs_tag  *tt = cfgs_tag_new_in( arena, CFGS_TAG_ENTRY );
         if ( !tt ) {
              cfgs_tag_free( t );
              return NULL;
@@ -209,7 +268,7 @@ cs_tags_from_entries( cfgs_entry *val )
     
         t = (cfgs_tag*)cfgs_dlist_add_tail( (cfgs_dlist*)t, (cfgs_dlist*)tt );
         
-        tt->attr = cfgs_pair_dup( v->attr );
+        tt->attr = cfgs_pair_dup_in( arena, v->attr );
         if ( !tt->attr ) {
              cfgs_tag_free( t );
              return NULL;
@@ -221,13 +280,13 @@ cs_tags_from_entries( cfgs_entry *val )
 
 
 cfgs_tag  *
-cs_subkeytags_from_strings( cfgs_str *str )
+cs_subkeytags_from_strings( cfgs_arena *arena, cfgs_str *str )
 {
     cfgs_tag   *t = NULL;
     cfgs_str   *v; 
     
     for ( v=str; v; v=v->next ) {
-        cfgs_tag  *tt = cfgs_tag_new( CFGS_TAG_SUBKEY );
+        cfgs_tag  *tt = cfgs_tag_new_in( arena, CFGS_TAG_SUBKEY );
         if ( !tt ) {
              cfgs_tag_free( t );
              return NULL;
@@ -270,6 +329,10 @@ cfgs_str_from_tag( cfgs_tag *t, const char *tag )
 struct _cfgs_session {
     cfgs_err     err;
     struct ucred ucreds;  /* "client" credentials */
+    void         *conn;   /* client side, see cfgs_client_api.c */
+    bool         defer;   /* server side: commits deferred */
+    cfgs_commit_func *commit;
+    long         commit_arg;
 };
 
 cfgs_session *
@@ -343,6 +406,57 @@ cfgs_session_set_creds( cfgs_session* s, struct ucred *creds )
 }
 
 
+void *
+cfgs_session_get_conn( cfgs_session* s )
+{
+    lassert( s );
+    return s->conn;
+}
+
+
+void
+cfgs_session_set_conn( cfgs_session* s, void *conn )
+{
+    lassert( s );
+    s->conn = conn;
+}
+
+
+void
+cfgs_session_defer_commits( cfgs_session* s, bool defer )
+{
+    lassert( s );
+    s->defer = defer;
+}
+
+
+bool
+cfgs_session_commit_or_defer( cfgs_session* s, cfgs_commit_func *commit, long arg )
+{
+    lassert( s && commit );
+    /* one deferred: another backend's commits now */
+    if ( !s->defer || (s->commit && s->commit != commit) )
+        return (*commit)( arg );
+
+    if ( !s->commit || arg > s->commit_arg )
+        s->commit_arg = arg;
+    s->commit = commit;
+    return true;
+}
+
+
+bool
+cfgs_session_commit( cfgs_session* s )
+{
+    cfgs_commit_func *commit;
+
+    lassert( s );
+    commit = s->commit;
+    s->commit = NULL;
+    return !commit || (*commit)( s->commit_arg );
+}
+
+
 cfgs_notif *
 cfgs_notif_local_new( const char *val, pid_t pid, int sig )
 {
@@ -392,6 +506,39 @@ cfgs_notif_remote_new( const char *val, const char *host, int port )
 }
 
 
+cfgs_notif *
+cfgs_notif_conn_new( const char *val )
+{
+    cfgs_notif *n = XCALLOC( cfgs_notif, 1 );
+    
+    if ( !n )
+        return NULL;
+    
+    n->valname = xstrdup( val );
+    if ( !n->valname ) {
+        cfgs_notif_free( n );
+        return NULL;
+    }
+    
+    n->type   = CSNT_CONN; 
+    n->sock   = -1;
+    
+    return n;
+}
+
+
+cfgs_notif *
+cfgs_notif_stream_new( const char *val )
+{
+    cfgs_notif *n = cfgs_notif_conn_new( val );
+    
+    if ( n ) 
+        n->type = CSNT_STREAM; 
+    
+    return n;
+}
+
+
 void       
 cfgs_notif_free( cfgs_notif* n )
 {
@@ -445,6 +592,14 @@ cfgs_notif_from_tag( cfgs_tag *t )
         port = atoi( att );
         vv = cfgs_notif_remote_new( val, host, port ); 
         break;
+    case CSNT_CONN: 
+        val  = cfgs_tag_attr( t, CFGS_EA_VALUE );
+        vv = cfgs_notif_conn_new( val ); 
+        break;
+    case CSNT_STREAM: 
+        val  = cfgs_tag_attr( t, CFGS_EA_VALUE );
+        vv = cfgs_notif_stream_new( val ); 
+        break;
     default: 
         lassert( false ); 
         vv = NULL; 
@@ -126,22 +126,31 @@ struct _cfgs_entry {
 
     cfgs_pair  *attr; 
     cfgs_hash  *attr_hash; 
+    cfgs_arena *arena;     /* NULL: on the heap */
 };
 
 
 cfgs_entry *cfgs_entry_new( void );
+/** Entry & attributes in @param arena; cfgs_entry_free does nothing on it */
+cfgs_entry *cfgs_entry_new_in( cfgs_arena *arena );
 void       cfgs_entry_free( cfgs_entry* );
+/** Copy of one entry, not of the list it is in.  Free it when done. */
+cfgs_entry *cfgs_entry_dup( cfgs_entry* );
+/** Copy of the list.  Free it when done. */
+cfgs_entry *cfgs_entries_dup( cfgs_entry* );
 /** Free returned pointer when done */ 
 cfgs_entry *cfgs_entry_from_tag( cfgs_tag *tag ); 
+cfgs_entry *cfgs_entry_from_tag_in( cfgs_arena *arena, cfgs_tag *tag ); 
 /**
  * @param tag is a parse of the xml tag into a cfgs_tag structure:  
  * &lt;cfgs:entry name=".." value=".."/&gt; 
  * Free returned pointer when done. 
  */
 cfgs_entry *cfgs_entries_from_tags( cfgs_tag *tag );
-cfgs_tag   *cs_tags_from_entries( cfgs_entry *val );
+/** Tags in @param arena, or on the heap if NULL */
+cfgs_tag   *cs_tags_from_entries( cfgs_arena *arena, cfgs_entry *val );
 /* Used by namespace navigation */
-cfgs_tag   *cs_subkeytags_from_strings( cfgs_str *str ); 
+cfgs_tag   *cs_subkeytags_from_strings( cfgs_arena *arena, cfgs_str *str ); 
 cfgs_str   *cfgs_str_from_tag( cfgs_tag *t, const char *tagname ); 
 
 /** Note: @param attr_name cannot contain spaces - those are replaced by '_'.  FIXME:ret err */
@@ -171,17 +180,40 @@ const char   *cfgs_session_xml_err( cfgs_session* s );
 struct ucred *cfgs_session_get_creds( cfgs_session* s ); 
 void         cfgs_session_set_creds( cfgs_session* s, struct ucred *creds ); 
 
+/** Client side: the daemon connection the session talks on, NULL if none */
+void         *cfgs_session_get_conn( cfgs_session* s ); 
+void         cfgs_session_set_conn( cfgs_session* s, void *conn ); 
+
+/** 
+ *  Server side: a backend's wait for its changes to be on disk, up to 
+ *  @param arg.  The daemon defers it past its locks, to cfgs_session_commit, 
+ *  so that the writers meanwhile are synced at once.  
+ */
+typedef bool cfgs_commit_func( long arg );
+void         cfgs_session_defer_commits( cfgs_session* s, bool defer ); 
+/** @return false if committing failed; true if deferred */
+bool         cfgs_session_commit_or_defer( cfgs_session* s, cfgs_commit_func *commit, 
+                                           long arg ); 
+/** Run the commit deferred, if any.  @return false if it failed */
+bool         cfgs_session_commit( cfgs_session* s ); 
+
 
 
 typedef enum {
     CSNT_LOCAL = 0,
     CSNT_REMOTE,
+    CSNT_CONN,
+    CSNT_STREAM,
 } CSNT;
 
 /** \struct _cfgs_notif
  *  Register for notification: local process 'pid' will 
  *  receive signal if any value under 'valname' changes. 
  *  Remote process on 'host' will be contacted by connecting to 'port'.  
+ *  CSNT_CONN: the changed value's name is pushed back on the connection 
+ *  the registration came from.  
+ *  CSNT_STREAM: the connection only carries changes from then on, with 
+ *  their new value; see cfgs_subscribe.  
  */
 typedef struct _cfgs_notif cfgs_notif; 
 struct _cfgs_notif {
@@ -196,10 +228,17 @@ struct _cfgs_notif {
     /* remote */
     char        *host;
     int         port;
+    /* connection, server side */
+    int         sock;
+    int         hproto;
+    void        *conn;     /* CSNT_STREAM output */
+    unsigned    batch;     /* last batch of changes notified */
 };
 
 cfgs_notif *cfgs_notif_local_new( const char *val, pid_t pid, int sig );
 cfgs_notif *cfgs_notif_remote_new( const char *val, const char *host, int port ); 
+cfgs_notif *cfgs_notif_conn_new( const char *val ); 
+cfgs_notif *cfgs_notif_stream_new( const char *val ); 
 void       cfgs_notif_free( cfgs_notif* n );
 cfgs_notif *cfgs_notif_from_tag( cfgs_tag *t ); 
 cfgs_notif *cfgs_notifs_from_tags( cfgs_tag *tag ); 
@@ -154,117 +154,51 @@ http_server_send( int sock, char *buf, int len, cfgs_err *err )
 }
 
 
-/** 
- * Will read from file fd into buf until upto is encountered 
- * in the stream or CGFS_MAX_HDR_LEN bytes are in the buffer.  
- * @param buf will contain @param upto too.  
- *
- * FIXME: move to cfgs_sock
- */
-static bool  
-buf_read_upto( int fd, cfgs_buf *cbuf, const char *upto )
-{
-    bool reading = true;
-    int  plen    = strlen( upto );
-    char rch     = upto[ plen-1 ];
-    int  no_tout = 1;
-    
-    /*FIXME: this is an expensive loop */
-    while ( reading ) {
-        char ch;
-        int  len;
-        
-        errno = 0;
-        len = cfgst_rread( fd, &ch, 1 );
-        /* socket closed.  since socket has been closed, further processing is 
-           useless */
-        if ( len == 0 )
-            return false; 
-        /* No more chars to read.   */
-        else if ( len < 0 && (errno == EAGAIN || errno == EINTR) ){
-            LOG( cfgs_log(CFGST_LL_CRITIC, "buf_read_upto" ); );
-            errno = 0;
-            if ( no_tout > 0 ) {
-                no_tout = cfgst_microsleep( fd, CFGST_SE_READ, CGFS_SOCK_TOUT*1000000 ); 
-TEST_ERROR                
-                if ( no_tout < 0 )
-                    return false; 
-                continue;
-            } else
-                return false;
-        } else {
-            no_tout = 1;
-            if ( !cfgs_buf_cat_ch(cbuf, ch) )
-                return false;
-
-            if ( ch == rch && cbuf->used >= plen ) {
-                char *ppat, *pbuf;
-                int  i;
-            
-                /* reverse scan for pattern */
-                ppat = (char*)&upto[ plen-1 ];
-                pbuf = &cbuf->buf[ cbuf->used-1 ];
-                reading = false;
-                for ( i=plen; i>0; i--, ppat--, pbuf-- ) {
-                    if ( *ppat != *pbuf ) {
-                        reading = true;
-                        break;
-                    }
-                }
-            } /* if scan */
-        
-            if ( cbuf->used >= CGFS_MAX_HDR_LEN )
-                reading = false;
-        }/*if len*/
-    }
-
-    return !reading;
-}
-
-
-static cfgs_buf*
-read_header( int sock )
+bool   
+http_server_frame( cfgs_buf *out, char *buf, int len )
 {
-    bool     ret;
-    cfgs_buf *hdr  = cfgs_buf_new( NULL, 0 );
+    char *hdr = print_server_header( len );
+    bool ret;
     
     if ( !hdr ) {
-        return NULL;
-    }
-
-    ret = buf_read_upto( sock, hdr, CFGSP_HEADER_SEP );
-    if ( !ret || !cfgs_buf_cat_ch(hdr, '\0') ) {
-        cfgs_buf_free( hdr );
-        return NULL;
+        return false;
     }
     
-    LOG( cfgs_log(ret?CFGST_LL_INFO:CFGST_LL_CRITIC, "read_header (%d): %s\n%s", 
-            hdr->used, ret?"":"invalid header", hdr->buf); );
-    
-    return hdr;
+    ret = cfgs_buf_cat( out, hdr, strlen(hdr) ) && cfgs_buf_cat( out, buf, len );
+    xfree( hdr );    
+    return ret;
 }
 
 
-static cfgs_buf*
-read_body( int sock, int len )
+/** 
+ * Will read from socket into its receive buffer until @param upto is 
+ * buffered or CGFS_MAX_HDR_LEN bytes are in the buffer.  Returns the 
+ * length of the data up to and including @param upto, counted from 
+ * rb->start, CGFS_MAX_HDR_LEN if @param upto was not found in as many 
+ * bytes (the header is truncated), or -1.  
+ */
+static int  
+buf_read_upto( int sock, cfgst_rbuf *rb, const char *upto )
 {
-    cfgs_buf *body = cfgs_buf_new( NULL, len+1 );
-    
-    if ( !body ) {
-        return NULL;
-    }
-    
-    body->used += cfgst_fullrecv( sock, body->buf, len, 0 );
-    /*FIXME: make it a macro NULL_BUF */
-    
-    if ( !cfgs_buf_cat_ch(body, '\0') ) {
-        cfgs_buf_free( body );
-        return NULL;
-    }
+    int  plen    = strlen( upto );
+    int  scanned = 0;  /* no match starts in the first scanned bytes */
     
-    LOG( cfgs_log(CFGST_LL_INFO, "read_body:\n%s", body->buf); ); 
+    while ( true ) {
+        int  avail = rb->end - rb->start;
+        char *p    = memmem( rb->buf + rb->start + scanned, avail - scanned, 
+                             upto, plen );
+        if ( p ) {
+            return (p - (rb->buf + rb->start)) + plen;
+        }
+        if ( avail >= plen ) 
+            scanned = avail - plen + 1;
         
-    return body;
+        if ( avail >= CGFS_MAX_HDR_LEN ) 
+            return CGFS_MAX_HDR_LEN;
+        /* socket closed, timeout or error: further processing is useless */
+        if ( cfgst_rbuf_fill(sock, rb) <= 0 ) 
+            return -1;
+    }
 }
 
 
@@ -306,9 +240,9 @@ stristr( const char *haystack, const char *needle )
 
 
 static int
-content_length( cfgs_buf *hdr )
+content_length( const char *hdr )
 {
-    char *b  = stristr( hdr->buf, "Content-Length: " );
+    char *b  = stristr( hdr, "Content-Length: " );
     int  len = 0;
     
     if ( b ) {
@@ -324,9 +258,9 @@ content_length( cfgs_buf *hdr )
 #if 0
 /* Keep-Alive by default */
 static bool
-keep_alive( cfgs_buf *hdr )
+keep_alive( const char *hdr )
 {
-    char *b  = stristr( hdr->buf, "Connection:" );
+    char *b  = stristr( hdr, "Connection:" );
     
     if ( b ) {
         bool alive = false;
@@ -344,37 +278,91 @@ keep_alive( cfgs_buf *hdr )
 #endif
 
 
+/**
+ * Reads the header into the receive buffer, parses it there and consumes 
+ * it.  Body bytes read along stay in the buffer for read_body.  
+ * @return the content length or -1.  
+ */
+static int
+read_header( int sock, cfgst_rbuf *rb )
+{
+    char *hdr;
+    int  hlen, blen;
+    
+    hlen = buf_read_upto( sock, rb, CFGSP_HEADER_SEP );
+    if ( hlen < 0 ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "read_header: invalid header\n"); );
+        return -1;
+    }
+    
+    /* Last separator byte is consumed anyway: turn the header into a string */
+    hdr = rb->buf + rb->start;
+    hdr[ hlen-1 ] = '\0';
+    LOG( cfgs_log(CFGST_LL_INFO, "read_header (%d): \n%s", hlen, hdr); );
+    
+    blen = content_length( hdr );
+    rb->start += hlen;
+    
+    return blen;
+}
+
+
+static cfgs_buf*
+read_body( int sock, cfgst_rbuf *rb, int len )
+{
+    cfgs_buf *body = cfgs_buf_new( NULL, len+1 );
+    
+    if ( !body ) {
+        return NULL;
+    }
+    
+    body->used += cfgst_rbuf_recv( sock, rb, body->buf, len );
+    /*FIXME: make it a macro NULL_BUF */
+    
+    /* NULL terminated, but the terminator is not part of the body */
+    if ( !cfgs_buf_cat_ch(body, '\0') ) {
+        cfgs_buf_free( body );
+        return NULL;
+    }
+    body->used--;
+    
+    LOG( cfgs_log(CFGST_LL_INFO, "read_body:\n%s", body->buf); ); 
+        
+    return body;
+}
+
+
 /* FIXME: should return cfgs_tag* list ? */
 cfgs_buf *
 http_client_recv( int sock, cfgs_err *err )
 {
-    cfgs_buf *hdr  = NULL; 
-    cfgs_buf *body = NULL;
-    int      blen;
+    cfgst_rbuf *rb   = cfgst_rbuf_get( sock );
+    cfgs_buf   *body = NULL;
+    int        blen;
     
-    if ( (hdr = read_header(sock)) == NULL ) {
+    if ( !rb ) {
         return NULL;
     }
 
     /*FIXME: accept/reject by analysing header */
     
-    /* Attempt to do the max we can.  
-       Should reject request as it is probably an attemt to break in ? */ 
-    blen  = content_length( hdr );
+    blen  = read_header( sock, rb );
     if ( blen <= 0 ) {
-        cfgs_buf_free( hdr );
         return NULL;
     }
-    if ( blen > CGFS_MAX_BODY_LEN )
-        blen = CGFS_MAX_BODY_LEN;
-    
+    /* Probably an attempt to break in.  Reading part of the body would 
+       leave the rest to be parsed as the next request: drop it all.  */
+    if ( blen > CGFS_MAX_BODY_LEN ) {
+        LOG( cfgs_log(CFGST_LL_CRITIC, "http_client_recv: body too long %d\n", blen); );
+        rb->start = rb->end = 0;
+        return NULL;
+    }
 
-    if ( (body = read_body(sock, blen)) == NULL ) {
-        cfgs_buf_free( hdr );
+
+    if ( (body = read_body(sock, rb, blen)) == NULL ) {
         return NULL;
     }
 
-    cfgs_buf_free( hdr );
     return body;
 }
 
@@ -386,3 +374,155 @@ http_server_recv( int sock, cfgs_err *err )
 }
 
 
+int
+http_request_len( int sock )
+{
+    cfgst_rbuf *rb = cfgst_rbuf_get( sock );
+    char       *hdr, *p;
+    char       last;
+    int        avail, hlen, blen;
+    
+    if ( !rb ) {
+        return -1;
+    }
+    
+    hdr   = rb->buf + rb->start;
+    avail = rb->end - rb->start;
+    p     = memmem( hdr, avail, CFGSP_HEADER_SEP, strlen(CFGSP_HEADER_SEP) );
+    if ( !p ) {
+        /* too long, http_server_recv truncates it */
+        return ( avail >= CGFS_MAX_HDR_LEN ) ? -1 : 0;
+    }
+    hlen = (p - hdr) + strlen( CFGSP_HEADER_SEP );
+    
+    last = hdr[ hlen-1 ];
+    hdr[ hlen-1 ] = '\0';
+    blen = content_length( hdr );
+    hdr[ hlen-1 ] = last;
+    
+    if ( blen < 0 || blen > CGFS_MAX_BODY_LEN ) {
+        return -1;
+    }
+    return hlen + blen;
+}
+
+
+static char*
+print_upgrade_header( const char *token )
+{
+    const char *fmt = 
+         "OPTIONS / HTTP/1.0\r\n" 
+         "User-Agent: Mozilla (" PACKAGE " " CFGS_VERSION ")\r\n" 
+         "Connection: Upgrade\r\n"
+         "Upgrade: %s\r\n"
+         "Content-Length: 0\r\n"
+         "\r\n"
+         ;
+    char *hdr = XCALLOC( char, strlen(fmt) + strlen(token) );
+
+    if ( !hdr )
+        return NULL;
+
+    sprintf( hdr, fmt, token );
+    
+    return hdr;
+}
+
+
+#define HTTP_SWITCHING  "HTTP/1.0 101 "
+bool
+http_client_upgrade( int sock, const char *token )
+{
+    cfgst_rbuf *rb  = cfgst_rbuf_get( sock );
+    char       *hdr = print_upgrade_header( token );
+    bool       ret  = false;
+    int        hlen;
+    
+    if ( !rb || !hdr ) {
+        xfree( hdr );
+        return false;
+    }
+    
+    if ( cfgst_fullsend(sock, hdr, strlen(hdr), 0) != strlen(hdr) ) {
+        xfree( hdr );
+        return false;
+    }
+    xfree( hdr );
+    
+    /* Old servers shut the connection down on a request without body */
+    hlen = buf_read_upto( sock, rb, CFGSP_HEADER_SEP );
+    if ( hlen < 0 ) {
+        return false;
+    }
+    
+    ret = ( 0 == strncmp(rb->buf + rb->start, HTTP_SWITCHING, strlen(HTTP_SWITCHING)) );
+    rb->start += hlen;
+    
+    LOG( cfgs_log(CFGST_LL_INFO, "http_client_upgrade %s: %d\n", token, ret); ); 
+    return ret;
+}
+
+
+/* Does the NULL terminated header ask for an upgrade to token? */
+static bool
+upgrade_requested( const char *hdr, const char *token )
+{
+    char *b  = stristr( hdr, "Upgrade:" );
+    
+    if ( b ) {
+        b  += strlen( "Upgrade:" );
+        while ( isspace(*b) ) b++;
+        if ( 0 == strncmp(b, token, strlen(token)) )
+            return true;
+    }
+    
+    return false;
+}
+
+
+bool
+http_server_upgrade( int sock, const char *token )
+{
+    const char *fmt = 
+         HTTP_SWITCHING "Switching Protocols\r\n"
+         "Connection: Upgrade\r\n"
+         "Upgrade: %s\r\n"
+         "\r\n"
+         ;
+    cfgst_rbuf *rb  = cfgst_rbuf_get( sock );
+    char       *hdr, *answer;
+    char       last;
+    int        hlen;
+    bool       upgrade;
+    
+    if ( !rb ) {
+        return false;
+    }
+    
+    /* Peek at the first header: leave it to http_server_recv if not ours */
+    hlen = buf_read_upto( sock, rb, CFGSP_HEADER_SEP );
+    if ( hlen < 0 ) {
+        return false;
+    }
+    /* a truncated header does not end with the separator */
+    hdr  = rb->buf + rb->start;
+    last = hdr[ hlen-1 ];
+    hdr[ hlen-1 ] = '\0';
+    upgrade = upgrade_requested( hdr, token );
+    hdr[ hlen-1 ] = last;
+    if ( !upgrade ) {
+        return false;
+    }
+    rb->start += hlen;
+    
+    answer = XCALLOC( char, strlen(fmt) + strlen(token) );
+    if ( !answer ) {
+        return false;
+    }
+    sprintf( answer, fmt, token );
+    upgrade = ( cfgst_fullsend(sock, answer, strlen(answer), 0) == strlen(answer) );
+    xfree( answer );
+    
+    LOG( cfgs_log(CFGST_LL_INFO, "http_server_upgrade %s: %d\n", token, upgrade); ); 
+    return upgrade;
+}
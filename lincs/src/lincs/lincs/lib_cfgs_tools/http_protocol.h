@@ -44,8 +44,26 @@ bool      http_client_send( int sock, char *buf, int len, cfgs_err *err );
 cfgs_buf *http_client_recv( int sock, cfgs_err *err );
 
 bool      http_server_send( int sock, char *buf, int len, cfgs_err *err );
+bool      http_server_frame( cfgs_buf *out, char *buf, int len );
 /** Receive request.  Verification of validity included.  Free returned poiter */ 
 cfgs_buf *http_server_recv( int sock, cfgs_err *err );
+/** 
+ * Length of the message starting the receive buffer of @param sock, header 
+ * included, without reading: 0 until the header is all there, -1 if the 
+ * message is invalid.  
+ */
+int       http_request_len( int sock );
+
+/** 
+ * Ask the server to switch the connection to the protocol named 
+ * @param token (http Upgrade:).  True if it did. 
+ */
+bool      http_client_upgrade( int sock, const char *token );
+/** 
+ * If the next request on the connection asks for an upgrade to @param token,
+ * consume it, agree and return true.  Any other request stays buffered. 
+ */
+bool      http_server_upgrade( int sock, const char *token );
 
 
 #ifdef __cplusplus
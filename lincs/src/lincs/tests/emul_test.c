@@ -0,0 +1,197 @@
+/*
+ *  $Revision: 1.1 $
+ *  $Date: 2004/04/24 18:12:09 $
+ *
+ *  Test lib_cfgs_emul's cache of the regenerated files: run again with
+ *  cfgs_emul.so preloaded, then opens FILENAME
+ *    -twice: regenerated the first time, served from the cache the second,
+ *     the same content
+ *    -after VALNAME, one of the values it is built from, changed: from
+ *     NB_THREADS threads at once, regenerated once for all of them
+ *    -again: served from the cache again
+ *  The content served from the cache is the same file: an open keeps its
+ *  inode, a regeneration makes another.
+ */
+/*
+#
+# This file is part of LinCS/tiger.
+#
+# LinCS/tiger is distributed under the terms of the GNU Lesser General Public
+# License version 2 or any later version.  See the file COPYING.LIB for copying
+# permission or http://www.gnu.org.
+#
+# THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED OR
+# IMPLIED, without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  ANY USE IS AT YOUR OWN RISK.
+#
+# Permission to modify the code and to distribute modified code is granted,
+# provided the above notices are retained, and a notice that the code was
+# modified is included with the above copyright notice.
+#
+ */
+
+
+#include "cfgs/cfgs_config.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "cfgs_client_api.h"
+
+
+#define PROGNAME   "emul_test"
+const char progname[] = PROGNAME;
+
+#define EMUL_LIB   CFGS_MOD_PATH "/cfgs_emul.so"
+#define FILENAME   "/etc/dummy"
+#define VALNAME    "/etc/dummy/" PROGNAME
+#define CONTENT    "Regenerated " FILENAME
+
+#define NB_THREADS (8)
+/* the change reaches the cache within NB_TRIES*TRY_USEC */
+#define NB_TRIES   (50)
+#define TRY_USEC   (100*1000)
+
+
+/* Open FILENAME, check its content.  @return its inode, 0 on error */
+static ino_t
+open_file( int *pfd )
+{
+    char        buf[ 1024 ];
+    struct stat st;
+    ssize_t     len;
+    int         fd = open( FILENAME, O_RDONLY );
+
+    *pfd = fd;
+    if ( fd < 0 || 0 != fstat(fd, &st) )
+        return 0;
+    len = read( fd, buf, sizeof(buf) - 1 );
+    if ( len <= 0 )
+        return 0;
+    buf[ len ] = '\0';
+
+    return strstr( buf, CONTENT ) ? st.st_ino : 0;
+}
+
+
+static bool
+check( const char *what, bool ok )
+{
+    printf( "  %s: %s\n", what, ok ? "ok" : "!!! ERROR !!!" );
+    fflush( stdout );
+    return ok;
+}
+
+
+static bool
+set( cfgs_session *session, const char *value )
+{
+    cfgs_entry *entry = cfgs_entry_new();
+    bool       ok;
+
+    ok =  entry
+       && cfgs_entry_add_attr( entry, CFGS_EA_NAME, VALNAME )
+       && cfgs_entry_add_attr( entry, CFGS_EA_VALUE, value )
+       && 1 == cfgs_setval( session, entry );
+    if ( entry )
+        cfgs_entry_free( entry );
+
+    return ok;
+}
+
+
+static ino_t m_inos[ NB_THREADS ];
+static int   m_fds[ NB_THREADS ];
+
+
+static void *
+run( void *arg )
+{
+    int i = (int)(long)arg;
+
+    m_inos[ i ] = open_file( &m_fds[i] );
+    return NULL;
+}
+
+
+/* The change is streamed to the cache: wait for a regeneration */
+static ino_t
+open_changed( ino_t before )
+{
+    pthread_t threads[ NB_THREADS ];
+    int       i, try;
+
+    for ( try=0; try<NB_TRIES; try++ ) {
+        for ( i=0; i<NB_THREADS; i++ ) {
+            if ( 0 != pthread_create(&threads[i], NULL, run, (void*)(long)i) )
+                return 0;
+        }
+        for ( i=0; i<NB_THREADS; i++ )
+            (void)pthread_join( threads[i], NULL );
+        for ( i=0; i<NB_THREADS; i++ ) {
+            if ( m_fds[i] >= 0 )
+                close( m_fds[i] );
+        }
+
+        if ( m_inos[0] != before )
+            break;
+        usleep( TRY_USEC );
+    }
+
+    for ( i=1; i<NB_THREADS; i++ ) {
+        if ( m_inos[i] != m_inos[0] )
+            return 0;
+    }
+    return m_inos[ 0 ];
+}
+
+
+int
+main( int argc, char **argv, char **envp )
+{
+    cfgs_session *session;
+    ino_t        first, cached, changed, again;
+    int          fd1, fd2, fd3;
+    const char   *preload = getenv( "LD_PRELOAD" );
+    bool         ok;
+
+    /* open is the library's once preloaded */
+    if ( !preload || !strstr(preload, EMUL_LIB) ) {
+        if ( 0 != setenv("LD_PRELOAD", EMUL_LIB, 1) )
+            return EXIT_FAILURE;
+        execv( "/proc/self/exe", argv );
+        perror( "execv" );
+        return EXIT_FAILURE;
+    }
+
+    fprintf( stderr, "%s " VERSION "\n\nEmulation library cache test program:\n", progname );
+    session = cfgs_connect();
+    if ( !session )
+        return EXIT_FAILURE;
+
+    /* not set before: no change of it may still be on its way */
+    first  = open_file( &fd1 );
+    cached = open_file( &fd2 );
+    ok =  check( "regenerated", first != 0 )
+       && check( "served from the cache", cached == first );
+
+    /* fd1 kept open: its inode is not reused */
+    ok =  ok && set( session, "1" )
+       && check( "regenerated once the value changed",
+                 (changed = open_changed(first)) != 0 && changed != first );
+    again = open_file( &fd3 );
+    ok =  ok && check( "served from the cache again", again == changed );
+
+    if ( fd1 >= 0 ) close( fd1 );
+    if ( fd2 >= 0 ) close( fd2 );
+    if ( fd3 >= 0 ) close( fd3 );
+    (void)cfgs_rmval( session, VALNAME, NULL );
+    (void)cfgs_disconnect( session );
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
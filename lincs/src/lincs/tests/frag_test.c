@@ -0,0 +1,238 @@
+/*
+ *  $Revision: 1.1 $
+ *  $Date: 2004/04/22 20:03:51 $
+ *
+ *  Test the daemon's reactor with requests cut in pieces: NB_CLIENTS
+ *  threads, each on its own connection, NB_ROUNDS times:
+ *    -sends NB_PIPELINED http getval requests of its own value at once,
+ *     a few bytes at a time, the pieces running over from one request
+ *     into the next
+ *    -reads back as many answers, each must hold its value
+ *  Meanwhile the other threads do the same: a worker must never block on
+ *  a request not fully received, nor hand a piece to another connection.
+ */
+/*
+#
+# This file is part of LinCS/tiger.
+#
+# LinCS/tiger is distributed under the terms of the GNU Lesser General Public
+# License version 2 or any later version.  See the file COPYING.LIB for copying
+# permission or http://www.gnu.org.
+#
+# THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED OR
+# IMPLIED, without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  ANY USE IS AT YOUR OWN RISK.
+#
+# Permission to modify the code and to distribute modified code is granted,
+# provided the above notices are retained, and a notice that the code was
+# modified is included with the above copyright notice.
+#
+ */
+
+
+#include "cfgs/cfgs_config.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+
+#include "cfgs_client_api.h"
+#include "cfgs_log.h"
+#include "cfgs_sock.h"
+#include "cfgs_dlist.h"
+
+
+#define PROGNAME   "frag_test"
+const char progname[] = PROGNAME;
+
+#define VALNAME_SET  "/tests/"PROGNAME"/"
+
+#define NB_CLIENTS    (32)
+#define NB_ROUNDS     (20)
+#define NB_PIPELINED  (3)
+/* pieces of 1 to MAX_PIECE bytes */
+#define MAX_PIECE     (7)
+
+#define RQ_BODY \
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n" \
+    "<cfgs protocol_version=\"1.0\" xmlns:cfgs=\"/\">\n" \
+    "    <cfgs:function_call function=\"cfgs_getval\" name=\"%s\" layer=\"default\" />\n" \
+    "</cfgs>\n"
+#define RQ_HEADER \
+    "POST / HTTP/1.0\r\n" \
+    "Connection: Keep-Alive\r\n" \
+    "Content-Type: text/xml\r\n" \
+    "Content-Length: %d\r\n" \
+    "\r\n"
+#define RS_HEADER_SEP  "\r\n\r\n"
+#define RS_LENGTH      "Content-Length: "
+
+
+/* Send buf a few bytes at a time, yielding between pieces */
+static bool
+send_pieces( int sock, const char *buf, int len, unsigned *seed )
+{
+    while ( len > 0 ) {
+        int piece = 1 + rand_r( seed ) % MAX_PIECE;
+
+        if ( piece > len )
+            piece = len;
+        if ( cfgst_fullsend(sock, buf, piece, 0) != piece )
+            return false;
+        buf += piece;
+        len -= piece;
+        sched_yield();
+    }
+
+    return true;
+}
+
+
+/* Receive one whole answer into buf, whatever else is behind it kept */
+static int
+recv_answer( int sock, char *buf, int size, int *have )
+{
+    while ( true ) {
+        char *sep = *have ? strstr( buf, RS_HEADER_SEP ) : NULL;
+        char *len = sep ? strstr( buf, RS_LENGTH ) : NULL;
+        int  n;
+
+        if ( len && len < sep ) {
+            n = sep - buf + strlen( RS_HEADER_SEP ) + atoi( len + strlen(RS_LENGTH) );
+            if ( n <= *have )
+                return n;
+        }
+        if ( *have >= size - 1 )
+            return -1;
+        n = cfgst_rrecv( sock, buf + *have, size - 1 - *have, 0 );
+        if ( n <= 0 )
+            return -1;
+        *have += n;
+        buf[ *have ] = '\0';
+    }
+}
+
+
+static void *
+run( void *arg )
+{
+    int      client = (int)(long)arg;
+    unsigned seed = client;
+    char     name[ 256 ], expect[ 256 ], body[ 1024 ], rq[ 2048 ];
+    char     *rqs, buf[ 8192 ];
+    int      rqlen, sock, round, i, have = 0;
+    bool     ok = true;
+
+    snprintf( name, sizeof(name), VALNAME_SET "%d", client );
+    snprintf( expect, sizeof(expect), "value=\"%d\"", client );
+    snprintf( body, sizeof(body), RQ_BODY, name );
+    rqlen = snprintf( rq, sizeof(rq), RQ_HEADER "%s", (int)strlen(body), body );
+    rqs   = malloc( NB_PIPELINED * rqlen );
+    if ( !rqs )
+        return (void*)0;
+    for ( i=0; i<NB_PIPELINED; i++ )
+        memcpy( rqs + i*rqlen, rq, rqlen );
+
+    sock = cfgst_connect( CSST_UNIX, CFGS_CONFIGD_PATH, CFGS_CONFIGD_PORT );
+    if ( sock < 0 ) {
+        free( rqs );
+        return (void*)0;
+    }
+    /* blocking: the answers are waited for */
+    (void)fcntl( sock, F_SETFL, fcntl(sock, F_GETFL) & ~O_NONBLOCK );
+
+    for ( round=0; ok && round<NB_ROUNDS; round++ ) {
+        ok = send_pieces( sock, rqs, NB_PIPELINED * rqlen, &seed );
+        for ( i=0; ok && i<NB_PIPELINED; i++ ) {
+            int n = recv_answer( sock, buf, sizeof(buf), &have );
+
+            ok = n > 0;
+            if ( ok ) {
+                char c = buf[ n ];
+
+                buf[ n ] = '\0';
+                ok = NULL != strstr( buf, expect );
+                buf[ n ] = c;
+                memmove( buf, buf + n, have - n + 1 );
+                have -= n;
+            }
+        }
+        if ( !ok ) {
+            printf( "  client %d, round %d, answer %d: !!! ERROR !!!\n", client, round, i );
+            fflush( stdout );
+        }
+    }
+
+    (void)cfgst_disconnect( sock );
+    close( sock );
+    free( rqs );
+    return (void*)(long)ok;
+}
+
+
+static bool
+set( cfgs_session *session, const char *name, const char *value )
+{
+    cfgs_entry *entry = cfgs_entry_new();
+    bool       ok;
+
+    ok =  entry
+       && cfgs_entry_add_attr( entry, CFGS_EA_NAME, name )
+       && cfgs_entry_add_attr( entry, CFGS_EA_VALUE, value )
+       && 1 == cfgs_setval( session, entry );
+    if ( entry )
+        cfgs_entry_free( entry );
+
+    return ok;
+}
+
+
+int
+main( int argc, char **argv, char **envp )
+{
+    pthread_t    threads[ NB_CLIENTS ];
+    cfgs_session *session;
+    void         *ret;
+    char         name[ 256 ], value[ 16 ];
+    int          i, nb_ok = 0;
+
+    fprintf( stderr, "%s " VERSION "\n\nFragmented requests test program:\n", progname );
+    session = cfgs_connect();
+    if ( !session )
+        return EXIT_FAILURE;
+    for ( i=0; i<NB_CLIENTS; i++ ) {
+        snprintf( name, sizeof(name), VALNAME_SET "%d", i );
+        snprintf( value, sizeof(value), "%d", i );
+        if ( !set(session, name, value) ) {
+            (void)cfgs_disconnect( session );
+            return EXIT_FAILURE;
+        }
+    }
+
+    printf( "  %d clients, %d rounds of %d requests, %d bytes pieces at most\n",
+            NB_CLIENTS, NB_ROUNDS, NB_PIPELINED, MAX_PIECE );
+    fflush( stdout );
+    for ( i=0; i<NB_CLIENTS; i++ ) {
+        if ( 0 != pthread_create(&threads[i], NULL, run, (void*)(long)i) )
+            return EXIT_FAILURE;
+    }
+    for ( i=0; i<NB_CLIENTS; i++ ) {
+        if ( 0 == pthread_join(threads[i], &ret) && ret )
+            nb_ok++;
+    }
+    printf( "  %d/%d clients answered right: %s\n", nb_ok, NB_CLIENTS,
+            nb_ok == NB_CLIENTS ? "ok" : "!!! ERROR !!!" );
+
+    for ( i=0; i<NB_CLIENTS; i++ ) {
+        snprintf( name, sizeof(name), VALNAME_SET "%d", i );
+        (void)cfgs_rmval( session, name, NULL );
+    }
+    (void)cfgs_disconnect( session );
+
+    return nb_ok == NB_CLIENTS ? EXIT_SUCCESS : EXIT_FAILURE;
+}
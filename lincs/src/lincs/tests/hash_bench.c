@@ -0,0 +1,189 @@
+/*
+ *  $Revision: 1.1 $
+ *  $Date: 2004/03/17 19:24:51 $
+ *
+ *  Micro-benchmark for cfgs_hash:
+ *    -insert, find, miss and delete on one big table
+ *    -many small tables used as tag attribute lists
+ *  Exits with failure if a lookup returns the wrong element.
+ */
+/*
+#
+# Copyright (c) 2003 Aurelian Melinte.
+# This file is part of LinCS/tiger.
+#
+# LinCS/tiger is distributed under the terms of the GNU Lesser General Public
+# License version 2 or any later version.  See the file COPYING.LIB for copying
+# permission or http://www.gnu.org.
+#
+# THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED OR
+# IMPLIED, without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  ANY USE IS AT YOUR OWN RISK.
+#
+# Permission to modify the code and to distribute modified code is granted,
+# provided the above notices are retained, and a notice that the code was
+# modified is included with the above copyright notice.
+#
+ */
+
+
+#include "cfgs/cfgs_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "cfgs_hash.h"
+#include "cfgs_str.h"
+#include "cfgs_tags.h"
+
+
+#define PROGNAME   "hash_bench"
+const char progname[] = PROGNAME;
+
+#define DEFAULT_COUNT  (100000)
+
+static const char *g_attrs[] = {
+    CFGS_EA_NAME, "type", "layer", "value", "hook", "a rather long attribute name"
+};
+#define NATTRS  ( sizeof(g_attrs)/sizeof(g_attrs[0]) )
+
+
+static double
+now( void )
+{
+    struct timeval tv;
+
+    gettimeofday( &tv, NULL );
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+static void
+report( const char *what, int ops, double start )
+{
+    double secs = now() - start;
+
+    printf( "%-24s %9d ops %8.3f s %10.0f ops/s\n",
+            what, ops, secs, secs > 0 ? ops / secs : 0.0 );
+}
+
+
+static int
+bench_table( int count )
+{
+    char      **keys = calloc( count, sizeof(char*) );
+    cfgs_hash *h;
+    char      buf[64];
+    double    start;
+    int       i, errs = 0;
+
+    if ( !keys )
+        return -1;
+    for ( i=0; i<count; i++ ) {
+        snprintf( buf, sizeof(buf), "/tests/hash_bench/%d/value", i );
+        keys[i] = strdup( buf );
+        if ( !keys[i] )
+            return -1;
+    }
+
+    /* start small: resizing is part of the measure */
+    h = cfgs_hash_new( 0 );
+    if ( !h )
+        return -1;
+
+    start = now();
+    for ( i=0; i<count; i++ ) {
+        if ( cfgs_hash_insert(h, keys[i], keys[i], 0) == CFGST_HASH_INVALID_IDX )
+            errs++;
+    }
+    report( "insert", count, start );
+
+    start = now();
+    for ( i=0; i<count; i++ ) {
+        if ( cfgs_hash_find(h, keys[i]) != keys[i] )
+            errs++;
+    }
+    report( "find", count, start );
+
+    start = now();
+    for ( i=0; i<count; i++ ) {
+        snprintf( buf, sizeof(buf), "/tests/hash_bench/%d/missing", i );
+        if ( cfgs_hash_find(h, buf) )
+            errs++;
+    }
+    report( "miss (incl. snprintf)", count, start );
+
+    start = now();
+    for ( i=0; i<count; i+=2 ) {
+        cfgs_hash_delete( h, keys[i], NULL, NULL );
+    }
+    report( "delete half", count/2, start );
+
+    for ( i=0; i<count; i++ ) {
+        if ( cfgs_hash_find(h, keys[i]) != ((i & 1) ? keys[i] : NULL) )
+            errs++;
+    }
+
+    cfgs_hash_free( h, NULL );
+    for ( i=0; i<count; i++ )
+        free( keys[i] );
+    free( keys );
+
+    return errs;
+}
+
+
+/* What each request does with the attributes of its tags */
+static int
+bench_attrs( int count )
+{
+    double start;
+    int    i, j, errs = 0;
+
+    start = now();
+    for ( i=0; i<count; i++ ) {
+        cfgs_tag *t = cfgs_tag_new( CFGS_TAG_ENTRY );
+
+        if ( !t )
+            return -1;
+        for ( j=0; j<NATTRS; j++ )
+            cfgs_tag_add_attr( t, g_attrs[j], g_attrs[j] );
+        for ( j=0; j<NATTRS; j++ ) {
+            char *v = cfgs_tag_attr( t, g_attrs[j] );
+            if ( !v || strcmp(v, g_attrs[j]) )
+                errs++;
+        }
+        if ( cfgs_tag_attr(t, "missing") )
+            errs++;
+        cfgs_tag_free( t );
+    }
+    report( "tag new/attrs/free", count, start );
+
+    return errs;
+}
+
+
+int
+main( int argc, char **argv )
+{
+    int count = DEFAULT_COUNT;
+    int errs;
+
+    if ( argc > 1 )
+        count = atoi( argv[1] );
+    if ( count <= 0 ) {
+        fprintf( stderr, "Usage: %s [count]\n", progname );
+        return EXIT_FAILURE;
+    }
+
+    errs  = bench_table( count );
+    errs += bench_attrs( count );
+    if ( errs ) {
+        fprintf( stderr, "%s: %d errors\n", progname, errs );
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
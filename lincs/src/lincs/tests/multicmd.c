@@ -44,6 +44,9 @@
 #define PROGNAME   "multicmd"
 const char progname[] = PROGNAME;
 
+/* asked for along with the entries, never set */
+#define NOT_SET_NAME  "/tests/" PROGNAME "/not_set"
+
 
 
 /*
@@ -169,6 +172,73 @@ print_cfgs_err( void )
     }
 }
 
+static cfgs_entry *
+find_entry( cfgs_entry *list, const char *name )
+{
+    for ( ; list; list=list->next ) {
+        const char *n = cfgs_entry_attr( list, CFGS_EA_NAME );
+        if ( n && 0 == strcmp(n, name) )
+            break;
+    }
+    
+    return list;
+}
+
+
+/* cfgs_getvals on the names of entries, NOT_SET_NAME after each one.  The 
+   answer has no slot for it: entries are matched by name.  Returns number 
+   of entries got, -1 if one is not asked for. */
+static int
+get_entries( cfgs_entry *entries, int len )
+{
+    const char **names = calloc( 2*len, sizeof(char*) );
+    cfgs_entry *val, *got;
+    int        n = 0;
+    
+    if ( !names ) 
+        return -1;
+    
+    for ( val=entries; val && n<2*len; val=val->next ) {
+        names[ n++ ] = cfgs_entry_attr( val, CFGS_EA_NAME );
+        names[ n++ ] = NOT_SET_NAME;
+    }
+    
+    got = cfgs_getvals( g_session, names, n, NULL );
+    for ( n=0, val=entries; val; val=val->next ) {
+        if ( find_entry(got, cfgs_entry_attr(val, CFGS_EA_NAME)) )
+            n++;
+    }
+    if (  find_entry(got, NOT_SET_NAME) 
+       || n != cfgs_dlist_length((cfgs_dlist*)got) )
+        n = -1;
+    
+    CFGST_DLIST_FREE( got, cfgs_entry_free );
+    free( names );
+    return n;
+}
+
+
+/* Pipelined cfgs_getval on the names of entries.  Returns number of entries got. */
+static int
+collect_entries( cfgs_entry *entries, int len )
+{
+    cfgs_entry *val, *got;
+    int        n = 0, sent = 0;
+    
+    for ( val=entries; val && sent<len; val=val->next, ++sent ) {
+        if ( cfgs_submit_getval(g_session, cfgs_entry_attr(val, CFGS_EA_NAME), NULL) < 0 )
+            break;
+    }
+    
+    while ( cfgs_collect(g_session, &got, NULL) > 0 ) {
+        n += got ? 1 : 0;
+        CFGST_DLIST_FREE( got, cfgs_entry_free );
+    }
+    
+    return sent == len ? n : -1;
+}
+
+
 int
 main( int argc, char **argv, char **envp )
 {
@@ -217,6 +287,28 @@ main( int argc, char **argv, char **envp )
     }
     printf( "OK \n" );
     
+    /* Read them back with one batched request */
+    printf( "Getting a batch of %d entries... ", len );
+    ret = get_entries( g_entries, len );
+    if ( ret != len ) {
+        fprintf( stderr, "Error: len=%d != ret=%d \n\n", len, ret );
+        print_cfgs_err();
+        (void)cfgs_disconnect( g_session );
+        exit_err( EXIT_FAILURE );
+    }
+    printf( "OK \n" );
+    
+    /* Again, pipelined: all requests first, then all answers */
+    printf( "Pipelining %d gets... ", len );
+    ret = collect_entries( g_entries, len );
+    if ( ret != len ) {
+        fprintf( stderr, "Error: len=%d != ret=%d \n\n", len, ret );
+        print_cfgs_err();
+        (void)cfgs_disconnect( g_session );
+        exit_err( EXIT_FAILURE );
+    }
+    printf( "OK \n" );
+    
     print_cfgs_err();
     (void)cfgs_disconnect( g_session );
     /*
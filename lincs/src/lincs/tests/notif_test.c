@@ -9,6 +9,9 @@
  *    -set value /tests/notif_test
  *    -at this point notification should arrive: return 0
  *    -await SIGUSR1 for 10 seconds and exit with -1 if not signaled 
+ *    -deregister, set the value again: no signal should arrive 
+ *    -a subscriber not reading its changes must not hold the setters back, 
+ *     and gets CFGS_CHANGES_LOST then the changes that follow 
  */
 /*
 # 
@@ -37,10 +40,13 @@
 #include <string.h>
 #include <signal.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/wait.h>
 
 #include "cfgs_client_api.h"
 #include "cfgs_log.h"
 #include "cfgs_tags.h"
+#include "cfgs_dlist.h"
 
 
 #define PROGNAME   "notif_test"
@@ -48,6 +54,11 @@ const char progname[] = PROGNAME;
 
 #define VALNAME_REG  "*"
 #define VALNAME_SET  "/tests/"PROGNAME
+#define VALNAME_SLOW VALNAME_SET"/slow/"
+
+/* changes of SLOW_NB * SLOW_LEN bytes: well over CGFS_NOTIF_BACKLOG */
+#define SLOW_NB      (64)
+#define SLOW_LEN     (60000)
 
 bool g_sigusr1_delivered = false;
 
@@ -107,8 +118,9 @@ set_sigusr1_handler( void )
 }
 
 
+/* Register, or deregister if !reg, for SIGUSR1 on VALNAME_REG changes */
 static int
-register_notif( void )
+register_notif( bool reg )
 {
     const cfgs_err *err;
     int            ret;
@@ -125,9 +137,10 @@ register_notif( void )
         exit_err( EXIT_FAILURE );
     }
 
-    printf( "  Registering for '" VALNAME_REG "'... " );
+    printf( "  %s for '" VALNAME_REG "'... ", reg ? "Registering" : "Deregistering" );
 
-    ret = cfgs_register_notif( session, &notif );
+    ret = reg ? cfgs_register_notif( session, &notif ) 
+              : cfgs_unregister_notif( session, &notif );
     if ( ret > 0 ) {
         printf( "ok\n" );
     } else {
@@ -144,7 +157,7 @@ register_notif( void )
 }
 
 static int
-set_value( void )
+set_value( const char *value )
 {
     const cfgs_err *err;
     int            ret;
@@ -154,7 +167,7 @@ set_value( void )
 
     if ( !cfgs_entry_add_attr(&entry, CFGS_EA_NAME, VALNAME_SET) )
         exit_err( EXIT_FAILURE );
-    if ( !cfgs_entry_add_attr(&entry, CFGS_EA_VALUE, VALNAME_SET) )
+    if ( !cfgs_entry_add_attr(&entry, CFGS_EA_VALUE, value) )
         exit_err( EXIT_FAILURE );
     entry.entry_type = CFGS_ET_VALUE; 
     
@@ -178,6 +191,242 @@ set_value( void )
     return ret;
 }
 
+/* A cached value must follow the changes made by other clients */
+static bool
+check_cache( void )
+{
+    cfgs_entry     *v;
+    cfgs_session   *session = NULL;
+    bool           ok;
+    pid_t          pid;
+    int            status;
+    
+    session = cfgs_connect();
+    if ( !session ) {
+        exit_err( EXIT_FAILURE );
+    }
+    
+    printf( "  Caching " VALNAME_SET "... " );
+    if ( !cfgs_set_cache(session, true) ) {
+        printf( "!!! ERROR !!!\n" );
+        cfgs_perror( cfgs_geterror(session), PROGNAME " - check_cache", stderr );
+        (void)cfgs_disconnect( session );
+        return false;
+    }
+    v = cfgs_getval( session, VALNAME_SET, NULL );
+    printf( "%s\n", v ? "ok" : "!!! ERROR !!!" );
+    CFGST_DLIST_FREE( v, cfgs_entry_free );
+    
+    /* The connection is per process: change it from another one */
+    fflush( stdout );
+    pid = fork();
+    if ( pid == 0 ) {
+        _exit( 1 == set_value(VALNAME_SET "/changed") ? EXIT_SUCCESS : EXIT_FAILURE );
+    }
+    if ( pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) 
+       || WEXITSTATUS(status) != EXIT_SUCCESS ) {
+        (void)cfgs_disconnect( session );
+        return false;
+    }
+    sleep( 1 ); /* for the daemon to push the change */
+    
+    v  = cfgs_getval( session, VALNAME_SET, NULL );
+    ok = v && 0 == strcmp( cfgs_entry_attr(v, CFGS_EA_VALUE), VALNAME_SET "/changed" );
+    printf( "  Cached " VALNAME_SET " follows the change: %s\n", 
+            ok ? "ok" : "!!! ERROR !!!" );
+    CFGST_DLIST_FREE( v, cfgs_entry_free );
+    
+    (void)cfgs_disconnect( session );
+    return ok;
+}
+
+
+static void
+on_change( const char *valname, const char *layer, const char *value, void *arg )
+{
+    if ( 0 == strcmp(valname, VALNAME_SET) && value ) {
+        (void)strncpy( (char*)arg, value, 255 );
+    }
+}
+
+/* A subscriber gets the changes themselves */
+static bool
+check_subscription( void )
+{
+    cfgs_session      *session = NULL;
+    cfgs_subscription *sub;
+    char              value[ 256 ] = "";
+    int               i, status, fd;
+    pid_t             pid;
+    bool              ok, closed;
+    
+    session = cfgs_connect();
+    if ( !session ) {
+        exit_err( EXIT_FAILURE );
+    }
+    
+    printf( "  Subscribing to " VALNAME_SET "... " );
+    sub = cfgs_subscribe( session, VALNAME_SET );
+    printf( "%s\n", sub ? "ok" : "!!! ERROR !!!" );
+    if ( !sub ) {
+        cfgs_perror( cfgs_geterror(session), PROGNAME " - check_subscription", stderr );
+        (void)cfgs_disconnect( session );
+        return false;
+    }
+    
+    /* The connection is per process: change it from another one */
+    fflush( stdout );
+    pid = fork();
+    if ( pid == 0 ) {
+        _exit( 1 == set_value(VALNAME_SET "/streamed") ? EXIT_SUCCESS : EXIT_FAILURE );
+    }
+    if ( pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) 
+       || WEXITSTATUS(status) != EXIT_SUCCESS ) {
+        cfgs_unsubscribe( sub );
+        (void)cfgs_disconnect( session );
+        return false;
+    }
+    for ( i=0; i<10 && !value[0]; i++ ) {
+        if ( cfgs_read_changes(sub, on_change, value, 1000000) < 0 ) 
+            break;
+    }
+    ok = 0 == strcmp( value, VALNAME_SET "/streamed" );
+    printf( "  Subscriber got the new value: %s\n", ok ? "ok" : "!!! ERROR !!!" );
+    
+    fd = cfgs_subscription_fd( sub );
+    cfgs_unsubscribe( sub );
+    (void)cfgs_disconnect( session );
+    closed = fcntl( fd, F_GETFD ) < 0;
+    printf( "  Unsubscribing closes the connection: %s\n", closed ? "ok" : "!!! ERROR !!!" );
+    return ok && closed;
+}
+
+
+typedef struct _slow_seen {
+    int  nb;
+    bool lost;
+    bool last;   /* the change after CFGS_CHANGES_LOST */
+} slow_seen;
+
+static void
+on_slow_change( const char *valname, const char *layer, const char *value, void *arg )
+{
+    slow_seen *seen = (slow_seen*)arg;
+    
+    seen->nb++;
+    if ( 0 == strcmp(valname, CFGS_CHANGES_LOST) ) 
+        seen->lost = true;
+    else if ( seen->lost && 0 == strcmp(valname, VALNAME_SLOW "last") ) 
+        seen->last = true;
+}
+
+
+/* In a child: set VALNAME_SLOW<i> for i in [from, to), or remove them */
+static void
+set_slow( int from, int to, bool rm )
+{
+    cfgs_session *session;
+    cfgs_entry   *entry;
+    char         name[ 256 ];
+    char         *value;
+    int          i;
+    
+    /* a daemon blocked by the subscriber would block us too */
+    alarm( 30 );
+    value = malloc( SLOW_LEN + 1 );
+    session = cfgs_connect();
+    if ( !value || !session ) 
+        _exit( EXIT_FAILURE );
+    memset( value, 'x', SLOW_LEN );
+    value[ SLOW_LEN ] = '\0';
+    
+    for ( i=from; i<to; i++ ) {
+        if ( i < SLOW_NB ) 
+            snprintf( name, sizeof(name), VALNAME_SLOW "%d", i );
+        else
+            snprintf( name, sizeof(name), VALNAME_SLOW "last" );
+        if ( rm ) {
+            (void)cfgs_rmval( session, name, NULL );
+            continue;
+        }
+        entry = cfgs_entry_new();
+        if (  !entry
+           || !cfgs_entry_add_attr(entry, CFGS_EA_NAME, name)
+           || !cfgs_entry_add_attr(entry, CFGS_EA_VALUE, value) ) 
+            _exit( EXIT_FAILURE );
+        entry->entry_type = CFGS_ET_VALUE; 
+        if ( 1 != cfgs_setval(session, entry) ) 
+            _exit( EXIT_FAILURE );
+        cfgs_entry_free( entry );
+    }
+    
+    (void)cfgs_disconnect( session );
+    _exit( EXIT_SUCCESS );
+}
+
+
+static bool
+run_slow( int from, int to, bool rm )
+{
+    int   status;
+    pid_t pid;
+    
+    fflush( stdout );
+    pid = fork();
+    if ( pid == 0 ) 
+        set_slow( from, to, rm );
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) 
+        && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+
+/* A subscriber too slow loses changes, but neither blocks nor is left unaware */
+static bool
+check_slow_subscription( void )
+{
+    cfgs_session      *session = NULL;
+    cfgs_subscription *sub;
+    slow_seen         seen = {0};
+    bool              ok;
+    
+    session = cfgs_connect();
+    if ( !session ) {
+        exit_err( EXIT_FAILURE );
+    }
+    
+    printf( "  Subscribing to " VALNAME_SLOW "*... " );
+    sub = cfgs_subscribe( session, VALNAME_SLOW "*" );
+    printf( "%s\n", sub ? "ok" : "!!! ERROR !!!" );
+    if ( !sub ) {
+        cfgs_perror( cfgs_geterror(session), PROGNAME " - check_slow_subscription", stderr );
+        (void)cfgs_disconnect( session );
+        return false;
+    }
+    
+    /* not read meanwhile */
+    ok = run_slow( 0, SLOW_NB, false );
+    printf( "  Setting %d values of %d bytes, not read: %s\n", SLOW_NB, SLOW_LEN, 
+            ok ? "ok" : "!!! ERROR !!!" );
+    
+    /* catch up, then one more change */
+    while ( ok && cfgs_read_changes(sub, on_slow_change, &seen, 1000000) > 0 ) 
+        ;
+    ok = ok && seen.lost && seen.nb < SLOW_NB + 1;
+    printf( "  Subscriber got %d changes and " CFGS_CHANGES_LOST ": %s\n", 
+            seen.nb - 1, ok ? "ok" : "!!! ERROR !!!" );
+    ok = ok && run_slow( SLOW_NB, SLOW_NB + 1, false );
+    while ( ok && !seen.last && cfgs_read_changes(sub, on_slow_change, &seen, 1000000) > 0 ) 
+        ;
+    ok = ok && seen.last;
+    printf( "  Subscriber got the change that followed: %s\n", ok ? "ok" : "!!! ERROR !!!" );
+    
+    cfgs_unsubscribe( sub );
+    (void)cfgs_disconnect( session );
+    (void)run_slow( 0, SLOW_NB + 1, true );
+    return ok;
+}
+
+
 int
 main( int argc, char **argv, char **envp )
 {
@@ -187,11 +436,11 @@ main( int argc, char **argv, char **envp )
         return EXIT_FAILURE;
     }
     
-    if ( 1 != register_notif() ) {
+    if ( 1 != register_notif(true) ) {
         return EXIT_FAILURE;
     }
 
-    if ( 1 != set_value() ) {
+    if ( 1 != set_value(VALNAME_SET) ) {
         return EXIT_FAILURE;
     }
     
@@ -204,7 +453,7 @@ main( int argc, char **argv, char **envp )
 
     g_sigusr1_delivered = false;
     printf( "  Calling set_value() a second time... \n" );
-    if ( 1 != set_value() ) {
+    if ( 1 != set_value(VALNAME_SET) ) {
         return EXIT_FAILURE;
     }
     
@@ -216,7 +465,29 @@ main( int argc, char **argv, char **envp )
     }
     
     g_sigusr1_delivered = false;
-    //FIXME: unregister notif & set_value; flag should be false
+    if ( 1 != register_notif(false) ) {
+        return EXIT_FAILURE;
+    }
+    printf( "  Calling set_value() after deregistering... \n" );
+    if ( 1 != set_value(VALNAME_SET) ) {
+        return EXIT_FAILURE;
+    }
+    sleep( 1 ); /* for a notification to show up, if any */
+    if ( g_sigusr1_delivered ) {
+        return EXIT_FAILURE;
+    }
+    
+    if ( !check_cache() ) {
+        return EXIT_FAILURE;
+    }
+    
+    if ( !check_subscription() ) {
+        return EXIT_FAILURE;
+    }
+    
+    if ( !check_slow_subscription() ) {
+        return EXIT_FAILURE;
+    }
     
     return EXIT_SUCCESS;
 }
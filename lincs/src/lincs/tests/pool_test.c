@@ -0,0 +1,182 @@
+/*
+ *  $Revision: 1.1 $
+ *  $Date: 2004/04/20 19:41:12 $
+ *
+ *  Test the client connection pool, POOL_SIZE connections kept, with
+ *  NB_THREADS threads each connecting and disconnecting NB_ROUNDS times:
+ *    -each thread sets and reads back values of its own: an answer to
+ *     another thread's request must never come back
+ *    -every other round, a request is submitted and its answer not
+ *     collected before the disconnect: that connection must not go back
+ *     to the pool
+ *    -once all threads are done, no more than POOL_SIZE connections are
+ *     left open
+ */
+/*
+#
+# This file is part of LinCS/tiger.
+#
+# LinCS/tiger is distributed under the terms of the GNU Lesser General Public
+# License version 2 or any later version.  See the file COPYING.LIB for copying
+# permission or http://www.gnu.org.
+#
+# THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED OR
+# IMPLIED, without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  ANY USE IS AT YOUR OWN RISK.
+#
+# Permission to modify the code and to distribute modified code is granted,
+# provided the above notices are retained, and a notice that the code was
+# modified is included with the above copyright notice.
+#
+ */
+
+
+#include "cfgs/cfgs_config.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "cfgs_client_api.h"
+#include "cfgs_log.h"
+#include "cfgs_dlist.h"
+
+
+#define PROGNAME   "pool_test"
+const char progname[] = PROGNAME;
+
+#define VALNAME_SET  "/tests/"PROGNAME"/"
+
+#define POOL_SIZE    "2"
+#define NB_THREADS   (8)
+#define NB_ROUNDS    (100)
+
+
+/* Open descriptors of the process */
+static int
+nb_fds( void )
+{
+    DIR           *d = opendir( "/proc/self/fd" );
+    struct dirent *de;
+    int           n = 0;
+
+    if ( !d )
+        return -1;
+    while ( (de = readdir(d)) ) {
+        if ( de->d_name[0] != '.' )
+            n++;
+    }
+    closedir( d );
+
+    /* opendir's own */
+    return n - 1;
+}
+
+
+static bool
+set( cfgs_session *session, const char *name, const char *value )
+{
+    cfgs_entry *entry = cfgs_entry_new();
+    bool       ok;
+
+    ok =  entry
+       && cfgs_entry_add_attr( entry, CFGS_EA_NAME, name )
+       && cfgs_entry_add_attr( entry, CFGS_EA_VALUE, value )
+       && 1 == cfgs_setval( session, entry );
+    if ( entry )
+        cfgs_entry_free( entry );
+
+    return ok;
+}
+
+
+static bool
+check( cfgs_session *session, const char *name, const char *value )
+{
+    cfgs_entry *v = cfgs_getval( session, name, NULL );
+    const char *got = v ? cfgs_entry_attr( v, CFGS_EA_VALUE ) : NULL;
+    bool       ok = got && 0 == strcmp( got, value );
+
+    if ( !ok ) {
+        printf( "  [%s] is '%s', not '%s': !!! ERROR !!!\n", name,
+                got ? got : "(none)", value );
+        fflush( stdout );
+    }
+    CFGST_DLIST_FREE( v, cfgs_entry_free );
+
+    return ok;
+}
+
+
+static void *
+run( void *arg )
+{
+    int  thread = (int)(long)arg;
+    char name[ 256 ], value[ 256 ];
+    int  round;
+
+    snprintf( name, sizeof(name), VALNAME_SET "%d", thread );
+    for ( round=0; round<NB_ROUNDS; round++ ) {
+        cfgs_session *session = cfgs_connect();
+        bool         ok;
+
+        if ( !session )
+            return (void*)0;
+        snprintf( value, sizeof(value), "%d/%d", thread, round );
+        ok =  set( session, name, value ) && check( session, name, value )
+           && ( round % 2 == 0 || 0 < cfgs_submit_getval(session, name, NULL) );
+        (void)cfgs_disconnect( session );
+        if ( !ok )
+            return (void*)0;
+    }
+
+    return (void*)1;
+}
+
+
+int
+main( int argc, char **argv, char **envp )
+{
+    pthread_t    threads[ NB_THREADS ];
+    cfgs_session *session;
+    void         *ret;
+    char         name[ 256 ];
+    int          i, fds, left;
+    bool         ok = true;
+
+    fprintf( stderr, "%s " VERSION "\n\nConnection pool test program:\n", progname );
+    if ( 0 != setenv(CFGS_ENV_CLIENT_POOL, POOL_SIZE, 1) )
+        return EXIT_FAILURE;
+    fds = nb_fds();
+
+    printf( "  %d threads, %d rounds\n", NB_THREADS, NB_ROUNDS );
+    fflush( stdout );
+    for ( i=0; i<NB_THREADS; i++ ) {
+        if ( 0 != pthread_create(&threads[i], NULL, run, (void*)(long)i) )
+            return EXIT_FAILURE;
+    }
+    for ( i=0; i<NB_THREADS; i++ ) {
+        if ( 0 != pthread_join(threads[i], &ret) || !ret )
+            ok = false;
+    }
+    printf( "  answers: %s\n", ok ? "ok" : "!!! ERROR !!!" );
+
+    left = nb_fds() - fds;
+    printf( "  %d connections left open: %s\n", left,
+            left <= atoi(POOL_SIZE) ? "ok" : "!!! ERROR !!!" );
+    ok = ok && left <= atoi( POOL_SIZE );
+
+    session = cfgs_connect();
+    if ( !session )
+        return EXIT_FAILURE;
+    for ( i=0; i<NB_THREADS; i++ ) {
+        snprintf( name, sizeof(name), VALNAME_SET "%d", i );
+        (void)cfgs_rmval( session, name, NULL );
+    }
+    (void)cfgs_disconnect( session );
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,307 @@
+/*
+ *  $Revision: 1.1 $
+ *  $Date: 2004/04/14 20:12:05 $
+ *
+ *  Test cfgs_snap_bk's layers, snap.c linked in, on layer LAYER:
+ *    -a child sets a value and dies, the delta file not merged
+ *    -a record cut short is appended to the delta file, as a crash would
+ *     leave it
+ *    -a second child must read the value and sets another one: nothing
+ *     must be lost after the torn tail
+ *    -the layer loaded, a child changes it: the change must be seen
+ *    -sets, removes, patterns and listings, before and after a merge
+ *    -CGFS_SNAP_DELTA_MAX changes logged: the merger must merge them
+ *    -a snapshot without a free bucket: a miss must not loop
+ */
+/*
+#
+# This file is part of LinCS/tiger.
+#
+# LinCS/tiger is distributed under the terms of the GNU Lesser General Public
+# License version 2 or any later version.  See the file COPYING.LIB for copying
+# permission or http://www.gnu.org.
+#
+# THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED OR
+# IMPLIED, without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  ANY USE IS AT YOUR OWN RISK.
+#
+# Permission to modify the code and to distribute modified code is granted,
+# provided the above notices are retained, and a notice that the code was
+# modified is included with the above copyright notice.
+#
+ */
+
+
+#include "cfgs/cfgs_config.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "cfgs_client_api.h"
+#include "cfgs_log.h"
+#include "cfgs_dlist.h"
+#include "snap.h"
+
+
+#define PROGNAME   "snap_test"
+const char progname[] = PROGNAME;
+
+#define LAYER      "tests_" PROGNAME
+#define LAYER_DIR  CFGS_VALUES_ROOT_DIR "/" LAYER
+#define DELTA_PATH LAYER_DIR "/cfgs_snap_bk/values/" DELTA_FILE
+#define SNAP_PATH  LAYER_DIR "/cfgs_snap_bk/values/" SNAP_FILE
+
+/* the merger is given CGFS_SNAP_MERGE_SECS more */
+#define MERGE_WAIT (10)
+
+
+static bool
+set( snap_layer *sl, const char *name, const char *value )
+{
+    cfgs_entry entry = {0};
+    bool       ok;
+
+    ok =  cfgs_entry_add_attr( &entry, CFGS_EA_NAME, name )
+       && cfgs_entry_add_attr( &entry, CFGS_EA_VALUE, value )
+       && 1 == snap_log( sl, name, &entry );
+    CFGST_DLIST_FREE( entry.attr, cfgs_pair_free );
+
+    return ok;
+}
+
+
+/* Is name value?  Not there if value is NULL */
+static bool
+check( snap_layer *sl, const char *name, const char *value )
+{
+    cfgs_entry *v = snap_get( sl, name );
+    bool       ok;
+
+    ok = value ? v && 0 == strcmp( cfgs_entry_attr(v, CFGS_EA_VALUE), value )
+               : !v;
+    printf( "  [%ld] %s is '%s': %s\n", (long)getpid(), name,
+            value ? value : "(none)", ok ? "ok" : "!!! ERROR !!!" );
+    fflush( stdout );
+    CFGST_DLIST_FREE( v, cfgs_entry_free );
+
+    return ok;
+}
+
+
+static bool
+wait_child( pid_t pid )
+{
+    int status;
+
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status)
+        && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+
+/* What a crash in the middle of a write leaves: a length, part of the rest */
+static bool
+tear_delta( void )
+{
+    uint32_t len = 1000;
+    int      f;
+    bool     ok;
+
+    f = open( DELTA_PATH, O_WRONLY|O_APPEND );
+    if ( f < 0 ) {
+        printf( "  " DELTA_PATH " not found: !!! ERROR !!!\n" );
+        return false;
+    }
+    ok =  write( f, &len, sizeof(len) ) == sizeof(len)
+       && write( f, "/torn", 5 ) == 5;
+    close( f );
+
+    return ok;
+}
+
+
+static bool
+check_replay( void )
+{
+    snap_layer *sl;
+    pid_t      pid;
+
+    printf( "  Replay after a crash\n" );
+    fflush( stdout );
+    pid = fork();
+    if ( pid == 0 ) {
+        sl = snap_layer_get( LAYER );
+        _exit( sl && set(sl, "/crash/1", "1") ? EXIT_SUCCESS : EXIT_FAILURE );
+    }
+    if ( !wait_child(pid) || !tear_delta() )
+        return false;
+
+    pid = fork();
+    if ( pid == 0 ) {
+        sl = snap_layer_get( LAYER );
+        _exit( sl && check(sl, "/crash/1", "1") && set(sl, "/crash/2", "2")
+               ? EXIT_SUCCESS : EXIT_FAILURE );
+    }
+    if ( !wait_child(pid) )
+        return false;
+
+    pid = fork();
+    if ( pid == 0 ) {
+        sl = snap_layer_get( LAYER );
+        _exit( sl && check(sl, "/crash/1", "1") && check(sl, "/crash/2", "2")
+               ? EXIT_SUCCESS : EXIT_FAILURE );
+    }
+    return wait_child( pid );
+}
+
+
+/* Changes made by another process are seen */
+static bool
+check_other( snap_layer *sl )
+{
+    pid_t pid;
+
+    printf( "  Changes by another process\n" );
+    fflush( stdout );
+    if ( !check(sl, "/other", NULL) )
+        return false;
+
+    pid = fork();
+    if ( pid == 0 )
+        _exit( set(sl, "/other", "changed") ? EXIT_SUCCESS : EXIT_FAILURE );
+    if ( !wait_child(pid) )
+        return false;
+
+    return check( sl, "/other", "changed" );
+}
+
+
+static bool
+check_access( snap_layer *sl )
+{
+    cfgs_entry *vlist = NULL;
+    cfgs_str   *subs;
+    int        n, merged;
+    bool       ok = true;
+
+    for ( merged=0; ok && merged<2; merged++ ) {
+        printf( "  Access, %s\n", merged ? "merged" : "logged" );
+        ok =  set( sl, "/a/b", "b" ) && set( sl, "/a/c", "c" )
+           && set( sl, "/a/d/e", "e" ) && set( sl, "/a/b", "b2" )
+           && 1 == snap_log( sl, "/a/c", NULL )
+           && 0 == snap_log( sl, "/a/none", NULL )
+           && check( sl, "/a/b", "b2" ) && check( sl, "/a/c", NULL )
+           && (!merged || snap_merge(sl));
+
+        n  = snap_glob( sl, "/a/*", &vlist );
+        CFGST_DLIST_FREE( vlist, cfgs_entry_free );
+        vlist = NULL;
+        /* fnmatch without FNM_PATHNAME: '*' matches '/' too */
+        printf( "  /a/* matches %d values: %s\n", n, n == 2 ? "ok" : "!!! ERROR !!!" );
+        ok = ok && n == 2;
+
+        subs = snap_subnames( sl, "/a" );
+        n    = cfgs_dlist_length( (cfgs_dlist*)subs );
+        printf( "  /a has %d subvalues: %s\n", n, n == 2 ? "ok" : "!!! ERROR !!!" );
+        ok = ok && n == 2;
+        CFGST_DLIST_FREE( subs, cfgs_str_free );
+
+        ok = ok && 1 == snap_log( sl, "/a/b", NULL ) && 1 == snap_log( sl, "/a/d/e", NULL );
+    }
+
+    return ok;
+}
+
+
+/* The changes are merged in the background, not by the set crossing the max. */
+static bool
+check_merge( snap_layer *sl )
+{
+    char   name[ 64 ];
+    time_t start;
+    int    i;
+    bool   ok;
+
+    printf( "  %d changes\n", CGFS_SNAP_DELTA_MAX );
+    fflush( stdout );
+    /* from an empty delta: the last change crosses the max */
+    ok = snap_merge( sl );
+    for ( i=0; ok && i<CGFS_SNAP_DELTA_MAX; i++ ) {
+        snprintf( name, sizeof(name), "/merge/%d", i );
+        ok = set( sl, name, "m" );
+    }
+    if ( !ok )
+        return false;
+
+    start = time( NULL );
+    while ( 0 == access(DELTA_PATH, F_OK) 
+            && time(NULL) - start < CGFS_SNAP_MERGE_SECS + MERGE_WAIT )
+        usleep( 100*1000 );
+    ok = 0 != access( DELTA_PATH, F_OK );
+    printf( "  merged in the background: %s\n", ok ? "ok" : "!!! ERROR !!!" );
+    fflush( stdout );
+
+    return ok && check( sl, "/merge/0", "m" ) && check( sl, name, "m" );
+}
+
+
+/* Every bucket taken, by the first name: a miss probes them all, once */
+static bool
+check_full_buckets( void )
+{
+    snap_hdr hdr;
+    pid_t    pid;
+    uint32_t one = 1, i;
+    int      f;
+    bool     ok;
+
+    printf( "  Snapshot without a free bucket\n" );
+    fflush( stdout );
+    f = open( SNAP_PATH, O_RDWR );
+    if ( f < 0 ) {
+        printf( "  " SNAP_PATH " not found: !!! ERROR !!!\n" );
+        return false;
+    }
+    ok = pread( f, &hdr, sizeof(hdr), 0 ) == sizeof(hdr);
+    for ( i=0; ok && i<hdr.nb_buckets; i++ )
+        ok = pwrite( f, &one, sizeof(one), hdr.buckets_off + i*sizeof(one) ) == sizeof(one);
+    close( f );
+    if ( !ok )
+        return false;
+
+    pid = fork();
+    if ( pid == 0 ) {
+        snap_layer *sl = snap_layer_get( LAYER );
+        alarm( MERGE_WAIT );
+        _exit( sl && check(sl, "/missing", NULL) ? EXIT_SUCCESS : EXIT_FAILURE );
+    }
+    return wait_child( pid );
+}
+
+
+int
+main( int argc, char **argv, char **envp )
+{
+    snap_layer *sl;
+    bool       ok;
+
+    fprintf( stderr, "%s " VERSION "\n\nSnapshot backend test program:\n", progname );
+    if ( 0 != system("rm -rf '" LAYER_DIR "'") )
+        return EXIT_FAILURE;
+
+    if ( !check_replay() )
+        return EXIT_FAILURE;
+
+    sl = snap_layer_get( LAYER );
+    ok = sl && check_other( sl ) && check_access( sl ) 
+       && snap_init() && check_merge( sl );
+    snap_layers_free();
+    ok = ok && check_full_buckets();
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,212 @@
+/*
+ *  $Revision: 1.1 $
+ *  $Date: 2004/04/23 19:27:40 $
+ *
+ *  Test cfgs_stacker with two backends, loaded in process, on layer LAYER.
+ *  Each step is a child loading the stacker with the backends
+ *  CFGS_STACKER_BACKENDS names:
+ *    -cfgs_snap_bk alone: BOTH and SNAP_ONLY set
+ *    -cfgs_fs_bk alone: BOTH set to another value
+ *    -both, fs first then snap first, with and without fan-out: BOTH is
+ *     the first backend's, SNAP_ONLY is found in snap whatever the order,
+ *     MISSING is found in none; again once routed, SNAP_ONLY's backend 
+ *     known must not shadow BOTH's first one
+ *    -both: all removed, from both, BOTH routed to fs first
+ */
+/*
+#
+# This file is part of LinCS/tiger.
+#
+# LinCS/tiger is distributed under the terms of the GNU Lesser General Public
+# License version 2 or any later version.  See the file COPYING.LIB for copying
+# permission or http://www.gnu.org.
+#
+# THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED OR
+# IMPLIED, without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  ANY USE IS AT YOUR OWN RISK.
+#
+# Permission to modify the code and to distribute modified code is granted,
+# provided the above notices are retained, and a notice that the code was
+# modified is included with the above copyright notice.
+#
+ */
+
+
+#include "cfgs/cfgs_config.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "cfgs_client_api.h"
+#include "cfgs_backend.h"
+#include "cfgs_log.h"
+#include "cfgs_dlist.h"
+
+
+#define PROGNAME   "stack_test"
+const char progname[] = PROGNAME;
+
+#define LAYER      "tests_" PROGNAME
+#define FS_BK      "cfgs_fs_bk"
+#define SNAP_BK    "cfgs_snap_bk"
+
+#define BOTH       "/tests/" PROGNAME "/both"
+#define SNAP_ONLY  "/tests/" PROGNAME "/snap_only"
+#define MISSING    "/tests/" PROGNAME "/missing"
+
+
+static cfgs_backend *m_stacker = NULL;
+static cfgs_session *m_session = NULL;
+
+
+/* In the child: the stacker on the backends, fan-out threads as asked */
+static bool
+stack( const char *backends, const char *fanout )
+{
+    printf( "  [%ld] stacking '%s', fan-out %s\n", (long)getpid(), backends, fanout );
+    fflush( stdout );
+    if (  0 != setenv(CFGS_ENV_STACKER_BACKENDS, backends, 1)
+       || 0 != setenv(CFGS_ENV_STACKER_FANOUT, fanout, 1)
+       || !cfgsb_init() )
+        return false;
+
+    m_stacker = cfgsb_load_backend( CFGS_STACKER_BACKEND );
+    m_session = m_stacker ? cfgs_session_new() : NULL;
+    return m_session != NULL;
+}
+
+
+static void
+unstack( void )
+{
+    if ( m_session )
+        cfgs_session_free( m_session );
+    if ( m_stacker )
+        (void)cfgsb_unload_backend( m_stacker );
+    (void)cfgsb_shutdown();
+}
+
+
+static bool
+set( const char *name, const char *value )
+{
+    cfgs_entry *entry = cfgs_entry_new();
+    bool       ok;
+
+    ok =  entry
+       && cfgs_entry_add_attr( entry, CFGS_EA_NAME, name )
+       && cfgs_entry_add_attr( entry, CFGS_EA_VALUE, value )
+       && cfgs_entry_add_attr( entry, CFGS_EA_LAYER, LAYER )
+       && 1 == (*m_stacker->cfgs_setval)( m_session, entry );
+    if ( entry )
+        cfgs_entry_free( entry );
+
+    return ok;
+}
+
+
+/* Is name value?  Not there if value is NULL */
+static bool
+check( const char *name, const char *value )
+{
+    cfgs_entry *v = (*m_stacker->cfgs_getval)( m_session, name, LAYER );
+    const char *got = v ? cfgs_entry_attr( v, CFGS_EA_VALUE ) : NULL;
+    bool       ok;
+
+    ok = value ? got && 0 == strcmp( got, value ) : !v;
+    printf( "  [%ld] %s is '%s': %s\n", (long)getpid(), name,
+            got ? got : "(none)", ok ? "ok" : "!!! ERROR !!!" );
+    fflush( stdout );
+    CFGST_DLIST_FREE( v, cfgs_entry_free );
+
+    return ok;
+}
+
+
+static bool
+wait_child( pid_t pid )
+{
+    int status;
+
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status)
+        && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+
+/* Set in one backend only, through the stacker */
+static bool
+set_in( const char *backend, const char *name, const char *value,
+        const char *name2, const char *value2 )
+{
+    pid_t pid = fork();
+
+    if ( pid == 0 ) {
+        bool ok =  stack( backend, "0" ) && set( name, value )
+                && (!name2 || set( name2, value2 ));
+        unstack();
+        _exit( ok ? EXIT_SUCCESS : EXIT_FAILURE );
+    }
+    return wait_child( pid );
+}
+
+
+/* The first backend having a value wins, a miss asks them all; routed too */
+static bool
+check_order( const char *backends, const char *fanout, const char *both )
+{
+    pid_t pid = fork();
+
+    if ( pid == 0 ) {
+        bool ok =  stack( backends, fanout )
+                && check( BOTH, both ) && check( SNAP_ONLY, SNAP_BK )
+                && check( MISSING, NULL )
+                /* again, routed */
+                && check( BOTH, both ) && check( SNAP_ONLY, SNAP_BK );
+        unstack();
+        _exit( ok ? EXIT_SUCCESS : EXIT_FAILURE );
+    }
+    return wait_child( pid );
+}
+
+
+static bool
+remove_all( void )
+{
+    pid_t pid = fork();
+
+    if ( pid == 0 ) {
+        bool ok = stack( FS_BK ":" SNAP_BK, "0" );
+
+        /* routed to fs or not: removed from both */
+        ok =  ok && check( BOTH, FS_BK )
+           && 2 == (*m_stacker->cfgs_rmval)( m_session, BOTH, LAYER )
+           && 1 == (*m_stacker->cfgs_rmval)( m_session, SNAP_ONLY, LAYER )
+           && check( BOTH, NULL ) && check( SNAP_ONLY, NULL );
+        unstack();
+        _exit( ok ? EXIT_SUCCESS : EXIT_FAILURE );
+    }
+    return wait_child( pid );
+}
+
+
+int
+main( int argc, char **argv, char **envp )
+{
+    bool ok;
+
+    fprintf( stderr, "%s " VERSION "\n\nStacker test program:\n", progname );
+
+    ok =  set_in( SNAP_BK, BOTH, SNAP_BK, SNAP_ONLY, SNAP_BK )
+       && set_in( FS_BK, BOTH, FS_BK, NULL, NULL )
+       && check_order( FS_BK ":" SNAP_BK, "0", FS_BK )
+       && check_order( FS_BK ":" SNAP_BK, "2", FS_BK )
+       && check_order( SNAP_BK ":" FS_BK, "0", SNAP_BK )
+       && check_order( SNAP_BK ":" FS_BK, "2", SNAP_BK );
+    /* whatever went wrong */
+    ok = remove_all() && ok;
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,197 @@
+/*
+ *  $Revision: 1.1 $
+ *  $Date: 2004/04/16 21:02:37 $
+ *
+ *  Test cfgs_fs_bk's write-ahead log, without the daemon.  For each
+ *  durability (sync, async, none):
+ *    -a child sets /tests/wal_test/<durability> and dies, the log not folded
+ *    -a record cut short is appended to the log, as a crash would leave it
+ *    -a second child must read the value, sets it again and dies too
+ *    -a third child must read the second value: nothing was lost after
+ *     the torn tail
+ */
+/*
+#
+# This file is part of LinCS/tiger.
+#
+# LinCS/tiger is distributed under the terms of the GNU Lesser General Public
+# License version 2 or any later version.  See the file COPYING.LIB for copying
+# permission or http://www.gnu.org.
+#
+# THIS MATERIAL IS PROVIDED AS IS, WITH ABSOLUTELY NO WARRANTY EXPRESSED OR
+# IMPLIED, without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE.  ANY USE IS AT YOUR OWN RISK.
+#
+# Permission to modify the code and to distribute modified code is granted,
+# provided the above notices are retained, and a notice that the code was
+# modified is included with the above copyright notice.
+#
+ */
+
+
+#include "cfgs/cfgs_config.h"
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "cfgs_client_api.h"
+#include "cfgs_log.h"
+#include "cfgs_dlist.h"
+
+
+#define PROGNAME   "wal_test"
+const char progname[] = PROGNAME;
+
+#define VALNAME_SET  "/tests/"PROGNAME"/"
+
+/* see backends/cfgs_fs_bk/wal.h */
+#define WAL_PATH     CFGS_VALUES_ROOT_DIR "/cfgs_fs_bk.wal"
+
+
+void
+exit_err( int status )
+{
+    perror( progname );
+    exit( status );
+}
+
+
+/* In a child: set name to value and die without folding the log */
+static void
+set_and_crash( const char *name, const char *value )
+{
+    cfgs_entry   entry = {0};
+    cfgs_session *session;
+
+    if (  !cfgs_entry_add_attr(&entry, CFGS_EA_NAME, name)
+       || !cfgs_entry_add_attr(&entry, CFGS_EA_VALUE, value) )
+        _exit( EXIT_FAILURE );
+    entry.entry_type = CFGS_ET_VALUE;
+
+    session = cfgs_connect();
+    if ( !session || 1 != cfgs_setval(session, &entry) ) {
+        if ( session )
+            cfgs_perror( cfgs_geterror(session), PROGNAME " - set", stderr );
+        _exit( EXIT_FAILURE );
+    }
+    _exit( EXIT_SUCCESS );
+}
+
+
+/* In a child: is name value?  Leaves the log folded if disconnect */
+static bool
+check_value( const char *name, const char *value, bool disconnect )
+{
+    cfgs_session *session;
+    cfgs_entry   *v;
+    bool         ok;
+
+    session = cfgs_connect();
+    if ( !session )
+        return false;
+    v  = cfgs_getval( session, name, NULL );
+    ok = v && 0 == strcmp( cfgs_entry_attr(v, CFGS_EA_VALUE), value );
+    printf( "  [%ld] %s is '%s': %s\n", (long)getpid(), name, value,
+            ok ? "ok" : "!!! ERROR !!!" );
+    CFGST_DLIST_FREE( v, cfgs_entry_free );
+    fflush( stdout );
+
+    if ( disconnect )
+        (void)cfgs_disconnect( session );
+    return ok;
+}
+
+
+static bool
+wait_child( pid_t pid )
+{
+    int status;
+
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status)
+        && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+
+/* What a crash in the middle of a write leaves: a length, part of the rest */
+static bool
+tear_log( void )
+{
+    uint32_t    len = 1000;
+    struct stat st;
+    int         f;
+    bool        ok;
+
+    f = open( WAL_PATH, O_WRONLY|O_APPEND );
+    if ( f < 0 || fstat(f, &st) != 0 || st.st_size == 0 ) {
+        printf( "  " WAL_PATH " has no changes: !!! ERROR !!!\n" );
+        if ( f >= 0 )
+            close( f );
+        return false;
+    }
+    ok =  write( f, &len, sizeof(len) ) == sizeof(len)
+       && write( f, "S/torn", 6 ) == 6;
+    close( f );
+
+    return ok;
+}
+
+
+static bool
+check_durability( const char *durability )
+{
+    char  name[ 256 ], value[ 256 ];
+    pid_t pid;
+
+    printf( "  Durability '%s'\n", durability );
+    fflush( stdout );
+    snprintf( name, sizeof(name), VALNAME_SET "%s", durability );
+    if ( 0 != setenv(CFGS_ENV_FS_DURABILITY, durability, 1) )
+        return false;
+
+    snprintf( value, sizeof(value), "%s/1", durability );
+    pid = fork();
+    if ( pid == 0 )
+        set_and_crash( name, value );
+    if ( !wait_child(pid) || !tear_log() )
+        return false;
+
+    /* replays the log, torn tail and all */
+    pid = fork();
+    if ( pid == 0 ) {
+        if ( !check_value(name, value, false) )
+            _exit( EXIT_FAILURE );
+        strcat( value, "/2" );
+        set_and_crash( name, value );
+    }
+    if ( !wait_child(pid) )
+        return false;
+
+    strcat( value, "/2" );
+    pid = fork();
+    if ( pid == 0 )
+        _exit( check_value(name, value, true) ? EXIT_SUCCESS : EXIT_FAILURE );
+    return wait_child( pid );
+}
+
+
+int
+main( int argc, char **argv, char **envp )
+{
+    fprintf( stderr, "%s " VERSION "\n\nWrite-ahead log test program:\n", progname );
+
+    if ( !check_durability("sync") )
+        return EXIT_FAILURE;
+    if ( !check_durability("async") )
+        return EXIT_FAILURE;
+    if ( !check_durability("none") )
+        return EXIT_FAILURE;
+
+    return EXIT_SUCCESS;
+}